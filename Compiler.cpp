@@ -6,837 +6,12535 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <algorithm>
+#include <new>
+#include <utility>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
 #include <stdexcept>
+#include <type_traits>
 #include <set>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <filesystem>
+#include <iomanip>
+#include <ctime>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <iterator>
+#include <optional>
+#include <random>
+
+//--------------------------------------------------
+// --- SYMBOL INTERNER ---
+//--------------------------------------------------
+// Every identifier is interned once by the lexer into a dense 32-bit
+// SymbolId; later stages compare and hash IDs instead of strings and only
+// go back to text when writing output. ID 0 is reserved as "no symbol" so
+// it can double as the empty key of the flat hash tables below.
+//
+// Interned text lives in fixed-size pages that never move, so symbolText()
+// is lock-free; intern() takes a mutex because the table is process-wide.
+using SymbolId = uint32_t;
+constexpr SymbolId NoSymbol = 0;
+
+class StringInterner {
+public:
+    StringInterner() : slots(InitialSlots) {
+        entryPages[0].reset(new std::string_view[PageSize]);
+        entryPages[0][0] = std::string_view();
+        count = 1;
+    }
+
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+
+    SymbolId intern(std::string_view text) {
+        uint32_t hash = hashText(text);
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.id == NoSymbol) {
+                SymbolId id = append(text);
+                slot = Slot{hash, id};
+                if (count * 4 > slots.size() * 3) grow();
+                return id;
+            }
+            if (slot.hash == hash && entry(slot.id) == text) return slot.id;
+        }
+    }
+
+    std::string_view text(SymbolId id) const { return entry(id); }
+    size_t size() const { return count; }
+
+private:
+    static constexpr size_t PageBits = 12;
+    static constexpr size_t PageSize = size_t(1) << PageBits;
+    static constexpr size_t MaxPages = size_t(1) << 14;
+    static constexpr size_t InitialSlots = 1024;
+    static constexpr size_t TextChunk = 64 * 1024;
+
+    struct Slot {
+        uint32_t hash = 0;
+        SymbolId id = NoSymbol;
+    };
+
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    std::unique_ptr<std::string_view[]> entryPages[MaxPages];
+    std::vector<std::unique_ptr<char[]>> textChunks;
+    size_t textUsed = TextChunk;
+    size_t count = 0;
+
+    // FNV-1a; identifiers are short, so this beats anything fancier.
+    static uint32_t hashText(std::string_view text) {
+        uint32_t h = 2166136261u;
+        for (char c : text) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    std::string_view entry(SymbolId id) const {
+        return entryPages[id >> PageBits][id & (PageSize - 1)];
+    }
+
+    SymbolId append(std::string_view text) {
+        if (count >= PageSize * MaxPages) throw std::runtime_error("Symbol table overflow");
+        const char* stored = copyText(text);
+        size_t page = count >> PageBits;
+        if (!entryPages[page]) entryPages[page].reset(new std::string_view[PageSize]);
+        entryPages[page][count & (PageSize - 1)] = std::string_view(stored, text.size());
+        return static_cast<SymbolId>(count++);
+    }
+
+    const char* copyText(std::string_view text) {
+        if (text.size() > TextChunk / 4) {
+            textChunks.emplace(textChunks.begin(), new char[text.size()]);
+            std::memcpy(textChunks.front().get(), text.data(), text.size());
+            return textChunks.front().get();
+        }
+        if (textUsed + text.size() > TextChunk) {
+            textChunks.emplace_back(new char[TextChunk]);
+            textUsed = 0;
+        }
+        char* dst = textChunks.back().get() + textUsed;
+        std::memcpy(dst, text.data(), text.size());
+        textUsed += text.size();
+        return dst;
+    }
+
+    void grow() {
+        std::vector<Slot> bigger(slots.size() * 2);
+        size_t mask = bigger.size() - 1;
+        for (const Slot& slot : slots) {
+            if (slot.id == NoSymbol) continue;
+            size_t i = slot.hash & mask;
+            while (bigger[i].id != NoSymbol) i = (i + 1) & mask;
+            bigger[i] = slot;
+        }
+        slots.swap(bigger);
+    }
+};
+
+inline StringInterner& globalInterner() {
+    static StringInterner interner;
+    return interner;
+}
+
+inline SymbolId internSymbol(std::string_view text) { return globalInterner().intern(text); }
+inline std::string_view symbolText(SymbolId id) { return globalInterner().text(id); }
+
+// Open-addressing hash map keyed by SymbolId (linear probing, power-of-two
+// capacity, NoSymbol marks an empty slot). Values must be default
+// constructible; clear() keeps the capacity so per-pass tables are reused.
+template <typename V>
+class SymbolMap {
+public:
+    V* find(SymbolId key) {
+        if (keys.empty()) return nullptr;
+        size_t mask = keys.size() - 1;
+        for (size_t i = slotFor(key, mask);; i = (i + 1) & mask) {
+            if (keys[i] == key) return &values[i];
+            if (keys[i] == NoSymbol) return nullptr;
+        }
+    }
+
+    const V* find(SymbolId key) const { return const_cast<SymbolMap*>(this)->find(key); }
+    bool contains(SymbolId key) const { return find(key) != nullptr; }
+
+    // Returns the value slot for key, inserting a default value if missing.
+    V& operator[](SymbolId key) { return *insert(key, V()).first; }
+
+    std::pair<V*, bool> insert(SymbolId key, V value) {
+        if ((used + 1) * 4 > keys.size() * 3) rehash(keys.empty() ? 16 : keys.size() * 2);
+        size_t mask = keys.size() - 1;
+        for (size_t i = slotFor(key, mask);; i = (i + 1) & mask) {
+            if (keys[i] == key) return {&values[i], false};
+            if (keys[i] == NoSymbol) {
+                keys[i] = key;
+                values[i] = std::move(value);
+                used++;
+                return {&values[i], true};
+            }
+        }
+    }
+
+    void clear() {
+        std::fill(keys.begin(), keys.end(), NoSymbol);
+        std::fill(values.begin(), values.end(), V());
+        used = 0;
+    }
+
+    size_t size() const { return used; }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (size_t i = 0; i < keys.size(); ++i)
+            if (keys[i] != NoSymbol) fn(keys[i], values[i]);
+    }
+
+private:
+    std::vector<SymbolId> keys;
+    std::vector<V> values;
+    size_t used = 0;
+
+    static size_t slotFor(SymbolId key, size_t mask) {
+        return (static_cast<uint32_t>(key) * 2654435761u) & mask; // Knuth multiplicative hash
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<SymbolId> oldKeys(capacity, NoSymbol);
+        std::vector<V> oldValues(capacity);
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        used = 0;
+        for (size_t i = 0; i < oldKeys.size(); ++i)
+            if (oldKeys[i] != NoSymbol) insert(oldKeys[i], std::move(oldValues[i]));
+    }
+};
+
+// Membership-only variant used for declared-name tracking.
+class SymbolSet {
+public:
+    bool insert(SymbolId key) { return map.insert(key, 1).second; }
+    bool contains(SymbolId key) const { return map.contains(key); }
+    void clear() { map.clear(); }
+    size_t size() const { return map.size(); }
+
+private:
+    SymbolMap<uint8_t> map;
+};
+
+//--------------------------------------------------
+// --- FILE INPUT AND OUTPUT BUFFERS ---
+//--------------------------------------------------
+// Sources are mapped read-only and lexed in place. Every artifact (.fir,
+// .asm, .ast, .log) is built in an OutputBuffer: appends copy into chunks
+// of up to 64 KiB, integers go through std::to_chars, and a finished buffer reaches
+// its file in a few writev calls with no iostream in between. Buffers
+// printed on different threads are spliced together without copying.
+#if defined(__unix__) || defined(__APPLE__)
+#define HYPERLACE_POSIX_IO 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#if HYPERLACE_POSIX_IO
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info{};
+        if (fd < 0 || ::fstat(fd, &info) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("Failed to open source file.");
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size > 0 && S_ISREG(info.st_mode)) {
+            void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const char*>(mapped);
+                ::madvise(mapped, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        if (data || size == 0) return;
+#endif
+        std::ifstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error("Failed to open source file.");
+        copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        size = copy.size();
+    }
+
+    ~MappedFile() {
+#if HYPERLACE_POSIX_IO
+        if (data) ::munmap(const_cast<char*>(data), size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view text() const { return data ? std::string_view(data, size) : std::string_view(copy); }
+
+private:
+    const char* data = nullptr;   // the mapping, when there is one
+    size_t size = 0;
+    std::string copy;             // otherwise the file's bytes
+};
+
+class OutputBuffer {
+public:
+    static constexpr size_t ChunkSize = 64 * 1024;
+    static constexpr size_t FirstChunk = 1024;
+
+    OutputBuffer& operator<<(std::string_view text) {
+        while (!text.empty()) {
+            size_t n = std::min(text.size(), room(text.size()));
+            std::memcpy(tail(), text.data(), n);
+            chunks.back().used += n;
+            text.remove_prefix(n);
+        }
+        return *this;
+    }
+    OutputBuffer& operator<<(const char* text) { return *this << std::string_view(text); }
+    OutputBuffer& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    OutputBuffer& operator<<(char c) {
+        room(1);
+        *tail() = c;
+        chunks.back().used++;
+        return *this;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, bool>>>
+    OutputBuffer& operator<<(T value) {
+        room(24);
+        char* at = tail();
+        chunks.back().used += static_cast<size_t>(std::to_chars(at, at + 24, value).ptr - at);
+        return *this;
+    }
+
+    // `value` with `precision` digits after the point, as std::fixed prints it.
+    OutputBuffer& fixed(double value, int precision) {
+        char text[64];
+        int n = std::snprintf(text, sizeof(text), "%.*f", precision, value);
+        return *this << std::string_view(text, n > 0 ? static_cast<size_t>(n) : 0);
+    }
+
+    // `value` right-aligned in `width` columns, as std::setw pads it.
+    OutputBuffer& padded(int64_t value, int width) {
+        char digits[24];
+        size_t n = static_cast<size_t>(std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+        for (size_t pad = n; pad < static_cast<size_t>(width); ++pad) *this << ' ';
+        return *this << std::string_view(digits, n);
+    }
+
+    // Moves `other`'s chunks onto the end of this buffer.
+    OutputBuffer& operator<<(OutputBuffer&& other) {
+        for (Chunk& chunk : other.chunks) {
+            if (chunk.used) chunks.push_back(std::move(chunk));
+        }
+        other.chunks.clear();
+        return *this;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const Chunk& chunk : chunks) total += chunk.used;
+        return total;
+    }
+
+    std::string str() const {
+        std::string out;
+        out.reserve(size());
+        for (const Chunk& chunk : chunks) out.append(chunk.data.get(), chunk.used);
+        return out;
+    }
+
+    // Replaces the file at `path`; throws `failure` when it cannot.
+    void writeFile(const std::string& path, const char* failure) const {
+#if HYPERLACE_POSIX_IO
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error(failure);
+        std::vector<iovec> pending;
+        for (const Chunk& chunk : chunks) {
+            if (chunk.used) pending.push_back(iovec{chunk.data.get(), chunk.used});
+        }
+        size_t next = 0;
+        while (next < pending.size()) {
+            int count = static_cast<int>(std::min<size_t>(pending.size() - next, IOV_MAX));
+            ssize_t written = ::writev(fd, pending.data() + next, count);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0) {
+                ::close(fd);
+                throw std::runtime_error(failure);
+            }
+            // Skip what was written; a short write leaves part of a chunk.
+            for (size_t left = static_cast<size_t>(written); left > 0;) {
+                size_t take = std::min(left, pending[next].iov_len);
+                pending[next].iov_base = static_cast<char*>(pending[next].iov_base) + take;
+                pending[next].iov_len -= take;
+                left -= take;
+                if (pending[next].iov_len == 0) next++;
+            }
+        }
+        if (::close(fd) != 0) throw std::runtime_error(failure);
+#else
+        std::ofstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error(failure);
+        for (const Chunk& chunk : chunks) file.write(chunk.data.get(), static_cast<std::streamsize>(chunk.used));
+        if (!file) throw std::runtime_error(failure);
+#endif
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t used = 0, capacity = 0;
+    };
+    std::vector<Chunk> chunks;
+
+    char* tail() { return chunks.back().data.get() + chunks.back().used; }
+
+    // Free bytes at the tail, after starting a new chunk if fewer than
+    // `wanted` (capped at one chunk) are left. Chunks start small and
+    // double, so a short function's text costs one small allocation.
+    size_t room(size_t wanted) {
+        size_t need = std::min(wanted, ChunkSize);
+        if (chunks.empty() || chunks.back().capacity - chunks.back().used < need) {
+            size_t capacity = chunks.empty() ? FirstChunk : std::min(ChunkSize, chunks.back().capacity * 2);
+            capacity = std::max(capacity, need);
+            chunks.push_back(Chunk{std::make_unique<char[]>(capacity), 0, capacity});
+        }
+        return chunks.back().capacity - chunks.back().used;
+    }
+};
+
+// A finished artifact waiting to be written.
+struct Artifact {
+    std::string path;
+    OutputBuffer data;
+    const char* failure;   // the error when it cannot be written
+};
 
 //--------------------------------------------------
 // --- TOKEN DEFINITIONS ---
 //--------------------------------------------------
-enum class TokenType {
+enum class TokenType : uint8_t {
     Identifier, Number, String, Keyword, Symbol, Comment,
-    Assign, ImmutableAssign, EndOfLine, EndOfFile
+    Assign, ImmutableAssign, PlusEq, MinusEq, StarEq, SlashEq,
+    Macro, EndOfLine, EndOfFile
+};
+
+// Lexemes are views into the source buffer (or into macro bodies owned by a
+// MacroExpander), which must outlive every token handed out. String and macro
+// lexemes exclude their delimiters (the quotes, or the bars of a |marker|).
+// Identifiers are interned as they are scanned and carry their SymbolId.
+struct Token {
+    TokenType type;
+    std::string_view lexeme;
+    int line;
+    int column;
+    SymbolId symbol = NoSymbol;
+};
+
+//--------------------------------------------------
+// --- LEXER SCAN KERNELS ---
+//--------------------------------------------------
+// The lexer's inner loops (blank runs, identifier/number runs, comment
+// bodies) go through a ScanKernel chosen once at startup: AVX2 (32 bytes per
+// step) or SSE2 (16) on x86-64, NEON (16) on ARM64, otherwise scalar. Every
+// kernel returns the length of the leading run, so the scalar kernel is a
+// drop-in reference; set HYPERLACE_SCAN=scalar|sse2|avx2|neon to force one.
+#if defined(__x86_64__) || defined(_M_X64)
+#define HYPERLACE_SCAN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define HYPERLACE_TARGET_AVX2
+#else
+#define HYPERLACE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HYPERLACE_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+struct ScanKernel {
+    const char* name;
+    size_t (*blankRun)(const char* p, size_t n);                 // ' ', '\t', '\r'
+    size_t (*identRun)(const char* p, size_t n);                 // [A-Za-z0-9_]
+    size_t (*digitRun)(const char* p, size_t n);                 // [0-9]
+    size_t (*untilEither)(const char* p, size_t n, char a, char b);
+};
+
+namespace scan {
+
+inline unsigned countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isIdent(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || isDigit(c);
+}
+
+inline size_t scalarBlankRun(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && isBlank(p[i])) i++;
+    return i;
+}
+
+inline size_t scalarIdentRun(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && isIdent(p[i])) i++;
+    return i;
+}
+
+inline size_t scalarDigitRun(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && isDigit(p[i])) i++;
+    return i;
+}
+
+inline size_t scalarUntilEither(const char* p, size_t n, char a, char b) {
+    size_t i = 0;
+    while (i < n && p[i] != a && p[i] != b) i++;
+    return i;
+}
+
+#if HYPERLACE_SCAN_X86
+// Byte-wise unsigned range test: (v - lo) <= (hi - lo).
+inline __m128i inRange16(__m128i v, char lo, char hi) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(static_cast<char>(hi - lo))), t);
+}
+
+inline __m128i blankMask16(__m128i v) {
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+}
+
+inline __m128i identMask16(__m128i v) {
+    // Folding case ('a'..'z' == ('A'..'Z' | 0x20)) saves one range test.
+    __m128i alpha = inRange16(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    return _mm_or_si128(_mm_or_si128(alpha, inRange16(v, '0', '9')), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+template <typename MaskFn>
+inline size_t sse2Run(const char* p, size_t n, MaskFn mask, size_t (*tail)(const char*, size_t)) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        uint32_t miss = ~static_cast<uint32_t>(_mm_movemask_epi8(mask(v))) & 0xFFFFu;
+        if (miss) return i + countTrailingZeros(miss);
+    }
+    return i + tail(p + i, n - i);
+}
+
+inline size_t sse2BlankRun(const char* p, size_t n) { return sse2Run(p, n, blankMask16, scalarBlankRun); }
+inline size_t sse2IdentRun(const char* p, size_t n) { return sse2Run(p, n, identMask16, scalarIdentRun); }
+inline size_t sse2DigitRun(const char* p, size_t n) {
+    return sse2Run(p, n, [](__m128i v) { return inRange16(v, '0', '9'); }, scalarDigitRun);
+}
+
+inline size_t sse2UntilEither(const char* p, size_t n, char a, char b) {
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        uint32_t hit = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))));
+        if (hit) return i + countTrailingZeros(hit);
+    }
+    return i + scalarUntilEither(p + i, n - i, a, b);
+}
+
+// Most runs are shorter than 16 bytes, so the AVX2 kernels probe the first
+// 16 with SSE2 and only switch to 32-byte steps for long runs.
+template <typename MaskFn>
+inline bool sse2Probe(const char* p, size_t n, MaskFn mask, size_t& run) {
+    if (n < 16) return false;
+    uint32_t miss = ~static_cast<uint32_t>(_mm_movemask_epi8(mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))))) & 0xFFFFu;
+    run = miss ? countTrailingZeros(miss) : 16;
+    return true;
+}
+
+HYPERLACE_TARGET_AVX2 inline __m256i inRange32(__m256i v, char lo, char hi) {
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(static_cast<char>(hi - lo))), t);
+}
+
+HYPERLACE_TARGET_AVX2 inline size_t avx2BlankRun(const char* p, size_t n) {
+    size_t i = 0;
+    if (sse2Probe(p, n, blankMask16, i) && i < 16) return i;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        uint32_t miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        if (miss) return i + countTrailingZeros(miss);
+    }
+    return i + sse2BlankRun(p + i, n - i);
+}
+
+HYPERLACE_TARGET_AVX2 inline size_t avx2IdentRun(const char* p, size_t n) {
+    size_t i = 0;
+    if (sse2Probe(p, n, identMask16, i) && i < 16) return i;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i alpha = inRange32(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i m = _mm256_or_si256(_mm256_or_si256(alpha, inRange32(v, '0', '9')),
+                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        uint32_t miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        if (miss) return i + countTrailingZeros(miss);
+    }
+    return i + sse2IdentRun(p + i, n - i);
+}
+
+HYPERLACE_TARGET_AVX2 inline size_t avx2DigitRun(const char* p, size_t n) {
+    size_t i = 0;
+    if (sse2Probe(p, n, [](__m128i v) { return inRange16(v, '0', '9'); }, i) && i < 16) return i;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        uint32_t miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(inRange32(v, '0', '9')));
+        if (miss) return i + countTrailingZeros(miss);
+    }
+    return i + sse2DigitRun(p + i, n - i);
+}
+
+HYPERLACE_TARGET_AVX2 inline size_t avx2UntilEither(const char* p, size_t n, char a, char b) {
+    size_t i = 0;
+    auto eitherMask = [a, b](__m128i v) {
+        return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+    };
+    // Probe inverted: a "miss" of the not-a-and-not-b mask is a hit.
+    if (sse2Probe(p, n, [&](__m128i v) { return _mm_xor_si128(eitherMask(v), _mm_set1_epi8(-1)); }, i) && i < 16) return i;
+    __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        uint32_t hit = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))));
+        if (hit) return i + countTrailingZeros(hit);
+    }
+    return i + sse2UntilEither(p + i, n - i, a, b);
+}
+
+inline bool cpuHasAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // HYPERLACE_SCAN_X86
+
+#if HYPERLACE_SCAN_NEON
+inline uint8x16_t inRange16(uint8x16_t v, uint8_t lo, uint8_t hi) {
+    return vcleq_u8(vsubq_u8(v, vdupq_n_u8(lo)), vdupq_n_u8(static_cast<uint8_t>(hi - lo)));
+}
+
+// Narrows a 0x00/0xFF byte mask to 4 bits per lane; returns the index of the
+// first lane that is NOT set, or 16.
+inline unsigned firstMiss16(uint8x16_t mask) {
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+    uint64_t miss = ~bits;
+    return miss ? static_cast<unsigned>(__builtin_ctzll(miss)) >> 2 : 16;
+}
+
+template <typename MaskFn>
+inline size_t neonRun(const char* p, size_t n, MaskFn mask, size_t (*tail)(const char*, size_t)) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned miss = firstMiss16(mask(vld1q_u8(reinterpret_cast<const uint8_t*>(p + i))));
+        if (miss < 16) return i + miss;
+    }
+    return i + tail(p + i, n - i);
+}
+
+inline size_t neonBlankRun(const char* p, size_t n) {
+    return neonRun(p, n, [](uint8x16_t v) {
+        return vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))), vceqq_u8(v, vdupq_n_u8('\r')));
+    }, scalarBlankRun);
+}
+
+inline size_t neonIdentRun(const char* p, size_t n) {
+    return neonRun(p, n, [](uint8x16_t v) {
+        uint8x16_t alpha = inRange16(vorrq_u8(v, vdupq_n_u8(0x20)), 'a', 'z');
+        return vorrq_u8(vorrq_u8(alpha, inRange16(v, '0', '9')), vceqq_u8(v, vdupq_n_u8('_')));
+    }, scalarIdentRun);
+}
+
+inline size_t neonDigitRun(const char* p, size_t n) {
+    return neonRun(p, n, [](uint8x16_t v) { return inRange16(v, '0', '9'); }, scalarDigitRun);
+}
+
+inline size_t neonUntilEither(const char* p, size_t n, char a, char b) {
+    uint8x16_t va = vdupq_n_u8(static_cast<uint8_t>(a)), vb = vdupq_n_u8(static_cast<uint8_t>(b));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+        // A hit is a miss of the inverted mask.
+        unsigned hit = firstMiss16(vmvnq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb))));
+        if (hit < 16) return i + hit;
+    }
+    return i + scalarUntilEither(p + i, n - i, a, b);
+}
+#endif // HYPERLACE_SCAN_NEON
+
+} // namespace scan
+
+inline const ScanKernel& scalarScanKernel() {
+    static const ScanKernel kernel{"scalar", scan::scalarBlankRun, scan::scalarIdentRun,
+                                   scan::scalarDigitRun, scan::scalarUntilEither};
+    return kernel;
+}
+
+// Every kernel this CPU can run, scalar first and the fastest last.
+inline const std::vector<const ScanKernel*>& availableScanKernels() {
+    static const std::vector<const ScanKernel*> kernels = [] {
+        std::vector<const ScanKernel*> list{&scalarScanKernel()};
+#if HYPERLACE_SCAN_X86
+        static const ScanKernel sse2{"sse2", scan::sse2BlankRun, scan::sse2IdentRun,
+                                     scan::sse2DigitRun, scan::sse2UntilEither};
+        static const ScanKernel avx2{"avx2", scan::avx2BlankRun, scan::avx2IdentRun,
+                                     scan::avx2DigitRun, scan::avx2UntilEither};
+        list.push_back(&sse2);
+        if (scan::cpuHasAVX2()) list.push_back(&avx2);
+#elif HYPERLACE_SCAN_NEON
+        static const ScanKernel neon{"neon", scan::neonBlankRun, scan::neonIdentRun,
+                                     scan::neonDigitRun, scan::neonUntilEither};
+        list.push_back(&neon);
+#endif
+        return list;
+    }();
+    return kernels;
+}
+
+inline const ScanKernel& selectScanKernel() {
+    const char* forced = std::getenv("HYPERLACE_SCAN");
+    std::string_view want = forced ? forced : "";
+    for (const ScanKernel* kernel : availableScanKernels()) {
+        if (want == kernel->name) return *kernel;
+    }
+    return *availableScanKernels().back();
+}
+
+// Resolved once (CPUID on x86) and shared by every Lexer.
+inline const ScanKernel& activeScanKernel() {
+    static const ScanKernel& kernel = selectScanKernel();
+    return kernel;
+}
+
+//--------------------------------------------------
+// --- LEXER ---
+//--------------------------------------------------
+// Streaming tokenizer: next() scans exactly one token from the buffer, so the
+// parser can pull tokens on demand and nothing proportional to the token
+// count is ever materialized. tokenize() remains for the debug log.
+class Lexer {
+public:
+    explicit Lexer(std::string_view source, const ScanKernel& kernel = activeScanKernel())
+        : src(source), scanner(kernel) {}
+
+    Token next() {
+        skipTrivia();
+        if (pos >= src.size()) return make(TokenType::EndOfFile, pos, 0);
+
+        size_t start = pos;
+        char c = src[pos];
+
+        if (isIdentStart(c)) {
+            pos += scanner.identRun(src.data() + pos, src.size() - pos);
+            std::string_view word = src.substr(start, pos - start);
+            if (isKeyword(word)) return make(TokenType::Keyword, start, pos - start);
+            Token tok = make(TokenType::Identifier, start, pos - start);
+            tok.symbol = internSymbol(word);
+            return tok;
+        }
+
+        if (isDigit(c)) {
+            pos += scanner.digitRun(src.data() + pos, src.size() - pos);
+            if (pos + 1 < src.size() && src[pos] == '.' && isDigit(src[pos + 1])) {
+                pos++;
+                pos += scanner.digitRun(src.data() + pos, src.size() - pos);
+            }
+            return make(TokenType::Number, start, pos - start);
+        }
+
+        if (c == '"') {
+            pos++;
+            while (pos < src.size() && src[pos] != '"' && src[pos] != '\n') {
+                if (src[pos] == '\\' && pos + 1 < src.size()) pos++;
+                pos++;
+            }
+            if (pos >= src.size() || src[pos] != '"') {
+                throw std::runtime_error("Unterminated string literal at line " + std::to_string(line));
+            }
+            pos++;
+            Token tok = make(TokenType::String, start, pos - start);
+            tok.lexeme = src.substr(start + 1, pos - start - 2);
+            return tok;
+        }
+
+        pos++;
+        char n = pos < src.size() ? src[pos] : '\0';
+        switch (c) {
+            case ';': return make(TokenType::EndOfLine, start, 1);
+            case '=':
+                if (n == '=') { pos++; return make(TokenType::ImmutableAssign, start, 2); }
+                return make(TokenType::Assign, start, 1);
+            case '+': if (n == '=') { pos++; return make(TokenType::PlusEq, start, 2); } break;
+            case '-':
+                if (n == '=') { pos++; return make(TokenType::MinusEq, start, 2); }
+                if (n == '>') { pos++; return make(TokenType::Symbol, start, 2); }
+                break;
+            case '*': if (n == '=') { pos++; return make(TokenType::StarEq, start, 2); } break;
+            case '/': if (n == '=') { pos++; return make(TokenType::SlashEq, start, 2); } break;
+            case '<':
+                if (n == '=' || n == '-') { pos++; return make(TokenType::Symbol, start, 2); }
+                break;
+            case '>': case '!':
+                if (n == '=') { pos++; return make(TokenType::Symbol, start, 2); }
+                break;
+            case '~':
+                if (n == '>') { pos++; return make(TokenType::Symbol, start, 2); }
+                break;
+            case '|': {
+                // |name args...| on one line is a macro marker; a lone bar stays a symbol.
+                size_t close = pos + scanner.untilEither(src.data() + pos, src.size() - pos, '|', '\n');
+                if (close < src.size() && src[close] == '|' && close > pos) {
+                    Token tok = make(TokenType::Macro, start, close + 1 - start);
+                    tok.lexeme = src.substr(pos, close - pos);
+                    pos = close + 1;
+                    return tok;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        return make(TokenType::Symbol, start, 1);
+    }
+
+    std::vector<Token> tokenize() {
+        std::vector<Token> tokens;
+        for (;;) {
+            tokens.push_back(next());
+            if (tokens.back().type == TokenType::EndOfFile) break;
+        }
+        return tokens;
+    }
+
+    size_t offset() const { return pos; }
+    const char* kernelName() const { return scanner.name; }
+
+private:
+    std::string_view src;
+    const ScanKernel& scanner;
+    size_t pos = 0;
+    size_t lineStart = 0;
+    int line = 1;
+
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+    static bool isIdentStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+
+    // Switch on the first byte so most identifiers are rejected without a compare.
+    static bool isKeyword(std::string_view w) {
+        if (w.size() < 2 || w.size() > 6) return false;
+        switch (w[0]) {
+            case 'S': return w == "Start" || w == "Struct";
+            case 'R': return w == "Return";
+            case 'I': return w == "Init" || w == "If";
+            case 'E': return w == "Else" || w == "Enum";
+            case 'F': return w == "For" || w == "False";
+            case 'W': return w == "While";
+            case 'T': return w == "Throw" || w == "Try" || w == "This" || w == "True";
+            case 'C': return w == "Catch";
+            case 'D': return w == "Define";
+            case 'L': return w == "Let";
+            case 'i': return w == "if";
+            case 'e': return w == "else";
+            case 'w': return w == "while";
+            case 'f': return w == "for" || w == "false";
+            case 't': return w == "true";
+            case 'a': return w == "and";
+            case 'o': return w == "or";
+            case 'n': return w == "not";
+            default: return false;
+        }
+    }
+
+    Token make(TokenType type, size_t start, size_t length) const {
+        return Token{type, src.substr(start, length), line, static_cast<int>(start - lineStart) + 1, NoSymbol};
+    }
+
+    void newline() {
+        line++;
+        lineStart = pos + 1;
+    }
+
+    // Skips whitespace, '#' line comments and '** ... **' block comments.
+    void skipTrivia() {
+        while (pos < src.size()) {
+            char c = src[pos];
+            if (c == '\n') {
+                newline();
+                pos++;
+            } else if (c == ' ' || c == '\t' || c == '\r') {
+                pos += scanner.blankRun(src.data() + pos, src.size() - pos);
+            } else if (c == '#') {
+                pos += scanner.untilEither(src.data() + pos, src.size() - pos, '\n', '\n');
+            } else if (c == '*' && pos + 1 < src.size() && src[pos + 1] == '*') {
+                pos += 2;
+                for (;;) {
+                    pos += scanner.untilEither(src.data() + pos, src.size() - pos, '*', '\n');
+                    if (pos >= src.size()) break;
+                    if (src[pos] == '\n') {
+                        newline();
+                        pos++;
+                    } else if (pos + 1 < src.size() && src[pos + 1] == '*') {
+                        pos += 2;
+                        break;
+                    } else {
+                        pos++;
+                    }
+                }
+            } else {
+                break;
+            }
+        }
+    }
+};
+
+//--------------------------------------------------
+// --- MACRO ENGINE (C.I.A.M.S.) ---
+//--------------------------------------------------
+// Macros are expanded on the token stream. `Define` followed by a marker
+// is a definition; the rest of the line is its body:
+//
+//     Define |inc v| v = v + 1;
+//
+// Every other marker is a use, e.g. `|inc counter|`; arguments are the
+// single tokens that follow the name. Bodies are tokenized once when they
+// are defined and replayed from the cached token list on every use.
+// Expansion is hygienic: identifiers the body assigns to that are not
+// parameters get a fresh name per expansion, so they cannot capture or
+// clobber names at the use site.
+// Separates a hygienic local's name from its expansion number, as in
+// `t$3`. The lexer never puts '$' in an identifier, so no name written in
+// source can meet one; NASM accepts it inside a label.
+constexpr char HygieneMark = '$';
+
+struct MacroBodyToken {
+    Token token;
+    int16_t param = -1;   // index into the parameter list
+    int16_t local = -1;   // index into the body-local (renamed) names
+};
+
+struct MacroDef {
+    SymbolId name = NoSymbol;
+    std::vector<SymbolId> params;
+    std::vector<SymbolId> locals;
+    std::vector<MacroBodyToken> body;
+};
+
+class MacroExpander {
+public:
+    MacroExpander() = default;
+
+    // A file-scoped table layered over a shared one: definitions made while
+    // compiling one file land here, lookups fall back to the parent, so the
+    // shared table stays read-only and can serve many files at once.
+    explicit MacroExpander(const MacroExpander* parent) : parent(parent) {}
+
+    // signature is the marker text, e.g. "|inc v|"; body is the replacement.
+    void define(const std::string& signature, const std::string& replacement) {
+        std::string_view text = keep(signature + " " + replacement);
+        Lexer lexer(text);
+        Token marker = lexer.next();
+        if (marker.type != TokenType::Macro) throw std::runtime_error("Macro Error: bad signature " + signature);
+        std::vector<Token> body;
+        for (Token tok = lexer.next(); tok.type != TokenType::EndOfFile; tok = lexer.next()) body.push_back(tok);
+        define(marker, body);
+    }
+
+    // Registers a definition from an already-lexed marker and body line. The
+    // token text is copied, so definitions outlive the buffer they came from.
+    void define(const Token& marker, const std::vector<Token>& bodyTokens) {
+        MacroDef def;
+        Lexer header(marker.lexeme);
+        Token nameTok = header.next();
+        if (nameTok.type != TokenType::Identifier)
+            throw std::runtime_error("Macro Error: expected macro name at line " + std::to_string(marker.line));
+        def.name = nameTok.symbol;
+        for (Token p = header.next(); p.type != TokenType::EndOfFile; p = header.next()) {
+            if (p.type != TokenType::Identifier)
+                throw std::runtime_error("Macro Error: macro parameters must be identifiers at line " + std::to_string(marker.line));
+            def.params.push_back(p.symbol);
+        }
+
+        for (size_t i = 0; i < bodyTokens.size(); ++i) {
+            MacroBodyToken bt;
+            bt.token = bodyTokens[i];
+            bt.token.lexeme = keep(bodyTokens[i].lexeme);
+            def.body.push_back(bt);
+        }
+
+        // Classify identifiers: parameters first, then assigned-to names as locals.
+        for (size_t i = 0; i < def.body.size(); ++i) {
+            const Token& tok = def.body[i].token;
+            if (tok.type != TokenType::Identifier) continue;
+            auto p = std::find(def.params.begin(), def.params.end(), tok.symbol);
+            if (p != def.params.end()) {
+                def.body[i].param = static_cast<int16_t>(p - def.params.begin());
+            } else if (i + 1 < def.body.size() && isAssignOp(def.body[i + 1].token.type)
+                       && std::find(def.locals.begin(), def.locals.end(), tok.symbol) == def.locals.end()) {
+                def.locals.push_back(tok.symbol);
+            }
+        }
+        for (MacroBodyToken& bt : def.body) {
+            if (bt.param >= 0 || bt.token.type != TokenType::Identifier) continue;
+            auto l = std::find(def.locals.begin(), def.locals.end(), bt.token.symbol);
+            if (l != def.locals.end()) bt.local = static_cast<int16_t>(l - def.locals.begin());
+        }
+
+        auto existing = index.find(def.name);
+        if (existing) {
+            defs[*existing] = std::move(def);
+        } else {
+            index.insert(def.name, static_cast<uint32_t>(defs.size()));
+            defs.push_back(std::move(def));
+        }
+    }
+
+    const MacroDef* find(SymbolId name) const {
+        const uint32_t* slot = index.find(name);
+        if (slot) return &defs[*slot];
+        return parent ? parent->find(name) : nullptr;
+    }
+
+    void loadDefaults() {
+        define("|inc v|", "v = v + 1;");
+        define("|dec v|", "v = v - 1;");
+        define("|reset v|", "v = 0;");
+    }
+
+    size_t definitionCount() const { return defs.size(); }
+
+    // Fresh, never-lexed spelling for a hygienic local.
+    SymbolId freshLocal(SymbolId local) {
+        return internSymbol(std::string(symbolText(local)) + HygieneMark + std::to_string(++freshCounter));
+    }
+
+private:
+    std::vector<MacroDef> defs;
+    SymbolMap<uint32_t> index;
+    std::vector<std::unique_ptr<std::string>> texts;
+    uint64_t freshCounter = 0;
+    const MacroExpander* parent = nullptr;
+
+    static bool isAssignOp(TokenType type) {
+        return type == TokenType::Assign || type == TokenType::PlusEq || type == TokenType::MinusEq
+            || type == TokenType::StarEq || type == TokenType::SlashEq;
+    }
+
+    std::string_view keep(std::string_view text) {
+        texts.emplace_back(new std::string(text));
+        return *texts.back();
+    }
+};
+
+// Token source the parser reads from: pulls tokens from the Lexer, records
+// macro definitions and splices cached macro bodies in place of uses.
+// Expanded tokens report the line/column of the use site.
+class MacroStream {
+public:
+    MacroStream(Lexer& lexer, MacroExpander& macros) : lexer(lexer), macros(macros) {}
+
+    Token next() {
+        for (;;) {
+            if (!frames.empty()) {
+                Frame& frame = frames.back();
+                if (frame.pos == frame.def->body.size()) {
+                    argStack.resize(frame.argBase);
+                    localStack.resize(frame.localBase);
+                    frames.pop_back();
+                    continue;
+                }
+                const MacroBodyToken& bt = frame.def->body[frame.pos++];
+                Token tok = bt.param >= 0 ? argStack[frame.argBase + bt.param] : bt.token;
+                if (bt.local >= 0) {
+                    tok.symbol = localStack[frame.localBase + bt.local];
+                    tok.lexeme = symbolText(tok.symbol);
+                }
+                tok.line = frame.line;
+                tok.column = frame.column;
+                if (tok.type == TokenType::Macro) {
+                    beginUse(tok, &frame);
+                    continue;
+                }
+                return tok;
+            }
+
+            Token tok = pull();
+            if (tok.type == TokenType::Macro) {
+                beginUse(tok, nullptr);
+            } else if (tok.type == TokenType::Keyword && tok.lexeme == "Define") {
+                Token marker = pull();
+                if (marker.type != TokenType::Macro || marker.line != tok.line)
+                    throw std::runtime_error("Macro Error: expected |name params...| after Define at line " + std::to_string(tok.line));
+                defineFrom(marker);
+            } else {
+                return tok;
+            }
+        }
+    }
+
+    size_t expansionCount() const { return expansions; }
+    size_t definitionCount() const { return definitions; }
+    double expansionMillis() const { return expansionNanos / 1e6; }
+
+private:
+    struct Frame {
+        const MacroDef* def;
+        size_t pos;
+        size_t argBase;
+        size_t localBase;
+        int line;
+        int column;
+    };
+
+    static constexpr size_t MaxDepth = 64;
+
+    Lexer& lexer;
+    MacroExpander& macros;
+    std::vector<Frame> frames;
+    std::vector<Token> argStack;
+    std::vector<SymbolId> localStack;
+    std::vector<Token> bodyScratch;
+    Token pending{};
+    bool hasPending = false;
+    size_t expansions = 0;
+    size_t definitions = 0;
+    int64_t expansionNanos = 0;
+
+    Token pull() {
+        Token tok = hasPending ? pending : lexer.next();
+        hasPending = false;
+        return tok;
+    }
+
+    // The body is the rest of the marker's line, possibly empty.
+    void defineFrom(const Token& marker) {
+        auto start = std::chrono::steady_clock::now();
+        bodyScratch.clear();
+        Token tok = lexer.next();
+        while (tok.type != TokenType::EndOfFile && tok.line == marker.line) {
+            bodyScratch.push_back(tok);
+            tok = lexer.next();
+        }
+        pending = tok;
+        hasPending = true;
+        macros.define(marker, bodyScratch);
+        definitions++;
+        expansionNanos += elapsedSince(start);
+    }
+
+    // Pushes a frame for a use; `outer` is the enclosing expansion when the
+    // marker came from another macro's body, so its arguments can refer to
+    // the outer macro's parameters and locals.
+    void beginUse(const Token& marker, const Frame* outer) {
+        auto start = std::chrono::steady_clock::now();
+        Lexer header(marker.lexeme);
+        Token nameTok = header.next();
+        const MacroDef* def = nameTok.type == TokenType::Identifier ? macros.find(nameTok.symbol) : nullptr;
+        if (!def) {
+            throw std::runtime_error("Macro Error: undefined macro |" + std::string(marker.lexeme) + "| at line "
+                                     + std::to_string(marker.line));
+        }
+        for (const Frame& f : frames) {
+            if (f.def == def) {
+                std::string chain;
+                for (const Frame& g : frames) chain += "|" + std::string(symbolText(g.def->name)) + "| -> ";
+                throw std::runtime_error("Macro Error: recursive expansion " + chain + "|" + std::string(symbolText(def->name)) + "|");
+            }
+        }
+        if (frames.size() >= MaxDepth) throw std::runtime_error("Macro Error: expansion nested too deeply");
+
+        size_t argBase = argStack.size();
+        for (Token arg = header.next(); arg.type != TokenType::EndOfFile; arg = header.next()) {
+            if (outer && arg.type == TokenType::Identifier) {
+                const MacroDef& od = *outer->def;
+                auto p = std::find(od.params.begin(), od.params.end(), arg.symbol);
+                auto l = std::find(od.locals.begin(), od.locals.end(), arg.symbol);
+                if (p != od.params.end()) {
+                    arg = argStack[outer->argBase + (p - od.params.begin())];
+                } else if (l != od.locals.end()) {
+                    arg.symbol = localStack[outer->localBase + (l - od.locals.begin())];
+                    arg.lexeme = symbolText(arg.symbol);
+                }
+            }
+            argStack.push_back(arg);
+        }
+        size_t argc = argStack.size() - argBase;
+        if (argc != def->params.size()) {
+            throw std::runtime_error("Macro Error: |" + std::string(symbolText(def->name)) + "| expects "
+                                     + std::to_string(def->params.size()) + " argument(s), got "
+                                     + std::to_string(argc) + " at line " + std::to_string(marker.line));
+        }
+
+        size_t localBase = localStack.size();
+        for (SymbolId local : def->locals) localStack.push_back(macros.freshLocal(local));
+
+        frames.push_back(Frame{def, 0, argBase, localBase, marker.line, marker.column});
+        expansions++;
+        expansionNanos += elapsedSince(start);
+    }
+
+    static int64_t elapsedSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Spells the expanded token stream back out as source text, one line per
+// source line, for the debug log's [Expanded Code] section.
+inline std::string renderExpanded(std::string_view source, MacroExpander& macros) {
+    Lexer lexer(source);
+    MacroStream stream(lexer, macros);
+    std::string out;
+    out.reserve(source.size());
+    int line = 1;
+    bool lineStart = true;
+    for (Token tok = stream.next(); tok.type != TokenType::EndOfFile; tok = stream.next()) {
+        for (; line < tok.line; ++line) {
+            out += '\n';
+            lineStart = true;
+        }
+        if (!lineStart) out += ' ';
+        lineStart = false;
+        if (tok.type == TokenType::String) {
+            out += '"';
+            out.append(tok.lexeme.data(), tok.lexeme.size());
+            out += '"';
+        } else {
+            out.append(tok.lexeme.data(), tok.lexeme.size());
+        }
+    }
+    out += '\n';
+    return out;
+}
+
+//--------------------------------------------------
+// --- AST ARENA ---
+//--------------------------------------------------
+// Nodes are bump-allocated out of large blocks owned by an ASTArena and are
+// referred to by 32-bit NodeId. Child statements/arguments of every node live
+// contiguously in one shared index buffer and are addressed by NodeList
+// ranges; names (params, fields, variants) are SymbolIds stored the same way
+// and addressed via NameList.
+// Node members never own memory, so no destructor is ever run on a node: the
+// whole tree is released at once when the arena goes away.
+using NodeId = uint32_t;
+constexpr NodeId NoNode = 0xFFFFFFFFu;
+
+struct NodeList {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+struct NameList {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+template <typename T>
+struct ArenaSpan {
+    const T* first;
+    const T* last;
+
+    const T* begin() const { return first; }
+    const T* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    const T& operator[](size_t i) const { return first[i]; }
+};
+
+//--------------------------------------------------
+// --- AST NODES ---
+//--------------------------------------------------
+// Every concrete node type, in NodeKind order. Adding a node means adding it
+// here; the kind enum and the visitor dispatch switch are generated from it.
+#define HYPERLACE_AST_NODES(X) \
+    X(Assignment)              \
+    X(NumberExpr)              \
+    X(IdentifierExpr)          \
+    X(BinaryExpr)              \
+    X(FunctionDef)             \
+    X(IfStatement)             \
+    X(FunctionCall)            \
+    X(WhileLoop)               \
+    X(ForLoop)                 \
+    X(StructDef)               \
+    X(StructInit)              \
+    X(FieldAccess)             \
+    X(EnumDef)                 \
+    X(ReturnStatement)         \
+    X(TernaryExpr)
+
+enum class NodeKind : uint8_t {
+#define HYPERLACE_NODE_KIND(Name) Name,
+    HYPERLACE_AST_NODES(HYPERLACE_NODE_KIND)
+#undef HYPERLACE_NODE_KIND
+};
+
+inline const char* nodeKindName(NodeKind kind) {
+    static const char* const names[] = {
+#define HYPERLACE_NODE_NAME(Name) #Name,
+        HYPERLACE_AST_NODES(HYPERLACE_NODE_NAME)
+#undef HYPERLACE_NODE_NAME
+    };
+    return names[static_cast<size_t>(kind)];
+}
+
+class ASTNode {
+public:
+    NodeKind kind;
+
+protected:
+    explicit ASTNode(NodeKind k) : kind(k) {}
+};
+
+class Expression : public ASTNode {
+protected:
+    using ASTNode::ASTNode;
+};
+
+class Statement : public ASTNode {
+protected:
+    using ASTNode::ASTNode;
+};
+
+class Assignment : public Statement {
+public:
+    static constexpr NodeKind Kind = NodeKind::Assignment;
+    SymbolId name;
+    NodeId value;
+    SymbolId field = NoSymbol;   // set for `name.field = value`
+
+    Assignment(SymbolId n, NodeId v)
+        : Statement(Kind), name(n), value(v) {}
+};
+
+class NumberExpr : public Expression {
+public:
+    static constexpr NodeKind Kind = NodeKind::NumberExpr;
+    std::string_view value;
+
+    NumberExpr(std::string_view val) : Expression(Kind), value(val) {}
+};
+
+class IdentifierExpr : public Expression {
+public:
+    static constexpr NodeKind Kind = NodeKind::IdentifierExpr;
+    SymbolId name;
+
+    IdentifierExpr(SymbolId n) : Expression(Kind), name(n) {}
+};
+
+// Binary Expression (also produced by compound-assignment desugaring)
+struct BinaryExpr : public Expression {
+    static constexpr NodeKind Kind = NodeKind::BinaryExpr;
+    std::string_view op;
+    NodeId left = NoNode;
+    NodeId right = NoNode;
+
+    BinaryExpr() : Expression(Kind) {}
+};
+
+// Function Definition
+struct FunctionDef : public Statement {
+    static constexpr NodeKind Kind = NodeKind::FunctionDef;
+    SymbolId name = NoSymbol;
+    NameList params;
+    NodeList body;
+
+    FunctionDef() : Statement(Kind) {}
+};
+
+// If Statement
+struct IfStatement : public Statement {
+    static constexpr NodeKind Kind = NodeKind::IfStatement;
+    NodeId condition = NoNode;
+    NodeList thenBranch;
+    NodeList elseBranch;
+
+    IfStatement() : Statement(Kind) {}
+};
+
+// Function Call
+struct FunctionCall : public Expression {
+    static constexpr NodeKind Kind = NodeKind::FunctionCall;
+    SymbolId name = NoSymbol;
+    NodeList arguments;
+
+    FunctionCall() : Expression(Kind) {}
+};
+
+// While loop
+struct WhileLoop : public Statement {
+    static constexpr NodeKind Kind = NodeKind::WhileLoop;
+    NodeId condition = NoNode;
+    NodeList body;
+
+    WhileLoop() : Statement(Kind) {}
+};
+
+// For loop
+struct ForLoop : public Statement {
+    static constexpr NodeKind Kind = NodeKind::ForLoop;
+    NodeId initializer = NoNode;
+    NodeId condition = NoNode;
+    NodeId increment = NoNode;
+    NodeList body;
+
+    ForLoop() : Statement(Kind) {}
+};
+
+struct StructDef : public Statement {
+    static constexpr NodeKind Kind = NodeKind::StructDef;
+    SymbolId name = NoSymbol;
+    NameList fields;
+
+    StructDef() : Statement(Kind) {}
+};
+
+struct StructInit : public Expression {
+    static constexpr NodeKind Kind = NodeKind::StructInit;
+    SymbolId structName = NoSymbol;
+
+    StructInit() : Expression(Kind) {}
+};
+
+struct FieldAccess : public Expression {
+    static constexpr NodeKind Kind = NodeKind::FieldAccess;
+    NodeId object = NoNode;
+    SymbolId field = NoSymbol;
+
+    FieldAccess() : Expression(Kind) {}
+};
+
+struct EnumDef : public Statement {
+    static constexpr NodeKind Kind = NodeKind::EnumDef;
+    SymbolId name = NoSymbol;
+    NameList variants;
+
+    EnumDef() : Statement(Kind) {}
+};
+
+struct ReturnStatement : public Statement {
+    static constexpr NodeKind Kind = NodeKind::ReturnStatement;
+    NodeId returnValue = NoNode; // optional
+
+    ReturnStatement() : Statement(Kind) {}
+};
+
+struct TernaryExpr : public Expression {
+    static constexpr NodeKind Kind = NodeKind::TernaryExpr;
+    NodeId condition = NoNode;
+    NodeId thenExpr = NoNode;
+    NodeId elseExpr = NoNode;
+
+    TernaryExpr() : Expression(Kind) {}
+};
+
+//--------------------------------------------------
+// --- AST ARENA STORAGE ---
+//--------------------------------------------------
+class ASTArena {
+public:
+    ASTArena() = default;
+    ASTArena(const ASTArena&) = delete;
+    ASTArena& operator=(const ASTArena&) = delete;
+
+    template <typename T, typename... Args>
+    NodeId make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "AST nodes are never destroyed individually");
+        void* mem = allocate(sizeof(T), alignof(T));
+        T* node = new (mem) T(std::forward<Args>(args)...);
+        nodes.push_back(node);
+        return static_cast<NodeId>(nodes.size() - 1);
+    }
+
+    // Tag-checked downcast: a single compare instead of an RTTI lookup.
+    template <typename T>
+    const T* as(NodeId id) const {
+        if (id == NoNode || nodes[id]->kind != T::Kind) return nullptr;
+        return static_cast<const T*>(nodes[id]);
+    }
+
+    NodeKind kind(NodeId id) const { return nodes[id]->kind; }
+
+    const ASTNode* get(NodeId id) const {
+        return id == NoNode ? nullptr : nodes[id];
+    }
+
+    // Copies text into arena storage; the view stays valid for the arena's lifetime.
+    std::string_view copyString(std::string_view text) {
+        if (text.empty()) return {};
+        char* mem = static_cast<char*>(allocate(text.size(), 1));
+        std::memcpy(mem, text.data(), text.size());
+        return std::string_view(mem, text.size());
+    }
+
+    // Child lists are collected on a scratch stack while the parser descends
+    // and are committed contiguously once the enclosing construct is complete.
+    size_t beginList() const { return scratch.size(); }
+    void push(NodeId id) { scratch.push_back(id); }
+
+    NodeList endList(size_t mark) {
+        NodeList list{static_cast<uint32_t>(childIds.size()), static_cast<uint32_t>(scratch.size() - mark)};
+        childIds.insert(childIds.end(), scratch.begin() + mark, scratch.end());
+        scratch.resize(mark);
+        return list;
+    }
+
+    size_t beginNames() const { return nameScratch.size(); }
+    void pushName(SymbolId name) { nameScratch.push_back(name); }
+
+    NameList endNames(size_t mark) {
+        NameList list{static_cast<uint32_t>(nameIds.size()), static_cast<uint32_t>(nameScratch.size() - mark)};
+        nameIds.insert(nameIds.end(), nameScratch.begin() + mark, nameScratch.end());
+        nameScratch.resize(mark);
+        return list;
+    }
+
+    // Discards entries pushed since `mark` (a statement abandoned mid-parse).
+    void dropList(size_t mark) { scratch.resize(mark); }
+    void dropNames(size_t mark) { nameScratch.resize(mark); }
+
+    ArenaSpan<NodeId> children(NodeList list) const {
+        const NodeId* base = childIds.data() + list.first;
+        return {base, base + list.count};
+    }
+
+    ArenaSpan<SymbolId> names(NameList list) const {
+        const SymbolId* base = nameIds.data() + list.first;
+        return {base, base + list.count};
+    }
+
+    size_t nodeCount() const { return nodes.size(); }
+    size_t blockCount() const { return blocks.size() + largeBlocks.size(); }
+
+private:
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<std::unique_ptr<char[]>> largeBlocks;
+    size_t blockUsed = BlockSize;
+
+    std::vector<ASTNode*> nodes;
+    std::vector<NodeId> childIds;
+    std::vector<NodeId> scratch;
+    std::vector<SymbolId> nameIds;
+    std::vector<SymbolId> nameScratch;
+
+    void* allocate(size_t size, size_t align) {
+        if (size > BlockSize / 4) {
+            // Large payloads get a dedicated block so the current one keeps filling.
+            largeBlocks.emplace_back(new char[size]);
+            return largeBlocks.back().get();
+        }
+        size_t offset = (blockUsed + align - 1) & ~(align - 1);
+        if (offset + size > BlockSize) {
+            blocks.emplace_back(new char[BlockSize]);
+            offset = 0;
+        }
+        blockUsed = offset + size;
+        return blocks.back().get() + offset;
+    }
+};
+
+//--------------------------------------------------
+// --- AST VISITOR ---
+//--------------------------------------------------
+// Statically dispatched (CRTP) visitor. visit() switches once on the node's
+// kind tag and calls Derived::visit<Kind>(ast, node); handlers the derived
+// pass does not declare fall back to visitNode(), which does nothing unless
+// the pass overrides it too.
+template <typename Derived, typename Result = void>
+class ASTVisitor {
+public:
+    Result visit(const ASTArena& ast, NodeId id) {
+        const ASTNode* node = ast.get(id);
+        Derived& self = static_cast<Derived&>(*this);
+        switch (node->kind) {
+#define HYPERLACE_VISIT_CASE(Name) \
+            case NodeKind::Name: return self.visit##Name(ast, static_cast<const Name&>(*node));
+            HYPERLACE_AST_NODES(HYPERLACE_VISIT_CASE)
+#undef HYPERLACE_VISIT_CASE
+        }
+        return Result();
+    }
+
+    void visitAll(const ASTArena& ast, NodeList list) {
+        for (NodeId id : ast.children(list)) visit(ast, id);
+    }
+
+protected:
+    Result visitNode(const ASTArena&, const ASTNode&) { return Result(); }
+
+#define HYPERLACE_VISIT_DEFAULT(Name) \
+    Result visit##Name(const ASTArena& ast, const Name& node) { \
+        return static_cast<Derived&>(*this).visitNode(ast, node); \
+    }
+    HYPERLACE_AST_NODES(HYPERLACE_VISIT_DEFAULT)
+#undef HYPERLACE_VISIT_DEFAULT
+};
+
+//--------------------------------------------------
+// --- PARSER IMPLEMENTATION ---
+//--------------------------------------------------
+// Binding power of each operator, lowest first. Assignment only appears at
+// statement level; every other level is handled by Parser::parseExpression.
+enum Precedence : uint8_t {
+    PREC_LOWEST,
+    PREC_ASSIGN,   // = == += -= *= /=
+    PREC_COND,     // ?:
+    PREC_OR,       // or
+    PREC_AND,      // and
+    PREC_COMPARE,  // == != < <= > >=
+    PREC_SUM,      // + -
+    PREC_PRODUCT,  // * / % ^
+    PREC_PREFIX,   // -x !x not x
+    PREC_CALL,     // f() a.b
+    PREC_PRIMARY
+};
+
+class Parser {
+public:
+    Parser(MacroStream& tokens, ASTArena& ast) : tokens(tokens), ast(ast) {
+        lookahead[0] = tokens.next();
+        lookahead[1] = tokens.next();
+        prev = lookahead[0];
+    }
+
+    // Parses the whole file. Syntax errors do not stop the parse: each one is
+    // recorded in errors() and the broken statement is left out of the result.
+    NodeList parse() {
+        std::vector<NodeId> statements;
+        while (!isAtEnd()) {
+            NodeId stmt = parseStatementOrRecover();
+            if (stmt != NoNode) statements.push_back(stmt);
+            else if (check('}')) advance(); // a stray '}' cannot close anything here
+        }
+        size_t mark = ast.beginList();
+        for (NodeId stmt : statements) ast.push(enumIfReferenced(stmt));
+        return ast.endList(mark);
+    }
+
+    const std::vector<std::string>& errors() const { return errorList; }
+
+private:
+    // Syntax errors unwind to the enclosing statement, which records them and
+    // resynchronizes; anything else (lexer or macro errors) stays fatal.
+    struct SyntaxError : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // Operator codes. classify() maps a token to one of these with a switch
+    // on its type and first byte; everything else is None.
+    enum class ExprOp : uint8_t {
+        None, Add, Sub, Mul, Div, Mod, Pow, Eq, Ne, Lt, Le, Gt, Ge, And, Or,
+        Not, Question, Colon, Open, Close, Comma, Dot, Count
+    };
+
+    struct OpRule {
+        Precedence infix;        // binding power after an operand; PREC_LOWEST ends the expression
+        std::string_view text;   // BinaryExpr::op spelling
+    };
+
+    static constexpr OpRule opRules[] = {
+        {PREC_LOWEST, ""},
+        {PREC_SUM, "+"}, {PREC_SUM, "-"},
+        {PREC_PRODUCT, "*"}, {PREC_PRODUCT, "/"}, {PREC_PRODUCT, "%"}, {PREC_PRODUCT, "^"},
+        {PREC_COMPARE, "=="}, {PREC_COMPARE, "!="}, {PREC_COMPARE, "<"},
+        {PREC_COMPARE, "<="}, {PREC_COMPARE, ">"}, {PREC_COMPARE, ">="},
+        {PREC_AND, "and"}, {PREC_OR, "or"},
+        {PREC_LOWEST, "not"}, {PREC_COND, "?"}, {PREC_LOWEST, ":"},
+        {PREC_CALL, "("}, {PREC_LOWEST, ")"}, {PREC_LOWEST, ","}, {PREC_CALL, "."},
+    };
+    static_assert(sizeof(opRules) / sizeof(opRules[0]) == static_cast<size_t>(ExprOp::Count),
+                  "one rule per operator code");
+
+    // An operator or bracket still waiting for its right-hand side. Group,
+    // Call and Then are barriers that only ')' , ',' or ':' may pop.
+    enum class Frame : uint8_t { Binary, Prefix, Group, Call, Then, Else };
+
+    struct PendingOp {
+        Frame frame;
+        Precedence prec;
+        ExprOp op;
+        SymbolId callee = NoSymbol;  // Call: function name
+        size_t args = 0;             // Call: ast list mark for the arguments
+    };
+
+    // Tokens are pulled from the (macro-expanded) stream on demand; only the
+    // previous token and a two-token lookahead window are kept alive.
+    MacroStream& tokens;
+    ASTArena& ast;
+    Token lookahead[2];
+    Token prev;
+    SymbolSet structNames;   // types defined so far, so `Name()` reads as a struct init
+    SymbolMap<std::vector<SymbolId>> dotted;   // name -> every member read as `name.member`
+    SymbolSet variables;     // names assigned, written through (`name.f = ...`) or taken as parameters
+    SymbolSet constructed;   // types built with `Name()`
+    std::vector<std::string> errorList;
+
+    // Expression stacks, reused across expressions so nesting depth costs
+    // neither native stack nor per-level allocation.
+    std::vector<NodeId> operands;
+    std::vector<PendingOp> pending;
+
+    bool isAtEnd() const {
+        return peek().type == TokenType::EndOfFile;
+    }
+
+    const Token& peek() const {
+        return lookahead[0];
+    }
+
+    const Token& peekNext() const {
+        return lookahead[1];
+    }
+
+    const Token& advance() {
+        if (!isAtEnd()) {
+            prev = lookahead[0];
+            lookahead[0] = lookahead[1];
+            lookahead[1] = tokens.next();
+        }
+        return previous();
+    }
+
+    const Token& previous() const {
+        return prev;
+    }
+
+    bool match(TokenType type) {
+        if (peek().type == type) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+
+    bool check(char symbol) const {
+        const Token& tok = peek();
+        return (tok.type == TokenType::Symbol || tok.type == TokenType::EndOfLine)
+            && tok.lexeme.size() == 1 && tok.lexeme[0] == symbol;
+    }
+
+    bool match(char symbol) {
+        if (check(symbol)) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw SyntaxError(message + " at line " + std::to_string(peek().line));
+    }
+
+    void expect(char symbol) {
+        if (!match(symbol)) fail(std::string("Expected '") + symbol + "'");
+    }
+
+    bool checkKeyword(const char* keyword) const {
+        return peek().type == TokenType::Keyword && peek().lexeme == keyword;
+    }
+
+    bool matchKeyword(const char* keyword) {
+        if (checkKeyword(keyword)) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+
+    SymbolId expectIdentifier(const char* message) {
+        if (peek().type != TokenType::Identifier) fail(message);
+        return advance().symbol;
+    }
+
+    // Parses one statement. On a syntax error the message is recorded, the
+    // rest of the statement is skipped and NoNode is returned in its place.
+    NodeId parseStatementOrRecover() {
+        size_t listMark = ast.beginList();
+        size_t nameMark = ast.beginNames();
+        try {
+            return parseStatement();
+        } catch (const SyntaxError& ex) {
+            errorList.push_back(ex.what());
+            ast.dropList(listMark);
+            ast.dropNames(nameMark);
+            operands.clear();
+            pending.clear();
+            synchronize();
+            return NoNode;
+        }
+    }
+
+    // Panic-mode recovery: skip past the next ';' or past a block the broken
+    // statement opened, but stop in front of a '}' closing an outer block.
+    void synchronize() {
+        int depth = 0;
+        while (!isAtEnd()) {
+            if (check('}')) {
+                if (depth == 0) return;
+                advance();
+                if (--depth == 0) return;
+                continue;
+            }
+            if (check('{')) depth++;
+            else if (depth == 0 && check(';')) {
+                advance();
+                return;
+            }
+            advance();
+        }
+    }
+
+    // Parses statements up to the closing '}' of the current block.
+    NodeList parseBlock() {
+        expect('{');
+        size_t mark = ast.beginList();
+        while (!check('}') && !isAtEnd()) {
+            NodeId stmt = parseStatementOrRecover();
+            if (stmt != NoNode) ast.push(stmt);
+        }
+        expect('}');
+        return ast.endList(mark);
+    }
+
+    NodeId parseStatement() {
+        if (checkKeyword("Start")) return parseFunction();
+        if (checkKeyword("if")) return parseIfStatement();
+        if (checkKeyword("while")) return parseWhile();
+        if (checkKeyword("for")) return parseFor();
+        if (checkKeyword("Init")) return parseStructDef();
+        if (checkKeyword("Return")) return parseReturn();
+        if (peek().type == TokenType::Identifier) return parseAssignmentOrCall();
+        fail("Unexpected '" + std::string(peek().lexeme) + "'");
+    }
+
+    // `=` and `==` store; the compound forms desugar to `x = x <op> value`.
+    // Returns nullptr for tokens that are not assignment operators.
+    static const char* assignmentOp(TokenType type) {
+        switch (type) {
+            case TokenType::Assign:
+            case TokenType::ImmutableAssign: return "";
+            case TokenType::PlusEq: return "+";
+            case TokenType::MinusEq: return "-";
+            case TokenType::StarEq: return "*";
+            case TokenType::SlashEq: return "/";
+            default: return nullptr;
+        }
+    }
+
+    // x = e, p.x = e (and their compound forms), or a call statement f(...).
+    NodeId parseAssignmentOrCall() {
+        SymbolId name = advance().symbol;
+        NodeId target = ast.make<IdentifierExpr>(name);
+        SymbolId field = NoSymbol;
+        if (match('.')) {
+            FieldAccess access;
+            access.object = target;
+            access.field = field = expectIdentifier("Expected field name");
+            target = ast.make<FieldAccess>(access);
+        }
+        const char* op = assignmentOp(peek().type);
+        if (!op) {
+            NodeId expr = parseExpression(target);
+            if (ast.kind(expr) != NodeKind::FunctionCall) fail("Expected assignment or call");
+            match(TokenType::EndOfLine); // ';'
+            return expr;
+        }
+        advance();
+        variables.insert(name);
+        NodeId value = parseExpression();
+        if (*op) {
+            BinaryExpr bin;
+            bin.op = op;
+            bin.left = target;
+            bin.right = value;
+            value = ast.make<BinaryExpr>(bin);
+        }
+        match(TokenType::EndOfLine); // ';'
+        Assignment assign(name, value);
+        assign.field = field;
+        return ast.make<Assignment>(assign);
+    }
+
+    static ExprOp symbolOp(char c) {
+        switch (c) {
+            case '+': return ExprOp::Add;
+            case '-': return ExprOp::Sub;
+            case '*': return ExprOp::Mul;
+            case '/': return ExprOp::Div;
+            case '%': return ExprOp::Mod;
+            case '^': return ExprOp::Pow;
+            case '<': return ExprOp::Lt;
+            case '>': return ExprOp::Gt;
+            case '!': return ExprOp::Not;
+            case '?': return ExprOp::Question;
+            case ':': return ExprOp::Colon;
+            case '(': return ExprOp::Open;
+            case ')': return ExprOp::Close;
+            case ',': return ExprOp::Comma;
+            case '.': return ExprOp::Dot;
+            default: return ExprOp::None;
+        }
+    }
+
+    static ExprOp classify(const Token& tok) {
+        switch (tok.type) {
+            case TokenType::ImmutableAssign:
+                return ExprOp::Eq;
+            case TokenType::Keyword:
+                if (tok.lexeme == "and") return ExprOp::And;
+                if (tok.lexeme == "or") return ExprOp::Or;
+                if (tok.lexeme == "not") return ExprOp::Not;
+                return ExprOp::None;
+            case TokenType::Symbol: {
+                ExprOp op = symbolOp(tok.lexeme[0]);
+                if (tok.lexeme.size() == 1) return op;
+                // Two-byte symbols: only <=, >= and != are operators (not -> <- ~>).
+                if (tok.lexeme[1] != '=') return ExprOp::None;
+                if (op == ExprOp::Lt) return ExprOp::Le;
+                if (op == ExprOp::Gt) return ExprOp::Ge;
+                if (op == ExprOp::Not) return ExprOp::Ne;
+                return ExprOp::None;
+            }
+            default:
+                return ExprOp::None;
+        }
+    }
+
+    // Pratt parser driven by opRules, run iteratively over the operand and
+    // pending-operator stacks: a binary operator first reduces every pending
+    // operator that binds at least as tightly (more tightly for the
+    // right-associative ?:), then waits for its right operand. Brackets and
+    // the ?: middle are barrier frames closed by ')', ',' and ':'. `seed`
+    // is an operand the caller has already read. The expression ends at the
+    // first token that cannot continue it, including a ')' or ',' that
+    // belongs to the enclosing construct.
+    NodeId parseExpression(NodeId seed = NoNode) {
+        const size_t base = pending.size();
+        bool expectOperand = seed == NoNode;
+        if (!expectOperand) operands.push_back(seed);
+        for (;;) {
+            if (expectOperand) {
+                expectOperand = !parseOperand();
+                continue;
+            }
+            ExprOp op = classify(peek());
+            if (op == ExprOp::Dot) {
+                parseMember();
+                continue;
+            }
+            if (op == ExprOp::Open) {
+                expectOperand = beginCall();
+                continue;
+            }
+            if (op == ExprOp::Close || op == ExprOp::Comma || op == ExprOp::Colon) {
+                if (!closeFrame(base, op)) break;
+                expectOperand = op != ExprOp::Close;
+                continue;
+            }
+            Precedence prec = opRules[static_cast<size_t>(op)].infix;
+            if (prec == PREC_LOWEST) break;
+            bool ternary = op == ExprOp::Question;
+            reduce(base, prec, ternary);
+            pending.push_back({ternary ? Frame::Then : Frame::Binary, prec, op});
+            advance();
+            expectOperand = true;
+        }
+        reduce(base, PREC_LOWEST, false);
+        if (pending.size() > base) {
+            if (pending.back().frame == Frame::Then) fail("Expected ':'");
+            fail("Expected ')'");
+        }
+        return popOperand();
+    }
+
+    // Reads a primary (pushing it, returns true) or a prefix operator or
+    // opening parenthesis (pushing a frame, returns false).
+    bool parseOperand() {
+        const Token& tok = peek();
+        switch (tok.type) {
+            case TokenType::Number:
+                operands.push_back(ast.make<NumberExpr>(ast.copyString(advance().lexeme)));
+                return true;
+            case TokenType::Identifier: {
+                SymbolId name = advance().symbol;
+                if (structNames.contains(name) && check('(')) operands.push_back(parseStructInit(name));
+                else operands.push_back(ast.make<IdentifierExpr>(name));
+                return true;
+            }
+            case TokenType::Keyword:
+                if (tok.lexeme == "true" || tok.lexeme == "True" || tok.lexeme == "false" || tok.lexeme == "False") {
+                    bool value = tok.lexeme[0] == 't' || tok.lexeme[0] == 'T';
+                    advance();
+                    operands.push_back(ast.make<NumberExpr>(value ? "1" : "0"));
+                    return true;
+                }
+                break;
+            default:
+                break;
+        }
+        ExprOp op = classify(tok);
+        if (op == ExprOp::Sub || op == ExprOp::Not) {
+            pending.push_back({Frame::Prefix, PREC_PREFIX, op});
+        } else if (op == ExprOp::Open) {
+            pending.push_back({Frame::Group, PREC_LOWEST, op});
+        } else if (tok.type == TokenType::EndOfFile) {
+            fail("Expected expression before end of file");
+        } else {
+            fail("Expected expression before '" + std::string(tok.lexeme) + "'");
+        }
+        advance();
+        return false;
+    }
+
+    // a.b binds tighter than any prefix, so it applies to the top operand.
+    void parseMember() {
+        advance(); // '.'
+        FieldAccess access;
+        access.object = operands.back();
+        access.field = expectIdentifier("Expected field name");
+        if (const IdentifierExpr* id = ast.as<IdentifierExpr>(access.object)) dotted[id->name].push_back(access.field);
+        operands.back() = ast.make<FieldAccess>(access);
+    }
+
+    // f(...) on the top operand. Returns whether an argument must follow.
+    bool beginCall() {
+        const IdentifierExpr* callee = ast.as<IdentifierExpr>(operands.back());
+        if (!callee) fail("Only named functions can be called");
+        SymbolId name = callee->name;
+        operands.pop_back();
+        advance(); // '('
+        if (match(')')) {
+            FunctionCall call;
+            call.name = name;
+            call.arguments = ast.endList(ast.beginList());
+            operands.push_back(ast.make<FunctionCall>(call));
+            return false;
+        }
+        pending.push_back({Frame::Call, PREC_CALL, ExprOp::Open, name, ast.beginList()});
+        return true;
+    }
+
+    // Handles ')', ',' or ':' after an operand. Returns false when no open
+    // frame of this expression claims the token, which then ends it.
+    bool closeFrame(size_t base, ExprOp op) {
+        reduce(base, PREC_LOWEST, false);
+        if (pending.size() == base) return false;
+        PendingOp& top = pending.back();
+        if (op == ExprOp::Colon) {
+            if (top.frame != Frame::Then) fail("Unexpected ':'");
+            top.frame = Frame::Else;
+        } else if (op == ExprOp::Comma) {
+            if (top.frame != Frame::Call) fail("Unexpected ','");
+            ast.push(popOperand());
+        } else if (top.frame == Frame::Then) {
+            fail("Expected ':'");
+        } else if (top.frame == Frame::Call) {
+            ast.push(popOperand());
+            FunctionCall call;
+            call.name = top.callee;
+            call.arguments = ast.endList(top.args);
+            pending.pop_back();
+            operands.push_back(ast.make<FunctionCall>(call));
+        } else {
+            pending.pop_back(); // Group: the operand inside is the value
+        }
+        advance();
+        return true;
+    }
+
+    // Pops and applies pending operators down to the nearest barrier while
+    // they bind at least as tightly as `prec` (strictly, if rightAssoc).
+    void reduce(size_t base, Precedence prec, bool rightAssoc) {
+        while (pending.size() > base) {
+            const PendingOp top = pending.back();
+            if (top.frame == Frame::Group || top.frame == Frame::Call || top.frame == Frame::Then) return;
+            if (top.prec < prec || (top.prec == prec && rightAssoc)) return;
+            pending.pop_back();
+            NodeId right = popOperand();
+            if (top.frame == Frame::Prefix) {
+                operands.push_back(top.op == ExprOp::Sub ? negate(right) : logicalNot(right));
+            } else if (top.frame == Frame::Binary) {
+                BinaryExpr bin;
+                bin.op = opRules[static_cast<size_t>(top.op)].text;
+                bin.left = popOperand();
+                bin.right = right;
+                operands.push_back(ast.make<BinaryExpr>(bin));
+            } else {
+                TernaryExpr ternary;
+                ternary.elseExpr = right;
+                ternary.thenExpr = popOperand();
+                ternary.condition = popOperand();
+                operands.push_back(ast.make<TernaryExpr>(ternary));
+            }
+        }
+    }
+
+    NodeId popOperand() {
+        NodeId id = operands.back();
+        operands.pop_back();
+        return id;
+    }
+
+    // -x is 0 - x; a negated literal folds into the literal itself.
+    NodeId negate(NodeId operand) {
+        if (const NumberExpr* num = ast.as<NumberExpr>(operand)) {
+            std::string_view text = num->value;
+            if (!text.empty() && text[0] == '-') return ast.make<NumberExpr>(text.substr(1));
+            return ast.make<NumberExpr>(ast.copyString("-" + std::string(text)));
+        }
+        BinaryExpr bin;
+        bin.op = "-";
+        bin.left = ast.make<NumberExpr>("0");
+        bin.right = operand;
+        return ast.make<BinaryExpr>(bin);
+    }
+
+    // not x is x == 0.
+    NodeId logicalNot(NodeId operand) {
+        BinaryExpr bin;
+        bin.op = "==";
+        bin.left = operand;
+        bin.right = ast.make<NumberExpr>("0");
+        return ast.make<BinaryExpr>(bin);
+    }
+
+    NodeId parseFunction() {
+        advance(); // Skip 'Start'
+        FunctionDef fn;
+        fn.name = expectIdentifier("Expected function name after Start");
+        expect('(');
+        size_t mark = ast.beginNames();
+        while (!match(')')) {
+            SymbolId param = expectIdentifier("Expected parameter name");
+            variables.insert(param);
+            ast.pushName(param);
+            match(','); // optional comma
+        }
+        fn.params = ast.endNames(mark);
+        fn.body = parseBlock();
+        return ast.make<FunctionDef>(fn);
+    }
+
+    NodeId parseIfStatement() {
+        advance(); // Skip 'if'
+        IfStatement ifs;
+        expect('(');
+        ifs.condition = parseExpression();
+        expect(')');
+        ifs.thenBranch = parseBlock();
+        if (matchKeyword("else")) {
+            ifs.elseBranch = parseBlock();
+        }
+        return ast.make<IfStatement>(ifs);
+    }
+
+    NodeId parseWhile() {
+        advance(); // skip 'while'
+        WhileLoop loop;
+        expect('(');
+        loop.condition = parseExpression();
+        expect(')');
+        loop.body = parseBlock();
+        return ast.make<WhileLoop>(loop);
+    }
+
+    NodeId parseFor() {
+        advance(); // skip 'for'
+        ForLoop loop;
+        expect('(');
+        loop.initializer = parseStatement();
+        loop.condition = parseExpression();
+        expect(';');
+        loop.increment = parseStatement();
+        expect(')');
+        loop.body = parseBlock();
+        return ast.make<ForLoop>(loop);
+    }
+
+    NodeId parseReturn() {
+        advance(); // skip 'Return'
+        ReturnStatement ret;
+        if (!match(TokenType::EndOfLine)) {
+            ret.returnValue = parseExpression();
+            match(TokenType::EndOfLine);
+        }
+        return ast.make<ReturnStatement>(ret);
+    }
+
+    NodeId parseStructDef() {
+        advance(); // Skip 'Init'
+        StructDef def;
+        def.name = expectIdentifier("Expected struct name");
+        structNames.insert(def.name);
+        expect('{');
+        size_t mark = ast.beginNames();
+        while (!match('}')) {
+            ast.pushName(expectIdentifier("Expected field name"));
+            match(';');
+        }
+        def.fields = ast.endNames(mark);
+        return ast.make<StructDef>(def);
+    }
+
+    // `Init Name { ... }` declares a struct or an enum alike. Once the whole
+    // file is read, a top-level one becomes an enum when `Name.Member` reads
+    // one of its own members and nothing uses Name as a value: it is never
+    // built with `Name()`, assigned, written through or a parameter. So a
+    // variable that shares the type's name leaves the type a struct.
+    NodeId enumIfReferenced(NodeId stmt) {
+        const StructDef* def = ast.as<StructDef>(stmt);
+        if (!def || constructed.contains(def->name) || variables.contains(def->name)) return stmt;
+        const std::vector<SymbolId>* read = dotted.find(def->name);
+        ArenaSpan<SymbolId> members = ast.names(def->fields);
+        if (!read || std::none_of(read->begin(), read->end(), [&](SymbolId member) {
+                return std::find(members.begin(), members.end(), member) != members.end();
+            })) {
+            return stmt;
+        }
+        EnumDef decl;
+        decl.name = def->name;
+        decl.variants = def->fields;
+        return ast.make<EnumDef>(decl);
+    }
+
+    NodeId parseStructInit(SymbolId name) {
+        expect('('); expect(')'); // e.g. Person()
+        constructed.insert(name);
+        StructInit init;
+        init.structName = name;
+        return ast.make<StructInit>(init);
+    }
+};
+
+//--------------------------------------------------
+// --- ALLOCATION COUNTING ---
+//--------------------------------------------------
+// The global operator new charges every allocation to the counter current
+// on its thread, if any. The driver's stage timers install a counter per
+// stage, and the scheduler carries the submitting thread's counter into
+// each task, so work a stage fans out is charged to that stage too.
+struct AllocationCounter {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+inline AllocationCounter*& currentAllocations() {
+    static thread_local AllocationCounter* counter = nullptr;
+    return counter;
+}
+
+// Installs `counter` on this thread for the scope's lifetime.
+class AllocationScope {
+public:
+    explicit AllocationScope(AllocationCounter* counter) : previous(currentAllocations()) { currentAllocations() = counter; }
+    ~AllocationScope() { currentAllocations() = previous; }
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+private:
+    AllocationCounter* previous;
+};
+
+inline void* countedAllocate(std::size_t size) {
+    if (AllocationCounter* counter = currentAllocations()) {
+        counter->count.fetch_add(1, std::memory_order_relaxed);
+        counter->bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = countedAllocate(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+    if (void* p = countedAllocate(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size); }
+// Kept out of line: once inlined, GCC pairs the free() with the new-expression
+// at each call site and reports a mismatch that isn't one.
+#if defined(__GNUC__)
+#define HYPERLACE_NOINLINE __attribute__((noinline))
+#else
+#define HYPERLACE_NOINLINE
+#endif
+HYPERLACE_NOINLINE void countedRelease(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p) noexcept { countedRelease(p); }
+void operator delete[](void* p) noexcept { countedRelease(p); }
+void operator delete(void* p, std::size_t) noexcept { countedRelease(p); }
+void operator delete[](void* p, std::size_t) noexcept { countedRelease(p); }
+
+//--------------------------------------------------
+// --- TASK SCHEDULER ---
+//--------------------------------------------------
+// Work-stealing pool for the per-function stages. Each worker owns a deque:
+// it pops its own work from the back and, when that runs dry, steals from
+// the front of someone else's, so a few expensive functions do not leave the
+// other cores idle. The thread that calls parallelFor() helps run tasks until
+// its batch is done, which also makes nested batches safe. With one job
+// everything runs inline on the caller.
+class TaskScheduler {
+public:
+    explicit TaskScheduler(unsigned jobs = 0) {
+        if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+        queues = std::vector<Queue>(jobs);
+        for (unsigned i = 1; i < jobs; ++i) threads.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~TaskScheduler() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) t.join();
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    unsigned jobCount() const { return static_cast<unsigned>(queues.size()); }
+    size_t stealCount() const { return steals.load(std::memory_order_relaxed); }
+
+    // Runs body(i) for every i in [0, count). If any call throws, the
+    // exception from the lowest index is rethrown once all calls finished,
+    // so error reporting does not depend on scheduling.
+    template<typename Body>
+    void parallelFor(size_t count, Body&& body) {
+        if (count == 0) return;
+        if (queues.size() == 1 || count == 1) {
+            for (size_t i = 0; i < count; ++i) body(i);
+            return;
+        }
+
+        Batch batch;
+        batch.run = [&body](size_t i) { body(i); };
+        batch.allocations = currentAllocations();
+        batch.remaining.store(count, std::memory_order_relaxed);
+
+        // Contiguous chunks per worker keep neighbouring functions together;
+        // stealing evens out whatever imbalance is left.
+        size_t workers = queues.size();
+        for (size_t w = 0; w < workers; ++w) {
+            size_t begin = count * w / workers, end = count * (w + 1) / workers;
+            if (begin == end) continue;
+            std::lock_guard<std::mutex> guard(queues[w].lock);
+            for (size_t i = begin; i < end; ++i) queues[w].tasks.push_back(Task{&batch, i});
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            queued.fetch_add(count, std::memory_order_relaxed);
+        }
+        wake.notify_all();
+
+        // Only help with this batch: picking up an unrelated file's work here
+        // would stall our own caller behind it.
+        size_t self = currentWorker();
+        while (batch.remaining.load(std::memory_order_acquire) != 0) {
+            if (!runOne(self, &batch)) std::this_thread::yield();
+        }
+        if (batch.error) std::rethrow_exception(batch.error);
+    }
+
+private:
+    struct Batch {
+        std::function<void(size_t)> run;
+        AllocationCounter* allocations = nullptr;   // the submitter's, installed around each task
+        std::atomic<size_t> remaining{0};
+        std::mutex errorLock;
+        std::exception_ptr error;
+        size_t errorIndex = SIZE_MAX;
+    };
+
+    struct Task {
+        Batch* batch;
+        size_t index;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> threads;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};  // raised under sleepLock so sleepers never miss it
+    bool stopping = false;      // guarded by sleepLock
+    std::atomic<size_t> steals{0};
+
+    // Slot 0 belongs to whichever outside thread is submitting work.
+    static size_t& workerSlot() {
+        static thread_local size_t slot = 0;
+        return slot;
+    }
+    size_t currentWorker() const { return workerSlot() < queues.size() ? workerSlot() : 0; }
+
+    // Own deque from the back, then steal from the front of the others.
+    // With `only` set, just tasks of that batch are taken.
+    bool take(size_t self, Task& task, const Batch* only) {
+        auto matches = [only](const Task& t) { return !only || t.batch == only; };
+        {
+            Queue& own = queues[self];
+            std::lock_guard<std::mutex> guard(own.lock);
+            auto it = std::find_if(own.tasks.rbegin(), own.tasks.rend(), matches);
+            if (it != own.tasks.rend()) {
+                task = *it;
+                own.tasks.erase(std::next(it).base());
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Queue& victim = queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            auto it = std::find_if(victim.tasks.begin(), victim.tasks.end(), matches);
+            if (it != victim.tasks.end()) {
+                task = *it;
+                victim.tasks.erase(it);
+                steals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool runOne(size_t self, const Batch* only = nullptr) {
+        Task task;
+        if (!take(self, task, only)) return false;
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        Batch& batch = *task.batch;
+        try {
+            AllocationScope scope(batch.allocations);
+            batch.run(task.index);
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(batch.errorLock);
+            if (task.index < batch.errorIndex) {
+                batch.errorIndex = task.index;
+                batch.error = std::current_exception();
+            }
+        }
+        batch.remaining.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+
+    void workerLoop(size_t self) {
+        workerSlot() = self;
+        for (;;) {
+            if (runOne(self)) continue;
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wake.wait(guard, [this] { return queued > 0 || stopping; });
+            if (stopping) return;
+        }
+    }
+};
+
+// Parses the value of -j; 0 (the default) means one job per core.
+inline unsigned parseJobCount(std::string_view value) {
+    std::string text(value);
+    char* end = nullptr;
+    long jobs = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || jobs < 1)
+        throw std::runtime_error("Invalid job count for -j: '" + text + "'");
+    return static_cast<unsigned>(jobs);
+}
+
+// Top-level FunctionDefs in source order: the units the per-function stages
+// hand to the scheduler.
+inline std::vector<NodeId> functionsOf(const ASTArena& ast, NodeList statements) {
+    std::vector<NodeId> functions;
+    for (NodeId stmt : ast.children(statements)) {
+        if (ast.kind(stmt) == NodeKind::FunctionDef) functions.push_back(stmt);
+    }
+    return functions;
+}
+
+//--------------------------------------------------
+// --- SEMANTIC ANALYZER ---
+//--------------------------------------------------
+// Top-level statements are checked in order and their assignments become the
+// module's globals. Function bodies only read the finished global set, so
+// once it is built every FunctionDef is checked as its own task. The first
+// error in source order is the one reported, whatever order tasks ran in.
+class SemanticAnalyzer : public ASTVisitor<SemanticAnalyzer> {
+public:
+    void analyze(const ASTArena& ast, NodeList statements) {
+        TaskScheduler serial(1);
+        analyze(ast, statements, serial);
+    }
+
+    void analyze(const ASTArena& ast, NodeList statements, TaskScheduler& scheduler) {
+        declared.clear();
+        globals = nullptr;
+        inFunction = false;
+
+        std::vector<NodeId> functions;
+        size_t firstError = SIZE_MAX;
+        std::string message;
+        ArenaSpan<NodeId> stmts = ast.children(statements);
+        for (size_t i = 0; i < stmts.size(); ++i) {
+            if (ast.kind(stmts[i]) == NodeKind::FunctionDef) {
+                functions.push_back(stmts[i]);
+                continue;
+            }
+            try {
+                visit(ast, stmts[i]);
+            } catch (const std::runtime_error& ex) {
+                // Keep collecting globals so functions see the full set.
+                if (firstError == SIZE_MAX) {
+                    firstError = i;
+                    message = ex.what();
+                }
+            }
+        }
+
+        std::vector<std::string> errors(functions.size());
+        scheduler.parallelFor(functions.size(), [&](size_t i) {
+            SemanticAnalyzer unit;
+            unit.globals = &declared;
+            try {
+                unit.visit(ast, functions[i]);
+            } catch (const std::runtime_error& ex) {
+                errors[i] = ex.what();
+            }
+        });
+
+        for (size_t i = 0, f = 0; i < stmts.size() && i < firstError; ++i) {
+            if (ast.kind(stmts[i]) != NodeKind::FunctionDef) continue;
+            if (!errors[f].empty()) throw std::runtime_error(errors[f]);
+            f++;
+        }
+        if (firstError != SIZE_MAX) throw std::runtime_error(message);
+    }
+
+private:
+    friend class ASTVisitor<SemanticAnalyzer>;
+
+    SymbolSet declared;
+    const SymbolSet* globals = nullptr;  // set while checking a function body
+    bool inFunction = false;
+
+    bool isDeclared(SymbolId name) const {
+        return declared.contains(name) || (globals && globals->contains(name));
+    }
+
+    void visitAssignment(const ASTArena& ast, const Assignment& stmt) {
+        // Writing a field needs the struct variable to exist already.
+        if (stmt.field != NoSymbol) {
+            if (!isDeclared(stmt.name))
+                throw std::runtime_error("Semantic Error: Use of undeclared variable '" + std::string(symbolText(stmt.name)) + "'");
+        } else {
+            declared.insert(stmt.name);
+        }
+
+        if (auto idExpr = ast.as<IdentifierExpr>(stmt.value)) {
+            if (!isDeclared(idExpr->name)) {
+                throw std::runtime_error("Semantic Error: Use of undeclared variable '" + std::string(symbolText(idExpr->name)) + "'");
+            }
+        }
+    }
+
+    void visitFunctionDef(const ASTArena& ast, const FunctionDef& fn) {
+        inFunction = true;
+        for (SymbolId param : ast.names(fn.params))
+            declared.insert(param);
+        visitAll(ast, fn.body);  // recursively walk inside
+        inFunction = false;
+    }
+
+    // Names assigned in a branch or loop body stay declared after it, as
+    // IRBuilder::collectAssigned treats them; reading one on a path that
+    // skipped the assignment sees the variable's zero initial value.
+    void visitIfStatement(const ASTArena& ast, const IfStatement& stmt) {
+        visit(ast, stmt.condition);
+        visitAll(ast, stmt.thenBranch);
+        visitAll(ast, stmt.elseBranch);
+    }
+
+    void visitWhileLoop(const ASTArena& ast, const WhileLoop& loop) {
+        visit(ast, loop.condition);
+        visitAll(ast, loop.body);
+    }
+
+    void visitForLoop(const ASTArena& ast, const ForLoop& loop) {
+        if (loop.initializer != NoNode) visit(ast, loop.initializer);
+        if (loop.condition != NoNode) visit(ast, loop.condition);
+        visitAll(ast, loop.body);
+        if (loop.increment != NoNode) visit(ast, loop.increment);
+    }
+
+    void visitReturnStatement(const ASTArena&, const ReturnStatement&) {
+        if (!inFunction)
+            throw std::runtime_error("Return statement used outside a function.");
+    }
+};
+
+//--------------------------------------------------
+// --- STRUCT LAYOUT ---
+//--------------------------------------------------
+// Field offsets, sizes and alignment for every `Init Name { ... }`,
+// computed once per module before lowering. The rules are C's: fields keep
+// declaration order, each starts at the next multiple of its alignment, and
+// the struct's size is rounded up to its widest alignment so instances can
+// sit back to back. Every field is one 64-bit word today (the language has
+// no narrower values), so that is the only size fieldShape() hands out.
+struct FieldLayout {
+    SymbolId name = NoSymbol;
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    uint32_t align = 0;
+};
+
+struct StructLayout {
+    SymbolId name = NoSymbol;
+    std::vector<FieldLayout> fields;
+    uint32_t size = 0;
+    uint32_t align = 1;
+
+    const FieldLayout* field(SymbolId name) const {
+        for (const FieldLayout& f : fields) {
+            if (f.name == name) return &f;
+        }
+        return nullptr;
+    }
+};
+
+// Where the module-level instances of a struct type go in .data.
+enum class StructStorage : uint8_t {
+    AoS,   // each instance is one block holding its fields at their offsets
+    SoA,   // one array per field, indexed by instance, across every instance of the type
+};
+
+class StructLayouts {
+public:
+    static StructLayouts compute(const ASTArena& ast, NodeList statements) {
+        StructLayouts layouts;
+        for (NodeId stmt : ast.children(statements)) {
+            const StructDef* def = ast.as<StructDef>(stmt);
+            if (!def) continue;
+            if (layouts.find(def->name))
+                throw std::runtime_error("IR Error: struct '" + std::string(symbolText(def->name)) + "' is defined twice");
+            StructLayout layout;
+            layout.name = def->name;
+            uint32_t offset = 0;
+            for (SymbolId name : ast.names(def->fields)) {
+                if (layout.field(name))
+                    throw std::runtime_error("IR Error: struct '" + std::string(symbolText(def->name)) + "' has two fields named '" +
+                                             std::string(symbolText(name)) + "'");
+                FieldLayout field = fieldShape(name);
+                offset = alignUp(offset, field.align);
+                field.offset = offset;
+                offset += field.size;
+                layout.align = std::max(layout.align, field.align);
+                layout.fields.push_back(field);
+            }
+            layout.size = alignUp(offset, layout.align);
+            layouts.index[def->name] = static_cast<uint32_t>(layouts.structs.size()) + 1;
+            layouts.structs.push_back(std::move(layout));
+        }
+        return layouts;
+    }
+
+    const StructLayout* find(SymbolId name) const {
+        const uint32_t* slot = index.find(name);
+        return slot ? &structs[*slot - 1] : nullptr;
+    }
+
+    const std::vector<StructLayout>& all() const { return structs; }
+
+    static uint32_t alignUp(uint32_t value, uint32_t align) { return (value + align - 1) / align * align; }
+
+private:
+    std::vector<StructLayout> structs;   // definition order
+    SymbolMap<uint32_t> index;           // name -> position + 1
+
+    static FieldLayout fieldShape(SymbolId name) {
+        FieldLayout field;
+        field.name = name;
+        field.size = 8;
+        field.align = 8;
+        return field;
+    }
+};
+
+//--------------------------------------------------
+// --- ENUMS ---
+//--------------------------------------------------
+// Variants are numbered densely from 0 in declaration order, so an enum
+// literal is a plain constant and a chain of tests against literals can
+// become a jump table. The backend also emits each enum's variant names
+// as a constant table in .rodata.
+struct EnumLayout {
+    SymbolId name = NoSymbol;
+    std::vector<SymbolId> variants;   // variants[i] has the value i
+
+    // The variant's value, or -1 if the enum has no such variant.
+    int64_t value(SymbolId variant) const {
+        auto it = std::find(variants.begin(), variants.end(), variant);
+        return it == variants.end() ? -1 : static_cast<int64_t>(it - variants.begin());
+    }
+};
+
+class EnumTable {
+public:
+    static EnumTable compute(const ASTArena& ast, NodeList statements, const StructLayouts& structs) {
+        EnumTable table;
+        for (NodeId stmt : ast.children(statements)) {
+            const EnumDef* def = ast.as<EnumDef>(stmt);
+            if (!def) continue;
+            std::string name(symbolText(def->name));
+            if (table.find(def->name)) throw std::runtime_error("IR Error: enum '" + name + "' is defined twice");
+            if (structs.find(def->name)) throw std::runtime_error("IR Error: '" + name + "' is defined as both a struct and an enum");
+            EnumLayout layout;
+            layout.name = def->name;
+            for (SymbolId variant : ast.names(def->variants)) {
+                if (layout.value(variant) >= 0)
+                    throw std::runtime_error("IR Error: enum '" + name + "' has two variants named '" + std::string(symbolText(variant)) + "'");
+                layout.variants.push_back(variant);
+            }
+            table.index[def->name] = static_cast<uint32_t>(table.enums.size()) + 1;
+            table.enums.push_back(std::move(layout));
+        }
+        return table;
+    }
+
+    const EnumLayout* find(SymbolId name) const {
+        const uint32_t* slot = index.find(name);
+        return slot ? &enums[*slot - 1] : nullptr;
+    }
+
+    const std::vector<EnumLayout>& all() const { return enums; }
+
+private:
+    std::vector<EnumLayout> enums;   // definition order
+    SymbolMap<uint32_t> index;       // name -> position + 1
+};
+
+//--------------------------------------------------
+// --- SSA IR ---
+//--------------------------------------------------
+// The in-memory IR every backend and optimization works on. A function is
+// three dense arrays: instructions, blocks, and a shared operand pool for
+// the variable-length operands (phi incomings, call arguments). An
+// instruction's index is its ValueId and doubles as its virtual register.
+// Function locals live only in SSA values; module-level variables are
+// memory, reached through load/store.
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+constexpr ValueId NoValue = 0xFFFFFFFF;
+constexpr BlockId NoBlock = 0xFFFFFFFF;
+
+#define HYPERLACE_IR_OPS(X) \
+    X(Nop, "nop")           \
+    X(Const, "const")       \
+    X(Param, "param")       \
+    X(Load, "load")         \
+    X(Store, "store")       \
+    X(Add, "add")           \
+    X(Sub, "sub")           \
+    X(Mul, "mul")           \
+    X(Div, "div")           \
+    X(CmpEq, "eq")          \
+    X(CmpNe, "ne")          \
+    X(CmpLt, "lt")          \
+    X(CmpLe, "le")          \
+    X(CmpGt, "gt")          \
+    X(CmpGe, "ge")          \
+    X(Phi, "phi")           \
+    X(Select, "select")     \
+    X(Call, "call")         \
+    X(Jump, "jmp")          \
+    X(Branch, "br")         \
+    X(Switch, "switch")     \
+    X(Return, "ret")        \
+    X(TailCall, "tailcall")
+
+enum class IROp : uint8_t {
+#define HYPERLACE_IR_OP_ENUM(Name, Text) Name,
+    HYPERLACE_IR_OPS(HYPERLACE_IR_OP_ENUM)
+#undef HYPERLACE_IR_OP_ENUM
+};
+
+inline const char* irOpName(IROp op) {
+    static const char* const names[] = {
+#define HYPERLACE_IR_OP_NAME(Name, Text) Text,
+        HYPERLACE_IR_OPS(HYPERLACE_IR_OP_NAME)
+#undef HYPERLACE_IR_OP_NAME
+    };
+    return names[static_cast<size_t>(op)];
+}
+
+enum class IRType : uint8_t { Void, I64, Bool };
+
+inline const char* irTypeName(IRType type) {
+    switch (type) {
+        case IRType::I64: return "i64";
+        case IRType::Bool: return "bool";
+        default: return "void";
+    }
+}
+
+inline bool isTerminator(IROp op) {
+    return op == IROp::Jump || op == IROp::Branch || op == IROp::Switch || op == IROp::Return || op == IROp::TailCall;
+}
+inline bool isCompare(IROp op) { return op >= IROp::CmpEq && op <= IROp::CmpGe; }
+inline bool hasSideEffects(IROp op) { return op == IROp::Store || op == IROp::Call || isTerminator(op); }
+
+// Operand layout by op:
+//   Const      imm
+//   Param      imm = parameter index
+//   Load       symbol                      Store  symbol, a = value
+//   arith/cmp  a, b
+//   Phi        extra/count: (value, block) pairs in IRFunction::operands
+//   Select     extra/count = 3: condition, value if true, value if false
+//   Call       symbol, extra/count: argument values
+//   Jump       target[0]                   Branch a = condition, target[0]/[1]
+//   Switch     a = value, target[0] = default, extra/count: (case, block)
+//              pairs in operands, cases as int32 in ascending order
+//   Return     a = value or NoValue
+//   TailCall   symbol, extra/count: argument values; returns whatever the callee returns
+struct IRInst {
+    IROp op = IROp::Nop;
+    IRType type = IRType::Void;
+    BlockId block = NoBlock;
+    ValueId a = NoValue;
+    ValueId b = NoValue;
+    uint32_t extra = 0;
+    uint32_t count = 0;
+    int64_t imm = 0;
+    SymbolId symbol = NoSymbol;
+    BlockId target[2] = {NoBlock, NoBlock};
+};
+
+struct IRBlock {
+    std::vector<ValueId> insts;   // in order; phis first, terminator last
+    std::vector<BlockId> preds;
+};
+
+class IRFunction {
+public:
+    SymbolId name = NoSymbol;
+    bool isEntry = false;         // the module's top-level code (_start)
+    std::vector<SymbolId> params;
+    std::vector<IRInst> insts;
+    std::vector<IRBlock> blocks;
+    std::vector<uint32_t> operands;
+    std::vector<uint64_t> counts;   // per block: times it ran under --profile-use; empty without a profile
+
+    BlockId addBlock() {
+        blocks.emplace_back();
+        if (!counts.empty()) counts.push_back(0);
+        return static_cast<BlockId>(blocks.size() - 1);
+    }
+
+    ValueId append(BlockId block, IRInst inst) {
+        inst.block = block;
+        insts.push_back(inst);
+        ValueId id = static_cast<ValueId>(insts.size() - 1);
+        blocks[block].insts.push_back(id);
+        return id;
+    }
+
+    const IRInst* terminator(BlockId block) const {
+        const IRBlock& b = blocks[block];
+        if (b.insts.empty()) return nullptr;
+        const IRInst& last = insts[b.insts.back()];
+        return isTerminator(last.op) ? &last : nullptr;
+    }
+
+    size_t successorCount(BlockId block) const {
+        const IRInst* term = terminator(block);
+        if (!term) return 0;
+        if (term->op == IROp::Switch) return 1 + term->count;
+        return term->op == IROp::Branch ? 2 : term->op == IROp::Jump ? 1 : 0;
+    }
+
+    // Successor 0 of a switch is its default; case i follows as i + 1.
+    BlockId successor(BlockId block, size_t i) const {
+        const IRInst* term = terminator(block);
+        if (term->op == IROp::Switch && i > 0) return switchTarget(*term, i - 1);
+        return term->target[i];
+    }
+
+    int64_t switchCase(const IRInst& sw, size_t i) const { return static_cast<int32_t>(operands[sw.extra + 2 * i]); }
+    BlockId switchTarget(const IRInst& sw, size_t i) const { return operands[sw.extra + 2 * i + 1]; }
+
+    // Phi incoming i: value and predecessor block.
+    ValueId phiValue(const IRInst& phi, size_t i) const { return operands[phi.extra + 2 * i]; }
+    BlockId phiBlock(const IRInst& phi, size_t i) const { return operands[phi.extra + 2 * i + 1]; }
+    ValueId callArg(const IRInst& call, size_t i) const { return operands[call.extra + i]; }
+
+    // A constant placed at the top of the entry block (after the params), so
+    // it dominates every use.
+    ValueId entryConstant(int64_t value) {
+        IRInst inst;
+        inst.op = IROp::Const;
+        inst.type = IRType::I64;
+        inst.imm = value;
+        inst.block = 0;
+        insts.push_back(inst);
+        ValueId id = static_cast<ValueId>(insts.size() - 1);
+        std::vector<ValueId>& entry = blocks[0].insts;
+        size_t at = 0;
+        while (at < entry.size() && insts[entry[at]].op == IROp::Param) at++;
+        entry.insert(entry.begin() + at, id);
+        return id;
+    }
+
+    // Adds inst to block just ahead of its terminator.
+    ValueId insertBeforeTerminator(BlockId block, IRInst inst) {
+        ValueId id = append(block, inst);
+        std::vector<ValueId>& list = blocks[block].insts;
+        if (list.size() >= 2) std::swap(list[list.size() - 1], list[list.size() - 2]);
+        return id;
+    }
+
+    // Gives a phi one more incoming; its pairs move to the end of the
+    // operand pool to make room.
+    void addIncoming(ValueId phi, ValueId value, BlockId from) {
+        uint32_t extra = static_cast<uint32_t>(operands.size());
+        for (uint32_t i = 0; i < 2 * insts[phi].count; ++i) {
+            uint32_t operand = operands[insts[phi].extra + i];
+            operands.push_back(operand);
+        }
+        operands.push_back(value);
+        operands.push_back(from);
+        insts[phi].extra = extra;
+        insts[phi].count++;
+    }
+
+    // Removes edge from -> to: drops `from` from to's predecessors and the
+    // matching phi incomings.
+    void removeEdge(BlockId from, BlockId to) {
+        std::vector<BlockId>& preds = blocks[to].preds;
+        auto it = std::find(preds.begin(), preds.end(), from);
+        if (it != preds.end()) preds.erase(it);
+        for (ValueId v : blocks[to].insts) {
+            IRInst& phi = insts[v];
+            if (phi.op != IROp::Phi) break;
+            for (uint32_t i = 0; i < phi.count; ++i) {
+                if (operands[phi.extra + 2 * i + 1] != from) continue;
+                for (uint32_t k = i + 1; k < phi.count; ++k) {
+                    operands[phi.extra + 2 * (k - 1)] = operands[phi.extra + 2 * k];
+                    operands[phi.extra + 2 * (k - 1) + 1] = operands[phi.extra + 2 * k + 1];
+                }
+                phi.count--;
+                break;
+            }
+        }
+    }
+
+    // Drops blocks the entry cannot reach, along with their instructions and
+    // the phi incomings they fed, and renumbers the remaining blocks.
+    void removeUnreachableBlocks() {
+        std::vector<uint8_t> reachable(blocks.size(), 0);
+        std::vector<BlockId> work{0};
+        reachable[0] = 1;
+        while (!work.empty()) {
+            BlockId b = work.back();
+            work.pop_back();
+            for (size_t i = 0; i < successorCount(b); ++i) {
+                BlockId s = successor(b, i);
+                if (!reachable[s]) {
+                    reachable[s] = 1;
+                    work.push_back(s);
+                }
+            }
+        }
+
+        std::vector<BlockId> remap(blocks.size(), NoBlock);
+        BlockId next = 0;
+        for (BlockId b = 0; b < blocks.size(); ++b) {
+            if (reachable[b]) remap[b] = next++;
+        }
+        renumberBlocks(remap);
+    }
+
+    // Moves block b to index remap[b], or drops it (and its instructions)
+    // when remap[b] is NoBlock; every block reference, and its profile
+    // count, follows. Dropped blocks disappear from predecessor lists and
+    // phi incomings.
+    void renumberBlocks(const std::vector<BlockId>& remap) {
+        size_t count = 0;
+        for (BlockId to : remap) count += to != NoBlock;
+        std::vector<IRBlock> kept(count);
+        for (BlockId b = 0; b < blocks.size(); ++b) {
+            if (remap[b] != NoBlock) {
+                kept[remap[b]] = std::move(blocks[b]);
+            } else {
+                for (ValueId v : blocks[b].insts) insts[v].op = IROp::Nop;
+            }
+        }
+        blocks = std::move(kept);
+        if (!counts.empty()) {
+            std::vector<uint64_t> moved(count, 0);
+            for (BlockId b = 0; b < remap.size(); ++b) {
+                if (remap[b] != NoBlock) moved[remap[b]] = counts[b];
+            }
+            counts = std::move(moved);
+        }
+
+        for (IRBlock& block : blocks) {
+            std::vector<BlockId> preds;
+            for (BlockId p : block.preds) {
+                if (remap[p] != NoBlock) preds.push_back(remap[p]);
+            }
+            block.preds = std::move(preds);
+        }
+        for (IRInst& inst : insts) {
+            if (inst.op == IROp::Nop) continue;
+            inst.block = remap[inst.block];
+            for (BlockId& t : inst.target) {
+                if (t != NoBlock) t = remap[t];
+            }
+            if (inst.op == IROp::Switch) {
+                for (uint32_t i = 0; i < inst.count; ++i) operands[inst.extra + 2 * i + 1] = remap[operands[inst.extra + 2 * i + 1]];
+            }
+            if (inst.op == IROp::Phi) {
+                uint32_t live = 0;
+                for (uint32_t i = 0; i < inst.count; ++i) {
+                    BlockId pred = operands[inst.extra + 2 * i + 1];
+                    if (remap[pred] == NoBlock) continue;
+                    operands[inst.extra + 2 * live] = operands[inst.extra + 2 * i];
+                    operands[inst.extra + 2 * live + 1] = remap[pred];
+                    live++;
+                }
+                inst.count = live;
+            }
+        }
+    }
+
+    // Folds a block into its predecessor when that predecessor jumps
+    // straight to it and nothing else enters it, so jump chains left behind
+    // by folded branches become one block. Returns whether anything merged.
+    bool mergeBlocks() {
+        bool merged = false;
+        for (BlockId b = 0; b < blocks.size(); ++b) {
+            for (;;) {
+                if (blocks[b].insts.empty()) break;
+                IRInst& term = insts[blocks[b].insts.back()];
+                if (term.op != IROp::Jump) break;
+                BlockId next = term.target[0];
+                if (next == b || next == 0 || blocks[next].preds.size() != 1) break;
+                const std::vector<ValueId>& moved = blocks[next].insts;
+                if (!moved.empty() && insts[moved.front()].op == IROp::Phi) break;
+
+                term.op = IROp::Nop;
+                blocks[b].insts.pop_back();
+                for (ValueId v : moved) {
+                    insts[v].block = b;
+                    blocks[b].insts.push_back(v);
+                }
+                blocks[next].insts.clear();
+                blocks[next].preds.clear();
+                for (size_t i = 0; i < successorCount(b); ++i) {
+                    BlockId succ = successor(b, i);
+                    for (BlockId& p : blocks[succ].preds) {
+                        if (p == next) p = b;
+                    }
+                    for (ValueId v : blocks[succ].insts) {
+                        IRInst& phi = insts[v];
+                        if (phi.op != IROp::Phi) break;
+                        for (uint32_t k = 0; k < phi.count; ++k) {
+                            if (operands[phi.extra + 2 * k + 1] == next) operands[phi.extra + 2 * k + 1] = b;
+                        }
+                    }
+                }
+                merged = true;
+            }
+        }
+        if (merged) removeUnreachableBlocks();
+        return merged;
+    }
+
+    // Replaces every phi whose incomings are all one value (or itself) with
+    // that value, iterating so chains of such phis collapse too.
+    void removeTrivialPhis() {
+        std::vector<ValueId> forward(insts.size(), NoValue);
+        auto resolve = [&](ValueId v) {
+            while (v != NoValue && forward[v] != NoValue) v = forward[v];
+            return v;
+        };
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (ValueId id = 0; id < insts.size(); ++id) {
+                IRInst& phi = insts[id];
+                if (phi.op != IROp::Phi || forward[id] != NoValue) continue;
+                ValueId same = NoValue;
+                bool trivial = true;
+                for (uint32_t i = 0; i < phi.count; ++i) {
+                    ValueId v = resolve(phiValue(phi, i));
+                    if (v == id || v == same) continue;
+                    if (same != NoValue) {
+                        trivial = false;
+                        break;
+                    }
+                    same = v;
+                }
+                if (!trivial) continue;
+                ValueId target = same == NoValue ? entryConstant(0) : same;  // may grow insts
+                forward.resize(insts.size(), NoValue);
+                forward[id] = target;
+                insts[id].op = IROp::Nop;
+                changed = true;
+            }
+        }
+        for (IRInst& inst : insts) {
+            if (inst.op == IROp::Nop) continue;
+            forEachOperand(inst, [&](ValueId& v) { v = resolve(v); });
+        }
+        for (IRBlock& block : blocks) {
+            block.insts.erase(std::remove_if(block.insts.begin(), block.insts.end(),
+                                             [&](ValueId v) { return insts[v].op == IROp::Nop; }),
+                              block.insts.end());
+        }
+    }
+
+    // Calls fn(ValueId&) for every value operand of inst, so passes can
+    // read or rewrite operands without knowing each op's layout.
+    template<typename Fn>
+    void forEachOperand(IRInst& inst, Fn&& fn) { visitOperands(*this, inst, fn); }
+    template<typename Fn>
+    void forEachOperand(const IRInst& inst, Fn&& fn) const { visitOperands(*this, inst, fn); }
+
+private:
+    template<typename Self, typename Inst, typename Fn>
+    static void visitOperands(Self& self, Inst& inst, Fn& fn) {
+        if (inst.a != NoValue) fn(inst.a);
+        if (inst.b != NoValue) fn(inst.b);
+        if (inst.op == IROp::Phi) {
+            for (uint32_t i = 0; i < inst.count; ++i) fn(self.operands[inst.extra + 2 * i]);
+        } else if (inst.op == IROp::Call || inst.op == IROp::TailCall || inst.op == IROp::Select) {
+            for (uint32_t i = 0; i < inst.count; ++i) fn(self.operands[inst.extra + i]);
+        }
+    }
+};
+
+// A module-level struct variable; its fields live in the globals named
+// `var.field`.
+struct IRStructVar {
+    SymbolId var = NoSymbol;
+    SymbolId type = NoSymbol;
+};
+
+// What functions reused from the compile cache, and so left out of a
+// pass run, still contribute to the module-wide passes.
+struct IRReusedCode {
+    SymbolMap<uint32_t> calls;   // callee -> call sites
+    SymbolSet loads;             // globals they may read
+    std::vector<const IRFunction*> bodies;   // their optimized IR: inlined from and summarized, never changed
+};
+
+struct IRModule {
+    std::vector<SymbolId> globals;      // module-level variables, first-assignment order
+    std::vector<IRFunction> functions;  // functions[0] is the entry; the rest in source order
+    StructLayouts layouts;
+    std::vector<IRStructVar> structVars;   // first-assignment order
+    EnumTable enums;
+    IRReusedCode reused;
+};
+
+//--------------------------------------------------
+// --- IR BUILDER ---
+//--------------------------------------------------
+// Lowers the AST straight into SSA form, following Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form": each block
+// records the current value of every local, reads that miss walk back
+// through the predecessors, and blocks whose predecessors are not all known
+// yet (loop headers) get placeholder phis that are completed when the block
+// is sealed. Trivial phis and unreachable blocks are cleaned up at the end.
+//
+// Struct variables are scalar-replaced: every field becomes a variable of
+// its own named `var.field`, so a local struct's fields are ordinary SSA
+// values and a module-level struct's fields are globals the backend places
+// by the struct's layout.
+
+// What every function's builder shares: the module's variables, which of
+// them hold structs, and the struct layouts.
+struct IRModuleScope {
+    SymbolSet globals;                 // scalar module variables and `var.field` cells
+    SymbolMap<SymbolId> structVars;    // module-level struct variable -> its type
+    SymbolMap<uint32_t> arity;         // every `Start` function -> its parameter count
+    const StructLayouts* layouts = nullptr;
+    const EnumTable* enums = nullptr;
+};
+
+class IRBuilder : public ASTVisitor<IRBuilder, ValueId> {
+public:
+    // Which variables assigned in `body` hold structs: `v = T()` makes v a
+    // T, and so does copying a T into it. Names that belong to `module` are
+    // not this scope's to type (a function assigning a module variable).
+    static SymbolMap<SymbolId> inferStructVars(const ASTArena& ast, NodeList body, const StructLayouts& layouts,
+                                               const IRModuleScope* module) {
+        SymbolMap<SymbolId> types;
+        auto typeOf = [&](NodeId value) -> SymbolId {
+            if (const StructInit* init = ast.as<StructInit>(value)) {
+                if (!layouts.find(init->structName))
+                    throw std::runtime_error("IR Error: unknown struct '" + std::string(symbolText(init->structName)) + "'");
+                return init->structName;
+            }
+            if (const IdentifierExpr* id = ast.as<IdentifierExpr>(value)) {
+                if (const SymbolId* type = types.find(id->name)) return *type;
+                if (module) {
+                    if (const SymbolId* type = module->structVars.find(id->name)) return *type;
+                }
+            }
+            return NoSymbol;
+        };
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (NodeId stmt : ast.children(body)) {
+                collectAssigned(ast, stmt, [&](const Assignment& assign) {
+                    if (assign.field != NoSymbol) return;
+                    if (module && (module->globals.contains(assign.name) || module->structVars.contains(assign.name))) return;
+                    SymbolId type = typeOf(assign.value);
+                    if (type == NoSymbol) return;
+                    const SymbolId* known = types.find(assign.name);
+                    if (!known) {
+                        types.insert(assign.name, type);
+                        changed = true;
+                    } else if (*known != type) {
+                        throw std::runtime_error("IR Error: '" + std::string(symbolText(assign.name)) + "' is assigned both a "
+                            + std::string(symbolText(*known)) + " and a " + std::string(symbolText(type)));
+                    }
+                });
+            }
+        }
+        return types;
+    }
+
+    // Module-level variables: every name assigned by top-level code. A
+    // struct variable contributes one `var.field` global per field instead.
+    static void collectGlobals(const ASTArena& ast, NodeList statements, const IRModuleScope& scope, IRModule& module) {
+        SymbolSet seen;
+        for (NodeId stmt : ast.children(statements)) {
+            if (ast.kind(stmt) == NodeKind::FunctionDef) continue;
+            collectAssigned(ast, stmt, [&](const Assignment& assign) {
+                if (assign.field != NoSymbol || !seen.insert(assign.name)) return;
+                const SymbolId* type = scope.structVars.find(assign.name);
+                if (!type) {
+                    module.globals.push_back(assign.name);
+                    return;
+                }
+                module.structVars.push_back({assign.name, *type});
+                for (const FieldLayout& field : module.layouts.find(*type)->fields)
+                    module.globals.push_back(fieldCell(assign.name, field.name));
+            });
+        }
+    }
+
+    static SymbolId fieldCell(SymbolId var, SymbolId field) {
+        return internSymbol(std::string(symbolText(var)) + "." + std::string(symbolText(field)));
+    }
+
+    // The top-level statements become the entry function.
+    static IRFunction buildEntry(const ASTArena& ast, NodeList statements, const IRModuleScope& scope) {
+        IRFunction fn;
+        fn.name = internSymbol("_start");
+        fn.isEntry = true;
+        IRBuilder builder(ast, scope, fn);
+        for (NodeId stmt : ast.children(statements)) {
+            if (ast.kind(stmt) != NodeKind::FunctionDef) builder.lowerStatement(stmt);
+        }
+        builder.finish();
+        return fn;
+    }
+
+    static IRFunction buildFunction(const ASTArena& ast, const FunctionDef& def, const IRModuleScope& scope) {
+        IRFunction fn;
+        fn.name = def.name;
+        IRBuilder builder(ast, scope, fn);
+        int64_t index = 0;
+        for (SymbolId param : ast.names(def.params)) {
+            fn.params.push_back(param);
+            builder.locals.insert(param);
+            IRInst inst;
+            inst.op = IROp::Param;
+            inst.type = IRType::I64;
+            inst.imm = index++;
+            builder.writeVariable(param, builder.current, fn.append(builder.current, inst));
+        }
+        for (NodeId stmt : ast.children(def.body)) {
+            collectAssigned(ast, stmt, [&](const Assignment& assign) {
+                if (assign.field == NoSymbol && !scope.globals.contains(assign.name) && !scope.structVars.contains(assign.name))
+                    builder.locals.insert(assign.name);
+            });
+        }
+        builder.structVars = inferStructVars(ast, def.body, *scope.layouts, &scope);
+        builder.structVars.forEach([&](SymbolId var, SymbolId type) {
+            for (const FieldLayout& field : scope.layouts->find(type)->fields) builder.locals.insert(fieldCell(var, field.name));
+        });
+        builder.lowerList(def.body);
+        builder.finish();
+        return fn;
+    }
+
+private:
+    friend class ASTVisitor<IRBuilder, ValueId>;
+
+    const ASTArena& ast;
+    const IRModuleScope& scope;
+    IRFunction& fn;
+    SymbolSet locals;
+    SymbolMap<SymbolId> structVars;   // local struct variable -> its type
+    BlockId current = NoBlock;
+    std::unordered_map<uint64_t, ValueId> defs;   // (block, local) -> current value
+    std::vector<std::vector<std::pair<SymbolId, ValueId>>> incompletePhis;
+    std::vector<uint8_t> sealed;
+    ValueId undef = NoValue;
+
+    IRBuilder(const ASTArena& ast, const IRModuleScope& scope, IRFunction& fn)
+        : ast(ast), scope(scope), fn(fn) {
+        current = newBlock();
+        seal(current);
+    }
+
+    template<typename Fn>
+    static void collectAssigned(const ASTArena& ast, NodeId id, Fn&& fn) {
+        if (id == NoNode) return;
+        auto list = [&](NodeList body) {
+            for (NodeId stmt : ast.children(body)) collectAssigned(ast, stmt, fn);
+        };
+        switch (ast.kind(id)) {
+            case NodeKind::Assignment: fn(*ast.as<Assignment>(id)); break;
+            case NodeKind::IfStatement: {
+                const IfStatement& s = *ast.as<IfStatement>(id);
+                list(s.thenBranch);
+                list(s.elseBranch);
+                break;
+            }
+            case NodeKind::WhileLoop: list(ast.as<WhileLoop>(id)->body); break;
+            case NodeKind::ForLoop: {
+                const ForLoop& s = *ast.as<ForLoop>(id);
+                collectAssigned(ast, s.initializer, fn);
+                collectAssigned(ast, s.increment, fn);
+                list(s.body);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    // --- blocks and variables ---
+
+    BlockId newBlock() {
+        BlockId id = fn.addBlock();
+        incompletePhis.emplace_back();
+        sealed.push_back(0);
+        return id;
+    }
+
+    bool terminated() const { return fn.terminator(current) != nullptr; }
+
+    void addEdge(BlockId from, BlockId to) { fn.blocks[to].preds.push_back(from); }
+
+    void jump(BlockId target) {
+        IRInst inst;
+        inst.op = IROp::Jump;
+        inst.target[0] = target;
+        fn.append(current, inst);
+        addEdge(current, target);
+    }
+
+    void branch(ValueId cond, BlockId onTrue, BlockId onFalse) {
+        IRInst inst;
+        inst.op = IROp::Branch;
+        inst.a = cond;
+        inst.target[0] = onTrue;
+        inst.target[1] = onFalse;
+        fn.append(current, inst);
+        addEdge(current, onTrue);
+        addEdge(current, onFalse);
+    }
+
+    static uint64_t key(BlockId block, SymbolId name) { return (static_cast<uint64_t>(block) << 32) | name; }
+
+    void writeVariable(SymbolId name, BlockId block, ValueId value) { defs[key(block, name)] = value; }
+
+    ValueId readVariable(SymbolId name, BlockId block) {
+        auto it = defs.find(key(block, name));
+        if (it != defs.end()) return it->second;
+        return readVariableRecursive(name, block);
+    }
+
+    ValueId readVariableRecursive(SymbolId name, BlockId block) {
+        ValueId value;
+        const std::vector<BlockId>& preds = fn.blocks[block].preds;
+        if (!sealed[block]) {
+            value = newPhi(block);
+            incompletePhis[block].emplace_back(name, value);
+        } else if (preds.size() == 1) {
+            value = readVariable(name, preds[0]);
+        } else if (preds.empty()) {
+            value = undefValue();
+        } else {
+            value = newPhi(block);
+            writeVariable(name, block, value);
+            addPhiOperands(name, value);
+        }
+        writeVariable(name, block, value);
+        return value;
+    }
+
+    ValueId newPhi(BlockId block) {
+        IRInst inst;
+        inst.op = IROp::Phi;
+        inst.type = IRType::I64;
+        inst.block = block;
+        fn.insts.push_back(inst);
+        ValueId id = static_cast<ValueId>(fn.insts.size() - 1);
+        std::vector<ValueId>& body = fn.blocks[block].insts;
+        size_t at = 0;
+        while (at < body.size() && fn.insts[body[at]].op == IROp::Phi) at++;
+        body.insert(body.begin() + at, id);
+        return id;
+    }
+
+    void addPhiOperands(SymbolId name, ValueId phi) {
+        BlockId block = fn.insts[phi].block;
+        std::vector<uint32_t> incoming;
+        for (BlockId pred : fn.blocks[block].preds) {
+            incoming.push_back(readVariable(name, pred));
+            incoming.push_back(pred);
+        }
+        fn.insts[phi].extra = static_cast<uint32_t>(fn.operands.size());
+        fn.insts[phi].count = static_cast<uint32_t>(incoming.size() / 2);
+        fn.operands.insert(fn.operands.end(), incoming.begin(), incoming.end());
+    }
+
+    void seal(BlockId block) {
+        for (auto& [name, phi] : incompletePhis[block]) addPhiOperands(name, phi);
+        incompletePhis[block].clear();
+        sealed[block] = 1;
+    }
+
+    // Reads of a local no path has assigned yield 0.
+    ValueId undefValue() {
+        if (undef == NoValue) undef = fn.entryConstant(0);
+        return undef;
+    }
+
+    // Variables and field cells: SSA values for locals, loads and stores
+    // for module variables.
+    ValueId readName(SymbolId name) {
+        if (locals.contains(name)) return readVariable(name, current);
+        if (!scope.globals.contains(name))
+            throw std::runtime_error("IR Error: unknown variable '" + std::string(symbolText(name)) + "'");
+        IRInst inst;
+        inst.op = IROp::Load;
+        inst.type = IRType::I64;
+        inst.symbol = name;
+        return fn.append(current, inst);
+    }
+
+    void writeName(SymbolId name, ValueId value) {
+        if (locals.contains(name)) {
+            writeVariable(name, current, value);
+            return;
+        }
+        IRInst inst;
+        inst.op = IROp::Store;
+        inst.symbol = name;
+        inst.a = value;
+        fn.append(current, inst);
+    }
+
+    // The struct type `name` holds in this function, or NoSymbol.
+    SymbolId structTypeOf(SymbolId name) const {
+        const SymbolId* type = locals.contains(name) ? structVars.find(name) : scope.structVars.find(name);
+        return type ? *type : NoSymbol;
+    }
+
+    SymbolId fieldCellOf(SymbolId var, SymbolId field) const {
+        SymbolId type = structTypeOf(var);
+        if (type == NoSymbol)
+            throw std::runtime_error("IR Error: '" + std::string(symbolText(var)) + "' is not a struct variable");
+        if (!scope.layouts->find(type)->field(field)) {
+            throw std::runtime_error("IR Error: struct '" + std::string(symbolText(type)) + "' has no field '"
+                + std::string(symbolText(field)) + "'");
+        }
+        return fieldCell(var, field);
+    }
+
+    ValueId emit(IROp op, IRType type, ValueId a = NoValue, ValueId b = NoValue) {
+        IRInst inst;
+        inst.op = op;
+        inst.type = type;
+        inst.a = a;
+        inst.b = b;
+        return fn.append(current, inst);
+    }
+
+    // --- statements ---
+
+    void lowerStatement(NodeId stmt) {
+        // Code after a return is unreachable; give it a block of its own.
+        if (terminated()) {
+            current = newBlock();
+            seal(current);
+        }
+        visit(ast, stmt);
+    }
+
+    void lowerList(NodeList list) {
+        for (NodeId stmt : ast.children(list)) lowerStatement(stmt);
+    }
+
+    ValueId visitAssignment(const ASTArena&, const Assignment& assign) {
+        if (assign.field != NoSymbol) {
+            SymbolId cell = fieldCellOf(assign.name, assign.field);
+            writeName(cell, visit(ast, assign.value));
+        } else if (SymbolId type = structTypeOf(assign.name); type != NoSymbol) {
+            assignStruct(assign.name, *scope.layouts->find(type), assign.value);
+        } else {
+            writeName(assign.name, visit(ast, assign.value));
+        }
+        return NoValue;
+    }
+
+    // `v = T()` zeroes every field; `v = w` copies them one by one.
+    void assignStruct(SymbolId var, const StructLayout& layout, NodeId value) {
+        if (ast.as<StructInit>(value)) {
+            for (const FieldLayout& field : layout.fields) writeName(fieldCell(var, field.name), fn.entryConstant(0));
+            return;
+        }
+        const IdentifierExpr* source = ast.as<IdentifierExpr>(value);
+        if (!source || structTypeOf(source->name) != layout.name) {
+            throw std::runtime_error("IR Error: struct variable '" + std::string(symbolText(var)) + "' can only be assigned a "
+                + std::string(symbolText(layout.name)));
+        }
+        // Read every field before writing any, so `v = v` stays a no-op.
+        std::vector<ValueId> values;
+        for (const FieldLayout& field : layout.fields) values.push_back(readName(fieldCell(source->name, field.name)));
+        for (size_t i = 0; i < layout.fields.size(); ++i) writeName(fieldCell(var, layout.fields[i].name), values[i]);
+    }
+
+    ValueId visitIfStatement(const ASTArena&, const IfStatement& ifs) {
+        ValueId cond = visit(ast, ifs.condition);
+        BlockId thenBlock = newBlock(), elseBlock = newBlock(), join = newBlock();
+        branch(cond, thenBlock, elseBlock);
+        seal(thenBlock);
+        seal(elseBlock);
+
+        current = thenBlock;
+        lowerList(ifs.thenBranch);
+        if (!terminated()) jump(join);
+        current = elseBlock;
+        lowerList(ifs.elseBranch);
+        if (!terminated()) jump(join);
+
+        seal(join);
+        current = join;
+        return NoValue;
+    }
+
+    void lowerLoop(NodeId condition, NodeList body, NodeId increment) {
+        BlockId header = newBlock(), loopBody = newBlock(), exit = newBlock();
+        jump(header);
+        current = header;
+        ValueId cond = visit(ast, condition);
+        branch(cond, loopBody, exit);
+        seal(loopBody);
+
+        current = loopBody;
+        lowerList(body);
+        if (increment != NoNode) lowerStatement(increment);
+        if (!terminated()) jump(header);
+
+        seal(header);
+        seal(exit);
+        current = exit;
+    }
+
+    ValueId visitWhileLoop(const ASTArena&, const WhileLoop& loop) {
+        lowerLoop(loop.condition, loop.body, NoNode);
+        return NoValue;
+    }
+
+    ValueId visitForLoop(const ASTArena&, const ForLoop& loop) {
+        if (loop.initializer != NoNode) lowerStatement(loop.initializer);
+        lowerLoop(loop.condition, loop.body, loop.increment);
+        return NoValue;
+    }
+
+    ValueId visitReturnStatement(const ASTArena&, const ReturnStatement& ret) {
+        IRInst inst;
+        inst.op = IROp::Return;
+        if (ret.returnValue != NoNode) inst.a = visit(ast, ret.returnValue);
+        fn.append(current, inst);
+        return NoValue;
+    }
+
+    ValueId visitFunctionDef(const ASTArena&, const FunctionDef& def) {
+        throw std::runtime_error("IR Error: nested function '" + std::string(symbolText(def.name)) + "' is not supported");
+    }
+
+    ValueId visitStructDef(const ASTArena&, const StructDef&) { return NoValue; }
+    ValueId visitEnumDef(const ASTArena&, const EnumDef&) { return NoValue; }
+
+    // --- expressions ---
+
+    ValueId visitNumberExpr(const ASTArena&, const NumberExpr& num) {
+        std::string text(num.value);
+        char* end = nullptr;
+        errno = 0;
+        long long value = std::strtoll(text.c_str(), &end, 10);
+        if (*end != '\0' || errno == ERANGE)
+            throw std::runtime_error("IR Error: unsupported numeric literal '" + text + "' (integers only)");
+        IRInst inst;
+        inst.op = IROp::Const;
+        inst.type = IRType::I64;
+        inst.imm = value;
+        return fn.append(current, inst);
+    }
+
+    ValueId visitIdentifierExpr(const ASTArena&, const IdentifierExpr& id) {
+        if (structTypeOf(id.name) != NoSymbol)
+            throw std::runtime_error("IR Error: struct variable '" + std::string(symbolText(id.name)) + "' used as a value");
+        return readName(id.name);
+    }
+
+    ValueId visitFieldAccess(const ASTArena&, const FieldAccess& access) {
+        const IdentifierExpr* object = ast.as<IdentifierExpr>(access.object);
+        if (!object) throw std::runtime_error("IR Error: only named struct variables have fields");
+        const EnumLayout* enumType = scope.enums->find(object->name);
+        if (enumType && !locals.contains(object->name) && !scope.globals.contains(object->name) && structTypeOf(object->name) == NoSymbol) {
+            int64_t value = enumType->value(access.field);
+            if (value < 0) {
+                throw std::runtime_error("IR Error: enum '" + std::string(symbolText(object->name)) + "' has no variant '"
+                    + std::string(symbolText(access.field)) + "'");
+            }
+            IRInst inst;
+            inst.op = IROp::Const;
+            inst.type = IRType::I64;
+            inst.imm = value;
+            return fn.append(current, inst);
+        }
+        return readName(fieldCellOf(object->name, access.field));
+    }
+
+    ValueId visitStructInit(const ASTArena&, const StructInit& init) {
+        throw std::runtime_error("IR Error: '" + std::string(symbolText(init.structName)) + "()' can only be assigned to a variable");
+    }
+
+    static bool binaryOp(std::string_view op, IROp& out) {
+        static const std::pair<std::string_view, IROp> table[] = {
+            {"+", IROp::Add}, {"-", IROp::Sub}, {"*", IROp::Mul}, {"/", IROp::Div},
+            {"==", IROp::CmpEq}, {"!=", IROp::CmpNe}, {"<", IROp::CmpLt},
+            {"<=", IROp::CmpLe}, {">", IROp::CmpGt}, {">=", IROp::CmpGe},
+        };
+        for (const auto& [text, code] : table) {
+            if (text == op) {
+                out = code;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ValueId visitBinaryExpr(const ASTArena&, const BinaryExpr& bin) {
+        if (bin.op == "and" || bin.op == "&&") return lowerLogical(bin, true);
+        if (bin.op == "or" || bin.op == "||") return lowerLogical(bin, false);
+        IROp op;
+        if (!binaryOp(bin.op, op)) throw std::runtime_error("IR Error: unsupported operator '" + std::string(bin.op) + "'");
+        ValueId left = visit(ast, bin.left);
+        ValueId right = visit(ast, bin.right);
+        return emit(op, isCompare(op) ? IRType::Bool : IRType::I64, left, right);
+    }
+
+    // 0 or 1 for any value.
+    ValueId truth(ValueId v) {
+        if (fn.insts[v].type == IRType::Bool) return v;
+        return emit(IROp::CmpNe, IRType::Bool, v, fn.entryConstant(0));
+    }
+
+    // Short-circuit `and` / `or`: the right side only runs when the left
+    // does not already decide the result, which is 0 or 1.
+    ValueId lowerLogical(const BinaryExpr& bin, bool isAnd) {
+        ValueId left = truth(visit(ast, bin.left));
+        BlockId decided = current, rhs = newBlock(), join = newBlock();
+        if (isAnd) branch(left, rhs, join);
+        else branch(left, join, rhs);
+        seal(rhs);
+        current = rhs;
+        ValueId right = truth(visit(ast, bin.right));
+        BlockId rhsEnd = current;
+        jump(join);
+        seal(join);
+        current = join;
+
+        ValueId phi = newPhi(join);
+        fn.insts[phi].extra = static_cast<uint32_t>(fn.operands.size());
+        fn.insts[phi].count = 2;
+        fn.operands.insert(fn.operands.end(), {fn.entryConstant(isAnd ? 0 : 1), decided, right, rhsEnd});
+        return phi;
+    }
+
+    // A call to a function of this module must pass one argument per
+    // parameter: a missing one would read whatever its register last held,
+    // and the tail call pass rewrites calls into parameter moves.
+    ValueId visitFunctionCall(const ASTArena&, const FunctionCall& call) {
+        ArenaSpan<NodeId> argNodes = ast.children(call.arguments);
+        const uint32_t* params = scope.arity.find(call.name);
+        if (params && *params != argNodes.size()) {
+            throw std::runtime_error("IR Error: '" + std::string(symbolText(call.name)) + "' takes " + std::to_string(*params)
+                                     + " argument(s), called with " + std::to_string(argNodes.size()));
+        }
+        std::vector<uint32_t> args;
+        for (NodeId arg : argNodes) args.push_back(visit(ast, arg));
+        IRInst inst;
+        inst.op = IROp::Call;
+        inst.type = IRType::I64;
+        inst.symbol = call.name;
+        inst.extra = static_cast<uint32_t>(fn.operands.size());
+        inst.count = static_cast<uint32_t>(args.size());
+        fn.operands.insert(fn.operands.end(), args.begin(), args.end());
+        return fn.append(current, inst);
+    }
+
+    ValueId visitTernaryExpr(const ASTArena&, const TernaryExpr& tern) {
+        ValueId cond = visit(ast, tern.condition);
+        BlockId thenBlock = newBlock(), elseBlock = newBlock(), join = newBlock();
+        branch(cond, thenBlock, elseBlock);
+        seal(thenBlock);
+        seal(elseBlock);
+        current = thenBlock;
+        ValueId onTrue = visit(ast, tern.thenExpr);
+        BlockId thenEnd = current;
+        jump(join);
+        current = elseBlock;
+        ValueId onFalse = visit(ast, tern.elseExpr);
+        BlockId elseEnd = current;
+        jump(join);
+        seal(join);
+        current = join;
+
+        ValueId phi = newPhi(join);
+        fn.insts[phi].extra = static_cast<uint32_t>(fn.operands.size());
+        fn.insts[phi].count = 2;
+        fn.operands.insert(fn.operands.end(), {onTrue, thenEnd, onFalse, elseEnd});
+        return phi;
+    }
+
+    ValueId visitNode(const ASTArena&, const ASTNode& node) {
+        throw std::runtime_error(std::string("IR Error: cannot lower ") + nodeKindName(node.kind));
+    }
+
+    // --- cleanup ---
+
+    void finish() {
+        if (!terminated()) {
+            IRInst ret;
+            ret.op = IROp::Return;
+            fn.append(current, ret);
+        }
+        fn.removeUnreachableBlocks();
+        fn.removeTrivialPhis();
+    }
+};
+
+// Lowers a whole module: struct layouts and globals, the entry function,
+// then every function (built in parallel; they share nothing but the
+// read-only module scope).
+inline IRModule buildIRModule(const ASTArena& ast, NodeList statements, TaskScheduler& scheduler) {
+    IRModule module;
+    module.layouts = StructLayouts::compute(ast, statements);
+    module.enums = EnumTable::compute(ast, statements, module.layouts);
+    IRModuleScope scope;
+    scope.layouts = &module.layouts;
+    scope.enums = &module.enums;
+    scope.structVars = IRBuilder::inferStructVars(ast, statements, module.layouts, nullptr);
+    IRBuilder::collectGlobals(ast, statements, scope, module);
+    for (SymbolId g : module.globals) scope.globals.insert(g);
+
+    std::vector<NodeId> functions = functionsOf(ast, statements);
+    for (NodeId f : functions) {
+        const FunctionDef& def = *ast.as<FunctionDef>(f);
+        scope.arity.insert(def.name, static_cast<uint32_t>(ast.names(def.params).size()));
+    }
+    module.functions.resize(functions.size() + 1);
+    module.functions[0] = IRBuilder::buildEntry(ast, statements, scope);
+    scheduler.parallelFor(functions.size(), [&](size_t i) {
+        module.functions[i + 1] = IRBuilder::buildFunction(ast, *ast.as<FunctionDef>(functions[i]), scope);
+    });
+    return module;
+}
+
+//--------------------------------------------------
+// --- IR PASS MANAGER ---
+//--------------------------------------------------
+// Passes run in pipeline order over the whole module. Most passes only look
+// at one function; they override runOnFunction() and the default
+// runOnModule() fans them out over the scheduler, so a function pass may be
+// called concurrently for different functions and must keep no per-run
+// state in the pass object. Passes that look across functions override
+// runOnModule() instead.
+
+// How `select` treats branches it could turn into conditional moves.
+enum class BranchMode : uint8_t {
+    Auto,   // when both arms are side-effect free and cheap
+    Cmov,   // whenever both arms are side-effect free
+    Jump,   // never
+};
+
+// Settings passes take when the pipeline is built.
+struct IRPassOptions {
+    BranchMode branches = BranchMode::Auto;
+    unsigned unroll = 4;    // loop body copies per trip; 1 turns unrolling off
+    unsigned inlineSize = 12;   // largest leaf inlined at every call, in instructions; 0 turns inlining off
+};
+
+class IRPass {
+public:
+    virtual ~IRPass() = default;
+    virtual const char* name() const = 0;
+
+    // Returns whether the function changed.
+    virtual bool runOnFunction(IRFunction&) { return false; }
+
+    virtual bool runOnModule(IRModule& module, TaskScheduler& scheduler) {
+        std::vector<uint8_t> changed(module.functions.size(), 0);
+        scheduler.parallelFor(module.functions.size(), [&](size_t i) {
+            changed[i] = runOnFunction(module.functions[i]) ? 1 : 0;
+        });
+        return std::find(changed.begin(), changed.end(), 1) != changed.end();
+    }
+
+    // What the last run transformed, one line each, for the build log.
+    const std::vector<std::string>& remarks() const { return notes; }
+
+protected:
+    std::vector<std::string> notes;
+};
+
+// Checks the structural invariants every pass relies on; throws on the
+// first violation. Cheap enough to keep in the default pipeline.
+class VerifyPass : public IRPass {
+public:
+    const char* name() const override { return "verify"; }
+
+    bool runOnFunction(IRFunction& fn) override {
+        auto fail = [&](const std::string& what) {
+            throw std::runtime_error("IR Verify Error in '" + std::string(symbolText(fn.name)) + "': " + what);
+        };
+        auto checkValue = [&](ValueId v) {
+            if (v >= fn.insts.size() || fn.insts[v].op == IROp::Nop) fail("operand %" + std::to_string(v) + " is not a live value");
+            if (fn.insts[v].type == IRType::Void) fail("operand %" + std::to_string(v) + " has no value");
+        };
+        if (fn.blocks.empty()) fail("function has no blocks");
+
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            const IRBlock& block = fn.blocks[b];
+            std::string where = "block b" + std::to_string(b);
+            if (!fn.terminator(b)) fail(where + " does not end in a terminator");
+            bool inPhis = true;
+            for (size_t i = 0; i < block.insts.size(); ++i) {
+                ValueId v = block.insts[i];
+                if (v >= fn.insts.size()) fail(where + " lists a missing instruction");
+                const IRInst& inst = fn.insts[v];
+                if (inst.block != b) fail("%" + std::to_string(v) + " is listed in " + where + " but owned by another block");
+                if (inst.op == IROp::Nop) fail(where + " contains a removed instruction");
+                if (inst.op == IROp::Phi) {
+                    if (!inPhis) fail("phi %" + std::to_string(v) + " after a non-phi in " + where);
+                    if (inst.count != block.preds.size()) fail("phi %" + std::to_string(v) + " does not cover every predecessor");
+                    for (uint32_t k = 0; k < inst.count; ++k) {
+                        if (std::find(block.preds.begin(), block.preds.end(), fn.phiBlock(inst, k)) == block.preds.end())
+                            fail("phi %" + std::to_string(v) + " names a non-predecessor");
+                    }
+                } else {
+                    inPhis = false;
+                }
+                if (isTerminator(inst.op) && i + 1 != block.insts.size()) fail(where + " has code after its terminator");
+                if (inst.op == IROp::Switch) {
+                    for (uint32_t k = 1; k < inst.count; ++k) {
+                        if (fn.switchCase(inst, k - 1) >= fn.switchCase(inst, k)) fail("switch in " + where + " has cases out of order");
+                    }
+                }
+                fn.forEachOperand(inst, checkValue);
+            }
+            for (size_t s = 0; s < fn.successorCount(b); ++s) {
+                BlockId succ = fn.successor(b, s);
+                if (succ >= fn.blocks.size()) fail(where + " jumps to a missing block");
+                const std::vector<BlockId>& preds = fn.blocks[succ].preds;
+                if (std::find(preds.begin(), preds.end(), b) == preds.end()) fail(where + " is missing from its successor's predecessors");
+            }
+        }
+        return false;
+    }
+};
+
+// Removes instructions whose values are never used and that have no side
+// effects, working back from stores, calls and terminators.
+class DeadCodePass : public IRPass {
+public:
+    const char* name() const override { return "dce"; }
+
+    bool runOnFunction(IRFunction& fn) override {
+        std::vector<uint8_t> live(fn.insts.size(), 0);
+        std::vector<ValueId> work;
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) {
+                if (hasSideEffects(fn.insts[v].op)) {
+                    live[v] = 1;
+                    work.push_back(v);
+                }
+            }
+        }
+        while (!work.empty()) {
+            ValueId v = work.back();
+            work.pop_back();
+            fn.forEachOperand(fn.insts[v], [&](ValueId operand) {
+                if (!live[operand]) {
+                    live[operand] = 1;
+                    work.push_back(operand);
+                }
+            });
+        }
+
+        bool changed = false;
+        for (IRBlock& block : fn.blocks) {
+            size_t before = block.insts.size();
+            block.insts.erase(std::remove_if(block.insts.begin(), block.insts.end(), [&](ValueId v) {
+                if (live[v]) return false;
+                fn.insts[v].op = IROp::Nop;
+                return true;
+            }), block.insts.end());
+            changed |= block.insts.size() != before;
+        }
+        return changed;
+    }
+};
+
+// Store-to-load forwarding for module variables. Within an extended basic
+// block (a block and its single-predecessor successors) a load of a global
+// returns whatever was last stored to or loaded from it, so `a = 5; b = a;`
+// reads the 5 directly. Calls may write any global and forget everything.
+class LoadForwardPass : public IRPass {
+public:
+    const char* name() const override { return "forward"; }
+
+    bool runOnFunction(IRFunction& fn) override {
+        std::vector<ValueId> replace(fn.insts.size(), NoValue);
+        std::vector<SymbolMap<ValueId>> exitState(fn.blocks.size());
+        std::vector<uint8_t> done(fn.blocks.size(), 0);
+        bool changed = false;
+
+        for (BlockId b : reversePostorder(fn)) {
+            const IRBlock& block = fn.blocks[b];
+            SymbolMap<ValueId> known;
+            if (block.preds.size() == 1 && done[block.preds[0]]) known = exitState[block.preds[0]];
+            for (ValueId v : block.insts) {
+                IRInst& inst = fn.insts[v];
+                if (inst.op == IROp::Load) {
+                    if (const ValueId* value = known.find(inst.symbol)) {
+                        replace[v] = *value;
+                        inst.op = IROp::Nop;
+                        changed = true;
+                    } else {
+                        known[inst.symbol] = v;
+                    }
+                } else if (inst.op == IROp::Store) {
+                    known[inst.symbol] = inst.a;
+                } else if (inst.op == IROp::Call) {
+                    known.clear();
+                }
+            }
+            exitState[b] = std::move(known);
+            done[b] = 1;
+        }
+        if (!changed) return false;
+
+        auto resolve = [&](ValueId v) {
+            while (replace[v] != NoValue) v = replace[v];
+            return v;
+        };
+        for (IRInst& inst : fn.insts) {
+            if (inst.op != IROp::Nop) fn.forEachOperand(inst, [&](ValueId& v) { v = resolve(v); });
+        }
+        for (IRBlock& block : fn.blocks) {
+            block.insts.erase(std::remove_if(block.insts.begin(), block.insts.end(),
+                                             [&](ValueId v) { return fn.insts[v].op == IROp::Nop; }),
+                              block.insts.end());
+        }
+        return true;
+    }
+
+    static std::vector<BlockId> reversePostorder(const IRFunction& fn) {
+        std::vector<BlockId> order;
+        std::vector<uint8_t> seen(fn.blocks.size(), 0);
+        std::vector<std::pair<BlockId, size_t>> stack{{0, 0}};
+        seen[0] = 1;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            if (next < fn.successorCount(b)) {
+                BlockId s = fn.successor(b, next++);
+                if (!seen[s]) {
+                    seen[s] = 1;
+                    stack.emplace_back(s, 0);
+                }
+            } else {
+                order.push_back(b);
+                stack.pop_back();
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        return order;
+    }
+};
+
+// Sparse conditional constant propagation (Wegman & Zadeck). Values start
+// unknown and only move down the lattice unknown -> constant -> varying;
+// only blocks reachable through edges that can actually be taken are
+// evaluated, so a branch (or ternary) on a constant condition makes its
+// other side dead. Constant values are then rewritten into `const`,
+// constant branches into jumps, and dead blocks are dropped.
+class ConstantFoldPass : public IRPass {
+public:
+    const char* name() const override { return "fold"; }
+
+    // Folds one operation over constants; false if it cannot be folded
+    // (division by zero and INT64_MIN / -1 are left to trap at runtime).
+    static bool fold(IROp op, int64_t a, int64_t b, int64_t& out) {
+        auto wrap = [](uint64_t v) { return static_cast<int64_t>(v); };
+        switch (op) {
+            case IROp::Add: out = wrap(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)); return true;
+            case IROp::Sub: out = wrap(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)); return true;
+            case IROp::Mul: out = wrap(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)); return true;
+            case IROp::Div:
+                if (b == 0 || (a == INT64_MIN && b == -1)) return false;
+                out = a / b;
+                return true;
+            case IROp::CmpEq: out = a == b; return true;
+            case IROp::CmpNe: out = a != b; return true;
+            case IROp::CmpLt: out = a < b; return true;
+            case IROp::CmpLe: out = a <= b; return true;
+            case IROp::CmpGt: out = a > b; return true;
+            case IROp::CmpGe: out = a >= b; return true;
+            default: return false;
+        }
+    }
+
+    bool runOnFunction(IRFunction& fn) override {
+        Solver solver(fn);
+        solver.solve();
+        return solver.rewrite();
+    }
+
+private:
+    enum class Lattice : uint8_t { Unknown, Constant, Varying };
+
+    class Solver {
+    public:
+        explicit Solver(IRFunction& fn)
+            : fn(fn), state(fn.insts.size(), Lattice::Unknown), value(fn.insts.size(), 0),
+              users(fn.insts.size()), reached(fn.blocks.size(), 0), edgeTaken(fn.blocks.size()) {
+            for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+                edgeTaken[b].assign(fn.blocks[b].preds.size(), 0);
+                for (ValueId v : fn.blocks[b].insts) {
+                    fn.forEachOperand(fn.insts[v], [&](ValueId operand) { users[operand].push_back(v); });
+                }
+            }
+        }
+
+        void solve() {
+            enterBlock(0);
+            while (!blockWork.empty() || !valueWork.empty()) {
+                while (!valueWork.empty()) {
+                    ValueId v = valueWork.back();
+                    valueWork.pop_back();
+                    for (ValueId user : users[v]) {
+                        if (reached[fn.insts[user].block]) evaluate(user);
+                    }
+                }
+                if (!blockWork.empty()) {
+                    BlockId b = blockWork.back();
+                    blockWork.pop_back();
+                    for (ValueId v : fn.blocks[b].insts) evaluate(v);
+                }
+            }
+        }
+
+        bool rewrite() {
+            bool changed = false;
+            for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+                if (!reached[b]) continue;
+                bool movedPhi = false;
+                for (ValueId v : fn.blocks[b].insts) {
+                    IRInst& inst = fn.insts[v];
+                    if (state[v] != Lattice::Constant || inst.op == IROp::Const) continue;
+                    movedPhi |= inst.op == IROp::Phi;
+                    IRInst constant;
+                    constant.op = IROp::Const;
+                    constant.type = inst.type;
+                    constant.block = inst.block;
+                    constant.imm = value[v];
+                    inst = constant;
+                    changed = true;
+                }
+                if (movedPhi) {
+                    std::vector<ValueId>& body = fn.blocks[b].insts;
+                    std::stable_partition(body.begin(), body.end(), [&](ValueId v) { return fn.insts[v].op == IROp::Phi; });
+                }
+            }
+            for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+                if (!reached[b]) continue;
+                IRInst& term = fn.insts[fn.blocks[b].insts.back()];
+                if (term.op == IROp::Switch && state[term.a] == Lattice::Constant) {
+                    BlockId taken = switchTaken(term, value[term.a]);
+                    for (size_t i = 0; i < fn.successorCount(b); ++i) {
+                        if (fn.successor(b, i) != taken) fn.removeEdge(b, fn.successor(b, i));
+                    }
+                    term.op = IROp::Jump;
+                    term.a = NoValue;
+                    term.count = 0;
+                    term.target[0] = taken;
+                    changed = true;
+                    continue;
+                }
+                if (term.op != IROp::Branch || state[term.a] != Lattice::Constant) continue;
+                BlockId taken = term.target[value[term.a] != 0 ? 0 : 1];
+                BlockId dropped = term.target[value[term.a] != 0 ? 1 : 0];
+                term.op = IROp::Jump;
+                term.a = NoValue;
+                term.target[0] = taken;
+                term.target[1] = NoBlock;
+                if (dropped != taken) fn.removeEdge(b, dropped);
+                changed = true;
+            }
+            if (changed) {
+                fn.removeUnreachableBlocks();
+                fn.removeTrivialPhis();
+                fn.mergeBlocks();
+            }
+            return changed;
+        }
+
+    private:
+        IRFunction& fn;
+        std::vector<Lattice> state;
+        std::vector<int64_t> value;
+        std::vector<std::vector<ValueId>> users;
+        std::vector<uint8_t> reached;
+        std::vector<std::vector<uint8_t>> edgeTaken;   // per block, per predecessor slot
+        std::vector<BlockId> blockWork;
+        std::vector<ValueId> valueWork;
+
+        BlockId switchTaken(const IRInst& sw, int64_t key) const {
+            for (uint32_t i = 0; i < sw.count; ++i) {
+                if (fn.switchCase(sw, i) == key) return fn.switchTarget(sw, i);
+            }
+            return sw.target[0];
+        }
+
+        void enterBlock(BlockId b) {
+            if (reached[b]) return;
+            reached[b] = 1;
+            blockWork.push_back(b);
+        }
+
+        void takeEdge(BlockId from, BlockId to) {
+            const std::vector<BlockId>& preds = fn.blocks[to].preds;
+            bool fresh = false;
+            for (size_t i = 0; i < preds.size(); ++i) {
+                if (preds[i] == from && !edgeTaken[to][i]) {
+                    edgeTaken[to][i] = 1;
+                    fresh = true;
+                }
+            }
+            if (!fresh) return;
+            if (!reached[to]) {
+                enterBlock(to);
+                return;
+            }
+            // A new way into an already-visited block only changes its phis.
+            for (ValueId v : fn.blocks[to].insts) {
+                if (fn.insts[v].op != IROp::Phi) break;
+                evaluate(v);
+            }
+        }
+
+        bool edgeIsTaken(BlockId from, BlockId to) const {
+            const std::vector<BlockId>& preds = fn.blocks[to].preds;
+            for (size_t i = 0; i < preds.size(); ++i) {
+                if (preds[i] == from && edgeTaken[to][i]) return true;
+            }
+            return false;
+        }
+
+        void lower(ValueId v, Lattice to, int64_t constant = 0) {
+            if (state[v] == Lattice::Varying || (state[v] == to && (to != Lattice::Constant || value[v] == constant))) return;
+            if (state[v] == Lattice::Constant && to == Lattice::Constant) to = Lattice::Varying;  // a second constant
+            state[v] = to;
+            value[v] = constant;
+            valueWork.push_back(v);
+        }
+
+        void evaluate(ValueId v) {
+            const IRInst& inst = fn.insts[v];
+            switch (inst.op) {
+                case IROp::Const:
+                    lower(v, Lattice::Constant, inst.imm);
+                    break;
+                case IROp::Param: case IROp::Load: case IROp::Call:
+                    lower(v, Lattice::Varying);
+                    break;
+                case IROp::Phi: {
+                    for (uint32_t i = 0; i < inst.count; ++i) {
+                        if (!edgeIsTaken(fn.phiBlock(inst, i), inst.block)) continue;
+                        ValueId in = fn.phiValue(inst, i);
+                        if (state[in] == Lattice::Unknown) continue;
+                        if (state[in] == Lattice::Varying) return lower(v, Lattice::Varying);
+                        lower(v, Lattice::Constant, value[in]);
+                        if (state[v] == Lattice::Varying) return;
+                    }
+                    break;
+                }
+                case IROp::Select: {
+                    ValueId cond = fn.operands[inst.extra];
+                    if (state[cond] == Lattice::Unknown) return;
+                    if (state[cond] == Lattice::Constant) {
+                        ValueId chosen = fn.operands[inst.extra + (value[cond] != 0 ? 1 : 2)];
+                        if (state[chosen] != Lattice::Unknown) lower(v, state[chosen], value[chosen]);
+                        return;
+                    }
+                    ValueId onTrue = fn.operands[inst.extra + 1], onFalse = fn.operands[inst.extra + 2];
+                    if (state[onTrue] == Lattice::Varying || state[onFalse] == Lattice::Varying) return lower(v, Lattice::Varying);
+                    if (state[onTrue] == Lattice::Unknown || state[onFalse] == Lattice::Unknown) return;
+                    if (value[onTrue] == value[onFalse]) lower(v, Lattice::Constant, value[onTrue]);
+                    else lower(v, Lattice::Varying);
+                    break;
+                }
+                case IROp::Jump:
+                    takeEdge(inst.block, inst.target[0]);
+                    break;
+                case IROp::Branch:
+                    if (state[inst.a] == Lattice::Constant) {
+                        takeEdge(inst.block, inst.target[value[inst.a] != 0 ? 0 : 1]);
+                    } else if (state[inst.a] == Lattice::Varying) {
+                        takeEdge(inst.block, inst.target[0]);
+                        takeEdge(inst.block, inst.target[1]);
+                    }
+                    break;
+                case IROp::Switch:
+                    if (state[inst.a] == Lattice::Constant) {
+                        takeEdge(inst.block, switchTaken(inst, value[inst.a]));
+                    } else if (state[inst.a] == Lattice::Varying) {
+                        for (size_t i = 0; i < fn.successorCount(inst.block); ++i) takeEdge(inst.block, fn.successor(inst.block, i));
+                    }
+                    break;
+                case IROp::Store: case IROp::Return: case IROp::TailCall: case IROp::Nop:
+                    break;
+                default: {
+                    if (state[inst.a] == Lattice::Varying || state[inst.b] == Lattice::Varying) return lower(v, Lattice::Varying);
+                    if (state[inst.a] == Lattice::Unknown || state[inst.b] == Lattice::Unknown) return;
+                    int64_t result;
+                    if (fold(inst.op, value[inst.a], value[inst.b], result)) lower(v, Lattice::Constant, result);
+                    else lower(v, Lattice::Varying);
+                    break;
+                }
+            }
+        }
+    };
+};
+
+// Dead-store elimination for module variables. A global is live at a point
+// if some path from it loads the global before storing it again; calls make
+// live whatever the callee (or anything it calls) may load. The program
+// exits from the entry function, so nothing is live there; any other return
+// leaves every global the module reads live for its callers. Stores to
+// non-live globals are removed, and globals no code touches any more are
+// dropped from the module so they get no `.data` slot.
+class DeadStorePass : public IRPass {
+public:
+    const char* name() const override { return "dse"; }
+
+    bool runOnModule(IRModule& module, TaskScheduler& scheduler) override {
+        SymbolMap<uint32_t> slot;
+        for (uint32_t i = 0; i < module.globals.size(); ++i) slot.insert(module.globals[i], i);
+        Summary summary = summarize(module, slot);
+
+        std::vector<uint8_t> changed(module.functions.size(), 0);
+        scheduler.parallelFor(module.functions.size(), [&](size_t i) {
+            changed[i] = removeDeadStores(module.functions[i], slot, summary) ? 1 : 0;
+        });
+
+        std::vector<uint8_t> used(module.globals.size(), 0);
+        for (const IRFunction& fn : module.functions) {
+            for (const IRBlock& block : fn.blocks) {
+                for (ValueId v : block.insts) {
+                    const IRInst& inst = fn.insts[v];
+                    if (inst.op == IROp::Load || inst.op == IROp::Store) used[*slot.find(inst.symbol)] = 1;
+                }
+            }
+        }
+        size_t before = module.globals.size();
+        std::vector<SymbolId> kept;
+        for (uint32_t i = 0; i < module.globals.size(); ++i) {
+            if (used[i]) kept.push_back(module.globals[i]);
+        }
+        module.globals = std::move(kept);
+        return module.globals.size() != before || std::find(changed.begin(), changed.end(), 1) != changed.end();
+    }
+
+private:
+    using GlobalSet = std::vector<uint8_t>;  // indexed by position in IRModule::globals
+
+    struct Summary {
+        SymbolMap<size_t> functionIndex;
+        std::vector<GlobalSet> mayRead;  // per function, including its callees
+        GlobalSet anyRead;               // everything the module ever loads
+    };
+
+    static void unite(GlobalSet& into, const GlobalSet& from) {
+        for (size_t i = 0; i < into.size(); ++i) into[i] |= from[i];
+    }
+
+    // Functions reused from the compile cache are summarized from their
+    // cached IR after the module's own, under the positions that follow.
+    static Summary summarize(const IRModule& module, const SymbolMap<uint32_t>& slot) {
+        Summary summary;
+        const std::vector<const IRFunction*>& reused = module.reused.bodies;
+        size_t count = module.functions.size() + reused.size();
+        auto body = [&](size_t f) -> const IRFunction& {
+            return f < module.functions.size() ? module.functions[f] : *reused[f - module.functions.size()];
+        };
+        summary.anyRead.assign(module.globals.size(), 0);
+        summary.mayRead.assign(count, summary.anyRead);
+        for (size_t f = 0; f < count; ++f) summary.functionIndex.insert(body(f).name, f);
+
+        std::vector<std::vector<size_t>> callees(count);
+        for (size_t f = 0; f < count; ++f) {
+            const IRFunction& fn = body(f);
+            for (const IRBlock& block : fn.blocks) {
+                for (ValueId v : block.insts) {
+                    const IRInst& inst = fn.insts[v];
+                    if (inst.op == IROp::Load) {
+                        // A global only reused code touches may be gone from the module already.
+                        if (const uint32_t* g = slot.find(inst.symbol)) summary.mayRead[f][*g] = 1;
+                    } else if (inst.op == IROp::Call || inst.op == IROp::TailCall) {
+                        if (const size_t* callee = summary.functionIndex.find(inst.symbol)) callees[f].push_back(*callee);
+                    }
+                }
+            }
+            unite(summary.anyRead, summary.mayRead[f]);
+        }
+        for (size_t g = 0; g < module.globals.size(); ++g) summary.anyRead[g] |= module.reused.loads.contains(module.globals[g]);
+        // Propagate through the call graph until nothing grows; recursion
+        // just takes another round.
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (size_t f = 0; f < count; ++f) {
+                for (size_t callee : callees[f]) {
+                    GlobalSet before = summary.mayRead[f];
+                    unite(summary.mayRead[f], summary.mayRead[callee]);
+                    grew |= summary.mayRead[f] != before;
+                }
+            }
+        }
+        return summary;
+    }
+
+    // Steps `live` backwards over one instruction. Returns false for a store
+    // to a global that is not live, which the caller removes.
+    static bool transfer(const IRInst& inst, GlobalSet& live, const SymbolMap<uint32_t>& slot, const Summary& summary,
+                         bool isEntry) {
+        switch (inst.op) {
+            case IROp::Load: live[*slot.find(inst.symbol)] = 1; return true;
+            case IROp::Store: {
+                uint32_t g = *slot.find(inst.symbol);
+                if (!live[g]) return false;
+                live[g] = 0;
+                return true;
+            }
+            case IROp::Call: {
+                const size_t* callee = summary.functionIndex.find(inst.symbol);
+                unite(live, callee ? summary.mayRead[*callee] : summary.anyRead);
+                return true;
+            }
+            case IROp::Return:
+            case IROp::TailCall:   // the callee returns to our caller, which may read anything
+                if (isEntry) std::fill(live.begin(), live.end(), 0);
+                else live = summary.anyRead;
+                return true;
+            default: return true;
+        }
+    }
+
+    static bool removeDeadStores(IRFunction& fn, const SymbolMap<uint32_t>& slot, const Summary& summary) {
+        size_t globalCount = summary.anyRead.size();
+        std::vector<GlobalSet> liveIn(fn.blocks.size(), GlobalSet(globalCount, 0));
+        std::vector<BlockId> order = LoadForwardPass::reversePostorder(fn);
+        std::reverse(order.begin(), order.end());
+
+        auto liveOut = [&](BlockId b) {
+            GlobalSet live(globalCount, 0);
+            for (size_t i = 0; i < fn.successorCount(b); ++i) unite(live, liveIn[fn.successor(b, i)]);
+            return live;
+        };
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (BlockId b : order) {
+                GlobalSet live = liveOut(b);
+                const std::vector<ValueId>& insts = fn.blocks[b].insts;
+                for (auto it = insts.rbegin(); it != insts.rend(); ++it) transfer(fn.insts[*it], live, slot, summary, fn.isEntry);
+                if (live != liveIn[b]) {
+                    liveIn[b] = std::move(live);
+                    grew = true;
+                }
+            }
+        }
+
+        bool changed = false;
+        for (BlockId b : order) {
+            GlobalSet live = liveOut(b);
+            std::vector<ValueId>& insts = fn.blocks[b].insts;
+            for (auto it = insts.rbegin(); it != insts.rend(); ++it) {
+                if (!transfer(fn.insts[*it], live, slot, summary, fn.isEntry)) {
+                    fn.insts[*it].op = IROp::Nop;
+                    changed = true;
+                }
+            }
+            insts.erase(std::remove_if(insts.begin(), insts.end(), [&](ValueId v) { return fn.insts[v].op == IROp::Nop; }),
+                        insts.end());
+        }
+        return changed;
+    }
+};
+
+// Tail calls. A `ret` of a phi is first copied into each predecessor that
+// jumps straight to it with a call made right before the jump, so calls in
+// the arms of a returned ternary or if/else end their own paths. A call
+// followed directly by a return of its result then becomes a `tailcall`
+// terminator: self-recursion turns into a loop through a new header block
+// whose phis take the arguments, and any other tail call is lowered to a
+// jump that reuses the frame. Calls needing more stack arguments than the
+// caller itself received stay ordinary calls, as does everything in the
+// entry function, which has no caller to return to.
+class TailCallPass : public IRPass {
+public:
+    const char* name() const override { return "tailcall"; }
+
+    bool runOnModule(IRModule& module, TaskScheduler& scheduler) override {
+        std::vector<std::vector<std::string>> found(module.functions.size());
+        std::vector<uint8_t> changed(module.functions.size(), 0);
+        scheduler.parallelFor(module.functions.size(), [&](size_t i) {
+            changed[i] = transform(module.functions[i], found[i]) ? 1 : 0;
+        });
+        notes.clear();
+        for (std::vector<std::string>& lines : found) {
+            for (std::string& line : lines) notes.push_back(std::move(line));
+        }
+        return std::find(changed.begin(), changed.end(), 1) != changed.end();
+    }
+
+private:
+    static bool transform(IRFunction& fn, std::vector<std::string>& remarks) {
+        if (fn.isEntry) return false;
+        bool changed = duplicateReturns(fn);
+        size_t ownStackArgs = fn.params.size() > 6 ? fn.params.size() - 6 : 0;
+        std::vector<BlockId> selfCalls;
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            std::vector<ValueId>& insts = fn.blocks[b].insts;
+            if (insts.size() < 2) continue;
+            ValueId callId = insts[insts.size() - 2];
+            IRInst& ret = fn.insts[insts.back()];
+            IRInst& call = fn.insts[callId];
+            if (ret.op != IROp::Return || ret.a != callId || call.op != IROp::Call) continue;
+            bool self = call.symbol == fn.name && call.count == fn.params.size();
+            if (!self && call.count > 6 && call.count - 6 > ownStackArgs) continue;
+
+            ret.op = IROp::Nop;
+            insts.pop_back();
+            call.op = IROp::TailCall;
+            call.type = IRType::Void;
+            if (self) selfCalls.push_back(b);
+            remarks.push_back(std::string(symbolText(fn.name)) + " -> " + std::string(symbolText(call.symbol)) +
+                              (self ? ": loop" : ": jump"));
+            changed = true;
+        }
+        if (!selfCalls.empty()) loopify(fn, selfCalls);
+        return changed;
+    }
+
+    static bool onlyPhisBefore(const IRFunction& fn, BlockId b) {
+        const std::vector<ValueId>& insts = fn.blocks[b].insts;
+        for (size_t i = 0; i + 1 < insts.size(); ++i) {
+            if (fn.insts[insts[i]].op != IROp::Phi) return false;
+        }
+        return true;
+    }
+
+    static bool duplicateReturns(IRFunction& fn) {
+        bool changed = false;
+        for (bool again = true; again;) {
+            again = false;
+            for (BlockId m = 0; m < fn.blocks.size(); ++m) {
+                if (fn.blocks[m].insts.empty() || !onlyPhisBefore(fn, m)) continue;
+                ValueId phi = fn.insts[fn.blocks[m].insts.back()].op == IROp::Return ? fn.insts[fn.blocks[m].insts.back()].a : NoValue;
+                if (phi == NoValue || fn.insts[phi].op != IROp::Phi || fn.insts[phi].block != m) continue;
+
+                std::vector<BlockId> preds = fn.blocks[m].preds;
+                for (BlockId p : preds) {
+                    const std::vector<ValueId>& from = fn.blocks[p].insts;
+                    if (fn.insts[from.back()].op != IROp::Jump) continue;
+                    ValueId incoming = NoValue;
+                    for (uint32_t i = 0; i < fn.insts[phi].count; ++i) {
+                        if (fn.phiBlock(fn.insts[phi], i) == p) incoming = fn.phiValue(fn.insts[phi], i);
+                    }
+                    const IRInst& in = fn.insts[incoming];
+                    bool callFirst = in.op == IROp::Call && from.size() >= 2 && from[from.size() - 2] == incoming;
+                    bool mergesAgain = in.op == IROp::Phi && in.block == p && onlyPhisBefore(fn, p);
+                    if (!callFirst && !mergesAgain) continue;
+
+                    fn.removeEdge(p, m);
+                    IRInst& jump = fn.insts[from.back()];
+                    jump.op = IROp::Return;
+                    jump.a = incoming;
+                    jump.target[0] = NoBlock;
+                    changed = again = true;
+                }
+            }
+            if (again) {
+                fn.removeUnreachableBlocks();
+                fn.removeTrivialPhis();
+            }
+        }
+        return changed;
+    }
+
+    // Everything the entry block did except reading the params moves to a
+    // new header, placed as block 1; the entry jumps there, and so does each
+    // self tail call, with a phi per param merging its arguments. A tail
+    // call in the entry block moves with the rest of it, so its back edge
+    // leaves from the header itself.
+    static void loopify(IRFunction& fn, const std::vector<BlockId>& tails) {
+        BlockId header = fn.addBlock();
+        for (size_t i = 0; i < fn.successorCount(0); ++i) {
+            BlockId succ = fn.successor(0, i);
+            for (BlockId& p : fn.blocks[succ].preds) {
+                if (p == 0) p = header;
+            }
+            for (ValueId v : fn.blocks[succ].insts) {
+                IRInst& phi = fn.insts[v];
+                if (phi.op != IROp::Phi) break;
+                for (uint32_t k = 0; k < phi.count; ++k) {
+                    if (fn.operands[phi.extra + 2 * k + 1] == 0) fn.operands[phi.extra + 2 * k + 1] = header;
+                }
+            }
+        }
+
+        std::vector<ValueId> params, body;
+        for (ValueId v : fn.blocks[0].insts) (fn.insts[v].op == IROp::Param ? params : body).push_back(v);
+        std::vector<ValueId> headerInsts;
+        for (ValueId param : params) {
+            IRInst phi;
+            phi.op = IROp::Phi;
+            phi.type = IRType::I64;
+            phi.block = header;
+            phi.extra = static_cast<uint32_t>(fn.operands.size());
+            phi.count = static_cast<uint32_t>(1 + tails.size());
+            fn.operands.push_back(param);
+            fn.operands.push_back(0);
+            for (BlockId t : tails) {
+                fn.operands.push_back(fn.callArg(fn.insts[fn.blocks[t].insts.back()], static_cast<size_t>(fn.insts[param].imm)));
+                fn.operands.push_back(t == 0 ? header : t);
+            }
+            fn.insts.push_back(phi);
+            headerInsts.push_back(static_cast<ValueId>(fn.insts.size() - 1));
+        }
+        for (ValueId v : body) {
+            fn.insts[v].block = header;
+            headerInsts.push_back(v);
+        }
+        fn.blocks[header].insts = std::move(headerInsts);
+        fn.blocks[header].preds.push_back(0);
+        for (BlockId t : tails) {
+            IRInst& call = fn.insts[fn.blocks[t].insts.back()];
+            call.op = IROp::Jump;
+            call.count = 0;
+            call.target[0] = header;
+            fn.blocks[header].preds.push_back(t == 0 ? header : t);
+        }
+        fn.blocks[0].insts = params;
+        IRInst jump;
+        jump.op = IROp::Jump;
+        jump.target[0] = header;
+        fn.append(0, jump);
+
+        // Every use of a param now reads its phi, except the phi's own entry incoming.
+        std::vector<ValueId> replacement(fn.insts.size(), NoValue);
+        for (size_t i = 0; i < params.size(); ++i) replacement[params[i]] = fn.blocks[header].insts[i];
+        for (IRInst& inst : fn.insts) {
+            if (inst.op == IROp::Nop) continue;
+            fn.forEachOperand(inst, [&](ValueId& v) {
+                if (replacement[v] != NoValue) v = replacement[v];
+            });
+        }
+        for (size_t i = 0; i < params.size(); ++i) fn.operands[fn.insts[fn.blocks[header].insts[i]].extra] = params[i];
+
+        std::vector<BlockId> remap(fn.blocks.size());
+        for (BlockId b = 0; b < header; ++b) remap[b] = b == 0 ? 0 : b + 1;
+        remap[header] = 1;
+        fn.renumberBlocks(remap);
+        fn.removeTrivialPhis();
+    }
+};
+
+// If-conversion. A branch whose arms only compute values before meeting
+// again (a ternary, a short-circuit `and`/`or`, an if/else that only
+// assigns) becomes straight-line code: the arms are hoisted above the
+// branch and each phi where they meet becomes a `select`, which the backend
+// lowers to cmov or setcc. Arms that store, call or divide (division can
+// trap) keep their branch. In auto mode the arms plus one move per phi must
+// also fit MaxCost, counting a multiply as 3 and a load as 2; `cmov` mode
+// drops that limit and `jump` mode turns the pass off.
+class SelectPass : public IRPass {
+public:
+    static constexpr int MaxCost = 6;
+
+    explicit SelectPass(const IRPassOptions& options) : mode(options.branches) {}
+
+    const char* name() const override { return "select"; }
+
+    bool runOnFunction(IRFunction& fn) override {
+        if (mode == BranchMode::Jump) return false;
+        bool changed = false;
+        for (bool again = true; again;) {
+            again = false;
+            for (BlockId b = 0; b < fn.blocks.size(); ++b) again |= convert(fn, b);
+            if (again) {
+                fn.removeUnreachableBlocks();
+                fn.removeTrivialPhis();
+                fn.mergeBlocks();   // lets an enclosing ternary see a straight arm
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+private:
+    BranchMode mode;
+
+    // Whether block b's code (all but its jump) can run unconditionally;
+    // adds its cost.
+    static bool speculatable(const IRFunction& fn, BlockId b, int& cost) {
+        const std::vector<ValueId>& insts = fn.blocks[b].insts;
+        int total = 0;
+        for (size_t i = 0; i + 1 < insts.size(); ++i) {
+            switch (fn.insts[insts[i]].op) {
+                case IROp::Const: break;
+                case IROp::Add: case IROp::Sub: case IROp::Select:
+                case IROp::CmpEq: case IROp::CmpNe: case IROp::CmpLt:
+                case IROp::CmpLe: case IROp::CmpGt: case IROp::CmpGe:
+                    total += 1;
+                    break;
+                case IROp::Load: total += 2; break;
+                case IROp::Mul: total += 3; break;
+                default: return false;
+            }
+        }
+        cost += total;
+        return true;
+    }
+
+    bool convert(IRFunction& fn, BlockId head) const {
+        const IRInst* term = fn.terminator(head);
+        if (!term || term->op != IROp::Branch) return false;
+        ValueId cond = term->a;
+        BlockId targets[2] = {term->target[0], term->target[1]};
+
+        // Each side either runs an arm block that jumps on to the join, or
+        // goes to the join directly.
+        BlockId join = NoBlock, from[2];
+        bool hoist[2];
+        int cost = 0;
+        for (int side = 0; side < 2; ++side) {
+            BlockId target = targets[side];
+            const IRInst* armEnd = fn.terminator(target);
+            hoist[side] = target != head && fn.blocks[target].preds.size() == 1 && armEnd && armEnd->op == IROp::Jump &&
+                          speculatable(fn, target, cost);
+            from[side] = hoist[side] ? target : head;
+            if (hoist[side]) target = armEnd->target[0];
+            if (side == 0) join = target;
+            else if (target != join) return false;
+        }
+        if ((!hoist[0] && !hoist[1]) || join == head || join == from[0] || join == from[1]) return false;
+
+        std::vector<ValueId> phis;
+        std::vector<std::pair<ValueId, ValueId>> picks;   // per phi: (if true, if false)
+        for (ValueId v : fn.blocks[join].insts) {
+            const IRInst& phi = fn.insts[v];
+            if (phi.op != IROp::Phi) break;
+            ValueId in[2] = {NoValue, NoValue};
+            for (uint32_t i = 0; i < phi.count; ++i) {
+                for (int side = 0; side < 2; ++side) {
+                    if (fn.phiBlock(phi, i) == from[side]) in[side] = fn.phiValue(phi, i);
+                }
+            }
+            phis.push_back(v);
+            picks.emplace_back(in[0], in[1]);
+        }
+        if (mode == BranchMode::Auto && cost + static_cast<int>(phis.size()) > MaxCost) return false;
+
+        // Hoist the arms above the branch, then move a compare feeding the
+        // condition down to the selects so it can stay in the flags.
+        std::vector<ValueId>& body = fn.blocks[head].insts;
+        ValueId branchId = body.back();
+        body.pop_back();
+        for (int side = 0; side < 2; ++side) {
+            if (!hoist[side]) continue;
+            std::vector<ValueId>& arm = fn.blocks[from[side]].insts;
+            fn.insts[arm.back()].op = IROp::Nop;
+            arm.pop_back();
+            for (ValueId v : arm) {
+                fn.insts[v].block = head;
+                body.push_back(v);
+            }
+            arm.clear();
+            fn.blocks[from[side]].preds.clear();
+        }
+        auto condAt = std::find(body.begin(), body.end(), cond);
+        if (condAt != body.end() && isCompare(fn.insts[cond].op)) {
+            body.erase(condAt);
+            body.push_back(cond);
+        }
+
+        for (int side = 0; side < 2; ++side) fn.removeEdge(from[side], join);
+        for (size_t i = 0; i < phis.size(); ++i) {
+            auto [onTrue, onFalse] = picks[i];
+            ValueId picked = onTrue;
+            if (onTrue != onFalse) {
+                IRInst select;
+                select.op = IROp::Select;
+                select.type = fn.insts[phis[i]].type;
+                select.extra = static_cast<uint32_t>(fn.operands.size());
+                select.count = 3;
+                fn.operands.insert(fn.operands.end(), {cond, onTrue, onFalse});
+                picked = fn.append(head, select);
+            }
+            IRInst& phi = fn.insts[phis[i]];   // room left by the two incomings just removed
+            fn.operands[phi.extra + 2 * phi.count] = picked;
+            fn.operands[phi.extra + 2 * phi.count + 1] = head;
+            phi.count++;
+        }
+        fn.blocks[join].preds.push_back(head);
+
+        IRInst& jump = fn.insts[branchId];
+        jump.op = IROp::Jump;
+        jump.a = NoValue;
+        jump.target[0] = join;
+        jump.target[1] = NoBlock;
+        fn.blocks[head].insts.push_back(branchId);
+        return true;
+    }
+};
+
+// Loop optimizations over natural loops (a back edge is an edge to a block
+// that dominates its source), innermost first:
+//   - invariant code motion: arithmetic whose operands all come from
+//     outside the loop moves to the preheader, as do loads of globals the
+//     loop neither stores nor can reach through a call. Compares stay next
+//     to the branch or select reading them, which fuses them into flags.
+//   - strength reduction: `i * k` for an induction variable i (a header phi
+//     stepped by a constant) and an invariant k becomes an induction
+//     variable of its own, stepped by an add of `step * k`.
+//   - unrolling of innermost loops that only leave through their header
+//     test: a constant trip count up to MaxFullTrips is unrolled completely
+//     while that stays within FullBudget instructions; otherwise the body
+//     runs `unroll` times per trip (--unroll), dropping the copies' exit
+//     tests when the trip count is a known multiple of the factor.
+// Loops without a preheader (one outside predecessor that only jumps to the
+// header) are left alone; the IR builder always makes one.
+class LoopPass : public IRPass {
+public:
+    static constexpr int64_t MaxFullTrips = 16;
+    static constexpr size_t FullBudget = 128;      // instructions after a full unroll
+    static constexpr size_t PartialBudget = 64;    // instructions after a partial unroll
+    static constexpr int64_t MaxSimulatedTrips = 1 << 16;
+
+    struct Loop {
+        BlockId header = NoBlock;
+        BlockId preheader = NoBlock;
+        std::vector<BlockId> latches;
+        std::vector<BlockId> blocks;       // header first, then index order
+        std::vector<uint8_t> contains;     // by block, as of when the loop was found
+
+        bool has(BlockId b) const { return b < contains.size() && contains[b]; }
+    };
+
+    explicit LoopPass(const IRPassOptions& options) : factor(options.unroll) {}
+
+    const char* name() const override { return "loop"; }
+
+    bool runOnModule(IRModule& module, TaskScheduler& scheduler) override {
+        std::vector<std::vector<std::string>> found(module.functions.size());
+        std::vector<uint8_t> changed(module.functions.size(), 0);
+        scheduler.parallelFor(module.functions.size(), [&](size_t i) {
+            changed[i] = transform(module.functions[i], found[i]) ? 1 : 0;
+        });
+        notes.clear();
+        for (std::vector<std::string>& lines : found) {
+            for (std::string& line : lines) notes.push_back(std::move(line));
+        }
+        return std::find(changed.begin(), changed.end(), 1) != changed.end();
+    }
+
+    // Immediate dominator of every block (Cooper, Harvey & Kennedy); the
+    // entry is its own, unreachable blocks get NoBlock.
+    static std::vector<BlockId> dominators(const IRFunction& fn) {
+        std::vector<BlockId> order = LoadForwardPass::reversePostorder(fn);
+        std::vector<uint32_t> rank(fn.blocks.size(), UINT32_MAX);
+        for (size_t i = 0; i < order.size(); ++i) rank[order[i]] = static_cast<uint32_t>(i);
+        std::vector<BlockId> idom(fn.blocks.size(), NoBlock);
+        idom[0] = 0;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (BlockId b : order) {
+                if (b == 0) continue;
+                BlockId best = NoBlock;
+                for (BlockId p : fn.blocks[b].preds) {
+                    if (idom[p] == NoBlock) continue;
+                    if (best == NoBlock) {
+                        best = p;
+                        continue;
+                    }
+                    BlockId x = p, y = best;
+                    while (x != y) {
+                        while (rank[x] > rank[y]) x = idom[x];
+                        while (rank[y] > rank[x]) y = idom[y];
+                    }
+                    best = x;
+                }
+                if (idom[b] != best) {
+                    idom[b] = best;
+                    changed = true;
+                }
+            }
+        }
+        return idom;
+    }
+
+    static bool dominates(const std::vector<BlockId>& idom, BlockId a, BlockId b) {
+        if (idom[b] == NoBlock) return false;
+        while (b != a && b != 0) b = idom[b];
+        return b == a;
+    }
+
+    // Every natural loop, one per header, smallest (innermost) first.
+    static std::vector<Loop> findLoops(const IRFunction& fn) {
+        std::vector<BlockId> idom = dominators(fn);
+        std::vector<Loop> loops;
+        std::vector<uint32_t> loopOf(fn.blocks.size(), UINT32_MAX);
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            if (idom[b] == NoBlock) continue;
+            for (size_t i = 0; i < fn.successorCount(b); ++i) {
+                BlockId h = fn.successor(b, i);
+                if (!dominates(idom, h, b)) continue;
+                if (loopOf[h] == UINT32_MAX) {
+                    loopOf[h] = static_cast<uint32_t>(loops.size());
+                    loops.emplace_back();
+                    loops.back().header = h;
+                }
+                loops[loopOf[h]].latches.push_back(b);
+            }
+        }
+
+        for (Loop& loop : loops) {
+            loop.contains.assign(fn.blocks.size(), 0);
+            loop.contains[loop.header] = 1;
+            std::vector<BlockId> work = loop.latches;
+            while (!work.empty()) {
+                BlockId b = work.back();
+                work.pop_back();
+                if (loop.contains[b]) continue;
+                loop.contains[b] = 1;
+                for (BlockId p : fn.blocks[b].preds) work.push_back(p);
+            }
+            loop.blocks.push_back(loop.header);
+            for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+                if (loop.contains[b] && b != loop.header) loop.blocks.push_back(b);
+            }
+            BlockId outside = NoBlock;
+            size_t entries = 0;
+            for (BlockId p : fn.blocks[loop.header].preds) {
+                if (!loop.contains[p]) {
+                    outside = p;
+                    entries++;
+                }
+            }
+            if (entries == 1 && fn.successorCount(outside) == 1) loop.preheader = outside;
+        }
+        std::stable_sort(loops.begin(), loops.end(), [](const Loop& x, const Loop& y) { return x.blocks.size() < y.blocks.size(); });
+        return loops;
+    }
+
+private:
+    unsigned factor;
+
+    struct Induction {
+        ValueId phi;
+        ValueId init;      // incoming from the preheader
+        int64_t step;      // added on the way round the latch
+    };
+
+    bool transform(IRFunction& fn, std::vector<std::string>& remarks) const {
+        std::vector<Loop> loops = findLoops(fn);
+        if (loops.empty()) return false;
+        std::vector<std::string> summary(loops.size());
+        bool changed = false;
+        for (size_t i = 0; i < loops.size(); ++i) {
+            size_t hoisted = hoistInvariants(fn, loops[i]);
+            size_t reduced = reduceStrength(fn, loops[i]);
+            if (hoisted) summary[i] += ", hoisted " + std::to_string(hoisted);
+            if (reduced) summary[i] += ", reduced " + std::to_string(reduced);
+            changed |= hoisted || reduced;
+        }
+
+        // Unrolling appends blocks; each loop's copies are laid out after
+        // its last block once every loop is done.
+        size_t originalBlocks = fn.blocks.size();
+        std::vector<std::vector<BlockId>> placedAfter(originalBlocks);
+        for (size_t i = 0; i < loops.size(); ++i) {
+            const Loop& loop = loops[i];
+            bool innermost = std::none_of(loops.begin(), loops.end(), [&](const Loop& other) {
+                return other.header != loop.header && loop.has(other.header);
+            });
+            if (!innermost) continue;
+            std::vector<BlockId> clones;
+            bool full = false;
+            size_t times = unroll(fn, loop, clones, full);
+            if (!times) continue;
+            summary[i] += full ? ", unrolled fully (" + std::to_string(times) + " trips)" : ", unrolled x" + std::to_string(times);
+            BlockId last = loop.blocks.size() > 1 ? loop.blocks.back() : loop.header;
+            placedAfter[std::max(last, loop.header)] = std::move(clones);
+            changed = true;
+        }
+        for (size_t i = 0; i < loops.size(); ++i) {
+            if (!summary[i].empty()) remarks.push_back(std::string(symbolText(fn.name)) + " b" + std::to_string(loops[i].header) + ":" + summary[i].substr(1));
+        }
+        if (fn.blocks.size() == originalBlocks) return changed;
+
+        std::vector<BlockId> remap(fn.blocks.size(), NoBlock);
+        BlockId next = 0;
+        for (BlockId b = 0; b < originalBlocks; ++b) {
+            remap[b] = next++;
+            for (BlockId clone : placedAfter[b]) remap[clone] = next++;
+        }
+        fn.renumberBlocks(remap);
+        fn.mergeBlocks();
+        fn.removeTrivialPhis();
+        return true;
+    }
+
+    static size_t hoistInvariants(IRFunction& fn, const Loop& loop) {
+        if (loop.preheader == NoBlock) return 0;
+        bool calls = false;
+        SymbolSet stored;
+        for (BlockId b : loop.blocks) {
+            for (ValueId v : fn.blocks[b].insts) {
+                const IRInst& inst = fn.insts[v];
+                if (inst.op == IROp::Call) calls = true;
+                if (inst.op == IROp::Store) stored.insert(inst.symbol);
+            }
+        }
+        auto movable = [&](const IRInst& inst) {
+            switch (inst.op) {
+                case IROp::Const: case IROp::Add: case IROp::Sub: case IROp::Mul: case IROp::Select:
+                    return true;
+                case IROp::Div: {
+                    const IRInst& divisor = fn.insts[inst.b];
+                    return divisor.op == IROp::Const && divisor.imm != 0 && divisor.imm != -1;
+                }
+                case IROp::Load: return !calls && !stored.contains(inst.symbol);
+                default: return false;
+            }
+        };
+
+        size_t hoisted = 0;
+        for (bool again = true; again;) {
+            again = false;
+            for (BlockId b : loop.blocks) {
+                std::vector<ValueId>& insts = fn.blocks[b].insts;
+                for (size_t i = 0; i < insts.size();) {
+                    IRInst& inst = fn.insts[insts[i]];
+                    bool invariant = movable(inst);
+                    fn.forEachOperand(inst, [&](ValueId operand) { invariant &= !loop.has(fn.insts[operand].block); });
+                    if (!invariant) {
+                        ++i;
+                        continue;
+                    }
+                    inst.block = loop.preheader;
+                    std::vector<ValueId>& pre = fn.blocks[loop.preheader].insts;
+                    pre.insert(pre.end() - 1, insts[i]);
+                    insts.erase(insts.begin() + static_cast<std::ptrdiff_t>(i));
+                    hoisted++;
+                    again = true;
+                }
+            }
+        }
+        return hoisted;
+    }
+
+    static std::vector<Induction> inductionVariables(const IRFunction& fn, const Loop& loop) {
+        std::vector<Induction> found;
+        if (loop.preheader == NoBlock || loop.latches.size() != 1) return found;
+        auto constant = [&](ValueId v) { return fn.insts[v].op == IROp::Const; };
+        for (ValueId v : fn.blocks[loop.header].insts) {
+            const IRInst& phi = fn.insts[v];
+            if (phi.op != IROp::Phi) break;
+            if (phi.count != 2) continue;
+            ValueId init = NoValue, next = NoValue;
+            for (uint32_t i = 0; i < phi.count; ++i) {
+                (fn.phiBlock(phi, i) == loop.preheader ? init : next) = fn.phiValue(phi, i);
+            }
+            if (init == NoValue || next == NoValue) continue;
+            const IRInst& step = fn.insts[next];
+            if (step.op == IROp::Add && step.a == v && constant(step.b)) {
+                found.push_back({v, init, fn.insts[step.b].imm});
+            } else if (step.op == IROp::Add && step.b == v && constant(step.a)) {
+                found.push_back({v, init, fn.insts[step.a].imm});
+            } else if (step.op == IROp::Sub && step.a == v && constant(step.b)) {
+                found.push_back({v, init, static_cast<int64_t>(0 - static_cast<uint64_t>(fn.insts[step.b].imm))});
+            }
+        }
+        return found;
+    }
+
+    static size_t reduceStrength(IRFunction& fn, const Loop& loop) {
+        std::vector<Induction> ivs = inductionVariables(fn, loop);
+        if (ivs.empty()) return 0;
+        std::vector<std::pair<ValueId, std::pair<size_t, ValueId>>> products;   // mul -> (induction, factor)
+        for (BlockId b : loop.blocks) {
+            for (ValueId v : fn.blocks[b].insts) {
+                const IRInst& mul = fn.insts[v];
+                if (mul.op != IROp::Mul) continue;
+                for (size_t i = 0; i < ivs.size(); ++i) {
+                    if (mul.a == ivs[i].phi && !loop.has(fn.insts[mul.b].block)) products.push_back({v, {i, mul.b}});
+                    else if (mul.b == ivs[i].phi && !loop.has(fn.insts[mul.a].block)) products.push_back({v, {i, mul.a}});
+                    else continue;
+                    break;
+                }
+            }
+        }
+        if (products.empty()) return 0;
+
+        BlockId header = loop.header, latch = loop.latches[0];
+        std::vector<std::pair<std::pair<size_t, ValueId>, ValueId>> made;
+        std::vector<ValueId> replace(fn.insts.size(), NoValue);
+        for (const auto& [mul, key] : products) {
+            auto it = std::find_if(made.begin(), made.end(), [&](const auto& m) { return m.first == key; });
+            if (it != made.end()) {
+                replace[mul] = it->second;
+                continue;
+            }
+            const Induction& iv = ivs[key.first];
+            ValueId k = key.second;
+            // value * k in the preheader; value may be a known constant
+            // instead, and products of constants fold.
+            auto scale = [&](ValueId value, bool known, int64_t imm) {
+                bool constantK = fn.insts[k].op == IROp::Const;
+                if (known && imm == 1) return k;
+                IRInst inst;
+                inst.type = IRType::I64;
+                if (known && (imm == 0 || constantK)) {
+                    inst.op = IROp::Const;
+                    ConstantFoldPass::fold(IROp::Mul, imm, imm == 0 ? 0 : fn.insts[k].imm, inst.imm);
+                    return fn.insertBeforeTerminator(loop.preheader, inst);
+                }
+                if (known) {
+                    inst.op = IROp::Const;
+                    inst.imm = imm;
+                    value = fn.insertBeforeTerminator(loop.preheader, inst);
+                }
+                inst.op = IROp::Mul;
+                inst.a = value;
+                inst.b = k;
+                return fn.insertBeforeTerminator(loop.preheader, inst);
+            };
+            bool knownStart = fn.insts[iv.init].op == IROp::Const;
+            ValueId init = scale(iv.init, knownStart, knownStart ? fn.insts[iv.init].imm : 0);
+            ValueId stride = scale(NoValue, true, iv.step);
+
+            IRInst phi;
+            phi.op = IROp::Phi;
+            phi.type = IRType::I64;
+            phi.block = header;
+            phi.extra = static_cast<uint32_t>(fn.operands.size());
+            phi.count = 2;
+            fn.operands.insert(fn.operands.end(), {init, loop.preheader, NoValue, latch});
+            fn.insts.push_back(phi);
+            ValueId product = static_cast<ValueId>(fn.insts.size() - 1);
+            std::vector<ValueId>& top = fn.blocks[header].insts;
+            auto at = std::find_if(top.begin(), top.end(), [&](ValueId v) { return fn.insts[v].op != IROp::Phi; });
+            top.insert(at, product);
+
+            IRInst add;
+            add.op = IROp::Add;
+            add.type = IRType::I64;
+            add.a = product;
+            add.b = stride;
+            fn.operands[phi.extra + 2] = fn.insertBeforeTerminator(latch, add);
+            made.push_back({key, product});
+            replace.resize(fn.insts.size(), NoValue);
+            replace[mul] = product;
+        }
+
+        for (IRInst& inst : fn.insts) {
+            if (inst.op == IROp::Nop) continue;
+            fn.forEachOperand(inst, [&](ValueId& v) {
+                if (replace[v] != NoValue) v = replace[v];
+            });
+        }
+        for (const auto& product : products) {
+            IRInst& mul = fn.insts[product.first];
+            std::vector<ValueId>& insts = fn.blocks[mul.block].insts;
+            insts.erase(std::find(insts.begin(), insts.end(), product.first));
+            mul.op = IROp::Nop;
+        }
+        return products.size();
+    }
+
+    // How many times a loop whose header tests an induction variable
+    // against a constant goes round; -1 when it does not, or the count is
+    // beyond MaxSimulatedTrips.
+    static int64_t tripCount(const IRFunction& fn, const Loop& loop, bool stayOnTrue) {
+        const IRInst& compare = fn.insts[fn.terminator(loop.header)->a];
+        if (!isCompare(compare.op)) return -1;
+        for (const Induction& iv : inductionVariables(fn, loop)) {
+            bool left = compare.a == iv.phi;
+            if (!left && compare.b != iv.phi) continue;
+            const IRInst& bound = fn.insts[left ? compare.b : compare.a];
+            const IRInst& init = fn.insts[iv.init];
+            if (bound.op != IROp::Const || init.op != IROp::Const || iv.step == 0) continue;
+            int64_t i = init.imm;
+            for (int64_t trips = 0; trips <= MaxSimulatedTrips; ++trips) {
+                int64_t taken = 0;
+                ConstantFoldPass::fold(compare.op, left ? i : bound.imm, left ? bound.imm : i, taken);
+                if ((taken != 0) != stayOnTrue) return trips;
+                ConstantFoldPass::fold(IROp::Add, i, iv.step, i);
+            }
+            return -1;
+        }
+        return -1;
+    }
+
+    // Lays the loop's iterations out back to back: copy k of every block
+    // runs trip k (mod the factor), its header phis replaced by what the
+    // previous copy sent round the back edge. Returns the number of body
+    // copies per trip (0 if the loop was left alone, the trip count if
+    // `full`); the new blocks go into clones.
+    size_t unroll(IRFunction& fn, const Loop& loop, std::vector<BlockId>& clones, bool& full) const {
+        if (factor < 2 || loop.preheader == NoBlock || loop.latches.size() != 1 || loop.latches[0] == loop.header) return 0;
+        BlockId header = loop.header, latch = loop.latches[0];
+        const IRInst& test = *fn.terminator(header);
+        if (test.op != IROp::Branch || loop.has(test.target[0]) == loop.has(test.target[1])) return 0;
+        bool stayOnTrue = loop.has(test.target[0]);
+        BlockId exit = test.target[stayOnTrue ? 1 : 0];
+        size_t size = 0;
+        for (BlockId b : loop.blocks) {
+            if (fn.terminator(b)->op == IROp::Switch) return 0;   // the copies below only retarget target[]
+            for (size_t i = 0; i < fn.successorCount(b); ++i) {
+                if (b != header && !loop.has(fn.successor(b, i))) return 0;
+            }
+            for (ValueId v : fn.blocks[b].insts) size += fn.insts[v].op != IROp::Phi && fn.insts[v].op != IROp::Const;
+        }
+
+        int64_t trips = tripCount(fn, loop, stayOnTrue);
+        if (trips == 0) return 0;
+        full = trips > 0 && trips <= MaxFullTrips && size * static_cast<size_t>(trips) <= FullBudget;
+        size_t times = full ? static_cast<size_t>(trips) : std::min<size_t>(factor, PartialBudget / size);
+        if (times < 2 && !full) return 0;
+        bool dropTests = full;
+        if (!full && trips > 0) {
+            for (size_t d = times; d >= 2; --d) {
+                if (trips % static_cast<int64_t>(d) == 0) {
+                    times = d;
+                    dropTests = true;
+                    break;
+                }
+            }
+        }
+        // A full unroll ends in one more header copy that leaves; partial
+        // copies that keep their tests leave from each header copy.
+        bool newExits = full || !dropTests;
+        if (newExits && fn.blocks[exit].preds.size() != 1) return 0;
+        size_t copies = full ? times : times - 1;
+
+        ValueId original = static_cast<ValueId>(fn.insts.size());
+        std::vector<ValueId> headerPhis;
+        for (ValueId v : fn.blocks[header].insts) {
+            if (fn.insts[v].op != IROp::Phi) break;
+            headerPhis.push_back(v);
+        }
+        if (newExits) closeOver(fn, loop, exit);
+
+        std::vector<std::vector<BlockId>> blockOf(copies + 1, std::vector<BlockId>(fn.blocks.size(), NoBlock));
+        for (size_t k = 1; k <= copies; ++k) {
+            for (BlockId b : loop.blocks) {
+                if (full && k == copies && b != header) continue;
+                blockOf[k][b] = fn.addBlock();
+                clones.push_back(blockOf[k][b]);
+            }
+        }
+        std::vector<std::vector<ValueId>> valueOf(copies + 1, std::vector<ValueId>(original, NoValue));
+        auto lookup = [&](size_t k, ValueId v) { return v < original && valueOf[k][v] != NoValue ? valueOf[k][v] : v; };
+        auto roundTheLatch = [&](ValueId phi) {
+            const IRInst& inst = fn.insts[phi];
+            for (uint32_t i = 0; i < inst.count; ++i) {
+                if (fn.phiBlock(inst, i) == latch) return fn.phiValue(inst, i);
+            }
+            return NoValue;
+        };
+
+        for (size_t k = 1; k <= copies; ++k) {
+            for (ValueId phi : headerPhis) valueOf[k][phi] = lookup(k - 1, roundTheLatch(phi));
+            for (BlockId b : loop.blocks) {
+                if (blockOf[k][b] == NoBlock) continue;
+                for (size_t i = 0; i < fn.blocks[b].insts.size(); ++i) {
+                    ValueId v = fn.blocks[b].insts[i];
+                    if (b == header && fn.insts[v].op == IROp::Phi) continue;
+                    IRInst inst = fn.insts[v];
+                    if (inst.count > 0) {
+                        uint32_t width = inst.op == IROp::Phi ? 2 * inst.count : inst.count;
+                        uint32_t extra = static_cast<uint32_t>(fn.operands.size());
+                        for (uint32_t j = 0; j < width; ++j) {
+                            uint32_t operand = fn.operands[inst.extra + j];
+                            fn.operands.push_back(operand);
+                        }
+                        inst.extra = extra;
+                    }
+                    valueOf[k][v] = fn.append(blockOf[k][b], inst);
+                }
+            }
+
+            for (BlockId b : loop.blocks) {
+                BlockId copy = blockOf[k][b];
+                if (copy == NoBlock) continue;
+                for (ValueId v : fn.blocks[copy].insts) {
+                    IRInst& inst = fn.insts[v];
+                    fn.forEachOperand(inst, [&](ValueId& x) { x = lookup(k, x); });
+                    if (inst.op != IROp::Phi) continue;
+                    for (uint32_t i = 0; i < inst.count; ++i) fn.operands[inst.extra + 2 * i + 1] = blockOf[k][fn.phiBlock(inst, i)];
+                }
+                std::vector<BlockId> preds;
+                if (b == header) {
+                    preds.push_back(k == 1 ? latch : blockOf[k - 1][latch]);
+                } else {
+                    for (BlockId p : fn.blocks[b].preds) preds.push_back(blockOf[k][p]);
+                }
+                fn.blocks[copy].preds = std::move(preds);
+
+                IRInst& term = fn.insts[fn.blocks[copy].insts.back()];
+                if (b == header && dropTests) {
+                    bool last = full && k == copies;
+                    term.op = IROp::Jump;
+                    term.a = NoValue;
+                    term.target[0] = last ? exit : term.target[stayOnTrue ? 0 : 1];
+                    term.target[1] = NoBlock;
+                }
+                for (BlockId& t : term.target) {
+                    if (t == NoBlock) continue;
+                    if (t == header) {
+                        t = k < copies ? blockOf[k + 1][header] : header;
+                    } else if (loop.has(t)) {
+                        t = blockOf[k][t];
+                    } else {
+                        fn.blocks[t].preds.push_back(copy);
+                        for (ValueId v : fn.blocks[t].insts) {
+                            if (fn.insts[v].op != IROp::Phi) break;
+                            ValueId value = NoValue;
+                            for (uint32_t i = 0; i < fn.insts[v].count; ++i) {
+                                if (fn.phiBlock(fn.insts[v], i) == header) value = fn.phiValue(fn.insts[v], i);
+                            }
+                            fn.addIncoming(v, lookup(k, value), copy);
+                        }
+                    }
+                }
+            }
+        }
+
+        IRInst& back = fn.insts[fn.blocks[latch].insts.back()];
+        for (BlockId& t : back.target) {
+            if (t == header) t = blockOf[1][header];
+        }
+        if (full) {
+            fn.removeEdge(latch, header);
+        } else {
+            BlockId lastLatch = blockOf[copies][latch];
+            for (BlockId& p : fn.blocks[header].preds) {
+                if (p == latch) p = lastLatch;
+            }
+            for (ValueId phi : headerPhis) {
+                IRInst& inst = fn.insts[phi];
+                for (uint32_t i = 0; i < inst.count; ++i) {
+                    if (fn.phiBlock(inst, i) != latch) continue;
+                    fn.operands[inst.extra + 2 * i] = lookup(copies, fn.phiValue(inst, i));
+                    fn.operands[inst.extra + 2 * i + 1] = lastLatch;
+                }
+            }
+        }
+        return times;
+    }
+
+    // Routes every use after the loop of a value from its header through a
+    // phi in the exit, so header copies that also leave can feed it.
+    static void closeOver(IRFunction& fn, const Loop& loop, BlockId exit) {
+        std::vector<ValueId> closed(fn.insts.size(), NoValue);
+        std::vector<ValueId> needed;
+        auto outsideUse = [&](BlockId b, ValueId v) { return !loop.has(b) && !(b == exit && fn.insts[v].op == IROp::Phi); };
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            for (ValueId v : fn.blocks[b].insts) {
+                if (!outsideUse(b, v)) continue;
+                fn.forEachOperand(fn.insts[v], [&](ValueId operand) {
+                    if (fn.insts[operand].block == loop.header && closed[operand] == NoValue) {
+                        closed[operand] = operand;
+                        needed.push_back(operand);
+                    }
+                });
+            }
+        }
+        if (needed.empty()) return;
+        std::vector<ValueId> phis;
+        for (ValueId v : needed) {
+            IRInst phi;
+            phi.op = IROp::Phi;
+            phi.type = fn.insts[v].type;
+            phi.block = exit;
+            phi.extra = static_cast<uint32_t>(fn.operands.size());
+            phi.count = 1;
+            fn.operands.insert(fn.operands.end(), {v, loop.header});
+            fn.insts.push_back(phi);
+            closed[v] = static_cast<ValueId>(fn.insts.size() - 1);
+            phis.push_back(closed[v]);
+        }
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            for (ValueId v : fn.blocks[b].insts) {
+                if (!outsideUse(b, v)) continue;
+                fn.forEachOperand(fn.insts[v], [&](ValueId& operand) {
+                    if (operand < closed.size() && closed[operand] != NoValue) operand = closed[operand];
+                });
+            }
+        }
+        std::vector<ValueId>& top = fn.blocks[exit].insts;
+        top.insert(top.begin(), phis.begin(), phis.end());
+    }
+};
+
+// Compare chains into multi-way switches. An if/else-if chain or nested
+// ternary testing one value against constants (`m == Mode.Alert`, ...)
+// lowers to one block per test that does nothing but compare and branch.
+// A run of such tests on the same value with at least MinCases distinct
+// constants becomes a single `switch` terminator in the first block, and
+// the other test blocks go away. When a constant is tested twice the first
+// test wins, as it did in the chain. The backend lowers a switch dense
+// enough for usesTable() to a jump table and any other to a binary search
+// over the sorted cases.
+class SwitchPass : public IRPass {
+public:
+    static constexpr size_t MinCases = 4;
+
+    const char* name() const override { return "switch"; }
+
+    bool runOnModule(IRModule& module, TaskScheduler& scheduler) override {
+        std::vector<std::vector<std::string>> found(module.functions.size());
+        std::vector<uint8_t> changed(module.functions.size(), 0);
+        scheduler.parallelFor(module.functions.size(), [&](size_t i) {
+            changed[i] = transform(module.functions[i], found[i]) ? 1 : 0;
+        });
+        notes.clear();
+        for (std::vector<std::string>& lines : found) {
+            for (std::string& line : lines) notes.push_back(std::move(line));
+        }
+        return std::find(changed.begin(), changed.end(), 1) != changed.end();
+    }
+
+    // At least a third of the slots between the lowest and highest case
+    // are cases of their own.
+    static bool usesTable(const IRFunction& fn, const IRInst& sw) {
+        if (sw.count < MinCases) return false;
+        int64_t span = fn.switchCase(sw, sw.count - 1) - fn.switchCase(sw, 0) + 1;
+        return span <= 3 * static_cast<int64_t>(sw.count);
+    }
+
+private:
+    // Block `block` goes to `match` when value == key and to `next` otherwise.
+    struct Test {
+        BlockId block = NoBlock;
+        ValueId value = NoValue;
+        ValueId compare = NoValue;
+        int64_t key = 0;
+        BlockId match = NoBlock, next = NoBlock;
+    };
+
+    static bool readTest(const IRFunction& fn, BlockId b, Test& test) {
+        const IRInst* term = fn.terminator(b);
+        if (!term || term->op != IROp::Branch) return false;
+        const IRInst& compare = fn.insts[term->a];
+        if ((compare.op != IROp::CmpEq && compare.op != IROp::CmpNe) || compare.block != b) return false;
+        bool keyOnRight = fn.insts[compare.b].op == IROp::Const;
+        const IRInst& key = fn.insts[keyOnRight ? compare.b : compare.a];
+        ValueId value = keyOnRight ? compare.a : compare.b;
+        if (key.op != IROp::Const || fn.insts[value].op == IROp::Const) return false;
+        if (key.imm < INT32_MIN || key.imm > INT32_MAX) return false;
+        bool eq = compare.op == IROp::CmpEq;
+        test = Test{b, value, term->a, key.imm, term->target[eq ? 0 : 1], term->target[eq ? 1 : 0]};
+        return true;
+    }
+
+    // A later link of the chain: entered only from the previous test and
+    // holding nothing but the compare, its constant and the branch.
+    static bool bareTest(const IRFunction& fn, const Test& test, BlockId from, const std::vector<uint32_t>& uses) {
+        const IRBlock& block = fn.blocks[test.block];
+        if (test.block == 0 || block.preds.size() != 1 || block.preds[0] != from) return false;
+        const IRInst& compare = fn.insts[test.compare];
+        for (ValueId v : block.insts) {
+            const IRInst& inst = fn.insts[v];
+            if (isTerminator(inst.op)) continue;
+            if (v == test.compare ? uses[v] != 1 : inst.op != IROp::Const || uses[v] != 1 || (v != compare.a && v != compare.b))
+                return false;
+        }
+        return true;
+    }
+
+    // The chain's first tests that can share one switch: every case goes to
+    // a block of its own, distinct from the default and from the chain.
+    static size_t usablePrefix(const std::vector<Test>& chain) {
+        for (size_t length = chain.size(); length > 0; --length) {
+            std::vector<int64_t> keys;
+            std::vector<BlockId> targets{chain[length - 1].next};
+            for (size_t i = 0; i < length; ++i) {
+                if (std::find(keys.begin(), keys.end(), chain[i].key) != keys.end()) continue;
+                keys.push_back(chain[i].key);
+                targets.push_back(chain[i].match);
+            }
+            bool distinct = true;
+            for (size_t i = 0; i < targets.size() && distinct; ++i) {
+                distinct = std::count(targets.begin(), targets.end(), targets[i]) == 1;
+                for (size_t k = 0; k < length && distinct; ++k) distinct = targets[i] != chain[k].block;
+            }
+            if (distinct) return keys.size() >= MinCases ? length : 0;
+        }
+        return 0;
+    }
+
+    // Points the edge from -> to at `head` instead, phis included.
+    static void moveEdge(IRFunction& fn, BlockId from, BlockId to, BlockId head) {
+        std::vector<BlockId>& preds = fn.blocks[to].preds;
+        *std::find(preds.begin(), preds.end(), from) = head;
+        for (ValueId v : fn.blocks[to].insts) {
+            IRInst& phi = fn.insts[v];
+            if (phi.op != IROp::Phi) break;
+            for (uint32_t i = 0; i < phi.count; ++i) {
+                if (fn.operands[phi.extra + 2 * i + 1] == from) fn.operands[phi.extra + 2 * i + 1] = head;
+            }
+        }
+    }
+
+    static bool transform(IRFunction& fn, std::vector<std::string>& remarks) {
+        std::vector<uint32_t> uses(fn.insts.size(), 0);
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) fn.forEachOperand(fn.insts[v], [&](ValueId operand) { uses[operand]++; });
+        }
+        std::vector<uint8_t> absorbed(fn.blocks.size(), 0);
+        bool changed = false;
+        for (BlockId head = 0; head < fn.blocks.size(); ++head) {
+            std::vector<Test> chain(1);
+            if (absorbed[head] || !readTest(fn, head, chain[0])) continue;
+            for (Test next; readTest(fn, chain.back().next, next) && next.value == chain[0].value &&
+                            bareTest(fn, next, chain.back().block, uses);) {
+                chain.push_back(next);
+            }
+            size_t length = usablePrefix(chain);
+            if (length == 0) continue;
+            chain.resize(length);
+
+            std::vector<std::pair<int64_t, BlockId>> cases;
+            for (const Test& test : chain) {
+                bool repeat = std::any_of(cases.begin(), cases.end(), [&](const auto& c) { return c.first == test.key; });
+                if (repeat) {
+                    fn.removeEdge(test.block, test.match);
+                } else {
+                    cases.emplace_back(test.key, test.match);
+                    moveEdge(fn, test.block, test.match, head);
+                }
+            }
+            BlockId fallback = chain.back().next;
+            moveEdge(fn, chain.back().block, fallback, head);
+            for (size_t i = 1; i < chain.size(); ++i) absorbed[chain[i].block] = 1;
+            std::sort(cases.begin(), cases.end());
+
+            std::vector<ValueId>& body = fn.blocks[head].insts;
+            if (uses[chain[0].compare] == 1) {
+                fn.insts[chain[0].compare].op = IROp::Nop;
+                body.erase(std::find(body.begin(), body.end(), chain[0].compare));
+            }
+            IRInst& sw = fn.insts[body.back()];
+            sw.op = IROp::Switch;
+            sw.a = chain[0].value;
+            sw.target[0] = fallback;
+            sw.target[1] = NoBlock;
+            sw.extra = static_cast<uint32_t>(fn.operands.size());
+            sw.count = static_cast<uint32_t>(cases.size());
+            for (const auto& [key, target] : cases) {
+                fn.operands.push_back(static_cast<uint32_t>(static_cast<int32_t>(key)));
+                fn.operands.push_back(target);
+            }
+            remarks.push_back(std::string(symbolText(fn.name)) + " b" + std::to_string(head) + ": " + std::to_string(cases.size()) +
+                              " cases -> " + (usesTable(fn, sw) ? "jump table" : "binary search"));
+            changed = true;
+        }
+        if (changed) fn.removeUnreachableBlocks();
+        return changed;
+    }
+};
+
+// Inlining. The call graph's strongly connected components (Tarjan) are
+// visited bottom-up, so a callee has already absorbed its own callees when
+// its size is measured. A call is inlined when the callee is a leaf (it
+// calls nothing) of at most `--inline-size` instructions, params not
+// counted, or when it is the callee's only call site in the module. Calls
+// within one component (recursion), calls into the entry and calls whose
+// argument count does not match stay calls. The callee keeps its own
+// definition, since other objects may link against it. Components run one
+// after another, as each depends on the ones below it.
+//
+// Under --profile-use the pass runs again once the block counts are on the
+// IR. Then a call site that never ran is never inlined, and a hot one (at
+// least 1/HotShare of the module's busiest block) inlines any callee of up
+// to HotScale times the limit, leaf or not. Inlined blocks take the
+// callee's counts, scaled to this site's share of the callee's calls.
+class InlinePass : public IRPass {
+public:
+    explicit InlinePass(const IRPassOptions& options) : limit(options.inlineSize) {}
+
+    const char* name() const override { return "inline"; }
+
+    bool runOnModule(IRModule& module, TaskScheduler&) override {
+        notes.clear();
+        if (limit == 0) return false;
+        std::vector<IRFunction>& fns = module.functions;
+        // Functions reused from the compile cache follow the module's own:
+        // they take part in the call graph and can be inlined, but are not
+        // visited themselves.
+        const std::vector<const IRFunction*>& reused = module.reused.bodies;
+        size_t count = fns.size() + reused.size();
+        auto body = [&](uint32_t i) -> const IRFunction& { return i < fns.size() ? fns[i] : *reused[i - fns.size()]; };
+        SymbolMap<uint32_t> index;   // function name -> 1 + position in fns, then in reused
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!body(i).isEntry) index.insert(body(i).name, i + 1);
+        }
+        std::vector<std::vector<uint32_t>> callees(count);
+        std::vector<uint32_t> sites(count, 0);
+        for (uint32_t i = 0; i < count; ++i) {
+            forEachCall(body(i), [&](ValueId, const IRInst& call) {
+                const uint32_t* to = index.find(call.symbol);
+                if (!to) return;
+                if (i < fns.size()) sites[*to - 1]++;   // the reused functions' sites are in reused.calls
+                if (std::find(callees[i].begin(), callees[i].end(), *to - 1) == callees[i].end()) callees[i].push_back(*to - 1);
+            });
+        }
+        module.reused.calls.forEach([&](SymbolId callee, uint32_t count) {
+            if (const uint32_t* to = index.find(callee)) sites[*to - 1] += count;
+        });
+
+        uint64_t busiest = 0;
+        for (const IRFunction& fn : fns) {
+            for (uint64_t count : fn.counts) busiest = std::max(busiest, count);
+        }
+
+        bool changed = false;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> component = components(callees, order);
+        for (uint32_t f : order) {
+            if (f >= fns.size()) continue;
+            IRFunction& fn = fns[f];
+            std::vector<ValueId> calls;
+            forEachCall(fn, [&](ValueId v, const IRInst& call) {
+                if (call.op == IROp::Call) calls.push_back(v);
+            });
+            std::vector<std::pair<uint32_t, std::string>> done;   // callee, reason
+            std::vector<uint32_t> times;
+            for (ValueId site : calls) {
+                const uint32_t* to = index.find(fn.insts[site].symbol);
+                if (!to || component[*to - 1] == component[f]) continue;
+                const IRFunction& callee = body(*to - 1);
+                if (fn.insts[site].count != callee.params.size()) continue;
+                size_t size = bodySize(callee);
+                uint64_t runs = fn.counts.empty() ? 0 : fn.counts[fn.insts[site].block];
+                if (!fn.counts.empty() && runs == 0) continue;
+                std::string reason;
+                if (runs && runs * HotShare >= busiest && size <= limit * HotScale)
+                    reason = "hot, " + std::to_string(runs) + " calls, " + std::to_string(size) + " insts";
+                else if (isLeaf(callee) && size <= limit) reason = "leaf, " + std::to_string(size) + " insts";
+                else if (sites[*to - 1] == 1) reason = "only call site, " + std::to_string(size) + " insts";
+                else continue;
+
+                inlineCall(fn, site, callee);
+                changed = true;
+                auto seen = std::find_if(done.begin(), done.end(), [&](const auto& d) { return d.first == *to - 1; });
+                if (seen != done.end()) {
+                    times[seen - done.begin()]++;
+                } else {
+                    done.emplace_back(*to - 1, reason);
+                    times.push_back(1);
+                }
+            }
+            if (done.empty()) continue;
+            fn.removeTrivialPhis();
+            fn.removeUnreachableBlocks();
+            fn.mergeBlocks();
+            for (size_t i = 0; i < done.size(); ++i) {
+                notes.push_back(std::string(symbolText(fn.name)) + ": inlined " + std::string(symbolText(body(done[i].first).name)) +
+                                (times[i] > 1 ? " x" + std::to_string(times[i]) : "") + " (" + done[i].second + ")");
+            }
+        }
+        return changed;
+    }
+
+private:
+    static constexpr uint64_t HotShare = 100;
+    static constexpr unsigned HotScale = 8;
+
+    unsigned limit;
+
+    template<typename Fn>
+    static void forEachCall(const IRFunction& fn, Fn&& visit) {
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) {
+                const IRInst& inst = fn.insts[v];
+                if (inst.op == IROp::Call || inst.op == IROp::TailCall) visit(v, inst);
+            }
+        }
+    }
+
+    static bool isLeaf(const IRFunction& fn) {
+        bool leaf = true;
+        forEachCall(fn, [&](ValueId, const IRInst&) { leaf = false; });
+        return leaf;
+    }
+
+    static size_t bodySize(const IRFunction& fn) {
+        size_t size = 0;
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) size += fn.insts[v].op != IROp::Param;
+        }
+        return size;
+    }
+
+    // Tarjan's algorithm; fills `order` as components complete, which puts
+    // every component after the ones it calls into. Returns each
+    // function's component number.
+    static std::vector<uint32_t> components(const std::vector<std::vector<uint32_t>>& callees, std::vector<uint32_t>& order) {
+        constexpr uint32_t Unvisited = 0xFFFFFFFF;
+        size_t n = callees.size();
+        std::vector<uint32_t> number(n, Unvisited), low(n, 0), component(n, Unvisited), stack;
+        std::vector<uint8_t> onStack(n, 0);
+        uint32_t counter = 0, componentCount = 0;
+
+        // Explicit stack of (function, next callee) so deep call chains
+        // cannot overflow the native stack.
+        std::vector<std::pair<uint32_t, size_t>> frames;
+        for (uint32_t root = 0; root < n; ++root) {
+            if (number[root] != Unvisited) continue;
+            frames.emplace_back(root, 0);
+            number[root] = low[root] = counter++;
+            stack.push_back(root);
+            onStack[root] = 1;
+            while (!frames.empty()) {
+                auto& [f, next] = frames.back();
+                if (next < callees[f].size()) {
+                    uint32_t g = callees[f][next++];
+                    if (number[g] == Unvisited) {
+                        number[g] = low[g] = counter++;
+                        stack.push_back(g);
+                        onStack[g] = 1;
+                        frames.emplace_back(g, 0);
+                    } else if (onStack[g]) {
+                        low[f] = std::min(low[f], number[g]);
+                    }
+                    continue;
+                }
+                uint32_t done = f;
+                frames.pop_back();
+                if (!frames.empty()) low[frames.back().first] = std::min(low[frames.back().first], low[done]);
+                if (low[done] != number[done]) continue;
+                for (uint32_t member = Unvisited; member != done;) {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack[member] = 0;
+                    component[member] = componentCount;
+                    order.push_back(member);
+                }
+                componentCount++;
+            }
+        }
+        return component;
+    }
+
+    // Replaces call `site` in fn with a copy of callee's body: the code
+    // after the call moves to a new block that every copied return jumps
+    // to, with a phi there when several returns meet. A copied tail call
+    // becomes a call followed by that jump. The new blocks are numbered
+    // right after the call's block so the body falls through in order.
+    static void inlineCall(IRFunction& fn, ValueId site, const IRFunction& callee) {
+        const IRInst call = fn.insts[site];
+        BlockId at = call.block;
+        BlockId firstNew = static_cast<BlockId>(fn.blocks.size());
+        std::vector<BlockId> blockMap(callee.blocks.size());
+        for (BlockId b = 0; b < callee.blocks.size(); ++b) blockMap[b] = fn.addBlock();
+        BlockId after = fn.addBlock();
+        if (!fn.counts.empty()) {
+            uint64_t runs = fn.counts[at];
+            uint64_t entered = callee.counts.empty() ? 0 : callee.counts[0];
+            for (BlockId b = 0; b < callee.blocks.size(); ++b) {
+                fn.counts[blockMap[b]] = entered ? static_cast<uint64_t>(static_cast<double>(callee.counts[b]) * runs / entered) : runs;
+            }
+            fn.counts[after] = runs;
+        }
+
+        std::vector<ValueId>& list = fn.blocks[at].insts;
+        auto pos = std::find(list.begin(), list.end(), site);
+        fn.blocks[after].insts.assign(pos + 1, list.end());
+        list.erase(pos, list.end());
+        for (ValueId v : fn.blocks[after].insts) fn.insts[v].block = after;
+        for (size_t i = 0; i < fn.successorCount(after); ++i) {
+            BlockId succ = fn.successor(after, i);
+            for (BlockId& p : fn.blocks[succ].preds) {
+                if (p == at) p = after;
+            }
+            for (ValueId v : fn.blocks[succ].insts) {
+                IRInst& phi = fn.insts[v];
+                if (phi.op != IROp::Phi) break;
+                for (uint32_t k = 0; k < phi.count; ++k) {
+                    if (fn.operands[phi.extra + 2 * k + 1] == at) fn.operands[phi.extra + 2 * k + 1] = after;
+                }
+            }
+        }
+
+        // Params read the call's arguments; every other copied instruction
+        // gets the next id, in the order it is appended below.
+        std::vector<ValueId> valueMap(callee.insts.size(), NoValue);
+        ValueId next = static_cast<ValueId>(fn.insts.size());
+        for (const IRBlock& block : callee.blocks) {
+            for (ValueId v : block.insts) {
+                const IRInst& inst = callee.insts[v];
+                if (inst.op == IROp::Param) valueMap[v] = fn.callArg(call, static_cast<size_t>(inst.imm));
+                else if (inst.op != IROp::Return) valueMap[v] = next++;
+            }
+        }
+        std::vector<std::pair<BlockId, ValueId>> exits;   // copied block, returned value
+        for (BlockId b = 0; b < callee.blocks.size(); ++b) {
+            for (BlockId p : callee.blocks[b].preds) fn.blocks[blockMap[b]].preds.push_back(blockMap[p]);
+            for (ValueId v : callee.blocks[b].insts) {
+                IRInst copy = callee.insts[v];
+                if (copy.op == IROp::Param) continue;
+                if (copy.op == IROp::Return) {
+                    exits.emplace_back(blockMap[b], copy.a == NoValue ? NoValue : valueMap[copy.a]);
+                    continue;
+                }
+                if (copy.a != NoValue) copy.a = valueMap[copy.a];
+                if (copy.b != NoValue) copy.b = valueMap[copy.b];
+                for (BlockId& t : copy.target) {
+                    if (t != NoBlock) t = blockMap[t];
+                }
+                if (copy.count > 0) {
+                    bool pairs = copy.op == IROp::Phi || copy.op == IROp::Switch;
+                    uint32_t extra = static_cast<uint32_t>(fn.operands.size());
+                    for (uint32_t i = 0; i < copy.count * (pairs ? 2 : 1); ++i) {
+                        uint32_t operand = callee.operands[copy.extra + i];
+                        bool isBlock = pairs && i % 2 == 1;
+                        if (isBlock) operand = blockMap[operand];
+                        else if (copy.op != IROp::Switch) operand = valueMap[operand];
+                        fn.operands.push_back(operand);
+                    }
+                    copy.extra = extra;
+                }
+                if (copy.op == IROp::TailCall) {
+                    copy.op = IROp::Call;
+                    copy.type = IRType::I64;
+                    exits.emplace_back(blockMap[b], valueMap[v]);
+                }
+                fn.append(blockMap[b], copy);
+            }
+        }
+
+        IRInst jump;
+        jump.op = IROp::Jump;
+        jump.target[0] = blockMap[0];
+        fn.append(at, jump);
+        fn.blocks[blockMap[0]].preds.push_back(at);
+        jump.target[0] = after;
+        for (const auto& [block, value] : exits) {
+            fn.append(block, jump);
+            fn.blocks[after].preds.push_back(block);
+        }
+
+        ValueId result;
+        if (exits.size() == 1 && exits[0].second != NoValue) {
+            result = exits[0].second;
+        } else if (exits.size() > 1) {
+            IRInst phi;
+            phi.op = IROp::Phi;
+            phi.type = IRType::I64;
+            phi.block = after;
+            phi.extra = static_cast<uint32_t>(fn.operands.size());
+            phi.count = static_cast<uint32_t>(exits.size());
+            ValueId zero = NoValue;
+            for (const auto& [block, value] : exits) {
+                if (value == NoValue && zero == NoValue) zero = fn.entryConstant(0);
+                fn.operands.push_back(value == NoValue ? zero : value);
+                fn.operands.push_back(block);
+            }
+            fn.insts.push_back(phi);
+            result = static_cast<ValueId>(fn.insts.size() - 1);
+            fn.blocks[after].insts.insert(fn.blocks[after].insts.begin(), result);
+        } else {
+            result = fn.entryConstant(0);   // a bare `ret`, or a callee that never returns
+        }
+        fn.insts[site].op = IROp::Nop;
+        for (IRInst& inst : fn.insts) {
+            if (inst.op == IROp::Nop) continue;
+            fn.forEachOperand(inst, [&](ValueId& v) {
+                if (v == site) v = result;
+            });
+        }
+
+        std::vector<BlockId> remap(fn.blocks.size());
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            if (b <= at) remap[b] = b;
+            else if (b < firstNew) remap[b] = b + (after - firstNew + 1);
+            else remap[b] = at + 1 + (b - firstNew);
+        }
+        fn.renumberBlocks(remap);
+    }
+};
+
+struct IRPassInfo {
+    const char* name;
+    const char* description;
+    std::unique_ptr<IRPass> (*create)(const IRPassOptions&);
+};
+
+template<typename Pass>
+std::unique_ptr<IRPass> makeIRPass(const IRPassOptions& options) {
+    if constexpr (std::is_constructible_v<Pass, const IRPassOptions&>) return std::make_unique<Pass>(options);
+    else return std::make_unique<Pass>();
+}
+
+// Every pass the pipeline can name. New passes are registered here.
+inline const std::vector<IRPassInfo>& irPassRegistry() {
+    static const std::vector<IRPassInfo> passes = {
+        {"verify", "check IR invariants", &makeIRPass<VerifyPass>},
+        {"dce", "remove unused side-effect-free instructions", &makeIRPass<DeadCodePass>},
+        {"forward", "forward stored globals to later loads", &makeIRPass<LoadForwardPass>},
+        {"fold", "sparse conditional constant propagation and folding", &makeIRPass<ConstantFoldPass>},
+        {"dse", "remove stores to globals that are never read again", &makeIRPass<DeadStorePass>},
+        {"tailcall", "turn tail calls into loops and frame-reusing jumps", &makeIRPass<TailCallPass>},
+        {"select", "turn small side-effect-free branches into cmov/setcc", &makeIRPass<SelectPass>},
+        {"loop", "hoist loop invariants, reduce induction multiplies, unroll", &makeIRPass<LoopPass>},
+        {"switch", "turn compare chains on one value into jump tables or binary searches", &makeIRPass<SwitchPass>},
+        {"inline", "inline small leaf functions and functions called once", &makeIRPass<InlinePass>},
+    };
+    return passes;
+}
+
+class PassManager {
+public:
+    static constexpr const char* DefaultPipeline = "verify,inline,forward,fold,loop,fold,switch,select,tailcall,dse,dce";
+
+    struct PassStats {
+        std::string name;
+        int64_t nanos = 0;
+        bool changed = false;
+        std::vector<std::string> remarks;
+    };
+
+    PassManager() = default;
+
+    // Comma-separated pass names, e.g. "verify,dce"; empty runs nothing.
+    explicit PassManager(std::string_view pipeline, const IRPassOptions& options = {}) {
+        size_t begin = 0;
+        while (begin <= pipeline.size()) {
+            size_t end = pipeline.find(',', begin);
+            if (end == std::string_view::npos) end = pipeline.size();
+            std::string_view item = pipeline.substr(begin, end - begin);
+            if (!item.empty()) add(createPass(item, options));
+            begin = end + 1;
+        }
+    }
+
+    static std::unique_ptr<IRPass> createPass(std::string_view name, const IRPassOptions& options = {}) {
+        std::string known;
+        for (const IRPassInfo& info : irPassRegistry()) {
+            if (name == info.name) return info.create(options);
+            known += known.empty() ? "" : ", ";
+            known += info.name;
+        }
+        throw std::runtime_error("Unknown IR pass '" + std::string(name) + "' (available: " + known + ")");
+    }
+
+    void add(std::unique_ptr<IRPass> pass) { passes.push_back(std::move(pass)); }
+
+    void run(IRModule& module, TaskScheduler& scheduler) {
+        stats.clear();
+        for (const std::unique_ptr<IRPass>& pass : passes) {
+            auto start = std::chrono::steady_clock::now();
+            bool changed = pass->runOnModule(module, scheduler);
+            int64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            stats.push_back(PassStats{pass->name(), nanos, changed, pass->remarks()});
+        }
+    }
+
+    const std::vector<PassStats>& lastRun() const { return stats; }
+
+private:
+    std::vector<std::unique_ptr<IRPass>> passes;
+    std::vector<PassStats> stats;
+};
+
+//--------------------------------------------------
+// --- IR PRINTER (.fir) ---
+//--------------------------------------------------
+// Text serialization of the IR:
+//
+//   global @x
+//   func @sum(n) {
+//   b0:
+//     %0 = param i64 0
+//     %1 = const i64 0
+//     jmp b1
+//   b1:
+//     %2 = phi i64 [%1, b0], [%4, b2]
+//     ...
+//   }
+//
+// Values are renumbered densely per function so output is stable across
+// passes that leave holes in the instruction array.
+class IRPrinter {
+public:
+    void write(const IRModule& module, const std::string& outPath, TaskScheduler& scheduler) {
+        std::vector<std::string> buffers(module.functions.size());
+        scheduler.parallelFor(module.functions.size(), [&](size_t i) { buffers[i] = text(module.functions[i]); });
+        render(module.globals, buffers).writeFile(outPath, "Failed to write IR file.");
+    }
+
+    // Already printed functions under the module's global list.
+    static OutputBuffer render(const std::vector<SymbolId>& globals, const std::vector<std::string>& functions) {
+        OutputBuffer out;
+        for (SymbolId g : globals) out << "global @" << symbolText(g) << '\n';
+        for (const std::string& buffer : functions) out << '\n' << buffer;
+        return out;
+    }
+
+    static std::string text(const IRFunction& fn) {
+        OutputBuffer out;
+        print(fn, out);
+        return out.str();
+    }
+
+    static void print(const IRFunction& fn, OutputBuffer& out) {
+        std::vector<uint32_t> number(fn.insts.size(), 0);
+        uint32_t next = 0;
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) {
+                if (fn.insts[v].type != IRType::Void) number[v] = next++;
+            }
+        }
+        auto value = [&](ValueId v) { return "%" + std::to_string(number[v]); };
+
+        out << "func @" << symbolText(fn.name) << "(";
+        for (size_t i = 0; i < fn.params.size(); ++i) out << (i ? ", " : "") << symbolText(fn.params[i]);
+        out << ") {\n";
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            out << "b" << b << ":\n";
+            for (ValueId v : fn.blocks[b].insts) {
+                const IRInst& inst = fn.insts[v];
+                out << "  ";
+                if (inst.type != IRType::Void) out << value(v) << " = ";
+                out << irOpName(inst.op);
+                if (inst.type != IRType::Void) out << " " << irTypeName(inst.type);
+                switch (inst.op) {
+                    case IROp::Const: case IROp::Param:
+                        out << " " << inst.imm;
+                        break;
+                    case IROp::Load:
+                        out << " @" << symbolText(inst.symbol);
+                        break;
+                    case IROp::Store:
+                        out << " @" << symbolText(inst.symbol) << ", " << value(inst.a);
+                        break;
+                    case IROp::Phi:
+                        for (uint32_t i = 0; i < inst.count; ++i) {
+                            out << (i ? ", [" : " [") << value(fn.phiValue(inst, i)) << ", b" << fn.phiBlock(inst, i) << "]";
+                        }
+                        break;
+                    case IROp::Select:
+                        out << " " << value(fn.operands[inst.extra]) << ", " << value(fn.operands[inst.extra + 1]) << ", "
+                            << value(fn.operands[inst.extra + 2]);
+                        break;
+                    case IROp::Call:
+                    case IROp::TailCall:
+                        out << " @" << symbolText(inst.symbol) << "(";
+                        for (uint32_t i = 0; i < inst.count; ++i) out << (i ? ", " : "") << value(fn.callArg(inst, i));
+                        out << ")";
+                        break;
+                    case IROp::Jump:
+                        out << " b" << inst.target[0];
+                        break;
+                    case IROp::Branch:
+                        out << " " << value(inst.a) << ", b" << inst.target[0] << ", b" << inst.target[1];
+                        break;
+                    case IROp::Switch:
+                        out << " " << value(inst.a) << ", b" << inst.target[0] << " [";
+                        for (uint32_t i = 0; i < inst.count; ++i) {
+                            out << (i ? ", " : "") << fn.switchCase(inst, i) << ": b" << fn.switchTarget(inst, i);
+                        }
+                        out << "]";
+                        break;
+                    case IROp::Return:
+                        if (inst.a != NoValue) out << " " << value(inst.a);
+                        break;
+                    default:
+                        out << " " << value(inst.a) << ", " << value(inst.b);
+                        break;
+                }
+                out << "\n";
+            }
+        }
+        out << "}\n";
+    }
+};
+
+//--------------------------------------------------
+// --- BINARY AST/IR FORMAT (.hlb) ---
+//--------------------------------------------------
+// An image of a file's AST and optimized IR that tools can map and walk in
+// place. Sections hold fixed-size records at 8-byte-aligned offsets, in the
+// byte order of the writer (little-endian on every target this compiler
+// supports), and refer to each other by index, never by pointer. Records
+// keep every field, so any one is reached by index without decoding those
+// before it; the price is size, several times the .fir text (about 9x on
+// generated workloads), which the format does not try to win back:
+//
+//   header     magic "HLB\x1a", version, byte-order mark, the top-level
+//              statement list, then {offset, count} for every section
+//   strings    {offset, length} into the string bytes: the interned text
+//              of every name, number and operator the image uses, once
+//              each, numbered in first-use order
+//   nodes      24 bytes each, indexed by NodeId: a kind and five fields
+//              whose meaning depends on it (see BinaryNode)
+//   children   NodeIds, addressed by (first, count) ranges in the nodes
+//   names      string indices, likewise (params, fields, variants)
+//   globals    string indices of the module's globals
+//   functions  one record per IR function, ranges into the next three
+//   insts      48 bytes each: an IRInst with its symbol as a string index
+//   blocks     the run of the function's instructions each block holds,
+//              and a range of the pool listing its predecessors
+//   pool       u32s: predecessor lists and each function's operand pool
+//
+// The same image holding one function and no AST is what the compile
+// cache stores for a function's IR. BinaryModule checks every index once
+// when it opens an image, so its accessors can trust them.
+constexpr uint32_t BinaryFormatVersion = 1;
+constexpr uint32_t BinaryByteOrder = 0x01020304;
+constexpr uint32_t NoString = 0xFFFFFFFFu;
+
+#define HYPERLACE_BINARY_SECTIONS(X) \
+    X(Strings)                       \
+    X(StringBytes)                   \
+    X(Nodes)                         \
+    X(Children)                      \
+    X(Names)                         \
+    X(Globals)                       \
+    X(Functions)                     \
+    X(Insts)                         \
+    X(Blocks)                        \
+    X(Pool)
+
+enum class BinarySection : uint8_t {
+#define HYPERLACE_BINARY_SECTION_ENUM(Name) Name,
+    HYPERLACE_BINARY_SECTIONS(HYPERLACE_BINARY_SECTION_ENUM)
+#undef HYPERLACE_BINARY_SECTION_ENUM
+    Count
+};
+
+struct BinaryRange {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+struct BinaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t sectionCount;
+    BinaryRange program;   // top-level statements, in children
+    BinaryRange sections[static_cast<size_t>(BinarySection::Count)];   // byte offset, record count
+};
+
+struct BinaryString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Fields by kind; NoNode or NoString where a node has nothing:
+//   Assignment       name, value, field
+//   NumberExpr       text
+//   IdentifierExpr   name
+//   BinaryExpr       op, left, right
+//   FunctionDef      name, params (first, count), body (first, count)
+//   IfStatement      condition, then (first, count), else (first, count)
+//   FunctionCall     name, arguments (first, count)
+//   WhileLoop        condition, body (first, count)
+//   ForLoop          initializer, condition, increment, body (first, count)
+//   StructDef        name, fields (first, count)
+//   StructInit       struct name
+//   FieldAccess      object, field
+//   EnumDef          name, variants (first, count)
+//   ReturnStatement  value
+//   TernaryExpr      condition, then, else
+struct BinaryNode {
+    NodeKind kind;
+    uint8_t reserved[3];
+    uint32_t field[5];
+};
+
+struct BinaryFunction {
+    uint32_t name;
+    uint32_t isEntry;
+    BinaryRange params;     // in names
+    BinaryRange insts;
+    BinaryRange blocks;
+    BinaryRange operands;   // in the pool
+};
+
+struct BinaryInst {
+    IROp op;
+    IRType type;
+    uint16_t reserved;
+    BlockId block;
+    ValueId a, b;
+    uint32_t extra, count;
+    uint32_t symbol;   // string index
+    BlockId target[2];
+    uint32_t padding;
+    int64_t imm;
+};
+
+struct BinaryBlock {
+    BinaryRange insts;   // in the function's instructions
+    BinaryRange preds;   // in the pool
+};
+
+static_assert(sizeof(BinaryHeader) == 24 + 8 * static_cast<size_t>(BinarySection::Count), "packed header");
+static_assert(sizeof(BinaryNode) == 24 && sizeof(BinaryInst) == 48 && sizeof(BinaryFunction) == 40, "packed records");
+
+class BinaryWriter {
+public:
+    // Nodes keep their arena NodeIds; child and name lists are packed in
+    // node order. Call once, before any function.
+    void addAST(const ASTArena& ast, NodeList program) {
+        nodes.reserve(ast.nodeCount());
+        for (NodeId id = 0; id < ast.nodeCount(); ++id) nodes.push_back(encode(ast, id));
+        header.program = list(ast, program);
+    }
+
+    void addGlobals(const std::vector<SymbolId>& names) {
+        for (SymbolId name : names) globals.push_back(string(name));
+    }
+
+    // Written compacted: only the instructions blocks still hold, renumbered
+    // in block order so each block's are one run, and only the operands
+    // they use. The printer numbers values the same way, so the .fir of a
+    // function read back is the text of the one written.
+    void addFunction(const IRFunction& fn) {
+        BinaryFunction record{string(fn.name), fn.isEntry, {}, {}, {}, {}};
+        record.params = range(names, fn.params.size());
+        for (SymbolId param : fn.params) names.push_back(string(param));
+
+        std::vector<ValueId> number(fn.insts.size(), NoValue);
+        ValueId next = 0;
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) number[v] = next++;
+        }
+        auto value = [&](ValueId v) { return v == NoValue ? NoValue : number[v]; };
+        std::vector<uint32_t> operands;
+        record.insts = range(insts, next);
+        record.blocks = range(blocks, fn.blocks.size());
+        for (const IRBlock& block : fn.blocks) {
+            BinaryBlock out;
+            out.insts = BinaryRange{static_cast<uint32_t>(insts.size()) - record.insts.first, static_cast<uint32_t>(block.insts.size())};
+            for (ValueId v : block.insts) {
+                const IRInst& inst = fn.insts[v];
+                BinaryInst packed{};
+                packed.op = inst.op;
+                packed.type = inst.type;
+                packed.block = inst.block;
+                packed.a = value(inst.a);
+                packed.b = value(inst.b);
+                packed.extra = static_cast<uint32_t>(operands.size());
+                packed.count = inst.count;
+                packed.symbol = string(inst.symbol);
+                packed.target[0] = inst.target[0];
+                packed.target[1] = inst.target[1];
+                packed.imm = inst.imm;
+                if (inst.op == IROp::Phi || inst.op == IROp::Switch) {
+                    for (uint32_t i = 0; i < inst.count; ++i) {
+                        uint32_t first = fn.operands[inst.extra + 2 * i];
+                        operands.push_back(inst.op == IROp::Phi ? value(first) : first);
+                        operands.push_back(fn.operands[inst.extra + 2 * i + 1]);
+                    }
+                } else if (inst.op == IROp::Call || inst.op == IROp::TailCall || inst.op == IROp::Select) {
+                    for (uint32_t i = 0; i < inst.count; ++i) operands.push_back(value(fn.operands[inst.extra + i]));
+                } else {
+                    packed.extra = 0;
+                }
+                insts.push_back(packed);
+            }
+            out.preds = range(pool, block.preds.size());
+            pool.insert(pool.end(), block.preds.begin(), block.preds.end());
+            blocks.push_back(out);
+        }
+        record.operands = range(pool, operands.size());
+        pool.insert(pool.end(), operands.begin(), operands.end());
+        functions.push_back(record);
+    }
+
+    std::string finish() {
+        std::string out(sizeof(BinaryHeader), '\0');
+        auto section = [&](BinarySection which, const void* data, size_t count, size_t size) {
+            out.resize((out.size() + 7) & ~size_t(7), '\0');
+            header.sections[static_cast<size_t>(which)] = BinaryRange{static_cast<uint32_t>(out.size()), static_cast<uint32_t>(count)};
+            out.append(static_cast<const char*>(data), count * size);
+        };
+        section(BinarySection::Strings, strings.data(), strings.size(), sizeof(BinaryString));
+        section(BinarySection::StringBytes, stringBytes.data(), stringBytes.size(), 1);
+        section(BinarySection::Nodes, nodes.data(), nodes.size(), sizeof(BinaryNode));
+        section(BinarySection::Children, children.data(), children.size(), sizeof(uint32_t));
+        section(BinarySection::Names, names.data(), names.size(), sizeof(uint32_t));
+        section(BinarySection::Globals, globals.data(), globals.size(), sizeof(uint32_t));
+        section(BinarySection::Functions, functions.data(), functions.size(), sizeof(BinaryFunction));
+        section(BinarySection::Insts, insts.data(), insts.size(), sizeof(BinaryInst));
+        section(BinarySection::Blocks, blocks.data(), blocks.size(), sizeof(BinaryBlock));
+        section(BinarySection::Pool, pool.data(), pool.size(), sizeof(uint32_t));
+        if (out.size() > UINT32_MAX) throw std::runtime_error("Binary Error: image exceeds 4 GiB");
+        std::memcpy(header.magic, "HLB\x1a", 4);
+        header.version = BinaryFormatVersion;
+        header.byteOrder = BinaryByteOrder;
+        header.sectionCount = static_cast<uint32_t>(BinarySection::Count);
+        std::memcpy(out.data(), &header, sizeof(header));
+        return out;
+    }
+
+private:
+    BinaryHeader header{};
+    SymbolMap<uint32_t> index;   // SymbolId -> string index
+    std::vector<BinaryString> strings;
+    std::string stringBytes;
+    std::vector<BinaryNode> nodes;
+    std::vector<uint32_t> children, names, globals, pool;
+    std::vector<BinaryFunction> functions;
+    std::vector<BinaryInst> insts;
+    std::vector<BinaryBlock> blocks;
+
+    template <typename T>
+    static BinaryRange range(const std::vector<T>& section, size_t count) {
+        return BinaryRange{static_cast<uint32_t>(section.size()), static_cast<uint32_t>(count)};
+    }
+
+    uint32_t string(SymbolId symbol) {
+        if (symbol == NoSymbol) return NoString;
+        auto inserted = index.insert(symbol, static_cast<uint32_t>(strings.size()));
+        if (inserted.second) {
+            std::string_view text = symbolText(symbol);
+            strings.push_back(BinaryString{static_cast<uint32_t>(stringBytes.size()), static_cast<uint32_t>(text.size())});
+            stringBytes.append(text);
+        }
+        return *inserted.first;
+    }
+
+    // Numbers and operators go through the interner too, so every string
+    // in the table is one SymbolId.
+    uint32_t string(std::string_view text) { return text.empty() ? NoString : string(internSymbol(text)); }
+
+    BinaryRange list(const ASTArena& ast, NodeList nodes) {
+        BinaryRange out = range(children, nodes.count);
+        for (NodeId id : ast.children(nodes)) children.push_back(id);
+        return out;
+    }
+
+    BinaryRange list(const ASTArena& ast, NameList ids) {
+        BinaryRange out = range(names, ids.count);
+        for (SymbolId id : ast.names(ids)) names.push_back(string(id));
+        return out;
+    }
+
+    BinaryNode encode(const ASTArena& ast, NodeId id) {
+        BinaryNode out{ast.kind(id), {}, {NoNode, NoNode, NoNode, NoNode, NoNode}};
+        uint32_t* f = out.field;
+        auto put = [&](size_t at, BinaryRange r) {
+            f[at] = r.first;
+            f[at + 1] = r.count;
+        };
+        switch (out.kind) {
+            case NodeKind::Assignment: {
+                const Assignment& n = *ast.as<Assignment>(id);
+                f[0] = string(n.name), f[1] = n.value, f[2] = string(n.field);
+                break;
+            }
+            case NodeKind::NumberExpr: f[0] = string(ast.as<NumberExpr>(id)->value); break;
+            case NodeKind::IdentifierExpr: f[0] = string(ast.as<IdentifierExpr>(id)->name); break;
+            case NodeKind::BinaryExpr: {
+                const BinaryExpr& n = *ast.as<BinaryExpr>(id);
+                f[0] = string(n.op), f[1] = n.left, f[2] = n.right;
+                break;
+            }
+            case NodeKind::FunctionDef: {
+                const FunctionDef& n = *ast.as<FunctionDef>(id);
+                f[0] = string(n.name);
+                put(1, list(ast, n.params));
+                put(3, list(ast, n.body));
+                break;
+            }
+            case NodeKind::IfStatement: {
+                const IfStatement& n = *ast.as<IfStatement>(id);
+                f[0] = n.condition;
+                put(1, list(ast, n.thenBranch));
+                put(3, list(ast, n.elseBranch));
+                break;
+            }
+            case NodeKind::FunctionCall: {
+                const FunctionCall& n = *ast.as<FunctionCall>(id);
+                f[0] = string(n.name);
+                put(1, list(ast, n.arguments));
+                break;
+            }
+            case NodeKind::WhileLoop: {
+                const WhileLoop& n = *ast.as<WhileLoop>(id);
+                f[0] = n.condition;
+                put(1, list(ast, n.body));
+                break;
+            }
+            case NodeKind::ForLoop: {
+                const ForLoop& n = *ast.as<ForLoop>(id);
+                f[0] = n.initializer, f[1] = n.condition, f[2] = n.increment;
+                put(3, list(ast, n.body));
+                break;
+            }
+            case NodeKind::StructDef: {
+                const StructDef& n = *ast.as<StructDef>(id);
+                f[0] = string(n.name);
+                put(1, list(ast, n.fields));
+                break;
+            }
+            case NodeKind::StructInit: f[0] = string(ast.as<StructInit>(id)->structName); break;
+            case NodeKind::FieldAccess: {
+                const FieldAccess& n = *ast.as<FieldAccess>(id);
+                f[0] = n.object, f[1] = string(n.field);
+                break;
+            }
+            case NodeKind::EnumDef: {
+                const EnumDef& n = *ast.as<EnumDef>(id);
+                f[0] = string(n.name);
+                put(1, list(ast, n.variants));
+                break;
+            }
+            case NodeKind::ReturnStatement: f[0] = ast.as<ReturnStatement>(id)->returnValue; break;
+            case NodeKind::TernaryExpr: {
+                const TernaryExpr& n = *ast.as<TernaryExpr>(id);
+                f[0] = n.condition, f[1] = n.thenExpr, f[2] = n.elseExpr;
+                break;
+            }
+        }
+        return out;
+    }
+};
+
+// A read-only view of an image; `bytes` must outlive it and be 8-byte
+// aligned, as a mapping or a heap buffer is. Throws on anything malformed.
+class BinaryModule {
+public:
+    explicit BinaryModule(std::string_view bytes) : bytes(bytes) {
+        if (reinterpret_cast<uintptr_t>(bytes.data()) % 8 != 0) fail("image is not 8-byte aligned");
+        if (bytes.size() < sizeof(BinaryHeader)) fail("truncated header");
+        header = reinterpret_cast<const BinaryHeader*>(bytes.data());
+        if (std::memcmp(header->magic, "HLB\x1a", 4) != 0) fail("not a Hyperlace binary");
+        if (header->byteOrder != BinaryByteOrder) fail("written with the other byte order");
+        if (header->version != BinaryFormatVersion)
+            fail("version " + std::to_string(header->version) + ", expected " + std::to_string(BinaryFormatVersion));
+        if (header->sectionCount != static_cast<uint32_t>(BinarySection::Count)) fail("unexpected section count");
+        strings = section<BinaryString>(BinarySection::Strings);
+        stringBytes = section<char>(BinarySection::StringBytes);
+        nodes = section<BinaryNode>(BinarySection::Nodes);
+        childIds = section<uint32_t>(BinarySection::Children);
+        nameIds = section<uint32_t>(BinarySection::Names);
+        globalIds = section<uint32_t>(BinarySection::Globals);
+        functionRecords = section<BinaryFunction>(BinarySection::Functions);
+        instRecords = section<BinaryInst>(BinarySection::Insts);
+        blockRecords = section<BinaryBlock>(BinarySection::Blocks);
+        pool = section<uint32_t>(BinarySection::Pool);
+        validate();
+    }
+
+    size_t stringCount() const { return strings.size(); }
+    std::string_view string(uint32_t index) const {
+        if (index == NoString) return {};
+        return std::string_view(stringBytes.begin() + strings[index].offset, strings[index].length);
+    }
+    SymbolId symbol(uint32_t index) const { return index == NoString ? NoSymbol : internSymbol(string(index)); }
+
+    size_t nodeCount() const { return nodes.size(); }
+    const BinaryNode& node(NodeId id) const { return nodes[id]; }
+    BinaryRange program() const { return header->program; }
+    ArenaSpan<uint32_t> children(uint32_t first, uint32_t count) const { return {childIds.begin() + first, childIds.begin() + first + count}; }
+    ArenaSpan<uint32_t> names(uint32_t first, uint32_t count) const { return {nameIds.begin() + first, nameIds.begin() + first + count}; }
+    ArenaSpan<uint32_t> globals() const { return globalIds; }
+
+    ArenaSpan<BinaryFunction> functions() const { return functionRecords; }
+
+    // Function i rebuilt as an IRFunction, for the passes and the printer.
+    IRFunction function(size_t i) const {
+        const BinaryFunction& record = functionRecords[i];
+        IRFunction fn;
+        fn.name = symbol(record.name);
+        fn.isEntry = record.isEntry != 0;
+        for (uint32_t param : names(record.params.first, record.params.count)) fn.params.push_back(symbol(param));
+        fn.insts.reserve(record.insts.count);
+        for (uint32_t k = 0; k < record.insts.count; ++k) {
+            const BinaryInst& in = instRecords[record.insts.first + k];
+            IRInst inst;
+            inst.op = in.op;
+            inst.type = in.type;
+            inst.block = in.block;
+            inst.a = in.a;
+            inst.b = in.b;
+            inst.extra = in.extra;
+            inst.count = in.count;
+            inst.imm = in.imm;
+            inst.symbol = symbol(in.symbol);
+            inst.target[0] = in.target[0];
+            inst.target[1] = in.target[1];
+            fn.insts.push_back(inst);
+        }
+        fn.blocks.resize(record.blocks.count);
+        for (uint32_t b = 0; b < record.blocks.count; ++b) {
+            const BinaryBlock& in = blockRecords[record.blocks.first + b];
+            for (uint32_t k = 0; k < in.insts.count; ++k) fn.blocks[b].insts.push_back(in.insts.first + k);
+            fn.blocks[b].preds.assign(pool.begin() + in.preds.first, pool.begin() + in.preds.first + in.preds.count);
+        }
+        fn.operands.assign(pool.begin() + record.operands.first, pool.begin() + record.operands.first + record.operands.count);
+        return fn;
+    }
+
+private:
+    std::string_view bytes;
+    const BinaryHeader* header = nullptr;
+    ArenaSpan<BinaryString> strings{};
+    ArenaSpan<char> stringBytes{};
+    ArenaSpan<BinaryNode> nodes{};
+    ArenaSpan<uint32_t> childIds{}, nameIds{}, globalIds{}, pool{};
+    ArenaSpan<BinaryFunction> functionRecords{};
+    ArenaSpan<BinaryInst> instRecords{};
+    ArenaSpan<BinaryBlock> blockRecords{};
+
+    [[noreturn]] static void fail(const std::string& what) { throw std::runtime_error("Binary Error: " + what); }
+
+    template <typename T>
+    ArenaSpan<T> section(BinarySection which) const {
+        const BinaryRange& r = header->sections[static_cast<size_t>(which)];
+        if (r.first % alignof(T) != 0 || r.first > bytes.size() || (bytes.size() - r.first) / sizeof(T) < r.count)
+            fail("section out of bounds");
+        const T* first = reinterpret_cast<const T*>(bytes.data() + r.first);
+        return {first, first + r.count};
+    }
+
+    static bool within(BinaryRange r, size_t size) { return r.first <= size && r.count <= size - r.first; }
+
+    void validate() const {
+        auto str = [&](uint32_t s) {
+            if (s != NoString && s >= strings.size()) fail("string index out of range");
+        };
+        for (const BinaryString& s : strings) {
+            if (!within(BinaryRange{s.offset, s.length}, stringBytes.size())) fail("string out of bounds");
+        }
+        for (uint32_t id : childIds) {
+            if (id >= nodes.size()) fail("child index out of range");
+        }
+        for (uint32_t s : nameIds) str(s);
+        for (uint32_t s : globalIds) str(s);
+        if (!within(header->program, childIds.size())) fail("program list out of bounds");
+        auto node = [&](uint32_t id) {
+            if (id != NoNode && id >= nodes.size()) fail("node index out of range");
+        };
+        auto kids = [&](const uint32_t* f) {
+            if (!within(BinaryRange{f[0], f[1]}, childIds.size())) fail("child list out of bounds");
+        };
+        auto ids = [&](const uint32_t* f) {
+            if (!within(BinaryRange{f[0], f[1]}, nameIds.size())) fail("name list out of bounds");
+        };
+        for (const BinaryNode& n : nodes) {
+            const uint32_t* f = n.field;
+            switch (n.kind) {
+                case NodeKind::Assignment: str(f[0]), node(f[1]), str(f[2]); break;
+                case NodeKind::NumberExpr: case NodeKind::IdentifierExpr: case NodeKind::StructInit: str(f[0]); break;
+                case NodeKind::BinaryExpr: str(f[0]), node(f[1]), node(f[2]); break;
+                case NodeKind::FunctionDef: str(f[0]), ids(f + 1), kids(f + 3); break;
+                case NodeKind::IfStatement: node(f[0]), kids(f + 1), kids(f + 3); break;
+                case NodeKind::FunctionCall: str(f[0]), kids(f + 1); break;
+                case NodeKind::WhileLoop: node(f[0]), kids(f + 1); break;
+                case NodeKind::ForLoop: node(f[0]), node(f[1]), node(f[2]), kids(f + 3); break;
+                case NodeKind::StructDef: case NodeKind::EnumDef: str(f[0]), ids(f + 1); break;
+                case NodeKind::FieldAccess: node(f[0]), str(f[1]); break;
+                case NodeKind::ReturnStatement: node(f[0]); break;
+                case NodeKind::TernaryExpr: node(f[0]), node(f[1]), node(f[2]); break;
+                default: fail("unknown node kind");
+            }
+        }
+        for (const BinaryFunction& fn : functionRecords) {
+            str(fn.name);
+            if (!within(fn.params, nameIds.size()) || !within(fn.insts, instRecords.size()) || !within(fn.blocks, blockRecords.size())
+                || !within(fn.operands, pool.size()))
+                fail("function out of bounds");
+            uint32_t values = fn.insts.count, blockCount = fn.blocks.count, operands = fn.operands.count;
+            auto value = [&](uint32_t v) {
+                if (v != NoValue && v >= values) fail("value out of range");
+            };
+            auto block = [&](uint32_t b) {
+                if (b != NoBlock && b >= blockCount) fail("block out of range");
+            };
+            for (uint32_t k = 0; k < values; ++k) {
+                const BinaryInst& inst = instRecords[fn.insts.first + k];
+                if (inst.op > IROp::TailCall || inst.type > IRType::Bool) fail("unknown instruction");
+                str(inst.symbol);
+                value(inst.a), value(inst.b);
+                block(inst.target[0]), block(inst.target[1]), block(inst.block);
+                uint64_t width = inst.op == IROp::Phi || inst.op == IROp::Switch ? 2 : 1;
+                if (inst.extra > operands || inst.count * width > operands - inst.extra) fail("operands out of bounds");
+                const uint32_t* used = pool.begin() + fn.operands.first + inst.extra;
+                for (uint32_t i = 0; i < inst.count; ++i) {
+                    if (inst.op == IROp::Phi) value(used[2 * i]), block(used[2 * i + 1]);
+                    else if (inst.op == IROp::Switch) block(used[2 * i + 1]);
+                    else if (inst.op == IROp::Call || inst.op == IROp::TailCall || inst.op == IROp::Select) value(used[i]);
+                }
+            }
+            for (uint32_t b = 0; b < blockCount; ++b) {
+                const BinaryBlock& record = blockRecords[fn.blocks.first + b];
+                if (!within(record.insts, values) || !within(record.preds, pool.size())) fail("block list out of bounds");
+                for (uint32_t k = 0; k < record.preds.count; ++k) block(pool[record.preds.first + k]);
+            }
+        }
+    }
+};
+
+//--------------------------------------------------
+// --- X86-64 REGISTER ALLOCATOR ---
+//--------------------------------------------------
+// Linear-scan allocation (Poletto & Sarkar) over the SSA IR. Blocks are
+// numbered in emission order and each value gets one conservative live
+// interval from its first to its last live position, built from a backward
+// liveness pass, so loop-carried values cover the whole loop. Intervals that
+// span a call only get callee-saved registers; the rest prefer the scratch
+// caller-saved ones. When registers run out, the interval with the lowest
+// spill weight (uses, weighted by loop depth, or under --profile-use by
+// how often their block ran) goes to a stack slot, so induction variables
+// and other hot values stay in registers. Free
+// registers are picked by hint first: parameters and call arguments prefer
+// their ABI register, arithmetic results their first operand's, and phis
+// the register of their incoming values, so most copies disappear.
+
+// Hardware encoding order.
+enum class Reg : uint8_t { Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+inline const char* regName(Reg reg) {
+    static const char* const names[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                        "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+    return names[static_cast<int>(reg)];
+}
+
+inline const char* regName32(Reg reg) {
+    static const char* const names[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                        "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+    return names[static_cast<int>(reg)];
+}
+
+inline const char* regName8(Reg reg) {
+    static const char* const names[] = {"al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+                                        "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+    return names[static_cast<int>(reg)];
+}
+
+// System V argument registers, in order.
+constexpr Reg ArgRegs[6] = {Reg::Rdi, Reg::Rsi, Reg::Rdx, Reg::Rcx, Reg::R8, Reg::R9};
+
+// rax, rdx and r11 are never allocated: rax and rdx belong to idiv and
+// return values, and rax/r11 are the code generator's scratch registers.
+constexpr Reg CallerSavedPool[] = {Reg::Rsi, Reg::Rdi, Reg::R8, Reg::R9, Reg::R10, Reg::Rcx};
+constexpr Reg CalleeSavedPool[] = {Reg::Rbx, Reg::R12, Reg::R13, Reg::R14, Reg::R15};
+
+// Where a value lives: nowhere (unused, or kept in the flags), a register,
+// an rbp-relative stack slot, or an immediate.
+struct Location {
+    enum class Kind : uint8_t { None, Reg, Stack, Imm };
+
+    Kind kind = Kind::None;
+    Reg reg = Reg::Rax;
+    int32_t offset = 0;
+    int64_t imm = 0;
+
+    static Location inReg(Reg reg) {
+        Location loc;
+        loc.kind = Kind::Reg;
+        loc.reg = reg;
+        return loc;
+    }
+    static Location onStack(int32_t offset) {
+        Location loc;
+        loc.kind = Kind::Stack;
+        loc.offset = offset;
+        return loc;
+    }
+    static Location immediate(int64_t imm) {
+        Location loc;
+        loc.kind = Kind::Imm;
+        loc.imm = imm;
+        return loc;
+    }
+
+    bool isReg() const { return kind == Kind::Reg; }
+    bool isReg(Reg r) const { return kind == Kind::Reg && reg == r; }
+    bool isStack() const { return kind == Kind::Stack; }
+    bool isImm() const { return kind == Kind::Imm; }
+
+    bool operator==(const Location& other) const {
+        if (kind != other.kind) return false;
+        switch (kind) {
+            case Kind::None: return true;
+            case Kind::Reg: return reg == other.reg;
+            case Kind::Stack: return offset == other.offset;
+            case Kind::Imm: return imm == other.imm;
+        }
+        return false;
+    }
+    bool operator!=(const Location& other) const { return !(*this == other); }
+};
+
+// Constants that fit a sign-extended 32-bit immediate need no location.
+inline bool isImmediateConstant(const IRFunction& fn, ValueId v) {
+    const IRInst& inst = fn.insts[v];
+    return inst.op == IROp::Const && inst.imm >= INT32_MIN && inst.imm <= INT32_MAX;
+}
+
+struct RegisterAssignment {
+    std::vector<Location> location;  // per value
+    std::vector<Reg> calleeSaved;    // callee-saved registers to preserve (never for the entry)
+    int32_t frameSize = 0;           // bytes below rbp: saved registers, then spill slots; 16-aligned
+    uint32_t spilled = 0;
+};
+
+class RegisterAllocator {
+public:
+    // `inFlags` marks compares whose result never leaves the flags (fused
+    // into the branch after them); they get no location.
+    static RegisterAssignment allocate(const IRFunction& fn, const std::vector<uint8_t>& inFlags) {
+        RegisterAllocator ra(fn, inFlags);
+        ra.number();
+        ra.computeLiveness();
+        ra.buildIntervals();
+        ra.scan();
+        return ra.assign();
+    }
+
+private:
+    // One bit per value.
+    struct ValueSet {
+        std::vector<uint64_t> words;
+
+        explicit ValueSet(size_t count = 0) : words((count + 63) / 64, 0) {}
+        void insert(ValueId v) { words[v / 64] |= uint64_t(1) << (v % 64); }
+        bool unite(const ValueSet& other) {
+            bool grew = false;
+            for (size_t i = 0; i < words.size(); ++i) {
+                uint64_t merged = words[i] | other.words[i];
+                grew |= merged != words[i];
+                words[i] = merged;
+            }
+            return grew;
+        }
+        template<typename Fn>
+        void forEach(Fn&& fn) const {
+            for (size_t i = 0; i < words.size(); ++i) {
+                for (uint64_t w = words[i]; w; w &= w - 1) fn(static_cast<ValueId>(i * 64 + __builtin_ctzll(w)));
+            }
+        }
+    };
+
+    struct Interval {
+        ValueId value = NoValue;
+        uint32_t start = UINT32_MAX, end = 0;
+        double weight = 0;
+        bool crossesCall = false;
+    };
+
+    const IRFunction& fn;
+    const std::vector<uint8_t>& inFlags;
+    std::vector<uint32_t> position;              // per value
+    std::vector<uint32_t> blockStart, blockEnd;  // per block
+    std::vector<uint32_t> depth;                 // loop depth per block
+    std::vector<uint32_t> calls;                 // positions of calls, ascending
+    std::vector<ValueSet> liveIn, liveOut;
+    std::vector<Interval> intervals;             // per value; only those with needsLocation
+    std::vector<Reg> fixedHint;                  // per value; Rsp if none
+    std::vector<std::vector<ValueId>> partners;  // values whose register this one would like to share
+    std::vector<Location> location;
+    std::vector<uint8_t> spilled;
+
+    RegisterAllocator(const IRFunction& fn, const std::vector<uint8_t>& inFlags) : fn(fn), inFlags(inFlags) {}
+
+    bool needsLocation(ValueId v) const {
+        return fn.insts[v].op != IROp::Nop && fn.insts[v].type != IRType::Void && !isImmediateConstant(fn, v) && !inFlags[v];
+    }
+
+    // Phis and params are all written on block (function) entry, so they
+    // are defined at the block's start; every other instruction gets its
+    // own even position, leaving odd positions for "just after".
+    void number() {
+        position.assign(fn.insts.size(), 0);
+        blockStart.assign(fn.blocks.size(), 0);
+        blockEnd.assign(fn.blocks.size(), 0);
+        depth.assign(fn.blocks.size(), 0);
+        uint32_t next = 0;
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            blockStart[b] = next;
+            next += 2;
+            for (ValueId v : fn.blocks[b].insts) {
+                const IRInst& inst = fn.insts[v];
+                if (inst.op == IROp::Phi || inst.op == IROp::Param) {
+                    position[v] = blockStart[b];
+                    continue;
+                }
+                position[v] = next;
+                if (inst.op == IROp::Call) calls.push_back(next);
+                next += 2;
+            }
+            blockEnd[b] = next - 2;
+        }
+        // Blocks are laid out in creation order, so a jump backwards closes a
+        // loop over the blocks between its target and itself. (A profiled
+        // function's blocks are reordered, but its weights use the counts.)
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            for (size_t i = 0; i < fn.successorCount(b); ++i) {
+                BlockId to = fn.successor(b, i);
+                if (to > b) continue;
+                for (BlockId inner = to; inner <= b; ++inner) depth[inner]++;
+            }
+        }
+    }
+
+    void computeLiveness() {
+        size_t count = fn.insts.size();
+        liveIn.assign(fn.blocks.size(), ValueSet(count));
+        liveOut.assign(fn.blocks.size(), ValueSet(count));
+        std::vector<ValueSet> uses(fn.blocks.size(), ValueSet(count)), defs(fn.blocks.size(), ValueSet(count));
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            for (ValueId v : fn.blocks[b].insts) {
+                const IRInst& inst = fn.insts[v];
+                if (inst.op != IROp::Phi) {
+                    fn.forEachOperand(inst, [&](ValueId operand) {
+                        if (needsLocation(operand)) {
+                            bool definedHere = (defs[b].words[operand / 64] >> (operand % 64)) & 1;
+                            if (!definedHere) uses[b].insert(operand);
+                        }
+                    });
+                }
+                defs[b].insert(v);
+            }
+        }
+        std::vector<BlockId> order = LoadForwardPass::reversePostorder(fn);
+        std::reverse(order.begin(), order.end());
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (BlockId b : order) {
+                ValueSet out(count);
+                for (size_t i = 0; i < fn.successorCount(b); ++i) {
+                    BlockId succ = fn.successor(b, i);
+                    out.unite(liveIn[succ]);
+                    for (ValueId v : fn.blocks[succ].insts) {
+                        const IRInst& phi = fn.insts[v];
+                        if (phi.op != IROp::Phi) break;
+                        for (uint32_t k = 0; k < phi.count; ++k) {
+                            if (fn.phiBlock(phi, k) == b && needsLocation(fn.phiValue(phi, k))) out.insert(fn.phiValue(phi, k));
+                        }
+                    }
+                }
+                ValueSet in = out;
+                for (size_t w = 0; w < in.words.size(); ++w) in.words[w] = (in.words[w] & ~defs[b].words[w]) | uses[b].words[w];
+                liveOut[b] = std::move(out);
+                grew |= liveIn[b].unite(in);
+            }
+        }
+    }
+
+    void buildIntervals() {
+        intervals.assign(fn.insts.size(), Interval{});
+        fixedHint.assign(fn.insts.size(), Reg::Rsp);
+        partners.assign(fn.insts.size(), {});
+        auto pair = [&](ValueId a, ValueId b) {
+            if (!needsLocation(a) || !needsLocation(b)) return;
+            partners[a].push_back(b);
+            partners[b].push_back(a);
+        };
+        auto extend = [&](ValueId v, uint32_t pos) {
+            Interval& interval = intervals[v];
+            interval.start = std::min(interval.start, pos);
+            interval.end = std::max(interval.end, pos);
+        };
+        auto weigh = [&](ValueId v, BlockId b) {
+            static const double scale[] = {1, 10, 100, 1000};
+            if (!fn.counts.empty()) intervals[v].weight += 1 + static_cast<double>(fn.counts[b]);
+            else intervals[v].weight += scale[std::min<uint32_t>(depth[b], 3)];
+        };
+        for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+            liveIn[b].forEach([&](ValueId v) { extend(v, blockStart[b]); });
+            liveOut[b].forEach([&](ValueId v) { extend(v, blockEnd[b] + 1); });
+            for (ValueId v : fn.blocks[b].insts) {
+                const IRInst& inst = fn.insts[v];
+                if (needsLocation(v)) {
+                    extend(v, position[v]);
+                    weigh(v, b);
+                }
+                if (inst.op == IROp::Phi) {
+                    for (uint32_t k = 0; k < inst.count; ++k) {
+                        ValueId operand = fn.phiValue(inst, k);
+                        if (needsLocation(operand)) weigh(operand, fn.phiBlock(inst, k));
+                        pair(v, operand);
+                    }
+                    continue;
+                }
+                if (inst.op == IROp::Param && inst.imm < 6) fixedHint[v] = ArgRegs[inst.imm];
+                if (inst.op == IROp::Add || inst.op == IROp::Sub || inst.op == IROp::Mul) pair(v, inst.a);
+                if (inst.op == IROp::Select) pair(v, fn.operands[inst.extra + 2]);
+                if (inst.op == IROp::Call || inst.op == IROp::TailCall) {
+                    for (uint32_t k = 0; k < inst.count && k < 6; ++k) {
+                        ValueId arg = fn.callArg(inst, k);
+                        if (needsLocation(arg) && fixedHint[arg] == Reg::Rsp) fixedHint[arg] = ArgRegs[k];
+                    }
+                }
+                fn.forEachOperand(inst, [&](ValueId operand) {
+                    if (!needsLocation(operand)) return;
+                    extend(operand, position[v]);
+                    weigh(operand, b);
+                });
+            }
+        }
+        for (ValueId v = 0; v < intervals.size(); ++v) {
+            Interval& interval = intervals[v];
+            interval.value = v;
+            if (interval.start > interval.end) continue;
+            auto call = std::upper_bound(calls.begin(), calls.end(), interval.start);
+            interval.crossesCall = call != calls.end() && *call < interval.end;
+        }
+    }
+
+    void scan() {
+        location.assign(fn.insts.size(), Location{});
+        spilled.assign(fn.insts.size(), 0);
+        std::vector<const Interval*> order;
+        for (const Interval& interval : intervals) {
+            if (interval.start <= interval.end) order.push_back(&interval);
+        }
+        std::sort(order.begin(), order.end(), [](const Interval* a, const Interval* b) {
+            return a->start != b->start ? a->start < b->start : a->value < b->value;
+        });
+
+        std::vector<const Interval*> active;
+        uint16_t freeRegs = 0;  // bit per Reg
+        for (Reg r : CallerSavedPool) freeRegs |= uint16_t(1) << static_cast<int>(r);
+        for (Reg r : CalleeSavedPool) freeRegs |= uint16_t(1) << static_cast<int>(r);
+        auto bit = [](Reg r) { return uint16_t(uint16_t(1) << static_cast<int>(r)); };
+
+        for (const Interval* current : order) {
+            // An interval ending where this one starts is only read by the
+            // instruction defining this one, so its register can be reused.
+            active.erase(std::remove_if(active.begin(), active.end(), [&](const Interval* old) {
+                if (old->end > current->start) return false;
+                freeRegs |= bit(location[old->value].reg);
+                return true;
+            }), active.end());
+
+            auto usable = [&](Reg r) {
+                return !current->crossesCall ||
+                       std::find(std::begin(CalleeSavedPool), std::end(CalleeSavedPool), r) != std::end(CalleeSavedPool);
+            };
+            bool found = false;
+            auto take = [&](Reg r) {
+                if (found || !usable(r) || !(freeRegs & bit(r))) return;
+                location[current->value] = Location::inReg(r);
+                freeRegs &= ~bit(r);
+                found = true;
+            };
+            if (fixedHint[current->value] != Reg::Rsp) take(fixedHint[current->value]);
+            for (ValueId partner : partners[current->value]) {
+                if (location[partner].isReg()) take(location[partner].reg);
+            }
+            for (Reg r : CallerSavedPool) take(r);
+            for (Reg r : CalleeSavedPool) take(r);
+            if (found) {
+                active.push_back(current);
+                continue;
+            }
+
+            // Out of registers: spill the cheapest interval that could give
+            // this one a register, or this one if it is the cheapest.
+            const Interval** victim = nullptr;
+            for (const Interval*& candidate : active) {
+                if (!usable(location[candidate->value].reg)) continue;
+                if (!victim || cheaper(*candidate, **victim)) victim = &candidate;
+            }
+            if (victim && cheaper(**victim, *current)) {
+                location[current->value] = location[(*victim)->value];
+                spilled[(*victim)->value] = 1;
+                location[(*victim)->value] = Location{};
+                *victim = current;
+            } else {
+                spilled[current->value] = 1;
+            }
+        }
+    }
+
+    static bool cheaper(const Interval& a, const Interval& b) {
+        double aCost = a.weight / (a.end - a.start + 1), bCost = b.weight / (b.end - b.start + 1);
+        return aCost != bCost ? aCost < bCost : a.end > b.end;
+    }
+
+    RegisterAssignment assign() {
+        RegisterAssignment result;
+        for (ValueId v = 0; v < fn.insts.size(); ++v) {
+            if (fn.insts[v].op != IROp::Nop && isImmediateConstant(fn, v)) location[v] = Location::immediate(fn.insts[v].imm);
+        }
+        if (!fn.isEntry) {
+            for (Reg r : CalleeSavedPool) {
+                bool used = std::any_of(location.begin(), location.end(), [&](const Location& loc) { return loc.isReg(r); });
+                if (used) result.calleeSaved.push_back(r);
+            }
+        }
+        int32_t base = static_cast<int32_t>(8 * result.calleeSaved.size());
+
+        // Spill slots are shared between intervals that do not overlap.
+        std::vector<const Interval*> order;
+        for (ValueId v = 0; v < fn.insts.size(); ++v) {
+            if (!spilled[v]) continue;
+            result.spilled++;
+            const IRInst& inst = fn.insts[v];
+            if (inst.op == IROp::Param && inst.imm >= 6) {
+                location[v] = Location::onStack(static_cast<int32_t>(16 + 8 * (inst.imm - 6)));   // already in the caller's frame
+                continue;
+            }
+            order.push_back(&intervals[v]);
+        }
+        std::sort(order.begin(), order.end(), [](const Interval* a, const Interval* b) { return a->start < b->start; });
+        std::vector<uint32_t> slotFreeAt;   // per slot: end of its last interval
+        for (const Interval* interval : order) {
+            size_t slot = 0;
+            while (slot < slotFreeAt.size() && slotFreeAt[slot] >= interval->start) slot++;
+            if (slot == slotFreeAt.size()) slotFreeAt.push_back(0);
+            slotFreeAt[slot] = interval->end;
+            location[interval->value] = Location::onStack(-(base + static_cast<int32_t>(8 * (slot + 1))));
+        }
+        result.frameSize = (base + static_cast<int32_t>(8 * slotFreeAt.size()) + 15) & ~15;
+        result.location = std::move(location);
+        return result;
+    }
+};
+
+//--------------------------------------------------
+// --- X86-64 MACHINE CODE ---
+//--------------------------------------------------
+// Instruction selection produces X86Inst lists. The NASM printer renders
+// them as text and X86Encoder as bytes, so a function's .asm and its
+// object code are always the same instructions. Jumps inside a function
+// are short when their target is already placed and in range, near
+// otherwise; references that leave the function (globals, jump tables,
+// other functions) come back as fixups for the object linker.
+// The third column is what the instruction does to the flags, for the
+// peephole optimizer.
+#define HYPERLACE_X86_OPS(X)                \
+    X(Mov, "mov", None)                     \
+    X(Movzx, "movzx", None)                 \
+    X(Lea, "lea", None)                     \
+    X(Xor, "xor", Write)                    \
+    X(Add, "add", Write)                    \
+    X(Sub, "sub", Write)                    \
+    X(Inc, "inc", WriteNoCarry)             \
+    X(Dec, "dec", WriteNoCarry)             \
+    X(Imul, "imul", Write)                  \
+    X(Cmp, "cmp", Write)                    \
+    X(Test, "test", Write)                  \
+    X(Cqo, "cqo", None)                     \
+    X(Idiv, "idiv", Write)                  \
+    X(Set, "set", Read)                     \
+    X(Cmov, "cmov", Read)                   \
+    X(Push, "push", None)                   \
+    X(Jmp, "jmp", Unknown)                  \
+    X(J, "j", Read)                         \
+    X(Call, "call", Clobber)                \
+    X(Leave, "leave", None)                 \
+    X(Ret, "ret", Clobber)                  \
+    X(Syscall, "syscall", Clobber)          \
+    X(Label, "", None)                      \
+    X(Entry, "", Unknown)
+
+enum class X86Op : uint8_t {
+#define HYPERLACE_X86_ENUM(Name, Mnemonic, Flags) Name,
+    HYPERLACE_X86_OPS(HYPERLACE_X86_ENUM)
+#undef HYPERLACE_X86_ENUM
+};
+
+// Write: sets every status flag (or leaves them undefined, like idiv).
+// WriteNoCarry: sets all but CF. Clobber: flags are dead afterwards (calls,
+// returns, syscalls). Unknown: control goes elsewhere, assume they are live.
+enum class FlagEffect : uint8_t { None, Read, Write, WriteNoCarry, Clobber, Unknown };
+
+inline FlagEffect x86FlagEffect(X86Op op) {
+    static const FlagEffect effects[] = {
+#define HYPERLACE_X86_FLAGS(Name, Mnemonic, Flags) FlagEffect::Flags,
+        HYPERLACE_X86_OPS(HYPERLACE_X86_FLAGS)
+#undef HYPERLACE_X86_FLAGS
+    };
+    return effects[static_cast<size_t>(op)];
+}
+
+inline const char* x86Mnemonic(X86Op op) {
+    static const char* const names[] = {
+#define HYPERLACE_X86_NAME(Name, Mnemonic, Flags) Mnemonic,
+        HYPERLACE_X86_OPS(HYPERLACE_X86_NAME)
+#undef HYPERLACE_X86_NAME
+    };
+    return names[static_cast<size_t>(op)];
+}
+
+// Condition codes by their encoding, the low nibble of jcc/setcc/cmovcc.
+enum class X86Cond : uint8_t { E = 0x4, NE = 0x5, A = 0x7, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF };
+
+inline const char* condName(X86Cond cc) {
+    switch (cc) {
+        case X86Cond::E: return "e";
+        case X86Cond::NE: return "ne";
+        case X86Cond::A: return "a";
+        case X86Cond::L: return "l";
+        case X86Cond::GE: return "ge";
+        case X86Cond::LE: return "le";
+        case X86Cond::G: return "g";
+    }
+    return "?";
+}
+
+// Where a global lives: a data label plus a byte offset.
+struct DataAddress {
+    SymbolId label = NoSymbol;
+    int64_t offset = 0;
+};
+
+// A register of 64, 32 or 8 bits, an immediate, a quadword in memory
+// ([rbp+disp], [label+disp], [r+rax*8]), a jump table's address, a
+// register plus displacement for lea ([r+disp]), a label inside the
+// function or another function.
+struct X86Operand {
+    enum class Kind : uint8_t { None, Reg, Imm, Stack, Data, Table, Slot, Indirect, Label, Symbol };
+    enum class LabelKind : uint8_t { Block, Edge, Search };   // .b<n>, .e<n>, .s<n>
+
+    Kind kind = Kind::None;
+    uint8_t bits = 64;         // Reg: width
+    bool sized = false;        // Data: written with an explicit qword
+    LabelKind label = LabelKind::Block;
+    Reg reg = Reg::Rax;        // Reg; Slot: base
+    SymbolId symbol = NoSymbol;   // Data: label; Symbol: function
+    int64_t value = 0;         // Imm; Stack/Data: displacement; Table/Label: index
+
+    static X86Operand inReg(Reg reg, uint8_t bits = 64) {
+        X86Operand op;
+        op.kind = Kind::Reg;
+        op.reg = reg;
+        op.bits = bits;
+        return op;
+    }
+    static X86Operand immediate(int64_t value) {
+        X86Operand op;
+        op.kind = Kind::Imm;
+        op.value = value;
+        return op;
+    }
+    static X86Operand onStack(int32_t offset) {
+        X86Operand op;
+        op.kind = Kind::Stack;
+        op.value = offset;
+        return op;
+    }
+    static X86Operand data(DataAddress address, bool sized) {
+        X86Operand op;
+        op.kind = Kind::Data;
+        op.symbol = address.label;
+        op.value = address.offset;
+        op.sized = sized;
+        return op;
+    }
+    static X86Operand table(size_t index) {
+        X86Operand op;
+        op.kind = Kind::Table;
+        op.value = static_cast<int64_t>(index);
+        return op;
+    }
+    static X86Operand slot(Reg base) {
+        X86Operand op;
+        op.kind = Kind::Slot;
+        op.reg = base;
+        return op;
+    }
+    static X86Operand indirect(Reg base, int64_t offset) {
+        X86Operand op;
+        op.kind = Kind::Indirect;
+        op.reg = base;
+        op.value = offset;
+        return op;
+    }
+    static X86Operand at(LabelKind label, size_t index) {
+        X86Operand op;
+        op.kind = Kind::Label;
+        op.label = label;
+        op.value = static_cast<int64_t>(index);
+        return op;
+    }
+    static X86Operand function(SymbolId name) {
+        X86Operand op;
+        op.kind = Kind::Symbol;
+        op.symbol = name;
+        return op;
+    }
+
+    bool is(Kind k) const { return kind == k; }
+    bool isMemory() const {
+        return kind == Kind::Stack || kind == Kind::Data || kind == Kind::Table || kind == Kind::Slot || kind == Kind::Indirect;
+    }
+
+    bool operator==(const X86Operand& other) const {
+        return kind == other.kind && bits == other.bits && sized == other.sized && label == other.label && reg == other.reg &&
+               symbol == other.symbol && value == other.value;
+    }
+    bool operator!=(const X86Operand& other) const { return !(*this == other); }
+};
+
+struct X86Inst {
+    X86Op op;
+    X86Cond cc = X86Cond::E;   // Set, Cmov, J
+    X86Operand a, b, c;
+};
+
+// A 32-bit field the encoder could not fill: the field's final value is
+// target + addend - (address of the field).
+struct MachineFixup {
+    enum class Kind : uint8_t { Data, Table, Call };
+
+    Kind kind;
+    uint32_t offset;        // of the field, from the function's start
+    SymbolId symbol;        // Data: label; Call: function
+    uint32_t table;         // Table: index
+    int64_t addend;
+};
+
+struct MachineCode {
+    SymbolId name = NoSymbol;
+    std::vector<uint8_t> bytes;
+    std::vector<MachineFixup> fixups;
+    std::vector<std::vector<uint32_t>> tables;   // jump table slots, as offsets into bytes
+};
+
+class X86Encoder {
+public:
+    static MachineCode encode(const std::vector<X86Inst>& code, const std::vector<std::vector<X86Operand>>& tables) {
+        X86Encoder encoder;
+        encoder.out.bytes.reserve(code.size() * 4);
+        for (const X86Inst& inst : code) encoder.instruction(inst);
+        for (const Jump& jump : encoder.jumps) encoder.patch(jump.field, encoder.placed(jump.target) - (jump.field + 4));
+        for (const std::vector<X86Operand>& table : tables) {
+            std::vector<uint32_t> slots;
+            for (const X86Operand& target : table) slots.push_back(static_cast<uint32_t>(encoder.placed(target)));
+            encoder.out.tables.push_back(std::move(slots));
+        }
+        return std::move(encoder.out);
+    }
+
+private:
+    using Kind = X86Operand::Kind;
+
+    struct Jump {
+        int64_t field;
+        X86Operand target;
+    };
+
+    MachineCode out;
+    std::vector<int64_t> labels[3];   // per label kind: offset, or -1 until placed
+    std::vector<Jump> jumps;
+
+    static bool fits8(int64_t v) { return v >= INT8_MIN && v <= INT8_MAX; }
+    static bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+    static uint8_t number(Reg r) { return static_cast<uint8_t>(r); }
+
+    int64_t size() const { return static_cast<int64_t>(out.bytes.size()); }
+    void byte(uint8_t b) { out.bytes.push_back(b); }
+    void word(int64_t v, int count) {
+        for (int i = 0; i < count; ++i) byte(static_cast<uint8_t>(static_cast<uint64_t>(v) >> (8 * i)));
+    }
+    void imm32(int64_t v) {
+        if (!fits32(v)) throw std::runtime_error("X86 Encoder Error: immediate " + std::to_string(v) + " does not fit 32 bits");
+        word(v, 4);
+    }
+    void patch(int64_t field, int64_t value) {
+        for (int i = 0; i < 4; ++i) out.bytes[static_cast<size_t>(field + i)] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+    }
+
+    std::vector<int64_t>& slotsFor(const X86Operand& label) { return labels[static_cast<size_t>(label.label)]; }
+    int64_t placed(const X86Operand& label) {
+        std::vector<int64_t>& slots = slotsFor(label);
+        size_t i = static_cast<size_t>(label.value);
+        if (i >= slots.size() || slots[i] < 0) throw std::runtime_error("X86 Encoder Error: jump to a label that is never placed");
+        return slots[i];
+    }
+    void place(const X86Operand& label) {
+        std::vector<int64_t>& slots = slotsFor(label);
+        size_t i = static_cast<size_t>(label.value);
+        if (slots.size() <= i) slots.resize(i + 1, -1);
+        slots[i] = size();
+    }
+
+    // REX.W for 64-bit operands, R and B for r8-r15, and a bare REX so
+    // 8-bit operands 4-7 mean spl/bpl/sil/dil rather than ah/ch/dh/bh.
+    void prefix(bool wide, uint8_t reg, const X86Operand& rm) {
+        bool r = reg >= 8;
+        bool b = (rm.is(Kind::Reg) || rm.is(Kind::Slot) || rm.is(Kind::Indirect)) && number(rm.reg) >= 8;
+        bool lowByte = rm.is(Kind::Reg) && rm.bits == 8 && number(rm.reg) >= 4 && number(rm.reg) < 8;
+        if (wide || r || b || lowByte) byte(static_cast<uint8_t>(0x40 | (wide << 3) | (r << 2) | b));
+    }
+
+    // ModRM (plus SIB and displacement) for `rm`; `trailing` immediate
+    // bytes follow, which RIP-relative displacements have to skip.
+    void modrm(uint8_t reg, const X86Operand& rm, int trailing) {
+        uint8_t r = static_cast<uint8_t>((reg & 7) << 3);
+        switch (rm.kind) {
+            case Kind::Reg:
+                byte(static_cast<uint8_t>(0xC0 | r | (number(rm.reg) & 7)));
+                return;
+            case Kind::Stack:   // [rbp+disp]
+                if (fits8(rm.value)) {
+                    byte(static_cast<uint8_t>(0x45 | r));
+                    word(rm.value, 1);
+                } else {
+                    byte(static_cast<uint8_t>(0x85 | r));
+                    imm32(rm.value);
+                }
+                return;
+            case Kind::Data:    // [rip+disp32]
+                byte(static_cast<uint8_t>(0x05 | r));
+                out.fixups.push_back(MachineFixup{MachineFixup::Kind::Data, static_cast<uint32_t>(size()), rm.symbol, 0, rm.value - 4 - trailing});
+                word(0, 4);
+                return;
+            case Kind::Table:
+                byte(static_cast<uint8_t>(0x05 | r));
+                out.fixups.push_back(MachineFixup{MachineFixup::Kind::Table, static_cast<uint32_t>(size()), NoSymbol,
+                                                  static_cast<uint32_t>(rm.value), -4 - trailing});
+                word(0, 4);
+                return;
+            case Kind::Slot: {  // [base+rax*8]
+                uint8_t base = number(rm.reg) & 7;
+                if (base == 5) {   // rbp/r13 as a base always take a displacement
+                    byte(static_cast<uint8_t>(0x44 | r));
+                    byte(static_cast<uint8_t>(0xC0 | base));
+                    byte(0);
+                } else {
+                    byte(static_cast<uint8_t>(0x04 | r));
+                    byte(static_cast<uint8_t>(0xC0 | base));
+                }
+                return;
+            }
+            case Kind::Indirect: {  // [base+disp]
+                uint8_t base = number(rm.reg) & 7;
+                uint8_t mode = rm.value == 0 && base != 5 ? 0x00 : fits8(rm.value) ? 0x40 : 0x80;
+                byte(static_cast<uint8_t>(mode | r | base));
+                if (base == 4) byte(0x24);   // rsp/r12 as a base need a SIB byte
+                if (mode == 0x40) word(rm.value, 1);
+                else if (mode == 0x80) imm32(rm.value);
+                return;
+            }
+            default:
+                throw std::runtime_error("X86 Encoder Error: operand is not a register or memory");
+        }
+    }
+
+    void rm(std::initializer_list<uint8_t> opcode, bool wide, uint8_t reg, const X86Operand& operand, int trailing = 0) {
+        prefix(wide, reg, operand);
+        for (uint8_t b : opcode) byte(b);
+        modrm(reg, operand, trailing);
+    }
+
+    void movImmediate(Reg r, int64_t value) {
+        X86Operand dst = X86Operand::inReg(r);
+        if (value >= 0 && value <= UINT32_MAX) {   // mov r32, imm32 zero-extends
+            prefix(false, 0, dst);
+            byte(static_cast<uint8_t>(0xB8 | (number(r) & 7)));
+            word(value, 4);
+        } else if (fits32(value)) {
+            rm({0xC7}, true, 0, dst, 4);
+            imm32(value);
+        } else {
+            prefix(true, 0, dst);
+            byte(static_cast<uint8_t>(0xB8 | (number(r) & 7)));
+            word(value, 8);
+        }
+    }
+
+    // add/sub/cmp: `digit` is the group-1 extension, which also picks
+    // the r/m,reg (digit*8+1) and reg,r/m (digit*8+3) opcodes.
+    void arithmetic(uint8_t digit, const X86Operand& a, const X86Operand& b) {
+        if (b.is(Kind::Imm)) {
+            if (fits8(b.value)) {
+                rm({0x83}, true, digit, a, 1);
+                word(b.value, 1);
+            } else {
+                rm({0x81}, true, digit, a, 4);
+                imm32(b.value);
+            }
+        } else if (a.is(Kind::Reg)) {
+            rm({static_cast<uint8_t>(digit << 3 | 0x03)}, true, number(a.reg), b);
+        } else {
+            rm({static_cast<uint8_t>(digit << 3 | 0x01)}, true, number(b.reg), a);
+        }
+    }
+
+    void jump(uint8_t shortOpcode, std::initializer_list<uint8_t> nearOpcode, const X86Operand& target) {
+        std::vector<int64_t>& slots = slotsFor(target);
+        size_t i = static_cast<size_t>(target.value);
+        if (i < slots.size() && slots[i] >= 0 && fits8(slots[i] - (size() + 2))) {
+            byte(shortOpcode);
+            word(slots[i] - (size() + 1), 1);
+            return;
+        }
+        for (uint8_t b : nearOpcode) byte(b);
+        jumps.push_back(Jump{size(), target});
+        word(0, 4);
+    }
+
+    void call(uint8_t opcode, SymbolId target) {
+        byte(opcode);
+        out.fixups.push_back(MachineFixup{MachineFixup::Kind::Call, static_cast<uint32_t>(size()), target, 0, -4});
+        word(0, 4);
+    }
+
+    void instruction(const X86Inst& inst) {
+        const X86Operand &a = inst.a, &b = inst.b, &c = inst.c;
+        uint8_t cc = static_cast<uint8_t>(inst.cc);
+        switch (inst.op) {
+            case X86Op::Entry:
+                out.name = a.symbol;
+                break;
+            case X86Op::Label:
+                place(a);
+                break;
+            case X86Op::Mov:
+                if (a.is(Kind::Reg) && b.is(Kind::Imm)) {
+                    movImmediate(a.reg, b.value);
+                } else if (b.is(Kind::Imm)) {
+                    rm({0xC7}, true, 0, a, 4);
+                    imm32(b.value);
+                } else if (a.is(Kind::Reg)) {
+                    rm({0x8B}, true, number(a.reg), b);
+                } else {
+                    rm({0x89}, true, number(b.reg), a);
+                }
+                break;
+            case X86Op::Movzx:
+                rm({0x0F, 0xB6}, false, number(a.reg), b);
+                break;
+            case X86Op::Lea:
+                rm({0x8D}, true, number(a.reg), b);
+                break;
+            case X86Op::Xor:
+                rm({0x33}, a.bits == 64, number(a.reg), b);
+                break;
+            case X86Op::Add: arithmetic(0, a, b); break;
+            case X86Op::Sub: arithmetic(5, a, b); break;
+            case X86Op::Cmp: arithmetic(7, a, b); break;
+            case X86Op::Inc: rm({0xFF}, true, 0, a); break;
+            case X86Op::Dec: rm({0xFF}, true, 1, a); break;
+            case X86Op::Imul:
+                if (!c.is(Kind::Imm)) {
+                    rm({0x0F, 0xAF}, true, number(a.reg), b);
+                } else if (fits8(c.value)) {
+                    rm({0x6B}, true, number(a.reg), b, 1);
+                    word(c.value, 1);
+                } else {
+                    rm({0x69}, true, number(a.reg), b, 4);
+                    imm32(c.value);
+                }
+                break;
+            case X86Op::Test:
+                rm({0x85}, true, number(b.reg), a);
+                break;
+            case X86Op::Cqo:
+                byte(0x48);
+                byte(0x99);
+                break;
+            case X86Op::Idiv:
+                rm({0xF7}, true, 7, a);
+                break;
+            case X86Op::Set:
+                rm({0x0F, static_cast<uint8_t>(0x90 | cc)}, false, 0, a);
+                break;
+            case X86Op::Cmov:
+                rm({0x0F, static_cast<uint8_t>(0x40 | cc)}, true, number(a.reg), b);
+                break;
+            case X86Op::Push:
+                if (a.is(Kind::Reg)) {
+                    prefix(false, 0, a);
+                    byte(static_cast<uint8_t>(0x50 | (number(a.reg) & 7)));
+                } else if (a.is(Kind::Imm)) {
+                    if (fits8(a.value)) {
+                        byte(0x6A);
+                        word(a.value, 1);
+                    } else {
+                        byte(0x68);
+                        imm32(a.value);
+                    }
+                } else {
+                    rm({0xFF}, false, 6, a);
+                }
+                break;
+            case X86Op::Jmp:
+                if (a.is(Kind::Label)) jump(0xEB, {0xE9}, a);
+                else if (a.is(Kind::Symbol)) call(0xE9, a.symbol);
+                else rm({0xFF}, false, 4, a);
+                break;
+            case X86Op::J:
+                jump(static_cast<uint8_t>(0x70 | cc), {0x0F, static_cast<uint8_t>(0x80 | cc)}, a);
+                break;
+            case X86Op::Call:
+                call(0xE8, a.symbol);
+                break;
+            case X86Op::Leave: byte(0xC9); break;
+            case X86Op::Ret: byte(0xC3); break;
+            case X86Op::Syscall:
+                byte(0x0F);
+                byte(0x05);
+                break;
+        }
+    }
+};
+
+// A relocatable object in memory: section contents, symbols, and the
+// relocations left for the linker. Relocations point either at a section
+// of this object plus the addend or at a symbol defined elsewhere.
+struct ObjectFile {
+    enum class Section : uint8_t { Text, Data, Rodata };
+    enum class RelocType : uint32_t { Abs64 = 1, Pc32 = 2, Plt32 = 4 };   // R_X86_64_*
+
+    struct Symbol {
+        std::string name;
+        Section section;
+        uint64_t offset, size;
+        bool global, function;
+    };
+    struct Relocation {
+        Section section;     // where the field is
+        uint64_t offset;
+        RelocType type;
+        Section target;      // unless `external` names the symbol
+        std::string external;
+        int64_t addend;
+    };
+
+    std::vector<uint8_t> text, data, rodata;
+    uint64_t dataAlign = 8;
+    std::vector<Symbol> symbols;
+    std::vector<Relocation> relocations;
+};
+
+//--------------------------------------------------
+// --- ELF64 OBJECT WRITER ---
+//--------------------------------------------------
+// Writes an ObjectFile as a relocatable x86-64 ELF64 object (ET_REL):
+// .text, .data, .rodata, their RELA sections, a symbol table and an empty
+// .note.GNU-stack so linkers keep the stack non-executable. Section
+// symbols come first among the locals, so section-relative relocations
+// refer to them; symbols from other objects are undefined globals.
+class ELFWriter {
+public:
+    static void write(const ObjectFile& object, const std::string& path) {
+        std::vector<uint8_t> image = build(object);
+        std::ofstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error("Failed to write object file.");
+        file.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+    }
+
+    static std::vector<uint8_t> build(const ObjectFile& object) {
+        using Section = ObjectFile::Section;
+        enum : uint32_t { Null, Text, Data, Rodata, Symtab, Strtab, RelaText, RelaData, RelaRodata, Note, Shstrtab, Count };
+        static const char* const names[Count] = {"", ".text", ".data", ".rodata", ".symtab", ".strtab",
+                                                 ".rela.text", ".rela.data", ".rela.rodata", ".note.GNU-stack", ".shstrtab"};
+
+        // Symbol table: null, the three section symbols, locals, globals.
+        std::vector<uint8_t> symtab(24, 0), strtab(1, 0);
+        auto symbol = [&](std::string_view name, uint8_t info, uint16_t section, uint64_t value, uint64_t size) {
+            uint32_t at = 0;
+            if (!name.empty()) {
+                at = static_cast<uint32_t>(strtab.size());
+                strtab.insert(strtab.end(), name.begin(), name.end());
+                strtab.push_back(0);
+            }
+            put(symtab, at, 4);
+            put(symtab, info, 1);
+            put(symtab, 0, 1);
+            put(symtab, section, 2);
+            put(symtab, value, 8);
+            put(symtab, size, 8);
+        };
+        auto index = [](Section section) { return static_cast<uint16_t>(Text + static_cast<uint32_t>(section)); };
+        for (Section s : {Section::Text, Section::Data, Section::Rodata}) symbol("", 3 /* STB_LOCAL, STT_SECTION */, index(s), 0, 0);
+        uint32_t firstGlobal = 0;
+        for (bool global : {false, true}) {
+            if (global) firstGlobal = static_cast<uint32_t>(symtab.size() / 24);
+            for (const ObjectFile::Symbol& s : object.symbols) {
+                // STB_GLOBAL in the high nibble; STT_FUNC or STT_OBJECT
+                if (s.global == global) symbol(s.name, static_cast<uint8_t>((global ? 0x10 : 0) | (s.function ? 2 : 1)), index(s.section), s.offset, s.size);
+            }
+        }
+
+        std::unordered_map<std::string, uint32_t> externals;
+        for (const ObjectFile::Relocation& r : object.relocations) {
+            if (r.external.empty() || externals.count(r.external)) continue;
+            externals[r.external] = static_cast<uint32_t>(symtab.size() / 24);
+            symbol(r.external, 0x10 /* STB_GLOBAL, STT_NOTYPE */, 0, 0, 0);
+        }
+
+        std::vector<uint8_t> rela[3];
+        for (const ObjectFile::Relocation& r : object.relocations) {
+            uint64_t sym = r.external.empty() ? 1 + static_cast<uint32_t>(r.target) : externals[r.external];
+            std::vector<uint8_t>& out = rela[static_cast<size_t>(r.section)];
+            put(out, r.offset, 8);
+            put(out, sym << 32 | static_cast<uint32_t>(r.type), 8);
+            put(out, static_cast<uint64_t>(r.addend), 8);
+        }
+
+        std::vector<uint8_t> shstrtab(1, 0);
+        uint32_t nameAt[Count] = {};
+        for (uint32_t s = 1; s < Count; ++s) {
+            nameAt[s] = static_cast<uint32_t>(shstrtab.size());
+            shstrtab.insert(shstrtab.end(), names[s], names[s] + std::strlen(names[s]));
+            shstrtab.push_back(0);
+        }
+
+        struct Header {
+            uint32_t type;
+            uint64_t flags;
+            const std::vector<uint8_t>* bytes;
+            uint32_t link, info;
+            uint64_t align, entsize;
+            uint64_t offset = 0;
+        };
+        const std::vector<uint8_t> none;
+        Header sections[Count] = {
+            {0, 0, &none, 0, 0, 0, 0},
+            {1 /* PROGBITS */, 0x6 /* ALLOC|EXEC */, &object.text, 0, 0, 16, 0},
+            {1, 0x3 /* WRITE|ALLOC */, &object.data, 0, 0, object.dataAlign, 0},
+            {1, 0x2 /* ALLOC */, &object.rodata, 0, 0, 8, 0},
+            {2 /* SYMTAB */, 0, &symtab, Strtab, firstGlobal, 8, 24},
+            {3 /* STRTAB */, 0, &strtab, 0, 0, 1, 0},
+            {4 /* RELA */, 0x40 /* INFO_LINK */, &rela[0], Symtab, Text, 8, 24},
+            {4, 0x40, &rela[1], Symtab, Data, 8, 24},
+            {4, 0x40, &rela[2], Symtab, Rodata, 8, 24},
+            {1, 0, &none, 0, 0, 1, 0},
+            {3, 0, &shstrtab, 0, 0, 1, 0},
+        };
+
+        std::vector<uint8_t> image(64, 0);
+        for (uint32_t s = 1; s < Count; ++s) {
+            image.resize((image.size() + sections[s].align - 1) / sections[s].align * sections[s].align, 0);
+            sections[s].offset = image.size();
+            image.insert(image.end(), sections[s].bytes->begin(), sections[s].bytes->end());
+        }
+        image.resize((image.size() + 7) / 8 * 8, 0);
+        uint64_t headers = image.size();
+        for (uint32_t s = 0; s < Count; ++s) {
+            const Header& h = sections[s];
+            put(image, nameAt[s], 4);
+            put(image, h.type, 4);
+            put(image, h.flags, 8);
+            put(image, 0, 8);   // address
+            put(image, s ? h.offset : 0, 8);
+            put(image, h.bytes->size(), 8);
+            put(image, h.link, 4);
+            put(image, h.info, 4);
+            put(image, h.align, 8);
+            put(image, h.entsize, 8);
+        }
+
+        static const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* little endian */, 1 /* version */};
+        std::vector<uint8_t> header(ident, ident + 16);
+        put(header, 1, 2);     // ET_REL
+        put(header, 62, 2);    // EM_X86_64
+        put(header, 1, 4);     // version
+        put(header, 0, 8);     // entry
+        put(header, 0, 8);     // program headers
+        put(header, headers, 8);
+        put(header, 0, 4);     // flags
+        put(header, 64, 2);    // header size
+        put(header, 0, 2);
+        put(header, 0, 2);
+        put(header, 64, 2);    // section header size
+        put(header, Count, 2);
+        put(header, Shstrtab, 2);
+        std::copy(header.begin(), header.end(), image.begin());
+        return image;
+    }
+
+private:
+    static void put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+};
+
+// Reads an object ELFWriter wrote back into an ObjectFile, as --jit does
+// with programs from the compile cache. Relocations against a defined
+// symbol come back relative to its section; anything malformed throws.
+class ELFReader {
+public:
+    static ObjectFile read(std::string_view image) {
+        using Section = ObjectFile::Section;
+        auto get = [&](uint64_t at, int bytes) {
+            if (at + bytes > image.size()) throw std::runtime_error("Object Error: truncated ELF image");
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; ++i) value |= static_cast<uint64_t>(static_cast<uint8_t>(image[at + i])) << (8 * i);
+            return value;
+        };
+        if (image.size() < 64 || image.substr(0, 4) != "\x7F" "ELF" || get(16, 2) != 1 || get(18, 2) != 62)
+            throw std::runtime_error("Object Error: not an x86-64 relocatable ELF image");
+
+        struct Header {
+            uint64_t name, type, offset, size, link, info, align;
+        };
+        uint64_t at = get(40, 8), count = get(60, 2);
+        std::vector<Header> headers;
+        for (uint64_t i = 0; i < count; ++i, at += 64)
+            headers.push_back({get(at, 4), get(at + 4, 4), get(at + 24, 8), get(at + 32, 8), get(at + 40, 4), get(at + 44, 4), get(at + 48, 8)});
+        auto bytes = [&](const Header& h) {
+            if (h.offset + h.size > image.size()) throw std::runtime_error("Object Error: truncated ELF image");
+            return image.substr(h.offset, h.size);
+        };
+        std::string_view names = bytes(headers.at(get(62, 2)));
+        auto name = [](std::string_view table, uint64_t offset) {
+            if (offset >= table.size()) throw std::runtime_error("Object Error: bad string table offset");
+            return std::string(table.substr(offset, table.find('\0', offset) - offset));
+        };
+
+        ObjectFile object;
+        std::vector<int> sectionOf(count, -1);   // header index -> Section
+        std::vector<uint8_t>* contents[] = {&object.text, &object.data, &object.rodata};
+        static const char* const known[] = {".text", ".data", ".rodata"};
+        uint64_t symtab = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            std::string section = name(names, headers[i].name);
+            for (int s = 0; s < 3; ++s) {
+                if (section != known[s]) continue;
+                sectionOf[i] = s;
+                std::string_view data = bytes(headers[i]);
+                contents[s]->assign(data.begin(), data.end());
+                if (s == static_cast<int>(Section::Data)) object.dataAlign = std::max<uint64_t>(headers[i].align, 1);
+            }
+            if (headers[i].type == 2) symtab = i;
+        }
+        if (!symtab) throw std::runtime_error("Object Error: ELF image has no symbol table");
+
+        struct Sym {
+            std::string name;
+            int section;
+            uint64_t value;
+        };
+        std::vector<Sym> symbols;
+        std::string_view strings = bytes(headers.at(headers[symtab].link));
+        for (uint64_t s = headers[symtab].offset, end = s + headers[symtab].size; s + 24 <= end; s += 24) {
+            uint64_t info = get(s + 4, 1), shndx = get(s + 6, 2);
+            Sym sym{name(strings, get(s, 4)), shndx < count ? sectionOf[shndx] : -1, get(s + 8, 8)};
+            symbols.push_back(sym);
+            if (sym.section < 0 || (info & 0xF) == 3 || sym.name.empty()) continue;   // undefined, or a section symbol
+            object.symbols.push_back({sym.name, static_cast<Section>(sym.section), sym.value, get(s + 16, 8), (info >> 4) == 1, (info & 0xF) == 2});
+        }
+
+        for (uint64_t i = 0; i < count; ++i) {
+            if (headers[i].type != 4 || headers[i].info >= count || sectionOf[headers[i].info] < 0) continue;
+            for (uint64_t r = headers[i].offset, end = r + headers[i].size; r + 24 <= end; r += 24) {
+                uint64_t info = get(r + 8, 8);
+                const Sym& sym = symbols.at(info >> 32);
+                ObjectFile::Relocation reloc{static_cast<Section>(sectionOf[headers[i].info]), get(r, 8),
+                                             static_cast<ObjectFile::RelocType>(info & 0xFFFFFFFF), Section::Text, {},
+                                             static_cast<int64_t>(get(r + 16, 8))};
+                if (sym.section < 0) {
+                    reloc.external = sym.name;
+                } else {
+                    reloc.target = static_cast<Section>(sym.section);
+                    reloc.addend += static_cast<int64_t>(sym.value);
+                }
+                object.relocations.push_back(std::move(reloc));
+            }
+        }
+        return object;
+    }
+};
+
+//--------------------------------------------------
+// --- X86-64 PEEPHOLE OPTIMIZER ---
+//--------------------------------------------------
+// Cleans up a lowered function's instruction list before it is printed or
+// encoded. Each rule in HYPERLACE_PEEPHOLE_RULES is one forward scan over
+// the list; they run in table order, round after round, until none fires:
+//   redundant-load  mov r, [m] when a register already holds [m]
+//   dead-store      mov [m], x overwritten before anything can read [m]
+//   self-move       mov r, r
+//   zero-xor        mov r, 0 -> xor r32, r32
+//   test-zero       cmp r, 0 -> test r, r
+//   add-zero        add/sub x, 0
+//   lea             mov a, b; add a, k -> lea a, [b+k]
+//   inc             add/sub r, 1 -> inc/dec r
+//   jump-thread     a jump to a jmp goes straight to its target
+//   branch-invert   jcc L; jmp M; L: -> jncc M; L:
+//   jump-next       a jump to the instruction right after it
+//   unreachable     code after jmp/ret up to the next label jumped to
+// What an instruction does to the flags comes from the flag column of
+// HYPERLACE_X86_OPS; rewrites that change flags only happen when the
+// flags are overwritten before they are read. Values remembered across
+// instructions (which register holds which quadword) are forgotten at
+// every label, call and syscall, so every rewrite rests on straight-line
+// code.
+#define HYPERLACE_PEEPHOLE_RULES(X)                 \
+    X(RedundantLoad, "redundant-load", redundantLoad) \
+    X(DeadStore, "dead-store", deadStore)             \
+    X(SelfMove, "self-move", selfMove)                \
+    X(ZeroXor, "zero-xor", zeroXor)                   \
+    X(TestZero, "test-zero", testZero)                \
+    X(AddZero, "add-zero", addZero)                   \
+    X(CopyAdd, "lea", copyAdd)                        \
+    X(Increment, "inc", increment)                    \
+    X(JumpThread, "jump-thread", jumpThread)          \
+    X(BranchInvert, "branch-invert", branchInvert)    \
+    X(JumpNext, "jump-next", jumpNext)                \
+    X(Unreachable, "unreachable", unreachable)
+
+enum class PeepholeRule : uint8_t {
+#define HYPERLACE_PEEPHOLE_ENUM(Name, Text, Apply) Name,
+    HYPERLACE_PEEPHOLE_RULES(HYPERLACE_PEEPHOLE_ENUM)
+#undef HYPERLACE_PEEPHOLE_ENUM
+    Count
+};
+
+constexpr size_t PeepholeRuleCount = static_cast<size_t>(PeepholeRule::Count);
+
+inline const char* peepholeRuleName(size_t rule) {
+    static const char* const names[] = {
+#define HYPERLACE_PEEPHOLE_NAME(Name, Text, Apply) Text,
+        HYPERLACE_PEEPHOLE_RULES(HYPERLACE_PEEPHOLE_NAME)
+#undef HYPERLACE_PEEPHOLE_NAME
+    };
+    return names[rule];
+}
+
+// How often each rule fired.
+struct PeepholeCounts {
+    uint32_t fired[PeepholeRuleCount] = {};
+
+    PeepholeCounts& operator+=(const PeepholeCounts& other) {
+        for (size_t i = 0; i < PeepholeRuleCount; ++i) fired[i] += other.fired[i];
+        return *this;
+    }
+    uint32_t total() const {
+        uint32_t sum = 0;
+        for (uint32_t n : fired) sum += n;
+        return sum;
+    }
+};
+
+class PeepholeOptimizer {
+public:
+    static PeepholeCounts run(std::vector<X86Inst>& code, std::vector<std::vector<X86Operand>>& tables) {
+        PeepholeOptimizer peephole(code, tables);
+        for (int round = 0; round < MaxRounds; ++round) {
+            uint32_t before = peephole.counts.total();
+#define HYPERLACE_PEEPHOLE_APPLY(Name, Text, Apply) peephole.apply(PeepholeRule::Name, &PeepholeOptimizer::Apply);
+            HYPERLACE_PEEPHOLE_RULES(HYPERLACE_PEEPHOLE_APPLY)
+#undef HYPERLACE_PEEPHOLE_APPLY
+            if (peephole.counts.total() == before) break;
+        }
+        return peephole.counts;
+    }
+
+private:
+    using Kind = X86Operand::Kind;
+    static constexpr int MaxRounds = 8;
+    static constexpr int MaxHops = 8;          // jump threading chain length
+    static constexpr size_t Window = 64;       // forward scans give up after this many instructions
+
+    std::vector<X86Inst>& code;
+    std::vector<std::vector<X86Operand>>& tables;
+    std::vector<uint8_t> removed;
+    std::vector<size_t> labelAt[3];   // per label kind (see X86Encoder): where it is placed
+    PeepholeCounts counts;
+
+    PeepholeOptimizer(std::vector<X86Inst>& code, std::vector<std::vector<X86Operand>>& tables) : code(code), tables(tables) {}
+
+    // Runs one rule; instructions it removed are swept out afterwards.
+    void apply(PeepholeRule rule, uint32_t (PeepholeOptimizer::*scan)()) {
+        removed.assign(code.size(), 0);
+        placeLabels();
+        uint32_t fired = (this->*scan)();
+        counts.fired[static_cast<size_t>(rule)] += fired;
+        if (!fired) return;
+        size_t out = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            if (!removed[i]) code[out++] = code[i];
+        }
+        code.resize(out);
+    }
+
+    void remove(size_t i) { removed[i] = 1; }
+
+    // The next instruction at or after `i` that is still there.
+    size_t live(size_t i) const {
+        while (i < code.size() && removed[i]) ++i;
+        return i;
+    }
+
+    static bool isReg64(const X86Operand& op) { return op.is(Kind::Reg) && op.bits == 64; }
+    static bool isImm(const X86Operand& op, int64_t value) { return op.is(Kind::Imm) && op.value == value; }
+
+    // A quadword the tracking rules can name: a stack slot or a global.
+    static bool trackable(const X86Operand& op) { return op.is(Kind::Stack) || op.is(Kind::Data); }
+
+    static bool sameMemory(const X86Operand& a, const X86Operand& b) {
+        return a.kind == b.kind && a.value == b.value && a.symbol == b.symbol;
+    }
+
+    // Whether a write to `written` may change `other`. Globals are compared
+    // by label only, so a store into a struct never hides behind a field
+    // offset; [r+rax*8] may be anywhere.
+    static bool mayAlias(const X86Operand& written, const X86Operand& other) {
+        if (written.is(Kind::Slot) || other.is(Kind::Slot)) return true;
+        if (written.kind != other.kind) return false;
+        if (written.is(Kind::Data)) return written.symbol == other.symbol;
+        return written.value == other.value;
+    }
+
+    // Whether `inst` writes its first operand (rather than only reading it).
+    static bool writesFirst(X86Op op) {
+        switch (op) {
+            case X86Op::Mov: case X86Op::Movzx: case X86Op::Lea: case X86Op::Xor: case X86Op::Add:
+            case X86Op::Sub: case X86Op::Inc: case X86Op::Dec: case X86Op::Imul: case X86Op::Set: case X86Op::Cmov:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Whether `inst` reads memory that `cell` may occupy.
+    static bool readsMemory(const X86Inst& inst, const X86Operand& cell) {
+        if (inst.op == X86Op::Lea) return false;
+        bool firstRead = inst.op != X86Op::Mov && inst.op != X86Op::Movzx && inst.op != X86Op::Set;
+        if (firstRead && inst.a.isMemory() && mayAlias(inst.a, cell)) return true;
+        return (inst.b.isMemory() && mayAlias(inst.b, cell)) || (inst.c.isMemory() && mayAlias(inst.c, cell));
+    }
+
+    // Whether control may leave straight-line code at `inst`.
+    static bool endsRun(X86Op op) {
+        switch (op) {
+            case X86Op::Label: case X86Op::Entry: case X86Op::Jmp: case X86Op::J: case X86Op::Call:
+            case X86Op::Ret: case X86Op::Leave: case X86Op::Syscall:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Whether the flags (only CF, if `carryOnly`) set at `i` are never read.
+    // A jmp to a label is followed; labelAt must be current.
+    bool flagsDeadAfter(size_t i, bool carryOnly) const {
+        size_t scanned = 0;
+        for (size_t j = live(i + 1); j < code.size(); j = live(j + 1)) {
+            if (++scanned > Window) return false;
+            if (code[j].op == X86Op::Jmp && code[j].a.is(Kind::Label)) {
+                j = target(code[j].a);
+                if (j >= code.size()) return false;
+                j = live(j);
+                if (j >= code.size()) return true;
+            }
+            switch (x86FlagEffect(code[j].op)) {
+                case FlagEffect::None:
+                    break;
+                case FlagEffect::Read:
+                    if (!carryOnly || code[j].cc == X86Cond::A) return false;
+                    break;
+                case FlagEffect::WriteNoCarry:
+                    if (!carryOnly) return true;
+                    break;
+                case FlagEffect::Write:
+                case FlagEffect::Clobber:
+                    return true;
+                case FlagEffect::Unknown:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // mov r, [m] where some register already holds [m]: dropped, or turned
+    // into a register move.
+    uint32_t redundantLoad() {
+        uint32_t fired = 0;
+        X86Operand held[16];   // per register: the memory it equals, or None
+        auto forget = [&]() {
+            for (X86Operand& h : held) h = X86Operand();
+        };
+        auto clobber = [&](Reg r) { held[static_cast<size_t>(r)] = X86Operand(); };
+        for (size_t i = 0; i < code.size(); ++i) {
+            X86Inst& inst = code[i];
+            if (endsRun(inst.op) && inst.op != X86Op::J) {
+                forget();
+                continue;
+            }
+            if (inst.op == X86Op::Mov && isReg64(inst.a) && trackable(inst.b)) {
+                const X86Operand cell = inst.b;
+                size_t dst = static_cast<size_t>(inst.a.reg);
+                int source = -1;
+                for (size_t r = 0; r < 16; ++r) {
+                    if (held[r].kind != Kind::None && sameMemory(held[r], cell)) {
+                        source = static_cast<int>(r);
+                        if (r == dst) break;
+                    }
+                }
+                if (source == static_cast<int>(dst)) {
+                    remove(i);
+                    fired++;
+                    continue;
+                }
+                if (source >= 0) {
+                    inst.b = X86Operand::inReg(static_cast<Reg>(source));
+                    fired++;
+                }
+                held[dst] = cell;
+                continue;
+            }
+            if (inst.a.isMemory() && writesFirst(inst.op)) {
+                for (X86Operand& h : held) {
+                    if (h.kind != Kind::None && mayAlias(inst.a, h)) h = X86Operand();
+                }
+                if (inst.op == X86Op::Mov && isReg64(inst.b) && trackable(inst.a)) held[static_cast<size_t>(inst.b.reg)] = inst.a;
+                continue;
+            }
+            if (inst.op == X86Op::Push) {
+                for (X86Operand& h : held) {
+                    if (h.is(Kind::Stack)) h = X86Operand();
+                }
+            }
+            if (inst.op == X86Op::Cqo || inst.op == X86Op::Idiv) clobber(Reg::Rdx);
+            if (inst.op == X86Op::Idiv) clobber(Reg::Rax);
+            if (inst.a.is(Kind::Reg) && writesFirst(inst.op)) {
+                clobber(inst.a.reg);
+                if (inst.a.reg == Reg::Rbp) forget();
+            }
+        }
+        return fired;
+    }
+
+    // mov [m], x followed by another store to [m] before anything could
+    // read it.
+    uint32_t deadStore() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            const X86Inst& store = code[i];
+            if (store.op != X86Op::Mov || !trackable(store.a)) continue;
+            for (size_t j = i + 1; j < code.size() && j <= i + Window; ++j) {
+                const X86Inst& next = code[j];
+                if (endsRun(next.op) || readsMemory(next, store.a)) break;
+                if (next.op == X86Op::Mov && next.a.isMemory() && sameMemory(next.a, store.a)) {
+                    remove(i);
+                    fired++;
+                    break;
+                }
+            }
+        }
+        return fired;
+    }
+
+    uint32_t selfMove() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            const X86Inst& inst = code[i];
+            if (inst.op == X86Op::Mov && isReg64(inst.a) && inst.b == inst.a) {
+                remove(i);
+                fired++;
+            }
+        }
+        return fired;
+    }
+
+    // The 32-bit xor is shorter and zero-extends, but it also sets flags.
+    uint32_t zeroXor() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            X86Inst& inst = code[i];
+            if (inst.op != X86Op::Mov || !isReg64(inst.a) || !isImm(inst.b, 0) || !flagsDeadAfter(i, false)) continue;
+            inst.op = X86Op::Xor;
+            inst.a = inst.b = X86Operand::inReg(inst.a.reg, 32);
+            fired++;
+        }
+        return fired;
+    }
+
+    // test r, r sets the flags exactly as cmp r, 0 does, without the immediate.
+    uint32_t testZero() {
+        uint32_t fired = 0;
+        for (X86Inst& inst : code) {
+            if (inst.op != X86Op::Cmp || !isReg64(inst.a) || !isImm(inst.b, 0)) continue;
+            inst.op = X86Op::Test;
+            inst.b = inst.a;
+            fired++;
+        }
+        return fired;
+    }
+
+    uint32_t addZero() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            const X86Inst& inst = code[i];
+            if ((inst.op == X86Op::Add || inst.op == X86Op::Sub) && isImm(inst.b, 0) && flagsDeadAfter(i, false)) {
+                remove(i);
+                fired++;
+            }
+        }
+        return fired;
+    }
+
+    // mov a, b; add a, k (or sub) is one lea when the flags are not needed.
+    uint32_t copyAdd() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i + 1 < code.size(); ++i) {
+            const X86Inst& copy = code[i];
+            X86Inst& add = code[i + 1];
+            if (copy.op != X86Op::Mov || !isReg64(copy.a) || !isReg64(copy.b) || copy.a == copy.b) continue;
+            if ((add.op != X86Op::Add && add.op != X86Op::Sub) || add.a != copy.a || !add.b.is(Kind::Imm)) continue;
+            int64_t offset = add.op == X86Op::Add ? add.b.value : -add.b.value;
+            if (offset < INT32_MIN || offset > INT32_MAX || !flagsDeadAfter(i + 1, false)) continue;
+            add.op = X86Op::Lea;
+            add.b = X86Operand::indirect(copy.b.reg, offset);
+            remove(i);
+            fired++;
+            ++i;
+        }
+        return fired;
+    }
+
+    // inc/dec are a byte shorter than add/sub r, 1 but leave CF alone.
+    uint32_t increment() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            X86Inst& inst = code[i];
+            if ((inst.op != X86Op::Add && inst.op != X86Op::Sub) || !isReg64(inst.a) || !inst.b.is(Kind::Imm)) continue;
+            int64_t step = inst.op == X86Op::Add ? inst.b.value : -inst.b.value;
+            if ((step != 1 && step != -1) || !flagsDeadAfter(i, true)) continue;
+            inst.op = step == 1 ? X86Op::Inc : X86Op::Dec;
+            inst.b = X86Operand();
+            fired++;
+        }
+        return fired;
+    }
+
+    void placeLabels() {
+        for (std::vector<size_t>& slots : labelAt) slots.clear();
+        for (size_t i = 0; i < code.size(); ++i) {
+            if (code[i].op != X86Op::Label) continue;
+            std::vector<size_t>& slots = labelAt[static_cast<size_t>(code[i].a.label)];
+            size_t index = static_cast<size_t>(code[i].a.value);
+            if (slots.size() <= index) slots.resize(index + 1, SIZE_MAX);
+            slots[index] = i;
+        }
+    }
+
+    // The first instruction executed after jumping to `label`.
+    size_t target(const X86Operand& label) const {
+        const std::vector<size_t>& slots = labelAt[static_cast<size_t>(label.label)];
+        size_t index = static_cast<size_t>(label.value);
+        if (index >= slots.size() || slots[index] == SIZE_MAX) return code.size();
+        size_t i = slots[index];
+        while (i < code.size() && code[i].op == X86Op::Label) ++i;
+        return i;
+    }
+
+    // Follows a label through unconditional jumps; true if it moved.
+    bool thread(X86Operand& label) const {
+        bool moved = false;
+        for (int hop = 0; hop < MaxHops; ++hop) {
+            size_t i = target(label);
+            if (i >= code.size() || code[i].op != X86Op::Jmp || !code[i].a.is(Kind::Label) || code[i].a == label) break;
+            label = code[i].a;
+            moved = true;
+        }
+        return moved;
+    }
+
+    uint32_t jumpThread() {
+        uint32_t fired = 0;
+        for (X86Inst& inst : code) {
+            if ((inst.op == X86Op::Jmp || inst.op == X86Op::J) && inst.a.is(Kind::Label) && thread(inst.a)) fired++;
+        }
+        for (std::vector<X86Operand>& table : tables) {
+            for (X86Operand& slot : table) {
+                if (thread(slot)) fired++;
+            }
+        }
+        return fired;
+    }
+
+    // Whether `label` is placed among the labels starting at `i`.
+    bool labelFollows(size_t i, const X86Operand& label) const {
+        for (; i < code.size() && code[i].op == X86Op::Label; ++i) {
+            if (code[i].a == label) return true;
+        }
+        return false;
+    }
+
+    static bool invert(X86Cond& cc) {
+        switch (cc) {
+            case X86Cond::E: cc = X86Cond::NE; return true;
+            case X86Cond::NE: cc = X86Cond::E; return true;
+            case X86Cond::L: cc = X86Cond::GE; return true;
+            case X86Cond::GE: cc = X86Cond::L; return true;
+            case X86Cond::LE: cc = X86Cond::G; return true;
+            case X86Cond::G: cc = X86Cond::LE; return true;
+            case X86Cond::A: return false;   // jbe is never emitted; leave it
+        }
+        return false;
+    }
+
+    // jcc L; jmp M; L: becomes jncc M; L:
+    uint32_t branchInvert() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i + 2 < code.size(); ++i) {
+            X86Inst& branch = code[i];
+            const X86Inst& jump = code[i + 1];
+            if (branch.op != X86Op::J || jump.op != X86Op::Jmp || !jump.a.is(Kind::Label) || !labelFollows(i + 2, branch.a)) continue;
+            X86Cond cc = branch.cc;
+            if (!invert(cc)) continue;
+            branch.cc = cc;
+            branch.a = jump.a;
+            remove(i + 1);
+            fired++;
+            ++i;
+        }
+        return fired;
+    }
+
+    uint32_t jumpNext() {
+        uint32_t fired = 0;
+        for (size_t i = 0; i + 1 < code.size(); ++i) {
+            const X86Inst& jump = code[i];
+            if ((jump.op == X86Op::Jmp || jump.op == X86Op::J) && jump.a.is(Kind::Label) && labelFollows(i + 1, jump.a)) {
+                remove(i);
+                fired++;
+            }
+        }
+        return fired;
+    }
+
+    // Everything after jmp/ret up to the next label something jumps to.
+    uint32_t unreachable() {
+        std::vector<uint8_t> referenced[3];
+        auto mark = [&](const X86Operand& label) {
+            std::vector<uint8_t>& seen = referenced[static_cast<size_t>(label.label)];
+            size_t index = static_cast<size_t>(label.value);
+            if (seen.size() <= index) seen.resize(index + 1, 0);
+            seen[index] = 1;
+        };
+        auto isReferenced = [&](const X86Operand& label) {
+            const std::vector<uint8_t>& seen = referenced[static_cast<size_t>(label.label)];
+            size_t index = static_cast<size_t>(label.value);
+            return index < seen.size() && seen[index];
+        };
+        for (const X86Inst& inst : code) {
+            if (inst.a.is(Kind::Label) && inst.op != X86Op::Label) mark(inst.a);
+        }
+        for (const std::vector<X86Operand>& table : tables) {
+            for (const X86Operand& slot : table) mark(slot);
+        }
+        uint32_t fired = 0;
+        bool dead = false;
+        for (size_t i = 0; i < code.size(); ++i) {
+            const X86Inst& inst = code[i];
+            if (inst.op == X86Op::Entry || (inst.op == X86Op::Label && isReferenced(inst.a))) dead = false;
+            if (dead) {
+                remove(i);
+                if (inst.op != X86Op::Label) fired++;
+                continue;
+            }
+            if (inst.op == X86Op::Jmp || inst.op == X86Op::Ret) dead = true;
+        }
+        return fired;
+    }
+};
+
+//--------------------------------------------------
+// --- NASM CODE GENERATOR ---
+//--------------------------------------------------
+// Lowers the IR to x86-64 instructions using the register allocator's
+// locations, then prints them as NASM or encodes them into an object (see
+// X86-64 MACHINE CODE). Constants that fit in 32 bits are used as
+// immediates, and a compare that only feeds the branch right after it
+// becomes cmp + jcc. Phis are resolved by parallel copies on the incoming
+// edges (via a small trampoline when the edge leaves a conditional
+// branch); the same resolver places call arguments and incoming
+// parameters. Functions follow the System V calling convention; the entry
+// function is _start and ends with the exit syscall. Each function's
+// instructions then go through the peephole optimizer. Functions are
+// lowered as separate tasks and stitched back in module order.
+class NASMGenerator {
+public:
+    explicit NASMGenerator(StructStorage storage = StructStorage::AoS) : storage(storage) {}
+
+    // One function's instructions, and the global operands it was lowered
+    // against, so a cached copy can be checked against a new data layout.
+    struct Fragment {
+        std::vector<X86Inst> code;
+        std::vector<std::vector<X86Operand>> tables;   // jump table i (.t<i>): one label per slot
+        uint32_t spills = 0;
+        PeepholeCounts peephole;
+        std::vector<std::pair<SymbolId, std::string>> addresses;   // global -> operand text, first use order
+    };
+
+    // The data section: plain globals are a quadword each, struct storage
+    // a block of `size` bytes at `align`. Items are zero-filled past `init`.
+    struct DataLayout {
+        struct Item {
+            SymbolId label;
+            uint32_t align;
+            uint64_t size;
+            bool quad;
+            std::string init = {};
+        };
+        std::vector<Item> items;
+        SymbolMap<DataAddress> addresses;   // struct field global -> where it lives
+    };
+
+    // --instrument: the module's block counters (8 bytes each, a function's
+    // from `first` on, in block order), and for the entry function what it
+    // writes where before it exits (see PROFILE-GUIDED OPTIMIZATION).
+    struct Probes {
+        SymbolId counters = NoSymbol;   // NoSymbol: not instrumented
+        uint64_t first = 0;
+        uint64_t total = 0;
+        SymbolId path = NoSymbol, header = NoSymbol;
+        uint64_t headerSize = 0;
+    };
+
+    void generate(const IRModule& module, const std::string& outputPath, TaskScheduler& scheduler) {
+        DataLayout data = placeData(module);
+        std::vector<Fragment> code(module.functions.size());
+        std::vector<OutputBuffer> text(code.size());
+        scheduler.parallelFor(code.size(), [&](size_t i) {
+            code[i] = lower(module.functions[i], data.addresses);
+            text[i] = print(code[i]);
+        });
+        countSpills(code);
+        assembly(module, data, text).writeFile(outputPath, "Failed to write ASM file.");
+    }
+
+    // As generate(), but straight to a relocatable ELF64 object.
+    void generateObject(const IRModule& module, const std::string& outputPath, TaskScheduler& scheduler) {
+        DataLayout data = placeData(module);
+        std::vector<Fragment> code(module.functions.size());
+        std::vector<MachineCode> machine(code.size());
+        scheduler.parallelFor(code.size(), [&](size_t i) {
+            code[i] = lower(module.functions[i], data.addresses);
+            machine[i] = encode(code[i]);
+        });
+        countSpills(code);
+        ELFWriter::write(link(module, data, machine), outputPath);
+    }
+
+    // Plain globals first, then struct storage. AoS gives every instance
+    // one aligned block with the fields at their offsets; SoA gives every
+    // field of a type one array holding that field of each instance.
+    // Instances whose fields dead store elimination dropped entirely get
+    // no storage.
+    DataLayout placeData(const IRModule& module) const {
+        DataLayout data;
+        SymbolSet live, cells;
+        for (SymbolId g : module.globals) live.insert(g);
+        std::vector<DataLayout::Item> structs;
+        std::vector<std::pair<SymbolId, std::vector<SymbolId>>> instances;   // SoA: type -> variables
+        for (const IRStructVar& var : module.structVars) {
+            const StructLayout& layout = *module.layouts.find(var.type);
+            bool used = false;
+            for (const FieldLayout& field : layout.fields) {
+                SymbolId cell = IRBuilder::fieldCell(var.var, field.name);
+                cells.insert(cell);
+                used |= live.contains(cell);
+            }
+            if (!used) continue;
+            if (storage == StructStorage::AoS) {
+                structs.push_back({var.var, layout.align, layout.size, false});
+                for (const FieldLayout& field : layout.fields)
+                    data.addresses.insert(IRBuilder::fieldCell(var.var, field.name), DataAddress{var.var, field.offset});
+                continue;
+            }
+            auto it = std::find_if(instances.begin(), instances.end(), [&](const auto& entry) { return entry.first == var.type; });
+            if (it == instances.end()) it = instances.insert(instances.end(), {var.type, {}});
+            it->second.push_back(var.var);
+        }
+        for (const auto& [type, vars] : instances) {
+            for (const FieldLayout& field : module.layouts.find(type)->fields) {
+                SymbolId array = internSymbol("soa." + std::string(symbolText(type)) + "." + std::string(symbolText(field.name)));
+                structs.push_back({array, field.align, vars.size() * field.size, false});
+                for (size_t i = 0; i < vars.size(); ++i)
+                    data.addresses.insert(IRBuilder::fieldCell(vars[i], field.name), DataAddress{array, static_cast<int64_t>(i * field.size)});
+            }
+        }
+        for (SymbolId g : module.globals) {
+            if (!cells.contains(g)) data.items.push_back({g, 8, 8, true});
+        }
+        data.items.insert(data.items.end(), structs.begin(), structs.end());
+        return data;
+    }
+
+    static Fragment lower(const IRFunction& fn, const SymbolMap<DataAddress>& addresses) { return lower(fn, addresses, Probes()); }
+
+    static Fragment lower(const IRFunction& fn, const SymbolMap<DataAddress>& addresses, const Probes& probes) {
+        Fragment fragment;
+        FunctionLowering lowering(fn, addresses, probes, fragment.code, fragment.tables);
+        fragment.spills = lowering.run();
+        fragment.peephole = PeepholeOptimizer::run(fragment.code, fragment.tables);
+        fragment.addresses = lowering.usedAddresses();
+        return fragment;
+    }
+
+    static DataAddress address(SymbolId global, const SymbolMap<DataAddress>& addresses) {
+        const DataAddress* placed = addresses.find(global);
+        return placed ? *placed : DataAddress{global, 0};
+    }
+
+    // The operand text `global` is reached through under `addresses`.
+    static std::string operand(SymbolId global, const SymbolMap<DataAddress>& addresses) {
+        DataAddress at = address(global, addresses);
+        std::string text(symbolText(at.label));
+        return at.offset ? text + "+" + std::to_string(at.offset) : text;
+    }
+
+    // A fragment as NASM text, its jump tables in .rodata after the code.
+    static OutputBuffer print(const Fragment& fragment) {
+        OutputBuffer out;
+        for (const X86Inst& inst : fragment.code) {
+            if (inst.op == X86Op::Entry) {
+                out << "\n";
+                out << symbolText(inst.a.symbol);
+                out << ":\n";
+                continue;
+            }
+            if (inst.op == X86Op::Label) {
+                print(inst.a, out);
+                out << ":\n";
+                continue;
+            }
+            out << "    ";
+            out << x86Mnemonic(inst.op);
+            if (inst.op == X86Op::Set || inst.op == X86Op::Cmov || inst.op == X86Op::J) out << condName(inst.cc);
+            const X86Operand* operands[] = {&inst.a, &inst.b, &inst.c};
+            for (size_t i = 0; i < 3 && !operands[i]->is(X86Operand::Kind::None); ++i) {
+                out << (i ? ", " : " ");
+                print(*operands[i], out);
+            }
+            out << "\n";
+        }
+        if (!fragment.tables.empty()) {
+            out << "section .rodata\nalign 8\n";
+            for (size_t i = 0; i < fragment.tables.size(); ++i) {
+                out << ".t" << i << ": dq ";
+                for (size_t k = 0; k < fragment.tables[i].size(); ++k) {
+                    if (k) out << ", ";
+                    print(fragment.tables[i][k], out);
+                }
+                out << "\n";
+            }
+            out << "section .text\n";
+        }
+        return out;
+    }
+
+    static MachineCode encode(const Fragment& fragment) { return X86Encoder::encode(fragment.code, fragment.tables); }
+
+    // The whole .asm file; the printed functions are moved into it.
+    OutputBuffer assembly(const IRModule& module, const DataLayout& data, std::vector<OutputBuffer>& text) const {
+        OutputBuffer out;
+        out << "section .data\n";
+        for (const DataLayout::Item& item : data.items) {
+            if (item.quad) {
+                out << symbolText(item.label) << " dq 0\n";
+                continue;
+            }
+            out << "align " << item.align << ", db 0\n" << symbolText(item.label) << ":";
+            for (size_t i = 0; i < item.init.size(); ++i) {
+                out << (i % 32 ? "," : i ? "\n    db " : " db ") << static_cast<unsigned>(static_cast<uint8_t>(item.init[i]));
+            }
+            if (item.size > item.init.size()) out << (item.init.empty() ? "" : "\n   ") << " times " << item.size - item.init.size() << " db 0";
+            out << "\n";
+        }
+        if (!module.enums.all().empty()) {
+            out << "\nsection .rodata\n";
+            enumNames(module.enums, out);
+        }
+        out << "\nsection .text\n global _start\n";
+        for (OutputBuffer& fn : text) out << std::move(fn);
+        return out;
+    }
+
+    // Lays the encoded functions out in .text, in order, with the data and
+    // enum names the assembly would have, and resolves calls between them;
+    // everything else becomes a relocation. Only _start is global, as in
+    // the assembly.
+    ObjectFile link(const IRModule& module, const DataLayout& data, const std::vector<MachineCode>& machine) const {
+        using Section = ObjectFile::Section;
+        using RelocType = ObjectFile::RelocType;
+        ObjectFile object;
+        auto align = [](std::vector<uint8_t>& bytes, uint64_t to) { bytes.resize((bytes.size() + to - 1) / to * to, 0); };
+
+        SymbolMap<uint64_t> placed;
+        for (const DataLayout::Item& item : data.items) {
+            align(object.data, item.align);
+            object.dataAlign = std::max<uint64_t>(object.dataAlign, item.align);
+            placed.insert(item.label, object.data.size());
+            object.symbols.push_back({std::string(symbolText(item.label)), Section::Data, object.data.size(), item.size, false, false});
+            object.data.insert(object.data.end(), item.init.begin(), item.init.end());
+            object.data.resize(object.data.size() + item.size - item.init.size(), 0);
+        }
+
+        for (const EnumLayout& layout : module.enums.all()) {
+            std::string prefix = "enum." + std::string(symbolText(layout.name));
+            align(object.rodata, 8);
+            uint64_t names = object.rodata.size();
+            size_t slots = std::max<size_t>(layout.variants.size(), 1);
+            object.symbols.push_back({prefix + ".names", Section::Rodata, names, 8 * slots, false, false});
+            object.rodata.resize(names + 8 * slots, 0);
+            for (size_t i = 0; i < layout.variants.size(); ++i) {
+                std::string_view name = symbolText(layout.variants[i]);
+                uint64_t at = object.rodata.size();
+                object.symbols.push_back({prefix + "." + std::to_string(i), Section::Rodata, at, name.size() + 1, false, false});
+                object.rodata.insert(object.rodata.end(), name.begin(), name.end());
+                object.rodata.push_back(0);
+                object.relocations.push_back({Section::Rodata, names + 8 * i, RelocType::Abs64, Section::Rodata, {}, static_cast<int64_t>(at)});
+            }
+        }
+
+        SymbolMap<uint64_t> functions;
+        std::vector<uint64_t> starts;
+        for (const MachineCode& fn : machine) {
+            starts.push_back(object.text.size());
+            functions.insert(fn.name, object.text.size());
+            std::string name(symbolText(fn.name));
+            object.symbols.push_back({name, Section::Text, object.text.size(), fn.bytes.size(), name == "_start", true});
+            object.text.insert(object.text.end(), fn.bytes.begin(), fn.bytes.end());
+        }
+
+        for (size_t f = 0; f < machine.size(); ++f) {
+            std::vector<uint64_t> tables;
+            for (const std::vector<uint32_t>& table : machine[f].tables) {
+                align(object.rodata, 8);
+                tables.push_back(object.rodata.size());
+                for (uint32_t slot : table) {
+                    object.relocations.push_back({Section::Rodata, object.rodata.size(), RelocType::Abs64, Section::Text, {},
+                                                  static_cast<int64_t>(starts[f] + slot)});
+                    object.rodata.resize(object.rodata.size() + 8, 0);
+                }
+            }
+            for (const MachineFixup& fixup : machine[f].fixups) {
+                uint64_t field = starts[f] + fixup.offset;
+                switch (fixup.kind) {
+                    case MachineFixup::Kind::Data: {
+                        const uint64_t* at = placed.find(fixup.symbol);
+                        if (!at) throw std::runtime_error("Object Error: no storage for '" + std::string(symbolText(fixup.symbol)) + "'");
+                        object.relocations.push_back({Section::Text, field, RelocType::Pc32, Section::Data, {},
+                                                      static_cast<int64_t>(*at) + fixup.addend});
+                        break;
+                    }
+                    case MachineFixup::Kind::Table:
+                        object.relocations.push_back({Section::Text, field, RelocType::Pc32, Section::Rodata, {},
+                                                      static_cast<int64_t>(tables[fixup.table]) + fixup.addend});
+                        break;
+                    case MachineFixup::Kind::Call: {
+                        const uint64_t* target = functions.find(fixup.symbol);
+                        if (!target) {
+                            object.relocations.push_back({Section::Text, field, RelocType::Plt32, Section::Text,
+                                                          std::string(symbolText(fixup.symbol)), fixup.addend});
+                            break;
+                        }
+                        int64_t rel = static_cast<int64_t>(*target) + fixup.addend - static_cast<int64_t>(field);
+                        for (int i = 0; i < 4; ++i) object.text[field + i] = static_cast<uint8_t>(static_cast<uint64_t>(rel) >> (8 * i));
+                        break;
+                    }
+                }
+            }
+        }
+        return object;
+    }
+
+    // Values the last generate() had to keep on the stack.
+    uint32_t spillCount() const { return spilledValues; }
+
+private:
+    StructStorage storage;
+    uint32_t spilledValues = 0;
+
+    void countSpills(const std::vector<Fragment>& code) {
+        spilledValues = 0;
+        for (const Fragment& fn : code) spilledValues += fn.spills;
+    }
+
+    static void print(const X86Operand& op, OutputBuffer& out) {
+        using Kind = X86Operand::Kind;
+        switch (op.kind) {
+            case Kind::Reg:
+                out << (op.bits == 64 ? regName(op.reg) : op.bits == 32 ? regName32(op.reg) : regName8(op.reg));
+                return;
+            case Kind::Imm:
+                out << op.value;
+                return;
+            case Kind::Stack:
+                out << "qword [rbp";
+                if (op.value >= 0) out << '+';
+                out << op.value << ']';
+                return;
+            case Kind::Data:
+                out << (op.sized ? "qword [" : "[") << symbolText(op.symbol);
+                if (op.value) out << '+' << op.value;
+                out << ']';
+                return;
+            case Kind::Table:
+                out << "[rel .t" << op.value << ']';
+                return;
+            case Kind::Slot:
+                out << "qword [" << regName(op.reg) << "+rax*8]";
+                return;
+            case Kind::Indirect:
+                out << '[' << regName(op.reg);
+                if (op.value > 0) out << '+';
+                if (op.value) out << op.value;
+                out << ']';
+                return;
+            case Kind::Label: {
+                static const char* const prefixes[] = {".b", ".e", ".s"};
+                out << prefixes[static_cast<size_t>(op.label)] << op.value;
+                return;
+            }
+            case Kind::Symbol:
+                out << symbolText(op.symbol);
+                return;
+            case Kind::None:
+                return;
+        }
+    }
+
+    // Enum-to-string: enum.<Name>.names[value] points at the variant's
+    // name as a NUL-terminated string.
+    static void enumNames(const EnumTable& enums, OutputBuffer& out) {
+        for (const EnumLayout& layout : enums.all()) {
+            std::string prefix = "enum." + std::string(symbolText(layout.name));
+            out << "align 8, db 0\n" << prefix << ".names:";
+            for (size_t i = 0; i < layout.variants.size(); ++i) out << (i ? ", " : " dq ") << prefix << "." << i;
+            if (layout.variants.empty()) out << " dq 0";
+            out << '\n';
+            for (size_t i = 0; i < layout.variants.size(); ++i)
+                out << prefix << '.' << i << ": db \"" << symbolText(layout.variants[i]) << "\", 0\n";
+        }
+    }
+
+    class FunctionLowering {
+    public:
+        FunctionLowering(const IRFunction& fn, const SymbolMap<DataAddress>& addresses, const Probes& probes,
+                         std::vector<X86Inst>& code, std::vector<std::vector<X86Operand>>& tables)
+            : fn(fn), addresses(addresses), probes(probes), code(code), tables(tables) {}
+
+        uint32_t run() {
+            findFusedCompares();
+            regs = RegisterAllocator::allocate(fn, fused);
+            code.reserve(fn.insts.size() * 2);
+            prologue();
+            for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+                emit(X86Op::Label, X86Operand::at(Label::Block, b));
+                // No flags are live into a block, so the counter may set them.
+                if (probes.counters != NoSymbol)
+                    emit(X86Op::Inc, X86Operand::data(DataAddress{probes.counters, static_cast<int64_t>(8 * (probes.first + b))}, true));
+                for (ValueId v : fn.blocks[b].insts) lower(b, v);
+            }
+            for (size_t i = 0; i < trampolines.size(); ++i) {
+                emit(X86Op::Label, X86Operand::at(Label::Edge, i));
+                phiCopies(trampolines[i].from, trampolines[i].to);
+                emit(X86Op::Jmp, X86Operand::at(Label::Block, trampolines[i].to));
+            }
+            return regs.spilled;
+        }
+
+        const std::vector<std::pair<SymbolId, std::string>>& usedAddresses() const { return used; }
+
+    private:
+        using Label = X86Operand::LabelKind;
+
+        struct Edge {
+            BlockId from, to;
+        };
+        struct Move {
+            Location to, from;
+        };
+
+        const IRFunction& fn;
+        const SymbolMap<DataAddress>& addresses;
+        const Probes& probes;
+        std::vector<X86Inst>& code;
+        std::vector<std::vector<X86Operand>>& tables;
+        RegisterAssignment regs;
+        std::vector<uint8_t> fused;
+        std::unordered_map<ValueId, uint32_t> flagReaders;   // fused compare -> selects/branch reading it
+        IROp flags = IROp::CmpNe;     // condition the live flags hold
+        uint32_t pendingFlagReads = 0;  // while nonzero nothing may touch the flags
+        std::vector<Edge> trampolines;
+        uint32_t searchLabels = 0;                      // .s<n> labels inside binary searches
+        std::vector<std::pair<SymbolId, std::string>> used;   // globals addressed so far
+        SymbolSet usedGlobals;
+
+        const Location& loc(ValueId v) const { return regs.location[v]; }
+
+        void emit(X86Op op, X86Operand a = {}, X86Operand b = {}, X86Operand c = {}) { code.push_back(X86Inst{op, X86Cond::E, a, b, c}); }
+        void emitIf(X86Op op, X86Cond cc, X86Operand a, X86Operand b = {}) { code.push_back(X86Inst{op, cc, a, b, {}}); }
+
+        static X86Operand reg(Reg r, uint8_t bits = 64) { return X86Operand::inReg(r, bits); }
+        static X86Operand imm(int64_t value) { return X86Operand::immediate(value); }
+
+        X86Operand global(SymbolId symbol, bool sized) {
+            if (usedGlobals.insert(symbol)) used.emplace_back(symbol, operand(symbol, addresses));
+            return X86Operand::data(address(symbol, addresses), sized);
+        }
+
+        static X86Operand x86(const Location& loc) {
+            switch (loc.kind) {
+                case Location::Kind::Reg: return reg(loc.reg);
+                case Location::Kind::Stack: return X86Operand::onStack(loc.offset);
+                case Location::Kind::Imm: return imm(loc.imm);
+                case Location::Kind::None: break;
+            }
+            throw std::runtime_error("NASM Error: value has no location");
+        }
+        X86Operand x86(ValueId v) const { return x86(loc(v)); }
+
+        void move(const Location& to, const Location& from) {
+            if (to == from || to.kind == Location::Kind::None) return;
+            if (to.isStack() && from.isStack()) {
+                emit(X86Op::Mov, reg(Reg::R11), x86(from));
+                emit(X86Op::Mov, x86(to), reg(Reg::R11));
+            } else if (to.isReg() && from.isImm() && from.imm == 0 && !pendingFlagReads) {
+                emit(X86Op::Xor, reg(to.reg, 32), reg(to.reg, 32));
+            } else {
+                emit(X86Op::Mov, x86(to), x86(from));
+            }
+        }
+
+        // Performs all moves as if simultaneously: a move waits while its
+        // destination is still to be read by another, and a cycle is broken
+        // by parking one destination's old value in rax.
+        void parallelMove(std::vector<Move> moves) {
+            moves.erase(std::remove_if(moves.begin(), moves.end(), [](const Move& m) { return m.to == m.from; }), moves.end());
+            while (!moves.empty()) {
+                bool progressed = false;
+                for (size_t i = 0; i < moves.size(); ++i) {
+                    bool blocked = std::any_of(moves.begin(), moves.end(), [&](const Move& other) { return other.from == moves[i].to; });
+                    if (blocked) continue;
+                    move(moves[i].to, moves[i].from);
+                    moves.erase(moves.begin() + static_cast<std::ptrdiff_t>(i));
+                    progressed = true;
+                    break;
+                }
+                if (progressed) continue;
+                Location parked = moves[0].to;
+                move(Location::inReg(Reg::Rax), parked);
+                for (Move& m : moves) {
+                    if (m.from == parked) m.from = Location::inReg(Reg::Rax);
+                }
+            }
+        }
+
+        // A compare stays in the flags when all its uses are the selects
+        // and/or branch straight after it, which only read its condition.
+        void findFusedCompares() {
+            fused.assign(fn.insts.size(), 0);
+            std::vector<uint32_t> uses(fn.insts.size(), 0);
+            for (const IRBlock& block : fn.blocks) {
+                for (ValueId v : block.insts) fn.forEachOperand(fn.insts[v], [&](ValueId operand) { uses[operand]++; });
+            }
+            for (const IRBlock& block : fn.blocks) {
+                for (size_t i = 0; i < block.insts.size(); ++i) {
+                    ValueId cond = block.insts[i];
+                    if (!isCompare(fn.insts[cond].op)) continue;
+                    uint32_t readers = 0;
+                    for (size_t j = i + 1; j < block.insts.size(); ++j) {
+                        const IRInst& next = fn.insts[block.insts[j]];
+                        if (next.op == IROp::Select && fn.operands[next.extra] == cond && fn.operands[next.extra + 1] != cond &&
+                            fn.operands[next.extra + 2] != cond) {
+                            readers++;
+                        } else {
+                            if (next.op == IROp::Branch && next.a == cond) readers++;
+                            break;
+                        }
+                    }
+                    if (readers && readers == uses[cond]) {
+                        fused[cond] = 1;
+                        flagReaders[cond] = readers;
+                    }
+                }
+            }
+        }
+
+        void prologue() {
+            emit(X86Op::Entry, X86Operand::function(fn.name));
+            if (!fn.isEntry) emit(X86Op::Push, reg(Reg::Rbp));
+            emit(X86Op::Mov, reg(Reg::Rbp), reg(Reg::Rsp));
+            if (regs.frameSize) emit(X86Op::Sub, reg(Reg::Rsp), imm(regs.frameSize));
+            for (size_t i = 0; i < regs.calleeSaved.size(); ++i)
+                emit(X86Op::Mov, X86Operand::onStack(-static_cast<int32_t>(8 * (i + 1))), reg(regs.calleeSaved[i]));
+
+            std::vector<Move> params;
+            for (ValueId v : fn.blocks[0].insts) {
+                const IRInst& inst = fn.insts[v];
+                if (inst.op != IROp::Param || loc(v).kind == Location::Kind::None) continue;
+                Location from = inst.imm < 6 ? Location::inReg(ArgRegs[inst.imm])
+                                             : Location::onStack(static_cast<int32_t>(16 + 8 * (inst.imm - 6)));
+                params.push_back(Move{loc(v), from});
+            }
+            parallelMove(std::move(params));
+        }
+
+        void restoreCalleeSaved() {
+            for (size_t i = 0; i < regs.calleeSaved.size(); ++i)
+                emit(X86Op::Mov, reg(regs.calleeSaved[i]), X86Operand::onStack(-static_cast<int32_t>(8 * (i + 1))));
+        }
+
+        bool hasPhis(BlockId block) const {
+            const std::vector<ValueId>& insts = fn.blocks[block].insts;
+            return !insts.empty() && fn.insts[insts[0]].op == IROp::Phi;
+        }
+
+        X86Operand edgeLabel(BlockId from, BlockId to) {
+            if (!hasPhis(to)) return X86Operand::at(Label::Block, to);
+            trampolines.push_back(Edge{from, to});
+            return X86Operand::at(Label::Edge, trampolines.size() - 1);
+        }
+
+        void phiCopies(BlockId from, BlockId to) {
+            std::vector<Move> copies;
+            for (ValueId v : fn.blocks[to].insts) {
+                const IRInst& phi = fn.insts[v];
+                if (phi.op != IROp::Phi) break;
+                for (uint32_t i = 0; i < phi.count; ++i) {
+                    if (fn.phiBlock(phi, i) == from) copies.push_back(Move{loc(v), loc(fn.phiValue(phi, i))});
+                }
+            }
+            parallelMove(std::move(copies));
+        }
+
+        // Condition codes in IROp compare order, and with operands swapped.
+        static X86Cond condition(IROp op) {
+            static const X86Cond cc[] = {X86Cond::E, X86Cond::NE, X86Cond::L, X86Cond::LE, X86Cond::G, X86Cond::GE};
+            return cc[static_cast<int>(op) - static_cast<int>(IROp::CmpEq)];
+        }
+        static IROp swapped(IROp op) {
+            switch (op) {
+                case IROp::CmpLt: return IROp::CmpGt;
+                case IROp::CmpLe: return IROp::CmpGe;
+                case IROp::CmpGt: return IROp::CmpLt;
+                case IROp::CmpGe: return IROp::CmpLe;
+                default: return op;
+            }
+        }
+        static IROp negated(IROp op) {
+            switch (op) {
+                case IROp::CmpEq: return IROp::CmpNe;
+                case IROp::CmpNe: return IROp::CmpEq;
+                case IROp::CmpLt: return IROp::CmpGe;
+                case IROp::CmpLe: return IROp::CmpGt;
+                case IROp::CmpGt: return IROp::CmpLe;
+                default: return IROp::CmpLt;
+            }
+        }
+
+        // Emits the cmp for a compare and returns the op whose condition
+        // code now holds (operands may have been swapped to fit cmp's forms).
+        IROp compare(const IRInst& inst) {
+            Location a = loc(inst.a), b = loc(inst.b);
+            IROp op = inst.op;
+            if (a.isImm() && !b.isImm()) {
+                std::swap(a, b);
+                op = swapped(op);
+            }
+            if (a.isImm() || (a.isStack() && b.isStack())) {
+                move(Location::inReg(Reg::Rax), a);
+                a = Location::inReg(Reg::Rax);
+            }
+            emit(X86Op::Cmp, x86(a), x86(b));
+            return op;
+        }
+
+        void arithmetic(ValueId v, const IRInst& inst) {
+            Location dst = loc(v), a = loc(inst.a), b = loc(inst.b);
+            bool commutative = inst.op != IROp::Sub;
+            if (commutative && dst.isReg() && dst == b) std::swap(a, b);
+            Location work = dst.isReg() && dst != b ? dst : Location::inReg(Reg::Rax);
+            if (inst.op == IROp::Mul && b.isImm() && !a.isImm()) {
+                emit(X86Op::Imul, reg(work.reg), x86(a), imm(b.imm));
+            } else {
+                move(work, a);
+                X86Op op = inst.op == IROp::Add ? X86Op::Add : inst.op == IROp::Sub ? X86Op::Sub : X86Op::Imul;
+                if (inst.op == IROp::Mul && b.isImm()) emit(X86Op::Imul, reg(work.reg), reg(work.reg), imm(b.imm));
+                else emit(op, reg(work.reg), x86(b));
+            }
+            move(dst, work);
+        }
+
+        void call(ValueId v, const IRInst& inst) {
+            size_t stackArgs = inst.count > 6 ? inst.count - 6 : 0;
+            bool pad = stackArgs % 2 != 0;   // keep rsp 16-byte aligned at the call
+            if (pad) emit(X86Op::Sub, reg(Reg::Rsp), imm(8));
+            for (size_t i = inst.count; i-- > 6;) emit(X86Op::Push, x86(fn.callArg(inst, i)));
+            std::vector<Move> args;
+            for (size_t i = 0; i < inst.count && i < 6; ++i) args.push_back(Move{Location::inReg(ArgRegs[i]), loc(fn.callArg(inst, i))});
+            parallelMove(std::move(args));
+            emit(X86Op::Call, X86Operand::function(inst.symbol));
+            if (stackArgs || pad) emit(X86Op::Add, reg(Reg::Rsp), imm(static_cast<int64_t>(8 * (stackArgs + (pad ? 1 : 0)))));
+            move(loc(v), Location::inReg(Reg::Rax));
+        }
+
+        // cmov between the two values, or setcc when they are the constants
+        // 0 and 1. With a fused compare the flags are already set.
+        void select(ValueId v, const IRInst& inst) {
+            ValueId cond = fn.operands[inst.extra];
+            Location onTrue = loc(fn.operands[inst.extra + 1]), onFalse = loc(fn.operands[inst.extra + 2]);
+            const Location& dst = loc(v);
+            IROp test = IROp::CmpNe;
+            if (fused[cond]) {
+                test = flags;
+            } else if (loc(cond).isImm()) {   // only when constant folding is off
+                move(dst, loc(cond).imm != 0 ? onTrue : onFalse);
+                return;
+            } else if (loc(cond).isReg()) {
+                emit(X86Op::Test, reg(loc(cond).reg), reg(loc(cond).reg));
+            } else {
+                emit(X86Op::Cmp, x86(cond), imm(0));
+            }
+
+            Reg work = dst.isReg() && dst != onTrue ? dst.reg : Reg::Rax;
+            bool flag = onTrue.isImm() && onFalse.isImm() && onTrue.imm + onFalse.imm == 1 && (onTrue.imm == 0 || onTrue.imm == 1);
+            if (flag) {
+                emitIf(X86Op::Set, condition(onTrue.imm == 1 ? test : negated(test)), reg(work, 8));
+                emit(X86Op::Movzx, reg(work, 32), reg(work, 8));
+            } else {
+                if (onFalse != Location::inReg(work)) emit(X86Op::Mov, reg(work), x86(onFalse));
+                X86Operand source = x86(onTrue);
+                if (onTrue.isImm()) {
+                    emit(X86Op::Mov, reg(Reg::R11), imm(onTrue.imm));
+                    source = reg(Reg::R11);
+                }
+                emitIf(X86Op::Cmov, condition(test), reg(work), source);
+            }
+            if (fused[cond]) pendingFlagReads--;
+            move(dst, Location::inReg(work));
+        }
+
+        // Reuses this frame: the arguments go straight into the argument
+        // registers and our own incoming stack slots (the tailcall pass only
+        // forms calls whose stack arguments fit there), then the frame is torn
+        // down and the callee is entered with our return address.
+        void tailCall(const IRInst& inst) {
+            if (fn.isEntry) throw std::runtime_error("NASM Error: tail call in the entry function");
+            std::vector<Move> args;
+            for (size_t i = 0; i < inst.count; ++i) {
+                Location to = i < 6 ? Location::inReg(ArgRegs[i]) : Location::onStack(static_cast<int32_t>(16 + 8 * (i - 6)));
+                args.push_back(Move{to, loc(fn.callArg(inst, i))});
+            }
+            parallelMove(std::move(args));
+            restoreCalleeSaved();
+            emit(X86Op::Leave);
+            emit(X86Op::Jmp, X86Operand::function(inst.symbol));
+        }
+
+        void lower(BlockId b, ValueId v) {
+            const IRInst& inst = fn.insts[v];
+            const Location& dst = loc(v);
+            // Values nobody reads (only without dce) need no code unless they
+            // have effects; fused compares live in the flags instead.
+            if (inst.type != IRType::Void && dst.kind == Location::Kind::None && !fused[v] && !hasSideEffects(inst.op)) return;
+            switch (inst.op) {
+                case IROp::Nop:
+                case IROp::Phi:
+                case IROp::Param:
+                case IROp::Const:
+                    if (inst.op == IROp::Const && !dst.isImm()) {
+                        if (dst.isReg()) {
+                            emit(X86Op::Mov, reg(dst.reg), imm(inst.imm));
+                        } else {
+                            emit(X86Op::Mov, reg(Reg::Rax), imm(inst.imm));
+                            emit(X86Op::Mov, x86(dst), reg(Reg::Rax));
+                        }
+                    }
+                    break;
+                case IROp::Load:
+                    if (dst.isReg()) {
+                        emit(X86Op::Mov, reg(dst.reg), global(inst.symbol, false));
+                    } else {
+                        emit(X86Op::Mov, reg(Reg::Rax), global(inst.symbol, false));
+                        move(dst, Location::inReg(Reg::Rax));
+                    }
+                    break;
+                case IROp::Store:
+                    if (loc(inst.a).isStack()) {
+                        emit(X86Op::Mov, reg(Reg::Rax), x86(inst.a));
+                        emit(X86Op::Mov, global(inst.symbol, false), reg(Reg::Rax));
+                    } else {
+                        emit(X86Op::Mov, global(inst.symbol, true), x86(inst.a));
+                    }
+                    break;
+                case IROp::Add:
+                case IROp::Sub:
+                case IROp::Mul:
+                    arithmetic(v, inst);
+                    break;
+                case IROp::Div:
+                    move(Location::inReg(Reg::Rax), loc(inst.a));
+                    emit(X86Op::Cqo);
+                    if (loc(inst.b).isImm()) {
+                        emit(X86Op::Mov, reg(Reg::R11), imm(loc(inst.b).imm));
+                        emit(X86Op::Idiv, reg(Reg::R11));
+                    } else {
+                        emit(X86Op::Idiv, x86(inst.b));
+                    }
+                    move(dst, Location::inReg(Reg::Rax));
+                    break;
+                case IROp::CmpEq: case IROp::CmpNe: case IROp::CmpLt:
+                case IROp::CmpLe: case IROp::CmpGt: case IROp::CmpGe: {
+                    IROp op = compare(inst);
+                    if (fused[v]) {
+                        flags = op;
+                        pendingFlagReads = flagReaders[v];
+                        break;
+                    }
+                    Reg r = dst.isReg() ? dst.reg : Reg::Rax;
+                    emitIf(X86Op::Set, condition(op), reg(r, 8));
+                    emit(X86Op::Movzx, reg(r, 32), reg(r, 8));
+                    move(dst, Location::inReg(r));
+                    break;
+                }
+                case IROp::Select:
+                    select(v, inst);
+                    break;
+                case IROp::Call:
+                    call(v, inst);
+                    break;
+                case IROp::TailCall:
+                    tailCall(inst);
+                    break;
+                case IROp::Jump:
+                    if (hasPhis(inst.target[0])) phiCopies(b, inst.target[0]);
+                    if (inst.target[0] != b + 1) emit(X86Op::Jmp, X86Operand::at(Label::Block, inst.target[0]));
+                    break;
+                case IROp::Branch:
+                    branch(b, inst);
+                    break;
+                case IROp::Switch:
+                    switchOn(b, inst);
+                    break;
+                case IROp::Return:
+                    if (fn.isEntry) {
+                        if (inst.a != NoValue) move(Location::inReg(Reg::Rdi), loc(inst.a));
+                        else emit(X86Op::Xor, reg(Reg::Rdi, 32), reg(Reg::Rdi, 32));
+                        if (probes.counters != NoSymbol) dumpProfile();
+                        emit(X86Op::Mov, reg(Reg::Rax), imm(60));
+                        emit(X86Op::Syscall);
+                    } else {
+                        if (inst.a != NoValue) move(Location::inReg(Reg::Rax), loc(inst.a));
+                        else emit(X86Op::Xor, reg(Reg::Rax, 32), reg(Reg::Rax, 32));
+                        restoreCalleeSaved();
+                        emit(X86Op::Leave);
+                        emit(X86Op::Ret);
+                    }
+                    break;
+            }
+        }
+
+        // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), write the header and
+        // the counters, close. The exit status waits in rbx, which syscalls
+        // keep and the entry function need not preserve; a failed open only
+        // makes the writes fail.
+        void dumpProfile() {
+            auto at = [](SymbolId label) { return X86Operand::data(DataAddress{label, 0}, false); };
+            emit(X86Op::Mov, reg(Reg::Rbx), reg(Reg::Rdi));
+            emit(X86Op::Mov, reg(Reg::Rax), imm(2));
+            emit(X86Op::Lea, reg(Reg::Rdi), at(probes.path));
+            emit(X86Op::Mov, reg(Reg::Rsi), imm(0x241));
+            emit(X86Op::Mov, reg(Reg::Rdx), imm(0644));
+            emit(X86Op::Syscall);
+            emit(X86Op::Mov, reg(Reg::Rdi), reg(Reg::Rax));
+            const std::pair<SymbolId, uint64_t> blobs[] = {{probes.header, probes.headerSize}, {probes.counters, 8 * probes.total}};
+            for (const auto& [label, size] : blobs) {
+                emit(X86Op::Mov, reg(Reg::Rax), imm(1));
+                emit(X86Op::Lea, reg(Reg::Rsi), at(label));
+                emit(X86Op::Mov, reg(Reg::Rdx), imm(static_cast<int64_t>(size)));
+                emit(X86Op::Syscall);
+            }
+            emit(X86Op::Mov, reg(Reg::Rax), imm(3));
+            emit(X86Op::Syscall);
+            emit(X86Op::Mov, reg(Reg::Rdi), reg(Reg::Rbx));
+        }
+
+        // A dense switch bounds-checks the value and jumps through a table in
+        // .rodata; a sparse one binary-searches the sorted cases.
+        void switchOn(BlockId b, const IRInst& sw) {
+            X86Operand fallback = edgeLabel(b, sw.target[0]);
+            std::vector<std::pair<int64_t, X86Operand>> cases;
+            for (uint32_t i = 0; i < sw.count; ++i) cases.emplace_back(fn.switchCase(sw, i), edgeLabel(b, fn.switchTarget(sw, i)));
+            if (loc(sw.a).isImm()) {   // only when constant folding is off
+                X86Operand taken = fallback;
+                for (const auto& [key, label] : cases) {
+                    if (key == loc(sw.a).imm) taken = label;
+                }
+                emit(X86Op::Jmp, taken);
+                return;
+            }
+            if (SwitchPass::usesTable(fn, sw)) {
+                int64_t low = cases.front().first, span = cases.back().first - low + 1;
+                move(Location::inReg(Reg::Rax), loc(sw.a));
+                if (low != 0) emit(X86Op::Sub, reg(Reg::Rax), imm(low));
+                emit(X86Op::Cmp, reg(Reg::Rax), imm(span - 1));
+                emitIf(X86Op::J, X86Cond::A, fallback);
+                emit(X86Op::Lea, reg(Reg::R11), X86Operand::table(tables.size()));
+                emit(X86Op::Jmp, X86Operand::slot(Reg::R11));
+                std::vector<X86Operand> slots(static_cast<size_t>(span), fallback);
+                for (const auto& [key, label] : cases) slots[static_cast<size_t>(key - low)] = label;
+                tables.push_back(std::move(slots));
+                return;
+            }
+            search(x86(sw.a), cases, 0, cases.size(), fallback);
+        }
+
+        // Runs of up to three cases are tested one by one.
+        void search(const X86Operand& value, const std::vector<std::pair<int64_t, X86Operand>>& cases, size_t lo, size_t hi,
+                    const X86Operand& fallback) {
+            if (hi - lo <= 3) {
+                for (size_t i = lo; i < hi; ++i) {
+                    emit(X86Op::Cmp, value, imm(cases[i].first));
+                    emitIf(X86Op::J, X86Cond::E, cases[i].second);
+                }
+                emit(X86Op::Jmp, fallback);
+                return;
+            }
+            size_t mid = lo + (hi - lo) / 2;
+            X86Operand upper = X86Operand::at(Label::Search, searchLabels++);
+            emit(X86Op::Cmp, value, imm(cases[mid].first));
+            emitIf(X86Op::J, X86Cond::E, cases[mid].second);
+            emitIf(X86Op::J, X86Cond::G, upper);
+            search(value, cases, lo, mid, fallback);
+            emit(X86Op::Label, upper);
+            search(value, cases, mid + 1, hi, fallback);
+        }
+
+        void branch(BlockId b, const IRInst& inst) {
+            if (loc(inst.a).isImm()) {   // only when constant folding is off
+                BlockId taken = inst.target[loc(inst.a).imm != 0 ? 0 : 1];
+                emit(X86Op::Jmp, edgeLabel(b, taken));
+                return;
+            }
+            IROp test = IROp::CmpNe;   // condition != 0
+            if (fused[inst.a]) {
+                test = flags;
+                pendingFlagReads--;
+            } else if (loc(inst.a).isReg()) {
+                emit(X86Op::Test, reg(loc(inst.a).reg), reg(loc(inst.a).reg));
+            } else {
+                emit(X86Op::Cmp, x86(inst.a), imm(0));
+            }
+            X86Operand onTrue = edgeLabel(b, inst.target[0]);
+            X86Operand onFalse = edgeLabel(b, inst.target[1]);
+            X86Operand next = X86Operand::at(Label::Block, b + 1);
+            if (onTrue == next) {
+                emitIf(X86Op::J, condition(negated(test)), onFalse);
+            } else {
+                emitIf(X86Op::J, condition(test), onTrue);
+                if (onFalse != next) emit(X86Op::Jmp, onFalse);
+            }
+        }
+    };
+};
+
+//--------------------------------------------------
+// --- AST XML VIEW ---
+//--------------------------------------------------
+// The .ast debug view (--ast-xml, --dump): the whole tree of a binary
+// image as indented XML, read straight from its node table.
+class ASTXMLWriter {
+public:
+    static OutputBuffer render(const BinaryModule& image) {
+        ASTXMLWriter writer(image);
+        writer.out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        writer.out << "<program version=\"" << BinaryFormatVersion << "\">\n";
+        writer.list(image.program(), 1);
+        writer.out << "</program>\n";
+        return std::move(writer.out);
+    }
+
+private:
+    const BinaryModule& image;
+    OutputBuffer out;
+
+    explicit ASTXMLWriter(const BinaryModule& image) : image(image) {}
+
+    void indent(int depth) {
+        for (int i = 0; i < depth; ++i) out << "  ";
+    }
+
+    void text(std::string_view value) {
+        for (char c : value) {
+            switch (c) {
+                case '<': out << "&lt;"; break;
+                case '>': out << "&gt;"; break;
+                case '&': out << "&amp;"; break;
+                case '"': out << "&quot;"; break;
+                default: out << c; break;
+            }
+        }
+    }
+
+    void attribute(const char* name, uint32_t string) {
+        if (string == NoString) return;
+        out << ' ' << name << "=\"";
+        text(image.string(string));
+        out << '"';
+    }
+
+    void list(BinaryRange range, int depth) {
+        for (uint32_t id : image.children(range.first, range.count)) node(id, depth);
+    }
+
+    void names(const char* tag, uint32_t first, uint32_t count, int depth) {
+        for (uint32_t name : image.names(first, count)) {
+            indent(depth);
+            out << '<' << tag << '>';
+            text(image.string(name));
+            out << "</" << tag << ">\n";
+        }
+    }
+
+    // <tag> around one child node, or <tag/> when there is none.
+    void wrapped(const char* tag, uint32_t id, int depth) {
+        indent(depth);
+        if (id == NoNode) {
+            out << '<' << tag << "/>\n";
+            return;
+        }
+        out << '<' << tag << ">\n";
+        node(id, depth + 1);
+        indent(depth);
+        out << "</" << tag << ">\n";
+    }
+
+    void block(const char* tag, uint32_t first, uint32_t count, int depth) {
+        indent(depth);
+        if (count == 0) {
+            out << '<' << tag << "/>\n";
+            return;
+        }
+        out << '<' << tag << ">\n";
+        list(BinaryRange{first, count}, depth + 1);
+        indent(depth);
+        out << "</" << tag << ">\n";
+    }
+
+    void open(const char* tag, int depth) {
+        indent(depth);
+        out << '<' << tag;
+    }
+
+    void close(const char* tag, int depth) {
+        indent(depth);
+        out << "</" << tag << ">\n";
+    }
+
+    void node(uint32_t id, int depth) {
+        const BinaryNode& n = image.node(id);
+        const uint32_t* f = n.field;
+        switch (n.kind) {
+            case NodeKind::Assignment:
+                open("assignment", depth);
+                attribute("var", f[0]);
+                attribute("field", f[2]);
+                out << ">\n";
+                node(f[1], depth + 1);
+                close("assignment", depth);
+                break;
+            case NodeKind::NumberExpr:
+                indent(depth);
+                out << "<number>";
+                text(image.string(f[0]));
+                out << "</number>\n";
+                break;
+            case NodeKind::IdentifierExpr:
+                indent(depth);
+                out << "<identifier>";
+                text(image.string(f[0]));
+                out << "</identifier>\n";
+                break;
+            case NodeKind::BinaryExpr:
+                open("binary", depth);
+                attribute("op", f[0]);
+                out << ">\n";
+                node(f[1], depth + 1);
+                node(f[2], depth + 1);
+                close("binary", depth);
+                break;
+            case NodeKind::FunctionDef:
+                open("function", depth);
+                attribute("name", f[0]);
+                out << ">\n";
+                names("param", f[1], f[2], depth + 1);
+                block("body", f[3], f[4], depth + 1);
+                close("function", depth);
+                break;
+            case NodeKind::IfStatement:
+                indent(depth);
+                out << "<if>\n";
+                wrapped("condition", f[0], depth + 1);
+                block("then", f[1], f[2], depth + 1);
+                if (f[4]) block("else", f[3], f[4], depth + 1);
+                close("if", depth);
+                break;
+            case NodeKind::FunctionCall:
+                open("call", depth);
+                attribute("name", f[0]);
+                out << ">\n";
+                for (uint32_t arg : image.children(f[1], f[2])) wrapped("arg", arg, depth + 1);
+                close("call", depth);
+                break;
+            case NodeKind::WhileLoop:
+                indent(depth);
+                out << "<while>\n";
+                wrapped("condition", f[0], depth + 1);
+                block("body", f[1], f[2], depth + 1);
+                close("while", depth);
+                break;
+            case NodeKind::ForLoop:
+                indent(depth);
+                out << "<for>\n";
+                wrapped("init", f[0], depth + 1);
+                wrapped("condition", f[1], depth + 1);
+                wrapped("increment", f[2], depth + 1);
+                block("body", f[3], f[4], depth + 1);
+                close("for", depth);
+                break;
+            case NodeKind::StructDef:
+            case NodeKind::EnumDef: {
+                const char* tag = n.kind == NodeKind::StructDef ? "struct" : "enum";
+                open(tag, depth);
+                attribute("name", f[0]);
+                out << ">\n";
+                names(n.kind == NodeKind::StructDef ? "field" : "variant", f[1], f[2], depth + 1);
+                close(tag, depth);
+                break;
+            }
+            case NodeKind::StructInit:
+                open("init", depth);
+                attribute("struct", f[0]);
+                out << "/>\n";
+                break;
+            case NodeKind::FieldAccess:
+                open("member", depth);
+                attribute("field", f[1]);
+                out << ">\n";
+                node(f[0], depth + 1);
+                close("member", depth);
+                break;
+            case NodeKind::ReturnStatement:
+                wrapped("return", f[0], depth);
+                break;
+            case NodeKind::TernaryExpr:
+                indent(depth);
+                out << "<ternary>\n";
+                wrapped("condition", f[0], depth + 1);
+                wrapped("then", f[1], depth + 1);
+                wrapped("else", f[2], depth + 1);
+                close("ternary", depth);
+                break;
+        }
+    }
+};
+
+//--------------------------------------------------
+// --- COMPILE CACHE ---
+//--------------------------------------------------
+// Incremental builds. Each function, and the entry holding the top-level
+// code, gets a key hashing its AST after macro expansion together with
+// everything else its optimized code depends on: the compiler build and
+// flags, the AST of every function it may call (the inliner copies them,
+// dead-store elimination reads their loads), how often each of those is
+// called in the module (the inliner's only-call-site rule), the globals
+// they load or store and whether any function loads those, and the
+// structs, enums and struct variables they name. Only the entry's key
+// covers every declaration in the file. A function whose entry exists
+// under DIR/.cache reuses its optimized IR and instructions; the passes,
+// register allocation and instruction selection run only for the misses,
+// which inline from the reused functions' cached IR. Lexing, parsing,
+// checking and SSA construction still cover the whole file: the keys are
+// computed from their results.
+
+// Identifies this compiler build, so a rebuilt compiler never reuses
+// entries another build wrote.
+constexpr const char* CompilerBuild = "hyperlace-cache-4 " __DATE__ " " __TIME__;
+
+// 64-bit FNV-1a. Strings go in length-first so adjacent fields cannot run
+// together.
+class ContentHash {
+public:
+    ContentHash& add(uint64_t value) {
+        for (int i = 0; i < 8; ++i) mix(static_cast<uint8_t>(value >> (8 * i)));
+        return *this;
+    }
+
+    ContentHash& add(std::string_view text) {
+        add(static_cast<uint64_t>(text.size()));
+        for (char c : text) mix(static_cast<uint8_t>(c));
+        return *this;
+    }
+
+    uint64_t value() const { return state; }
+
+private:
+    uint64_t state = 14695981039346656037ull;
+
+    void mix(uint8_t byte) { state = (state ^ byte) * 1099511628211ull; }
+};
+
+// Feeds a subtree into a ContentHash: each node's kind, then its names
+// (as text), literals and children in order. With `names`, every name
+// hashed is also appended there.
+class ASTHasher : public ASTVisitor<ASTHasher> {
+public:
+    explicit ASTHasher(ContentHash& hash, std::vector<SymbolId>* names = nullptr) : hash(hash), seen(names) {}
+
+    void node(const ASTArena& ast, NodeId id) {
+        if (id == NoNode) {
+            hash.add(uint64_t{0xFF});
+            return;
+        }
+        hash.add(static_cast<uint64_t>(ast.kind(id)));
+        visit(ast, id);
+    }
+
+private:
+    friend class ASTVisitor<ASTHasher>;
+
+    ContentHash& hash;
+    std::vector<SymbolId>* seen;
+
+    void name(SymbolId id) {
+        hash.add(id == NoSymbol ? std::string_view() : symbolText(id));
+        if (seen && id != NoSymbol) seen->push_back(id);
+    }
+
+    void list(const ASTArena& ast, NodeList nodes) {
+        hash.add(uint64_t{nodes.count});
+        for (NodeId id : ast.children(nodes)) node(ast, id);
+    }
+
+    void names(const ASTArena& ast, NameList ids) {
+        hash.add(uint64_t{ids.count});
+        for (SymbolId id : ast.names(ids)) name(id);
+    }
+
+    void visitAssignment(const ASTArena& ast, const Assignment& n) {
+        name(n.name);
+        name(n.field);
+        node(ast, n.value);
+    }
+    void visitNumberExpr(const ASTArena&, const NumberExpr& n) { hash.add(n.value); }
+    void visitIdentifierExpr(const ASTArena&, const IdentifierExpr& n) { name(n.name); }
+    void visitBinaryExpr(const ASTArena& ast, const BinaryExpr& n) {
+        hash.add(n.op);
+        node(ast, n.left);
+        node(ast, n.right);
+    }
+    void visitFunctionDef(const ASTArena& ast, const FunctionDef& n) {
+        name(n.name);
+        names(ast, n.params);
+        list(ast, n.body);
+    }
+    void visitIfStatement(const ASTArena& ast, const IfStatement& n) {
+        node(ast, n.condition);
+        list(ast, n.thenBranch);
+        list(ast, n.elseBranch);
+    }
+    void visitFunctionCall(const ASTArena& ast, const FunctionCall& n) {
+        name(n.name);
+        list(ast, n.arguments);
+    }
+    void visitWhileLoop(const ASTArena& ast, const WhileLoop& n) {
+        node(ast, n.condition);
+        list(ast, n.body);
+    }
+    void visitForLoop(const ASTArena& ast, const ForLoop& n) {
+        node(ast, n.initializer);
+        node(ast, n.condition);
+        node(ast, n.increment);
+        list(ast, n.body);
+    }
+    void visitStructDef(const ASTArena& ast, const StructDef& n) {
+        name(n.name);
+        names(ast, n.fields);
+    }
+    void visitStructInit(const ASTArena&, const StructInit& n) { name(n.structName); }
+    void visitFieldAccess(const ASTArena& ast, const FieldAccess& n) {
+        node(ast, n.object);
+        name(n.field);
+    }
+    void visitEnumDef(const ASTArena& ast, const EnumDef& n) {
+        name(n.name);
+        names(ast, n.variants);
+    }
+    void visitReturnStatement(const ASTArena& ast, const ReturnStatement& n) { node(ast, n.returnValue); }
+    void visitTernaryExpr(const ASTArena& ast, const TernaryExpr& n) {
+        node(ast, n.condition);
+        node(ast, n.thenExpr);
+        node(ast, n.elseExpr);
+    }
+};
+
+// Cache keys for one module, computed from its IR before any pass runs.
+struct CachePlan {
+    std::vector<uint64_t> keys;   // per function; 0 when it cannot be cached
+};
+
+// A function without a top-level definition of its own, or one that may
+// call such a function, gets no key. `settings` hashes the build and flags.
+inline CachePlan planCache(const ASTArena& ast, NodeList statements, const IRModule& module, uint64_t settings) {
+    const std::vector<IRFunction>& fns = module.functions;
+    SymbolMap<uint64_t> units;
+    SymbolMap<std::vector<SymbolId>> named;   // function -> every name its definition mentions
+    ContentHash topLevel;
+    for (NodeId stmt : ast.children(statements)) {
+        if (const FunctionDef* fn = ast.as<FunctionDef>(stmt)) {
+            ContentHash unit;
+            std::vector<SymbolId> names;
+            ASTHasher(unit, &names).node(ast, stmt);
+            if (units.insert(fn->name, unit.value()).second) named.insert(fn->name, std::move(names));
+        } else {
+            ASTHasher(topLevel).node(ast, stmt);
+        }
+    }
+
+    SymbolMap<uint32_t> index;   // function name -> 1 + position
+    for (uint32_t i = 0; i < fns.size(); ++i) {
+        if (!fns[i].isEntry) index.insert(fns[i].name, i + 1);
+    }
+    SymbolSet loaded;
+    SymbolMap<uint32_t> sites;
+    std::vector<std::vector<uint32_t>> callees(fns.size());
+    std::vector<std::vector<SymbolId>> touched(fns.size());   // globals loaded or stored
+    for (uint32_t i = 0; i < fns.size(); ++i) {
+        for (const IRBlock& block : fns[i].blocks) {
+            for (ValueId v : block.insts) {
+                const IRInst& inst = fns[i].insts[v];
+                if (inst.op == IROp::Load) loaded.insert(inst.symbol);
+                if (inst.op == IROp::Load || inst.op == IROp::Store) touched[i].push_back(inst.symbol);
+                if (inst.op != IROp::Call && inst.op != IROp::TailCall) continue;
+                sites[inst.symbol]++;
+                if (const uint32_t* to = index.find(inst.symbol)) callees[i].push_back(*to - 1);
+            }
+        }
+    }
+
+    ContentHash context;
+    for (SymbolId g : module.globals) context.add(symbolText(g)).add(uint64_t{loaded.contains(g)});
+    for (const IRStructVar& var : module.structVars) context.add(symbolText(var.var)).add(symbolText(var.type));
+    for (const StructLayout& layout : module.layouts.all()) {
+        context.add(symbolText(layout.name));
+        for (const FieldLayout& field : layout.fields) context.add(symbolText(field.name));
+    }
+    for (const EnumLayout& layout : module.enums.all()) {
+        context.add(symbolText(layout.name));
+        for (SymbolId variant : layout.variants) context.add(symbolText(variant));
+    }
+
+    auto byText = [](std::vector<SymbolId>& ids) {
+        std::sort(ids.begin(), ids.end(), [](SymbolId a, SymbolId b) { return symbolText(a) < symbolText(b); });
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    };
+    CachePlan plan;
+    plan.keys.assign(fns.size(), 0);
+    for (uint32_t i = 0; i < fns.size(); ++i) {
+        std::vector<uint32_t> reach{i};
+        std::vector<uint8_t> seen(fns.size(), 0);
+        seen[i] = 1;
+        for (size_t k = 0; k < reach.size(); ++k) {
+            for (uint32_t callee : callees[reach[k]]) {
+                if (!seen[callee]) {
+                    seen[callee] = 1;
+                    reach.push_back(callee);
+                }
+            }
+        }
+        std::sort(reach.begin(), reach.end(), [&](uint32_t a, uint32_t b) { return symbolText(fns[a].name) < symbolText(fns[b].name); });
+        ContentHash key;
+        key.add(settings);
+        if (fns[i].isEntry) key.add(context.value());
+        bool cacheable = true;
+        std::vector<SymbolId> globals, names;
+        for (uint32_t f : reach) {
+            const uint64_t* unit = fns[f].isEntry ? nullptr : units.find(fns[f].name);
+            if (!fns[f].isEntry && !unit) cacheable = false;
+            const uint32_t* calls = sites.find(fns[f].name);
+            key.add(symbolText(fns[f].name)).add(fns[f].isEntry ? topLevel.value() : unit ? *unit : 0).add(uint64_t{calls ? *calls : 0});
+            globals.insert(globals.end(), touched[f].begin(), touched[f].end());
+            if (const std::vector<SymbolId>* mentioned = fns[f].isEntry ? nullptr : named.find(fns[f].name))
+                names.insert(names.end(), mentioned->begin(), mentioned->end());
+        }
+        if (!fns[i].isEntry) {
+            // Whether a name is a global decides how it lowers, and a store
+            // to one survives dead-store elimination only if something loads it.
+            byText(globals);
+            for (SymbolId g : globals) key.add(symbolText(g)).add(uint64_t{loaded.contains(g)});
+            byText(names);
+            for (SymbolId name : names) {
+                if (const StructLayout* layout = module.layouts.find(name)) {
+                    key.add("struct").add(symbolText(name));
+                    for (const FieldLayout& field : layout->fields) key.add(symbolText(field.name));
+                } else if (const EnumLayout* layout = module.enums.find(name)) {
+                    key.add("enum").add(symbolText(name));
+                    for (SymbolId variant : layout->variants) key.add(symbolText(variant));
+                }
+                for (const IRStructVar& var : module.structVars) {
+                    if (var.var == name) key.add("var").add(symbolText(var.var)).add(symbolText(var.type));
+                }
+            }
+        }
+        if (cacheable) plan.keys[i] = key.value() ? key.value() : 1;
+    }
+    return plan;
+}
+
+// A function's output as the cache keeps it.
+struct CachedFunction {
+    IRFunction ir;                   // after the passes; a one-function binary image on disk
+    NASMGenerator::Fragment code;
+    std::vector<SymbolId> globals;   // globals it loads or stores after the passes
+};
+
+// One file per key under the cache directory. Entries are written to a
+// temporary name and renamed into place, so concurrent builds sharing a
+// directory only ever see whole entries; anything unreadable is a miss.
+// Entries read or written are also kept in memory, which is what a
+// compile server hits on after its first build of a file.
+class CompileCache {
+public:
+    explicit CompileCache(std::filesystem::path dir) : dir(std::move(dir)) {
+        std::filesystem::create_directories(this->dir);
+    }
+
+    bool load(uint64_t key, CachedFunction& entry) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = warm.find(key);
+            if (found != warm.end()) {
+                entry = found->second;
+                return true;
+            }
+        }
+        if (!read(key, entry)) return false;
+        remember(key, entry);
+        return true;
+    }
+
+    void store(uint64_t key, const CachedFunction& entry) {
+        write(key, entry);
+        remember(key, entry);
+    }
+
+    // A whole linked program, as the ELF image --jit runs; keyed by source
+    // and settings rather than per function, and kept on disk only.
+    bool loadProgram(uint64_t key, std::string& image) const {
+        std::ifstream file(pathFor(key, "hlj"), std::ios::binary);
+        std::string magic;
+        return std::getline(file, magic) && magic == CompilerBuild && readText(file, "image", image);
+    }
+
+    void storeProgram(uint64_t key, const std::vector<uint8_t>& image) const {
+        std::filesystem::path target = pathFor(key, "hlj");
+        std::filesystem::path temporary = target;
+        temporary += ".tmp" + std::to_string(serial++);
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            if (!file) throw std::runtime_error("Failed to write cache entry '" + temporary.string() + "'");
+            file << CompilerBuild << "\nimage " << image.size() << "\n";
+            file.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+        }
+        std::filesystem::rename(temporary, target);
+    }
+
+private:
+    static constexpr size_t WarmLimit = 1 << 16;   // entries; past it the memory layer starts over
+    static inline std::atomic<uint64_t> serial{0};  // temporary file names
+
+    std::filesystem::path dir;
+    std::mutex mutex;
+    std::unordered_map<uint64_t, CachedFunction> warm;
+
+    void remember(uint64_t key, const CachedFunction& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (warm.size() >= WarmLimit) warm.clear();
+        warm[key] = entry;
+    }
+
+    bool read(uint64_t key, CachedFunction& entry) const {
+        std::ifstream file(pathFor(key), std::ios::binary);
+        std::string magic, label;
+        size_t count = 0;
+        if (!std::getline(file, magic) || magic != CompilerBuild) return false;
+        if (!(file >> label >> entry.code.spills) || label != "spills") return false;
+        if (!(file >> label) || label != "peephole") return false;
+        for (uint32_t& fired : entry.code.peephole.fired) {
+            if (!(file >> fired)) return false;
+        }
+        if (!(file >> label >> count) || label != "globals") return false;
+        entry.globals.clear();
+        for (std::string name; count > 0 && file >> name; --count) entry.globals.push_back(internSymbol(name));
+        if (!(file >> label >> count) || label != "addresses") return false;
+        entry.code.addresses.clear();
+        for (std::string name, operand; count > 0 && file >> name >> operand; --count)
+            entry.code.addresses.emplace_back(internSymbol(name), operand);
+        if (!(file >> label >> count) || label != "names") return false;
+        std::vector<SymbolId> names;
+        for (std::string name; count > 0 && file >> name; --count) names.push_back(internSymbol(name));
+        std::string image, code;
+        if (!readText(file, "ir", image) || !readText(file, "code", code) || !unpack(code, names, entry.code)) return false;
+        try {
+            BinaryModule ir(image);
+            if (ir.functions().size() != 1) return false;
+            entry.ir = ir.function(0);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        return true;
+    }
+
+    void write(uint64_t key, const CachedFunction& entry) const {
+        std::filesystem::path target = pathFor(key);
+        std::filesystem::path temporary = target;
+        temporary += ".tmp" + std::to_string(serial++);
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            if (!file) throw std::runtime_error("Failed to write cache entry '" + temporary.string() + "'");
+            file << CompilerBuild << "\nspills " << entry.code.spills << "\npeephole";
+            for (uint32_t fired : entry.code.peephole.fired) file << " " << fired;
+            file << "\nglobals " << entry.globals.size();
+            for (SymbolId g : entry.globals) file << " " << symbolText(g);
+            file << "\naddresses " << entry.code.addresses.size() << "\n";
+            for (const auto& [global, operand] : entry.code.addresses) file << symbolText(global) << " " << operand << "\n";
+            std::vector<SymbolId> names;
+            std::string code = pack(entry.code, names);
+            file << "names " << names.size();
+            for (SymbolId name : names) file << " " << symbolText(name);
+            BinaryWriter ir;
+            ir.addFunction(entry.ir);
+            std::string image = ir.finish();
+            file << "\nir " << image.size() << "\n" << image << "code " << code.size() << "\n" << code;
+        }
+        std::filesystem::rename(temporary, target);
+    }
+
+    std::filesystem::path pathFor(uint64_t key, const char* extension = "hlc") const {
+        char name[24];
+        std::snprintf(name, sizeof(name), "%016llx.%s", static_cast<unsigned long long>(key), extension);
+        return dir / name;
+    }
+
+    // Instructions and jump tables as fixed-size little-endian records;
+    // symbols are indices into `names`, which is written out as text.
+    static std::string pack(const NASMGenerator::Fragment& fragment, std::vector<SymbolId>& names) {
+        std::string out;
+        SymbolMap<uint32_t> index;
+        auto put = [&](uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; ++i) out.push_back(static_cast<char>(value >> (8 * i)));
+        };
+        auto operand = [&](const X86Operand& op) {
+            uint32_t name = 0;
+            if (op.symbol != NoSymbol) {
+                auto inserted = index.insert(op.symbol, static_cast<uint32_t>(names.size() + 1));
+                if (inserted.second) names.push_back(op.symbol);
+                name = *inserted.first;
+            }
+            put(static_cast<uint8_t>(op.kind), 1);
+            put(op.bits, 1);
+            put(op.sized, 1);
+            put(static_cast<uint8_t>(op.label), 1);
+            put(static_cast<uint8_t>(op.reg), 1);
+            put(name, 4);
+            put(static_cast<uint64_t>(op.value), 8);
+        };
+        put(fragment.code.size(), 4);
+        for (const X86Inst& inst : fragment.code) {
+            put(static_cast<uint8_t>(inst.op), 1);
+            put(static_cast<uint8_t>(inst.cc), 1);
+            operand(inst.a);
+            operand(inst.b);
+            operand(inst.c);
+        }
+        put(fragment.tables.size(), 4);
+        for (const std::vector<X86Operand>& table : fragment.tables) {
+            put(table.size(), 4);
+            for (const X86Operand& slot : table) operand(slot);
+        }
+        return out;
+    }
+
+    static bool unpack(const std::string& in, const std::vector<SymbolId>& names, NASMGenerator::Fragment& fragment) {
+        size_t pos = 0;
+        bool ok = true;
+        auto get = [&](int bytes) {
+            uint64_t value = 0;
+            if (pos + bytes > in.size()) {
+                ok = false;
+                return value;
+            }
+            for (int i = 0; i < bytes; ++i) value |= static_cast<uint64_t>(static_cast<uint8_t>(in[pos++])) << (8 * i);
+            return value;
+        };
+        auto operand = [&]() {
+            X86Operand op;
+            uint64_t kind = get(1);
+            if (kind > static_cast<uint8_t>(X86Operand::Kind::Symbol)) ok = false;
+            op.kind = static_cast<X86Operand::Kind>(kind);
+            op.bits = static_cast<uint8_t>(get(1));
+            op.sized = get(1) != 0;
+            op.label = static_cast<X86Operand::LabelKind>(get(1));
+            op.reg = static_cast<Reg>(get(1) & 15);
+            uint64_t name = get(4);
+            if (name > names.size()) ok = false;
+            else if (name) op.symbol = names[name - 1];
+            op.value = static_cast<int64_t>(get(8));
+            return op;
+        };
+        size_t count = static_cast<size_t>(get(4));
+        if (count > in.size()) return false;
+        fragment.code.clear();
+        fragment.code.reserve(count);
+        for (size_t i = 0; ok && i < count; ++i) {
+            uint64_t op = get(1);
+            if (op > static_cast<uint8_t>(X86Op::Entry)) return false;
+            X86Inst inst;
+            inst.op = static_cast<X86Op>(op);
+            inst.cc = static_cast<X86Cond>(get(1));
+            inst.a = operand();
+            inst.b = operand();
+            inst.c = operand();
+            fragment.code.push_back(inst);
+        }
+        size_t tables = static_cast<size_t>(get(4));
+        if (tables > in.size()) return false;
+        fragment.tables.assign(tables, {});
+        for (std::vector<X86Operand>& table : fragment.tables) {
+            size_t slots = static_cast<size_t>(get(4));
+            if (!ok || slots > in.size()) return false;
+            for (size_t i = 0; ok && i < slots; ++i) table.push_back(operand());
+        }
+        return ok && pos == in.size();
+    }
+
+    static bool readText(std::istream& file, const char* expected, std::string& text) {
+        std::string label;
+        size_t size = 0;
+        if (!(file >> label >> size) || label != expected || file.get() != '\n') return false;
+        text.resize(size);
+        return static_cast<bool>(file.read(text.data(), static_cast<std::streamsize>(size)));
+    }
+};
+
+//--------------------------------------------------
+// --- PROFILE-GUIDED OPTIMIZATION ---
+//--------------------------------------------------
+// --instrument gives every block of every function a 64-bit counter, bumped
+// by an `inc` at the block's label, and has the entry function write them
+// out on its way to the exit syscall, to <stem>.hlprof in its working directory:
+//
+//   hyperlace-profile 1
+//   counters 7
+//   fn _start 9c3f01e2a4b5d687 0 3
+//   fn fib 5e20d1c7f0a81b34 3 4
+//   end
+//   <7 little-endian uint64 counters>
+//
+// Each function line gives the fingerprint of the IR the counters were
+// taken on (the pipeline's output, which the counters do not change), where
+// its counters start and how many blocks it has. A block count is an edge
+// count wherever the block has one predecessor; a call site's count is its
+// block's, and a function's is its entry block's.
+//
+// --profile-use reads the file back. A function takes its counts only when
+// the same pipeline leaves it with the same fingerprint; one edited since,
+// or built with other pass options, is reported stale and compiled as if
+// there were no profile. The counts then re-run the inliner and the
+// cleanups after it (see InlinePass), order each function's blocks
+// (ProfileLayout), weigh spill candidates (RegisterAllocator) and put the
+// busiest functions first in .text. Runs of the program overwrite the
+// file rather than adding to it.
+
+constexpr const char* ProfileMagic = "hyperlace-profile 1";
+
+// Names, blocks, ops and successors of the function's IR, independent of
+// value numbering and interning order.
+inline uint64_t irFingerprint(const IRFunction& fn) {
+    ContentHash hash;
+    hash.add(symbolText(fn.name)).add(uint64_t{fn.blocks.size()});
+    for (BlockId b = 0; b < fn.blocks.size(); ++b) {
+        hash.add(uint64_t{fn.blocks[b].insts.size()});
+        for (ValueId v : fn.blocks[b].insts) {
+            const IRInst& inst = fn.insts[v];
+            hash.add(uint64_t{static_cast<uint8_t>(inst.op)}).add(uint64_t{inst.count});
+            if (inst.op == IROp::Const || inst.op == IROp::Param) hash.add(static_cast<uint64_t>(inst.imm));
+            if (inst.symbol != NoSymbol) hash.add(symbolText(inst.symbol));
+        }
+        for (size_t i = 0; i < fn.successorCount(b); ++i) hash.add(uint64_t{fn.successor(b, i)});
+    }
+    return hash.value();
+}
+
+struct ProfileData {
+    struct Function {
+        uint64_t fingerprint = 0;
+        std::vector<uint64_t> counts;   // per block
+    };
+    SymbolMap<Function> functions;
+
+    // The header an instrumented build embeds: `first[i]` is where
+    // function i's counters start.
+    static std::string header(const IRModule& module, const std::vector<uint64_t>& first, uint64_t total) {
+        std::ostringstream out;
+        out << ProfileMagic << "\ncounters " << total << "\n";
+        for (size_t i = 0; i < module.functions.size(); ++i) {
+            const IRFunction& fn = module.functions[i];
+            char fingerprint[17];
+            std::snprintf(fingerprint, sizeof fingerprint, "%016llx", static_cast<unsigned long long>(irFingerprint(fn)));
+            out << "fn " << symbolText(fn.name) << ' ' << fingerprint << ' ' << first[i] << ' ' << fn.blocks.size() << '\n';
+        }
+        out << "end\n";
+        return out.str();
+    }
+
+    static ProfileData read(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error("Profile Error: cannot open '" + path + "'");
+        auto fail = [&](const std::string& what) { throw std::runtime_error("Profile Error: '" + path + "' " + what); };
+        std::string line;
+        if (!std::getline(file, line) || line != ProfileMagic) fail("is not a Hyperlace profile");
+        std::string label;
+        uint64_t total = 0;
+        if (!std::getline(file, line) || !(std::istringstream(line) >> label >> total) || label != "counters") fail("has no counter total");
+        struct Entry {
+            std::string name;
+            uint64_t fingerprint, first, blocks;
+        };
+        std::vector<Entry> entries;
+        while (std::getline(file, line) && line != "end") {
+            Entry entry;
+            std::istringstream fields(line);
+            if (!(fields >> label >> entry.name >> std::hex >> entry.fingerprint >> std::dec >> entry.first >> entry.blocks) || label != "fn" ||
+                entry.first > total || entry.blocks > total - entry.first)
+                fail("has a malformed line: " + line);
+            entries.push_back(std::move(entry));
+        }
+        if (line != "end") fail("is truncated");
+        std::vector<uint64_t> counters(total);
+        for (uint64_t& counter : counters) {
+            uint8_t bytes[8];
+            if (!file.read(reinterpret_cast<char*>(bytes), 8)) fail("is missing counters");
+            counter = 0;
+            for (int i = 0; i < 8; ++i) counter |= uint64_t{bytes[i]} << (8 * i);
+        }
+        ProfileData profile;
+        for (const Entry& entry : entries) {
+            Function fn;
+            fn.fingerprint = entry.fingerprint;
+            fn.counts.assign(counters.begin() + static_cast<std::ptrdiff_t>(entry.first),
+                             counters.begin() + static_cast<std::ptrdiff_t>(entry.first + entry.blocks));
+            profile.functions.insert(internSymbol(entry.name), std::move(fn));
+        }
+        return profile;
+    }
+
+    // Puts the counts on every function whose IR they still fit; returns a
+    // remark per function.
+    std::vector<std::string> attach(IRModule& module) const {
+        std::vector<std::string> remarks;
+        for (IRFunction& fn : module.functions) {
+            std::string name(symbolText(fn.name));
+            const Function* entry = functions.find(fn.name);
+            if (!entry) {
+                remarks.push_back(name + ": not in the profile");
+            } else if (entry->fingerprint != irFingerprint(fn) || entry->counts.size() != fn.blocks.size()) {
+                remarks.push_back(name + ": stale, its IR changed since the profile was taken");
+            } else {
+                fn.counts = entry->counts;
+                size_t ran = static_cast<size_t>(std::count_if(fn.counts.begin(), fn.counts.end(), [](uint64_t c) { return c != 0; }));
+                remarks.push_back(name + ": entered " + std::to_string(fn.counts[0]) + " time(s), " + std::to_string(ran) + " of " +
+                                  std::to_string(fn.blocks.size()) + " block(s) ran");
+            }
+        }
+        return remarks;
+    }
 };
 
-struct Token {
-    TokenType type;
-    std::string lexeme;
-    int line;
-    int column;
+// The passes --profile-use runs again once the counts are on the IR: the
+// inliner, and the cleanups after it, where the pipeline has them, each
+// once. Empty when the pipeline does not inline.
+inline std::string profilePipeline(std::string_view pipeline) {
+    static const std::string_view rerun[] = {"verify", "inline", "forward", "fold", "dce"};
+    std::vector<std::string_view> kept;
+    size_t begin = 0;
+    while (begin <= pipeline.size()) {
+        size_t end = pipeline.find(',', begin);
+        if (end == std::string_view::npos) end = pipeline.size();
+        std::string_view item = pipeline.substr(begin, end - begin);
+        begin = end + 1;
+        if (std::find(std::begin(rerun), std::end(rerun), item) != std::end(rerun) && std::find(kept.begin(), kept.end(), item) == kept.end())
+            kept.push_back(item);
+    }
+    if (std::find(kept.begin(), kept.end(), "inline") == kept.end()) return {};
+    std::string passes;
+    for (std::string_view item : kept) {
+        passes += passes.empty() ? "" : ",";
+        passes += item;
+    }
+    return passes;
+}
+
+// Orders a profiled function's blocks as chains: from the entry, each
+// block is followed by its hottest successor not yet placed, so the common
+// path falls through; the remaining blocks that ran seed further chains,
+// hottest first; blocks that never ran go last, in their old order, out
+// of the hot code's way. Returns whether the order changed.
+class ProfileLayout {
+public:
+    static bool run(IRFunction& fn) {
+        if (fn.counts.empty()) return false;
+        const std::vector<uint64_t>& counts = fn.counts;
+        size_t n = fn.blocks.size();
+        std::vector<uint8_t> placed(n, 0);
+        std::vector<BlockId> order;
+        auto chain = [&](BlockId b) {
+            while (b != NoBlock) {
+                placed[b] = 1;
+                order.push_back(b);
+                BlockId next = NoBlock;
+                for (size_t i = 0; i < fn.successorCount(b); ++i) {
+                    BlockId succ = fn.successor(b, i);
+                    if (!placed[succ] && counts[succ] && (next == NoBlock || counts[succ] > counts[next])) next = succ;
+                }
+                b = next;
+            }
+        };
+        chain(0);
+        std::vector<BlockId> seeds;
+        for (BlockId b = 0; b < n; ++b) {
+            if (counts[b]) seeds.push_back(b);
+        }
+        std::stable_sort(seeds.begin(), seeds.end(), [&](BlockId a, BlockId b) { return counts[a] > counts[b]; });
+        for (BlockId b : seeds) {
+            if (!placed[b]) chain(b);
+        }
+        for (BlockId b = 0; b < n; ++b) {
+            if (!placed[b]) order.push_back(b);
+        }
+
+        std::vector<BlockId> remap(n);
+        bool moved = false;
+        for (BlockId i = 0; i < n; ++i) {
+            remap[order[i]] = i;
+            moved |= order[i] != i;
+        }
+        if (moved) fn.renumberBlocks(remap);
+        return moved;
+    }
 };
 
 //--------------------------------------------------
-// --- AST NODES ---
+// --- JIT ---
 //--------------------------------------------------
-class ASTNode {
-public:
-    virtual ~ASTNode() = default;
-};
+// `hyperlace --jit file.hl` runs a program inside the compiler: the linked
+// object is copied into anonymous memory, relocated there, and entered
+// through a thunk that saves the host's callee-saved registers and stack.
+// The entry function's exit syscall is rewritten into a jump to an exit
+// stub, which restores them and returns the exit status to the driver.
+// Code pages end up read+execute, .rodata read-only, .data read+write.
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__unix__) || defined(__APPLE__))
+#define HYPERLACE_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-class Expression : public ASTNode {};
-class Statement : public ASTNode {};
+// The runtime stub the entry function exits through under --jit. Not a
+// valid Hyperlace identifier, so it cannot clash with a user function.
+constexpr const char* JITExitStub = "hyperlace.exit";
 
-class Assignment : public Statement {
+// `code` with every `mov rax, 60` + `syscall` exit replaced by a jump to
+// the exit stub; the status is already in rdi.
+inline std::vector<X86Inst> hostedExit(std::vector<X86Inst> code) {
+    for (size_t i = 0; i + 1 < code.size(); ++i) {
+        X86Inst& set = code[i];
+        if (set.op != X86Op::Mov || !set.a.is(X86Operand::Kind::Reg) || set.a.reg != Reg::Rax || !set.b.is(X86Operand::Kind::Imm) ||
+            set.b.value != 60 || code[i + 1].op != X86Op::Syscall)
+            continue;
+        set = X86Inst{X86Op::Jmp, X86Cond::E, X86Operand::function(internSymbol(JITExitStub)), {}, {}};
+        code.erase(code.begin() + static_cast<std::ptrdiff_t>(i + 1));
+    }
+    return code;
+}
+
+#if HYPERLACE_JIT
+class JITProgram {
 public:
-    std::string name;
-    std::shared_ptr<Expression> value;
+    explicit JITProgram(const ObjectFile& object) {
+        using Section = ObjectFile::Section;
+        size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        auto round = [](size_t size, size_t to) { return (size + to - 1) / to * to; };
+        size_t text = round(sizeof(EnterThunk) + sizeof(ExitStub), 16);
+        size_t rodata = round(text + object.text.size(), page);
+        size_t data = round(rodata + object.rodata.size(), page);
+        size_t slot = round(data + object.data.size(), 8);
+        size = round(slot + 8, page);
+        void* mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) throw std::runtime_error(std::string("JIT Error: mmap failed: ") + std::strerror(errno));
+        base = static_cast<uint8_t*>(mapped);
 
-    Assignment(const std::string& n, std::shared_ptr<Expression> v)
-        : name(n), value(v) {}
-};
+        std::memcpy(base, EnterThunk, sizeof(EnterThunk));
+        uint8_t* exit = base + sizeof(EnterThunk);
+        std::memcpy(exit, ExitStub, sizeof(ExitStub));
+        saved = reinterpret_cast<uint64_t*>(base + slot);
+        std::memcpy(exit + 2, &saved, 8);   // the movabs immediate
+        std::memcpy(base + text, object.text.data(), object.text.size());
+        std::memcpy(base + rodata, object.rodata.data(), object.rodata.size());
+        std::memcpy(base + data, object.data.data(), object.data.size());
 
-class NumberExpr : public Expression {
+        uint8_t* sections[] = {base + text, base + data, base + rodata};
+        for (const ObjectFile::Relocation& r : object.relocations) {
+            uint8_t* field = sections[static_cast<size_t>(r.section)] + r.offset;
+            const uint8_t* target = sections[static_cast<size_t>(r.target)];
+            if (!r.external.empty()) {
+                if (r.external != JITExitStub) throw std::runtime_error("JIT Error: undefined symbol '" + r.external + "'");
+                target = exit;
+            }
+            int64_t value = reinterpret_cast<int64_t>(target) + r.addend;
+            if (r.type == ObjectFile::RelocType::Abs64) {
+                std::memcpy(field, &value, 8);
+                continue;
+            }
+            value -= reinterpret_cast<int64_t>(field);
+            if (value < INT32_MIN || value > INT32_MAX) throw std::runtime_error("JIT Error: relocation out of range");
+            int32_t rel = static_cast<int32_t>(value);
+            std::memcpy(field, &rel, 4);
+        }
+        for (const ObjectFile::Symbol& symbol : object.symbols) {
+            if (symbol.name == "_start" && symbol.section == Section::Text) entry = base + text + symbol.offset;
+        }
+        if (!entry) throw std::runtime_error("JIT Error: program has no _start");
+
+        if (::mprotect(base, rodata, PROT_READ | PROT_EXEC) != 0 || (data > rodata && ::mprotect(base + rodata, data - rodata, PROT_READ) != 0))
+            throw std::runtime_error(std::string("JIT Error: mprotect failed: ") + std::strerror(errno));
+    }
+
+    ~JITProgram() { ::munmap(base, size); }
+    JITProgram(const JITProgram&) = delete;
+    JITProgram& operator=(const JITProgram&) = delete;
+
+    // Runs the program to its exit; returns the status it exited with.
+    int run() {
+        using Enter = int64_t (*)(const uint8_t* entry, uint64_t* saved);
+        Enter enter = reinterpret_cast<Enter>(base);
+        return static_cast<int>(enter(entry, saved) & 0xFF);
+    }
+
+private:
+    // enter(entry, saved): push rbx, rbp, r12-r15; sub rsp, 8 so rsp is
+    // 16-byte aligned as at process start; *saved = rsp; jmp entry.
+    static constexpr uint8_t EnterThunk[] = {
+        0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,   // push rbx .. r15
+        0x48, 0x83, 0xEC, 0x08,                                       // sub rsp, 8
+        0x48, 0x89, 0x26,                                             // mov [rsi], rsp
+        0xFF, 0xE7,                                                   // jmp rdi
+    };
+    // exit(status in rdi): back to the stack enter() saved, pop what it
+    // pushed and return the status from enter().
+    static constexpr uint8_t ExitStub[] = {
+        0x48, 0xB9, 0, 0, 0, 0, 0, 0, 0, 0,                           // movabs rcx, slot
+        0x48, 0x8B, 0x21,                                             // mov rsp, [rcx]
+        0x48, 0x83, 0xC4, 0x08,                                       // add rsp, 8
+        0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B,   // pop r15 .. rbx
+        0x48, 0x89, 0xF8,                                             // mov rax, rdi
+        0xC3,                                                         // ret
+    };
+
+    uint8_t* base = nullptr;
+    size_t size = 0;
+    const uint8_t* entry = nullptr;
+    uint64_t* saved = nullptr;   // host rsp while the program runs
+};
+#else
+class JITProgram {
 public:
-    std::string value;
+    explicit JITProgram(const ObjectFile&) {}
+    int run() { throw std::runtime_error("--jit needs an x86-64 POSIX host, which this build is not"); }
+};
+#endif
 
-    NumberExpr(const std::string& val) : value(val) {}
+//--------------------------------------------------
+// --- WORKLOAD GENERATOR ---
+//--------------------------------------------------
+// `hyperlace --generate FILE [--shape SPEC]` writes a synthetic program
+// for benchmarking. SPEC is a comma-separated list of key=value pairs over
+// the fields of WorkloadShape, e.g. `functions=500,depth=6,body=32`. Every
+// program declares its structs, enums and macros first, then the
+// functions, then a top-level loop that runs `iterations` times so the
+// compiled program has work to do. Output depends only on the shape.
+struct WorkloadShape {
+    unsigned functions = 64;        // `Start` definitions
+    unsigned depth = 3;             // if/while/for nesting inside each function
+    unsigned body = 16;             // statements in every block
+    unsigned macros = 4;            // macro definitions; with any, every other statement is a use
+    unsigned fields = 8;            // fields per struct and variants per enum
+    unsigned iterations = 100000;   // trips of the top-level loop; 0 for none, else at least 4
 };
 
-class IdentifierExpr : public Expression {
+inline WorkloadShape parseWorkloadShape(std::string_view spec, WorkloadShape shape = {}) {
+    while (!spec.empty()) {
+        size_t comma = spec.find(',');
+        std::string_view item = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+        if (item.empty()) continue;
+        size_t eq = item.find('=');
+        std::string_view key = item.substr(0, eq);
+        unsigned value = 0;
+        const char* end = item.data() + item.size();
+        if (eq == std::string_view::npos || eq + 1 == item.size()
+            || std::from_chars(item.data() + eq + 1, end, value).ptr != end)
+            throw std::runtime_error("Invalid workload shape entry '" + std::string(item) + "' (expected key=number)");
+        if (key == "functions") shape.functions = value;
+        else if (key == "depth") shape.depth = value;
+        else if (key == "body") shape.body = value;
+        else if (key == "macros") shape.macros = value;
+        else if (key == "fields") shape.fields = value;
+        else if (key == "iterations") shape.iterations = value;
+        else throw std::runtime_error("Unknown workload shape key '" + std::string(key)
+                                      + "' (expected functions, depth, body, macros, fields or iterations)");
+    }
+    if (shape.depth > 64) throw std::runtime_error("Workload depth is limited to 64");
+    if (shape.fields == 0) shape.fields = 1;
+    if (shape.iterations > 0 && shape.iterations < 4) shape.iterations = 4;
+    return shape;
+}
+
+class WorkloadGenerator {
 public:
-    std::string name;
+    static OutputBuffer generate(const WorkloadShape& shape) {
+        WorkloadGenerator gen(shape);
+        gen.program();
+        return std::move(gen.out);
+    }
 
-    IdentifierExpr(const std::string& n) : name(n) {}
-};
+private:
+    static constexpr unsigned Types = 4;   // structs, and as many enums
 
-// Function Definition
-struct FunctionDef : public Statement {
-    std::string name;
-    std::vector<std::string> params;
-    std::vector<std::shared_ptr<Statement>> body;
-};
+    const WorkloadShape& shape;
+    OutputBuffer out;
+    uint64_t next = 0;   // statement counter, picks each statement's form
 
-// If Statement
-struct IfStatement : public Statement {
-    std::shared_ptr<Expression> condition;
-    std::vector<std::shared_ptr<Statement>> thenBranch;
-    std::vector<std::shared_ptr<Statement>> elseBranch;
+    explicit WorkloadGenerator(const WorkloadShape& shape) : shape(shape) {}
+
+    void indent(unsigned level) {
+        for (unsigned i = 0; i < level; ++i) out << "    ";
+    }
+
+    void program() {
+        out << "# Generated by hyperlace --generate: functions=" << shape.functions << ",depth=" << shape.depth << ",body=" << shape.body
+            << ",macros=" << shape.macros << ",fields=" << shape.fields << ",iterations=" << shape.iterations << "\n\n";
+        // Each macro assigns to a body-local name, which hygiene renames at every use.
+        for (unsigned m = 0; m < shape.macros; ++m) out << "Define |mix" << m << " x y| t" << m << " = y; x += t" << m << ";\n";
+        for (unsigned t = 0; t < Types; ++t) {
+            out << "\nInit Vec" << t << " {\n";
+            for (unsigned f = 0; f < shape.fields; ++f) out << "    f" << f << ";\n";
+            out << "}\n";
+            out << "Init Mode" << t << " {\n";
+            for (unsigned f = 0; f < shape.fields; ++f) out << "    v" << f << ";\n";
+            out << "}\n";
+        }
+        for (unsigned f = 0; f < shape.functions; ++f) {
+            out << "\nStart fn" << f << "(a, b) {\n";
+            out << "    s = a;\n    r = b;\n    p = Vec" << f % Types << "();\n";
+            block(1, shape.depth);
+            out << "    Return s;\n}\n";
+        }
+
+        out << "\ns = 0;\nr = 1;\np = Vec0();\n";
+        if (shape.iterations == 0) return;
+        out << "n = 0;\n";
+        out << "while (n < " << shape.iterations << ") {\n";
+        statements(1);
+        out << "    n += 1;\n}\n";
+    }
+
+    // `body` statements at `level`, then one construct nesting `depth` more.
+    void block(unsigned level, unsigned depth) {
+        statements(level);
+        if (depth == 0) return;
+        switch (depth % 3) {
+            case 0:
+                indent(level);
+                out << "if (s) {\n";
+                block(level + 1, depth - 1);
+                indent(level);
+                out << "} else {\n";
+                indent(level + 1);
+                out << "r += 1;\n";
+                indent(level);
+                out << "}\n";
+                break;
+            case 1:
+                indent(level);
+                out << "w" << depth << " = 1;\n";
+                indent(level);
+                out << "while (w" << depth << ") {\n";
+                block(level + 1, depth - 1);
+                indent(level + 1);
+                out << "w" << depth << " = 0;\n";
+                indent(level);
+                out << "}\n";
+                break;
+            default:
+                indent(level);
+                out << "for (k" << depth << " = 0; k" << depth << "; k" << depth << " += 1) {\n";
+                block(level + 1, depth - 1);
+                indent(level);
+                out << "}\n";
+                break;
+        }
+    }
+
+    void statements(unsigned level) {
+        for (unsigned i = 0; i < shape.body; ++i, ++next) {
+            indent(level);
+            if (shape.macros && next % 2 == 0) {
+                out << "|mix" << (next / 2) % shape.macros << " s r|\n";
+                continue;
+            }
+            unsigned field = static_cast<unsigned>(next % shape.fields);
+            switch (next % 5) {
+                case 0: out << "s = s + r * 3 - (r - " << next % 7 + 1 << ") / 2;\n"; break;
+                case 1: out << "p.f" << field << " = s;\n"; break;
+                case 2: out << "r = p.f" << field << ";\n"; break;
+                case 3: out << "m = Mode" << next % Types << ".v" << field << ";\n"; break;
+                default: out << "r += s > r ? " << next % 97 + 1 << " : -" << next % 89 + 1 << ";\n"; break;
+            }
+        }
+    }
 };
 
-// Function Call
-struct FunctionCall : public Expression {
-    std::string name;
-    std::vector<std::shared_ptr<Expression>> arguments;
+//--------------------------------------------------
+// --- BATCH DRIVER ---
+//--------------------------------------------------
+// hyperlace [-j N] [-o DIR] [--passes LIST] [--branches MODE] [--unroll N] [--inline-size N]
+//           [--struct-layout aos|soa] [--emit obj|asm|both] [--no-cache] [--profile] [--ast-xml]
+//           [--instrument | --profile-use PATH] [--manifest FILE | @FILE] file.hl...
+// hyperlace --jit [options] file.hl
+// hyperlace --serve SOCKET [-j N]
+// hyperlace --connect SOCKET [options] file.hl...
+// hyperlace --dump FILE.hlb
+// hyperlace --generate FILE [--shape SPEC]
+// hyperlace --bench [options] [--bench-*] [file.hl...]
+// hyperlace --check [options] [--check-cases N] [--check-seed N]
+//
+// Compiles every input in one process. The interner, scan kernel and the
+// default macro table are set up once and shared; each file gets its own
+// arena, token stream and file-scoped macro layer, and files run as tasks
+// on the same scheduler the per-function stages use. Outputs are written
+// as DIR/<stem>.{fir,o,hlb,log}, with .asm as well as or instead of the
+// object under --emit and the .ast XML view under --ast-xml; a per-stage timing summary, summed over all files,
+// is printed at the end. Unless --no-cache is given, unchanged functions
+// are taken from the compile cache in DIR/.cache. --jit links the one
+// input in memory and runs it in-process instead of writing an object
+// (see JIT); a source seen before with the same flags runs straight from
+// the program cached for it. --serve and --connect run the same driver
+// as a long-lived server (see COMPILE SERVER). --generate writes a
+// synthetic program (see WORKLOAD GENERATOR) and --bench times the
+// driver on such programs (see BENCHMARK SUITE); --check diffs the front
+// end against references and known answers (see SELF-CHECK).
+// --instrument and --profile-use build with block counters and from the
+// profile they wrote (see PROFILE-GUIDED OPTIMIZATION); both bypass the
+// cache.
+
+// What the backend writes: an ELF64 object, NASM text, or both.
+enum class OutputFormat : uint8_t { Object, Assembly, Both };
+
+struct BenchOptions {
+    bool enabled = false;
+    unsigned scale = 1;         // multiplies the size of every built-in workload
+    unsigned millis = 500;      // minimum time spent on each workload's compile, and again on its run
+    double threshold = 10.0;    // percent slower than the baseline that counts as a regression
+    std::string baseline;       // results file to compare against
+    std::string results;        // where to write this run's results; DIR/bench.json by default
+    std::string filter;         // only workloads whose name contains this
 };
 
-// While loop
-struct WhileLoop : public Statement {
-    std::shared_ptr<Expression> condition;
-    std::vector<std::shared_ptr<Statement>> body;
+struct CheckOptions {
+    bool enabled = false;
+    unsigned cases = 2000;   // random inputs for each randomized check
+    unsigned seed = 1;       // random case i is built from seed + i
 };
 
-// For loop
-struct ForLoop : public Statement {
-    std::shared_ptr<Statement> initializer;
-    std::shared_ptr<Expression> condition;
-    std::shared_ptr<Statement> increment;
-    std::vector<std::shared_ptr<Statement>> body;
+struct DriverOptions {
+    std::vector<std::string> inputs;
+    std::string outputDir = "output";
+    std::string pipeline = PassManager::DefaultPipeline;
+    IRPassOptions passOptions;
+    StructStorage structStorage = StructStorage::AoS;
+    OutputFormat format = OutputFormat::Object;
+    bool cache = true;      // reuse and store per-function output under DIR/.cache
+    bool jit = false;       // run the program in-process instead of writing .o
+    bool profile = false;   // also write <stem>.profile.json and <stem>.trace.json
+    bool astXML = false;    // also write <stem>.ast, the XML view of <stem>.hlb
+    bool instrument = false;   // count block runs; the program writes <stem>.hlprof at exit
+    std::string profileUse;    // a .hlprof file, or a directory of <stem>.hlprof files, to optimize with
+    unsigned jobs = 0;
+    std::string serve;      // socket to listen on instead of compiling
+    std::string generate;   // write a synthetic program here instead of compiling
+    std::string dump;       // print this .hlb image as XML instead of compiling
+    std::optional<WorkloadShape> shape;   // --shape: the generated program, or the one --bench workload
+    BenchOptions bench;
+    CheckOptions check;
 };
 
-// Function Call
-struct FunctionCall : public Expression {
-    std::string functionName;
-    std::vector<std::shared_ptr<Expression>> arguments;
+inline BranchMode parseBranchMode(std::string_view text) {
+    if (text == "auto") return BranchMode::Auto;
+    if (text == "cmov") return BranchMode::Cmov;
+    if (text == "jump") return BranchMode::Jump;
+    throw std::runtime_error("Unknown branch mode '" + std::string(text) + "' (expected auto, cmov or jump)");
+}
+
+inline OutputFormat parseOutputFormat(std::string_view text) {
+    if (text == "obj") return OutputFormat::Object;
+    if (text == "asm") return OutputFormat::Assembly;
+    if (text == "both") return OutputFormat::Both;
+    throw std::runtime_error("Unknown output format '" + std::string(text) + "' (expected obj, asm or both)");
+}
+
+inline StructStorage parseStructStorage(std::string_view text) {
+    if (text == "aos") return StructStorage::AoS;
+    if (text == "soa") return StructStorage::SoA;
+    throw std::runtime_error("Unknown struct layout '" + std::string(text) + "' (expected aos or soa)");
+}
+
+// The value of --unroll: loop body copies per trip, 1 to keep loops rolled.
+inline unsigned parseUnrollFactor(std::string_view value) {
+    std::string text(value);
+    char* end = nullptr;
+    long factor = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || factor < 1 || factor > 16)
+        throw std::runtime_error("Invalid unroll factor for --unroll: '" + text + "' (expected 1 to 16)");
+    return static_cast<unsigned>(factor);
+}
+
+// The value of --inline-size: the largest leaf, in instructions, inlined
+// at every call; 0 turns inlining off.
+inline unsigned parseInlineSize(std::string_view value) {
+    std::string text(value);
+    char* end = nullptr;
+    long size = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || size < 0 || size > 1000)
+        throw std::runtime_error("Invalid size for --inline-size: '" + text + "' (expected 0 to 1000)");
+    return static_cast<unsigned>(size);
+}
+
+// A positive integer option value no larger than `limit`.
+inline unsigned parseCount(std::string_view flag, std::string_view value, unsigned limit) {
+    std::string text(value);
+    char* end = nullptr;
+    long count = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || count < 1 || count > static_cast<long>(limit))
+        throw std::runtime_error("Invalid value for " + std::string(flag) + ": '" + text + "' (expected 1 to " + std::to_string(limit) + ")");
+    return static_cast<unsigned>(count);
+}
+
+inline double parsePercent(std::string_view flag, std::string_view value) {
+    std::string text(value);
+    if (!text.empty() && text.back() == '%') text.pop_back();
+    char* end = nullptr;
+    double percent = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || !(percent >= 0))
+        throw std::runtime_error("Invalid percentage for " + std::string(flag) + ": '" + std::string(value) + "'");
+    return percent;
+}
+
+// One path per line; blank lines and '#' comments are skipped. Relative
+// paths are taken relative to the manifest's directory.
+inline void readManifest(const std::string& path, std::vector<std::string>& inputs) {
+    std::ifstream file(path);
+    if (!file) throw std::runtime_error("Failed to open manifest '" + path + "'");
+    std::filesystem::path base = std::filesystem::path(path).parent_path();
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        std::filesystem::path entry = line.substr(first, last - first + 1);
+        inputs.push_back((entry.is_relative() ? base / entry : entry).string());
+    }
+}
+
+// Relative paths in `args` are taken relative to `base`, the current
+// directory when empty; the server passes its client's directory.
+inline DriverOptions parseDriverOptions(const std::vector<std::string>& args, const std::filesystem::path& base = {}) {
+    DriverOptions options;
+    auto resolve = [&](std::string_view path) {
+        std::filesystem::path entry(path);
+        return (base.empty() || entry.is_absolute() ? entry : (base / entry).lexically_normal()).string();
+    };
+    options.outputDir = resolve(options.outputDir);
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string_view arg = args[i];
+        auto value = [&](std::string_view flag) -> std::string {
+            if (i + 1 >= args.size()) throw std::runtime_error("Missing value for " + std::string(flag));
+            return args[++i];
+        };
+        if (arg == "-j") {
+            options.jobs = parseJobCount(value(arg));
+        } else if (arg.size() > 2 && arg.substr(0, 2) == "-j") {
+            options.jobs = parseJobCount(arg.substr(2));
+        } else if (arg == "-o") {
+            options.outputDir = resolve(value(arg));
+        } else if (arg == "--passes") {
+            options.pipeline = value(arg);
+        } else if (arg == "--branches") {
+            options.passOptions.branches = parseBranchMode(value(arg));
+        } else if (arg == "--unroll") {
+            options.passOptions.unroll = parseUnrollFactor(value(arg));
+        } else if (arg == "--inline-size") {
+            options.passOptions.inlineSize = parseInlineSize(value(arg));
+        } else if (arg == "--struct-layout") {
+            options.structStorage = parseStructStorage(value(arg));
+        } else if (arg == "--emit") {
+            options.format = parseOutputFormat(value(arg));
+        } else if (arg == "--no-cache") {
+            options.cache = false;
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--profile") {
+            options.profile = true;
+        } else if (arg == "--ast-xml") {
+            options.astXML = true;
+        } else if (arg == "--instrument") {
+            options.instrument = true;
+        } else if (arg == "--profile-use") {
+            options.profileUse = resolve(value(arg));
+        } else if (arg == "--dump") {
+            options.dump = resolve(value(arg));
+        } else if (arg == "--serve") {
+            options.serve = resolve(value(arg));
+        } else if (arg == "--generate") {
+            options.generate = resolve(value(arg));
+        } else if (arg == "--shape") {
+            options.shape = parseWorkloadShape(value(arg));
+        } else if (arg == "--bench") {
+            options.bench.enabled = true;
+        } else if (arg == "--bench-scale") {
+            options.bench.scale = parseCount(arg, value(arg), 1000);
+        } else if (arg == "--bench-time") {
+            options.bench.millis = parseCount(arg, value(arg), 3600000);
+        } else if (arg == "--bench-threshold") {
+            options.bench.threshold = parsePercent(arg, value(arg));
+        } else if (arg == "--bench-baseline") {
+            options.bench.baseline = resolve(value(arg));
+        } else if (arg == "--bench-out") {
+            options.bench.results = resolve(value(arg));
+        } else if (arg == "--bench-filter") {
+            options.bench.filter = value(arg);
+        } else if (arg == "--check") {
+            options.check.enabled = true;
+        } else if (arg == "--check-cases") {
+            options.check.cases = parseCount(arg, value(arg), 10000000);
+        } else if (arg == "--check-seed") {
+            options.check.seed = parseCount(arg, value(arg), 1000000000);
+        } else if (arg == "--manifest") {
+            readManifest(resolve(value(arg)), options.inputs);
+        } else if (arg.size() > 1 && arg[0] == '@') {
+            readManifest(resolve(arg.substr(1)), options.inputs);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            throw std::runtime_error("Unknown option '" + std::string(arg) + "'");
+        } else {
+            options.inputs.push_back(resolve(arg));
+        }
+    }
+    if (options.inputs.empty() && options.generate.empty() && options.dump.empty() && !options.bench.enabled && !options.check.enabled)
+        options.inputs.push_back(resolve("Samples/hello.hl"));
+    if (options.jit && options.inputs.size() != 1) throw std::runtime_error("--jit runs exactly one file");
+    if (options.jit && options.bench.enabled) throw std::runtime_error("--bench times --jit runs itself; drop --jit");
+    if (options.instrument && !options.profileUse.empty()) throw std::runtime_error("--instrument and --profile-use do not combine");
+    PassManager{options.pipeline};   // reject unknown pass names before any file is read
+    return options;
+}
+
+#define HYPERLACE_STAGES(X) \
+    X(Read, "read")         \
+    X(Lex, "lex")           \
+    X(Parse, "parse+macro") \
+    X(Semantic, "semantic") \
+    X(IR, "ir")             \
+    X(Passes, "passes")     \
+    X(Cache, "cache")       \
+    X(NASM, "nasm")         \
+    X(Object, "object")     \
+    X(Binary, "binary")     \
+    X(ASTXML, "ast-xml")    \
+    X(Log, "log")           \
+    X(Write, "write")
+
+enum class Stage : uint8_t {
+#define HYPERLACE_STAGE_ENUM(Name, Label) Name,
+    HYPERLACE_STAGES(HYPERLACE_STAGE_ENUM)
+#undef HYPERLACE_STAGE_ENUM
+    Count
 };
 
-struct StructDef : public Statement {
-    std::string name;
-    std::vector<std::string> fields;
+inline const char* stageName(Stage stage) {
+    static const char* const names[] = {
+#define HYPERLACE_STAGE_NAME(Name, Label) Label,
+        HYPERLACE_STAGES(HYPERLACE_STAGE_NAME)
+#undef HYPERLACE_STAGE_NAME
+    };
+    return names[static_cast<size_t>(stage)];
+}
+
+// Stage totals summed over every file; safe to add to from any thread.
+class StageTimes {
+public:
+    void add(Stage stage, int64_t nanos) {
+        totals[static_cast<size_t>(stage)].fetch_add(nanos, std::memory_order_relaxed);
+    }
+    double millis(Stage stage) const {
+        return totals[static_cast<size_t>(stage)].load(std::memory_order_relaxed) / 1e6;
+    }
+    void clear() {
+        for (std::atomic<int64_t>& total : totals) total.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> totals[static_cast<size_t>(Stage::Count)] = {};
 };
 
-struct StructInit : public Expression {
-    std::string structName;
+#if HYPERLACE_POSIX_IO
+#include <sys/resource.h>
+#endif
+
+// The process's peak resident set so far, in KiB; 0 where unknown.
+inline uint64_t peakResidentKiB() {
+#if HYPERLACE_POSIX_IO
+    rusage usage{};
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024;   // bytes there
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#else
+    return 0;
+#endif
+}
+
+// A small stable number for the calling thread, for trace events.
+inline uint32_t traceThreadId() {
+    static std::atomic<uint32_t> next{0};
+    static thread_local uint32_t id = next++;
+    return id;
+}
+
+// One timed run of a stage on one file. `items` is what the stage
+// produced or consumed: source bytes, tokens, AST nodes, IR or x86
+// instructions, cache hits, or output bytes.
+struct StageSample {
+    Stage stage;
+    uint32_t thread;
+    int64_t start, nanos;   // start: nanoseconds since the batch began
+    uint64_t allocations, allocatedBytes;
+    uint64_t items;
+    uint64_t peakRss;       // KiB, the process's peak as the stage ended
 };
 
-struct FieldAccess : public Expression {
-    std::shared_ptr<Expression> object;
-    std::string field;
+// A file's stage samples; timers add to it from any thread.
+class StageProfile {
+public:
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    void add(const StageSample& sample) {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples.push_back(sample);
+    }
+
+    std::vector<StageSample> snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return samples;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<StageSample> samples;
 };
 
-struct EnumDef : public Statement {
-    std::string name;
-    std::vector<std::string> variants;
+// Times one stage of one file into the file's profile and the totals,
+// counting the allocations made under it on any thread.
+class StageTimer {
+public:
+    StageTimer(StageTimes& times, StageProfile& profile, Stage stage)
+        : times(times), profile(profile), stage(stage), scope(&allocations), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { stop(); }
+
+    void count(uint64_t produced) { items = produced; }
+
+    int64_t stop() {
+        if (stopped) return nanos;
+        auto now = std::chrono::steady_clock::now();
+        nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+        times.add(stage, nanos);
+        profile.add(StageSample{stage, traceThreadId(), std::chrono::duration_cast<std::chrono::nanoseconds>(start - profile.epoch).count(),
+                                nanos, allocations.count.load(std::memory_order_relaxed), allocations.bytes.load(std::memory_order_relaxed),
+                                items, peakResidentKiB()});
+        stopped = true;
+        return nanos;
+    }
+
+private:
+    StageTimes& times;
+    StageProfile& profile;
+    Stage stage;
+    AllocationCounter allocations;
+    AllocationScope scope;
+    std::chrono::steady_clock::time_point start;
+    int64_t nanos = 0;
+    uint64_t items = 0;
+    bool stopped = false;
 };
 
-//--------------------------------------------------
-// --- PARSER IMPLEMENTATION ---
-//--------------------------------------------------
-class Parser {
+// The scheduler, default macros and compile caches outlive a run, so a
+// server reuses them for every request; runs themselves are one at a time.
+class BatchDriver {
 public:
-    Parser(const std::vector<Token>& tokens) : tokens(tokens), current(0) {}
+    explicit BatchDriver(unsigned jobs) : scheduler(jobs) { macros.loadDefaults(); }
 
-    std::vector<std::shared_ptr<Statement>> parse() {
-        std::vector<std::shared_ptr<Statement>> statements;
-        while (!isAtEnd()) {
-            statements.push_back(parseStatement());
+    unsigned jobCount() const { return scheduler.jobCount(); }
+
+    int run(DriverOptions runOptions, std::ostream& out, std::ostream& err) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<FileResult> results = begin(std::move(runOptions));
+        if (options.jit) return runJIT(results[0], err);
+
+        scheduler.parallelFor(results.size(), [&](size_t i) {
+            try {
+                compileFile(results[i]);
+            } catch (const std::exception& ex) {
+                results[i].error = ex.what();
+            }
+        });
+
+        size_t failed = 0;
+        for (const FileResult& r : results) {
+            if (r.error.empty()) {
+                out << r.input << ": " << r.statements << " statement(s) -> " << r.stem << outputs() << "\n";
+            } else {
+                err << r.input << ": " << r.error << "\n";
+                failed++;
+            }
+        }
+
+        double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        out << "\n[Batch] " << results.size() << " file(s), " << failed << " failed, "
+                  << scheduler.jobCount() << " job(s)\n";
+        for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+            Stage stage = static_cast<Stage>(s);
+            out << "  " << std::left << std::setw(12) << stageName(stage) << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(12) << times.millis(stage) << " ms\n";
         }
-        return statements;
+        out << "  " << std::left << std::setw(12) << "wall" << std::right
+                  << std::setw(12) << wall << " ms\n";
+        return failed == 0 ? 0 : 1;
+    }
+
+    // Compiles the one input of `runOptions` and links it in memory as
+    // --jit does, without running it or consulting the program cache.
+    ObjectFile link(DriverOptions runOptions) {
+        runOptions.jit = true;
+        std::vector<FileResult> results = begin(std::move(runOptions));
+        compileFile(results[0]);
+        return std::move(results[0].object);
     }
 
+    // The stage totals of the last run.
+    const StageTimes& stageTimes() const { return times; }
+
 private:
-    const std::vector<Token>& tokens;
-    size_t current;
+    struct FileResult {
+        std::string input;
+        std::string stem;   // output path without extension
+        std::string error;
+        size_t statements = 0;
+        ObjectFile object;  // --jit: the linked program, kept in memory
+        std::vector<Artifact> artifacts;   // finished outputs, written together by writeLog()
+        StageProfile profile;
+    };
 
-    bool isAtEnd() const {
-        return peek().type == TokenType::EndOfFile;
+    DriverOptions options;
+    TaskScheduler scheduler;
+    MacroExpander macros;   // shared defaults; read-only once run() starts
+    StageTimes times;
+    std::string timestamp;  // batch start, shared by every log
+    std::unordered_map<std::string, std::unique_ptr<CompileCache>> caches;   // by directory
+    CompileCache* cache = nullptr;   // this run's, null with --no-cache
+    uint64_t settings = 0;  // build and flags, part of every cache key
+
+    // Takes on a run's options and settles its cache, output directory and
+    // one result per input.
+    std::vector<FileResult> begin(DriverOptions runOptions) {
+        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        timestamp = std::ctime(&now);
+        options = std::move(runOptions);
+        times.clear();
+        const IRPassOptions& passes = options.passOptions;
+        settings = ContentHash()
+                       .add(CompilerBuild)
+                       .add(options.pipeline)
+                       .add(uint64_t{static_cast<uint8_t>(passes.branches)})
+                       .add(uint64_t{passes.unroll})
+                       .add(uint64_t{passes.inlineSize})
+                       .add(uint64_t{static_cast<uint8_t>(options.structStorage)})
+                       .value();
+        std::filesystem::create_directories(options.outputDir);
+        cache = nullptr;
+        if (options.cache && !options.instrument && options.profileUse.empty()) {
+            std::filesystem::path dir = std::filesystem::absolute(std::filesystem::path(options.outputDir) / ".cache");
+            std::unique_ptr<CompileCache>& slot = caches[dir.lexically_normal().string()];
+            if (!slot) slot = std::make_unique<CompileCache>(dir);
+            std::filesystem::create_directories(dir);   // the output directory may have been cleaned since
+            cache = slot.get();
+        }
+
+        std::vector<FileResult> results(options.inputs.size());
+        SymbolMap<size_t> stems;
+        for (size_t i = 0; i < options.inputs.size(); ++i) {
+            results[i].input = options.inputs[i];
+            std::string stem = std::filesystem::path(options.inputs[i]).stem().string();
+            auto inserted = stems.insert(internSymbol(stem), i);
+            if (!inserted.second) {
+                throw std::runtime_error("Inputs '" + options.inputs[*inserted.first] + "' and '" + options.inputs[i]
+                                         + "' would both write " + options.outputDir + "/" + stem + ".*");
+            }
+            results[i].stem = (std::filesystem::path(options.outputDir) / stem).string();
+        }
+        return results;
+    }
+
+    // What emit() wrote, per function in module order.
+    struct Emitted {
+        std::vector<size_t> stale;      // cached functions that no longer fit the data layout; nothing else is set then
+        std::vector<size_t> compiled;   // functions lowered in this run
+        std::vector<std::string> fir;
+        std::vector<NASMGenerator::Fragment> code;
+        uint32_t spills = 0;
+        PeepholeCounts peephole;
+        uint64_t counters = 0;          // --instrument: block counters in the program
+    };
+
+    void compileFile(FileResult& result) {
+        auto start_time = std::chrono::steady_clock::now();
+        std::string name = std::filesystem::path(result.stem).filename().string();
+
+        std::optional<MappedFile> source;
+        {
+            StageTimer timer(times, result.profile, Stage::Read);
+            source.emplace(result.input);
+            timer.count(source->text().size());
+        }
+        std::string_view raw_input = source->text();
+
+        MacroExpander fileMacros(&macros);
+        OutputBuffer log;
+        log << "Hyperlace Compiler Debug Log\n";
+        log << "Timestamp: " << timestamp;
+        log << "----------------------------------------\n\n";
+
+        // Dedicated lexing pass: measures the raw tokenizer rate.
+        size_t tokenCount = 0;
+        double lex_mbps = 0.0;
+        {
+            StageTimer timer(times, result.profile, Stage::Lex);
+            for (Lexer counter(raw_input); counter.next().type != TokenType::EndOfFile;) tokenCount++;
+            timer.count(tokenCount);
+            double lex_seconds = timer.stop() / 1e9;
+            lex_mbps = lex_seconds > 0 ? (raw_input.size() / 1e6) / lex_seconds : 0.0;
+        }
+
+        ASTArena ast;
+        Lexer lexer(raw_input);
+        MacroStream tokens(lexer, fileMacros);
+        NodeList statements;
+        std::vector<std::string> parseErrors;
+        try {
+            StageTimer timer(times, result.profile, Stage::Parse);
+            Parser parser(tokens, ast);
+            statements = parser.parse();
+            parseErrors = parser.errors();
+            timer.count(ast.nodeCount());
+        } catch (const std::exception& ex) {
+            parseErrors.push_back(ex.what());
+        }
+        if (!parseErrors.empty()) {
+            log << "[Source Code]\n" << raw_input << "\n\n";
+            for (const std::string& error : parseErrors) log << "[Parse Error] " << error << "\n";
+            writeLog(result, log);
+            if (parseErrors.size() == 1) throw std::runtime_error(parseErrors.front());
+            std::string summary = std::to_string(parseErrors.size()) + " parse errors";
+            for (const std::string& error : parseErrors) summary += "\n  " + error;
+            throw std::runtime_error(summary);
+        }
+        result.statements = statements.count;
+
+        {
+            StageTimer timer(times, result.profile, Stage::Log);
+            log << "[Source Code]\n" << raw_input << "\n\n";
+            log << "[Expanded Code]\n" << renderExpanded(raw_input, fileMacros) << "\n\n";
+            log << "[Tokens]\n";
+            Lexer logLexer(raw_input);
+            MacroStream tokenLog(logLexer, fileMacros);
+            for (Token token = tokenLog.next(); token.type != TokenType::EndOfFile; token = tokenLog.next()) {
+                log.padded(token.line, 4) << ':';
+                log.padded(token.column, 2) << '\t' << static_cast<int>(token.type) << '\t' << token.lexeme << '\n';
+            }
+            log << "\n[AST]\n";
+            for (NodeId stmt : ast.children(statements)) {
+                if (auto assign = ast.as<Assignment>(stmt)) {
+                    log << "Assign to " << symbolText(assign->name);
+                    if (assign->field != NoSymbol) log << "." << symbolText(assign->field);
+                    log << " <- ";
+                    if (auto num = ast.as<NumberExpr>(assign->value)) {
+                        log << "NUM(" << num->value << ")\n";
+                    } else if (auto id = ast.as<IdentifierExpr>(assign->value)) {
+                        log << "REF(" << symbolText(id->name) << ")\n";
+                    } else if (auto init = ast.as<StructInit>(assign->value)) {
+                        log << "INIT(" << symbolText(init->structName) << ")\n";
+                    } else {
+                        log << nodeKindName(ast.kind(assign->value)) << "\n";
+                    }
+                }
+            }
+            timer.count(log.size());
+        }
+
+        try {
+            StageTimer timer(times, result.profile, Stage::Semantic);
+            SemanticAnalyzer analyzer;
+            analyzer.analyze(ast, statements, scheduler);
+            timer.count(ast.nodeCount());
+            log << "\n[Semantic] Success\n";
+        } catch (const std::exception& ex) {
+            log << "\n[Semantic Error] " << ex.what() << "\n";
+            writeLog(result, log);
+            throw;
+        }
+
+        IRModule module;
+        {
+            StageTimer timer(times, result.profile, Stage::IR);
+            module = buildIRModule(ast, statements, scheduler);
+            timer.count(instructionCount(module));
+        }
+        for (const EnumLayout& layout : module.enums.all()) {
+            log << "[Enum] " << symbolText(layout.name) << ":";
+            for (size_t i = 0; i < layout.variants.size(); ++i) log << (i ? ", " : " ") << symbolText(layout.variants[i]) << "=" << i;
+            log << "\n";
+        }
+        for (const StructLayout& layout : module.layouts.all()) {
+            log << "[Layout] " << symbolText(layout.name) << ": size " << layout.size << ", align " << layout.align << " (";
+            for (size_t i = 0; i < layout.fields.size(); ++i) {
+                log << (i ? ", " : "") << symbolText(layout.fields[i].name) << "@" << layout.fields[i].offset;
+            }
+            log << ")\n";
+        }
+        std::vector<CachedFunction> cached(module.functions.size());
+        std::vector<uint8_t> hit(module.functions.size(), 0);
+        CachePlan plan;
+        if (cache) {
+            StageTimer timer(times, result.profile, Stage::Cache);
+            plan = planCache(ast, statements, module, settings);
+            for (size_t i = 0; i < module.functions.size(); ++i) hit[i] = plan.keys[i] != 0 && cache->load(plan.keys[i], cached[i]);
+            timer.count(static_cast<uint64_t>(std::count(hit.begin(), hit.end(), 1)));
+        }
+        std::optional<ProfileData> profileData;
+        if (!options.profileUse.empty()) {
+            try {
+                profileData = ProfileData::read(profilePath(result));
+            } catch (const std::exception& ex) {
+                log << "\n[PGO Error] " << ex.what() << "\n";
+                writeLog(result, log);
+                throw;
+            }
+        }
+        const std::vector<SymbolId> declared = module.globals;
+        size_t functionCount = module.functions.size();
+        PassManager passes(options.pipeline, options.passOptions);
+        PassManager profiled(profileData ? profilePipeline(options.pipeline) : std::string(), options.passOptions);
+        std::vector<std::string> profileRemarks;
+        Emitted emitted;
+        for (;;) {
+            std::vector<size_t> compiled;
+            {
+                StageTimer timer(times, result.profile, Stage::Passes);
+                compiled = detachReused(module, hit, cached);
+                passes.run(module, scheduler);
+                if (profileData) {
+                    profileRemarks = profileData->attach(module);
+                    profiled.run(module, scheduler);
+                    std::vector<uint8_t> moved(module.functions.size(), 0);
+                    scheduler.parallelFor(module.functions.size(), [&](size_t k) { moved[k] = ProfileLayout::run(module.functions[k]); });
+                    for (size_t k = 0; k < moved.size(); ++k) {
+                        if (moved[k]) profileRemarks.push_back(std::string(symbolText(module.functions[k].name)) + ": blocks reordered hottest path first");
+                    }
+                }
+                timer.count(instructionCount(module));
+            }
+            emitted = emit(result, module, std::move(compiled), cached, declared);
+            if (emitted.stale.empty()) break;
+            // Some cached functions address struct fields where the new data
+            // layout no longer puts them: rebuild those along with the misses.
+            // Each round takes at least one hit away, so this ends.
+            log << "[Cache] data layout changed; recompiling";
+            for (size_t i : emitted.stale) {
+                log << " " << symbolText(cached[i].ir.name);
+                hit[i] = 0;
+            }
+            log << "\n";
+            StageTimer timer(times, result.profile, Stage::IR);
+            module = buildIRModule(ast, statements, scheduler);
+        }
+        size_t hits = static_cast<size_t>(std::count(hit.begin(), hit.end(), 1));
+        if (cache) {
+            StageTimer timer(times, result.profile, Stage::Cache);
+            for (size_t k = 0; k < emitted.compiled.size(); ++k) {
+                size_t i = emitted.compiled[k];
+                if (plan.keys[i] == 0 || hit[i]) continue;
+                CachedFunction entry;
+                entry.ir = module.functions[k];
+                entry.code = std::move(emitted.code[i]);
+                entry.globals = touchedGlobals(module.functions[k]);
+                cache->store(plan.keys[i], entry);
+            }
+        }
+
+        log << "\n[Passes]";
+        for (const PassManager::PassStats& pass : passes.lastRun()) {
+            log << " " << pass.name << (pass.changed ? "*" : "") << " (";
+            log.fixed(pass.nanos / 1e6, 3) << " ms)";
+        }
+        log << "\n";
+        for (const PassManager::PassStats& pass : passes.lastRun()) {
+            for (const std::string& remark : pass.remarks) log << "[" << pass.name << "] " << remark << "\n";
+        }
+        if (profileData) {
+            log << "[PGO] Profile " << profilePath(result) << "\n";
+            for (const std::string& remark : profileRemarks) log << "[PGO] " << remark << "\n";
+            if (!profiled.lastRun().empty()) {
+                log << "[Passes] profile:";
+                for (const PassManager::PassStats& pass : profiled.lastRun()) {
+                    log << " " << pass.name << (pass.changed ? "*" : "") << " (";
+                    log.fixed(pass.nanos / 1e6, 3) << " ms)";
+                }
+                log << "\n";
+                for (const PassManager::PassStats& pass : profiled.lastRun()) {
+                    for (const std::string& remark : pass.remarks) log << "[" << pass.name << "] " << remark << "\n";
+                }
+            }
+        }
+        if (options.instrument) {
+            log << "[PGO] " << emitted.counters << " block counter(s); the program writes " << name
+                << ".hlprof into its working directory when it exits\n";
+        }
+        if (cache) {
+            log << "[Cache] " << hits << " hit(s), " << functionCount - hits << " miss(es); " << emitted.compiled.size()
+                << " of " << functionCount << " function(s) compiled\n";
+        }
+        log << "[IR] Emitted to " << name << ".fir\n";
+        if (writesAssembly()) log << "[ASM] Emitted to " << name << ".asm\n";
+        if (options.jit) log << "[JIT] Linked in memory\n";
+        else if (writesObject()) log << "[OBJ] Emitted to " << name << ".o\n";
+        uint32_t spills = emitted.spills;
+        std::string image;
+        {
+            StageTimer timer(times, result.profile, Stage::Binary);
+            std::vector<const IRFunction*> functions(functionCount);
+            for (size_t i = 0; i < functionCount; ++i) functions[i] = &cached[i].ir;
+            for (size_t k = 0; k < emitted.compiled.size(); ++k) functions[emitted.compiled[k]] = &module.functions[k];
+            BinaryWriter writer;
+            writer.addAST(ast, statements);
+            writer.addGlobals(module.globals);
+            for (const IRFunction* fn : functions) writer.addFunction(*fn);
+            image = writer.finish();
+            OutputBuffer data;
+            data << image;
+            result.artifacts.push_back({result.stem + ".hlb", std::move(data), "Failed to write binary AST/IR file."});
+            timer.count(image.size());
+            log << "[HLB] AST and IR written to " << name << ".hlb\n";
+        }
+        if (options.astXML) {
+            StageTimer timer(times, result.profile, Stage::ASTXML);
+            result.artifacts.push_back({result.stem + ".ast", ASTXMLWriter::render(BinaryModule(image)), "Failed to open .ast file"});
+            timer.count(result.artifacts.back().data.size());
+            log << "[AST] XML written to " << name << ".ast\n";
+        }
+
+        log << "\n[Statistics]\n";
+        log << "Total Statements: " << statements.count << "\n";
+        log << "Total Tokens: " << tokenCount << "\n";
+        log << "Lex Rate: ";
+        log.fixed(lex_mbps, 1) << " MB/s\n";
+        log << "Lexer Kernel: " << activeScanKernel().name << "\n";
+        log << "Macro Expansions: " << tokens.expansionCount() << "\n";
+        log << "Macro Time: ";
+        log.fixed(tokens.expansionMillis(), 3) << " ms\n";
+        log << "Register Spills: " << spills << "\n";
+        log << "Peephole Rewrites: " << emitted.peephole.total() << "\n";
+        for (size_t rule = 0; rule < PeepholeRuleCount; ++rule) {
+            if (emitted.peephole.fired[rule]) log << "[Peephole] " << peepholeRuleName(rule) << ": " << emitted.peephole.fired[rule] << "\n";
+        }
+        log << "Worker Threads: " << scheduler.jobCount() << "\n";
+
+        int64_t compileNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+        log << "Compile Time: " << compileNanos / 1000000 << "ms\n";
+
+        std::vector<StageSample> stages = stageTotals(result.profile.snapshot());
+        log << "\n[Profile]\n";
+        log << "stage                 ns     allocs        bytes      items   peak KiB\n";
+        for (const StageSample& stage : stages) {
+            std::string_view label = stageName(stage.stage);
+            log << label;
+            for (size_t pad = label.size(); pad < 12; ++pad) log << ' ';
+            log.padded(stage.nanos, 12) << ' ';
+            log.padded(static_cast<int64_t>(stage.allocations), 10) << ' ';
+            log.padded(static_cast<int64_t>(stage.allocatedBytes), 12) << ' ';
+            log.padded(static_cast<int64_t>(stage.items), 10) << ' ';
+            log.padded(static_cast<int64_t>(stage.peakRss), 10) << '\n';
+        }
+        if (options.profile) {
+            const std::pair<const char*, int64_t> statistics[] = {
+                {"statements", static_cast<int64_t>(statements.count)},
+                {"tokens", static_cast<int64_t>(tokenCount)},
+                {"ast_nodes", static_cast<int64_t>(ast.nodeCount())},
+                {"macro_expansions", static_cast<int64_t>(tokens.expansionCount())},
+                {"macro_ns", static_cast<int64_t>(tokens.expansionMillis() * 1e6)},
+                {"register_spills", static_cast<int64_t>(spills)},
+                {"peephole_rewrites", static_cast<int64_t>(emitted.peephole.total())},
+                {"worker_threads", static_cast<int64_t>(scheduler.jobCount())},
+                {"compile_ns", compileNanos},
+            };
+            result.artifacts.push_back({result.stem + ".profile.json", profileJSON(result.input, statistics, stages), "Failed to write profile."});
+            result.artifacts.push_back({result.stem + ".trace.json", traceJSON(result.input, result.profile.snapshot()), "Failed to write trace."});
+            log << "[Profile] Written to " << name << ".profile.json and " << name << ".trace.json\n";
+        }
+        log << "\n[Status] Compilation Completed.\n";
+        writeLog(result, log);
+    }
+
+    static uint64_t instructionCount(const IRModule& module) {
+        uint64_t count = 0;
+        for (const IRFunction& fn : module.functions) count += fn.insts.size();
+        return count;
+    }
+
+    // One entry per stage that ran, in stage order: the sum of its runs,
+    // with the highest peak RSS any of them ended at.
+    static std::vector<StageSample> stageTotals(const std::vector<StageSample>& samples) {
+        std::vector<StageSample> totals;
+        for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+            StageSample total{static_cast<Stage>(s), 0, 0, 0, 0, 0, 0, 0};
+            bool ran = false;
+            for (const StageSample& sample : samples) {
+                if (sample.stage != total.stage) continue;
+                ran = true;
+                total.nanos += sample.nanos;
+                total.allocations += sample.allocations;
+                total.allocatedBytes += sample.allocatedBytes;
+                total.items += sample.items;
+                total.peakRss = std::max(total.peakRss, sample.peakRss);
+            }
+            if (ran) totals.push_back(total);
+        }
+        return totals;
+    }
+
+    static void jsonString(OutputBuffer& out, std::string_view text) {
+        static const char* const hex = "0123456789abcdef";
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    static void jsonStage(OutputBuffer& out, const StageSample& stage) {
+        out << "\"allocations\": " << stage.allocations << ", \"allocated_bytes\": " << stage.allocatedBytes << ", \"items\": " << stage.items
+            << ", \"peak_rss_kib\": " << stage.peakRss;
+    }
+
+    template <size_t N>
+    static OutputBuffer profileJSON(const std::string& input, const std::pair<const char*, int64_t> (&statistics)[N],
+                                    const std::vector<StageSample>& stages) {
+        OutputBuffer out;
+        out << "{\n  \"file\": ";
+        jsonString(out, input);
+        out << ",\n  \"statistics\": {";
+        for (size_t i = 0; i < N; ++i) out << (i ? ", \"" : "\"") << statistics[i].first << "\": " << statistics[i].second;
+        out << "},\n  \"stages\": [";
+        for (size_t i = 0; i < stages.size(); ++i) {
+            out << (i ? ",\n    {" : "\n    {") << "\"stage\": \"" << stageName(stages[i].stage) << "\", \"ns\": " << stages[i].nanos << ", ";
+            jsonStage(out, stages[i]);
+            out << '}';
+        }
+        out << "\n  ]\n}\n";
+        return out;
+    }
+
+    // Chrome trace-event format (chrome://tracing, Perfetto): one complete
+    // event per stage run, on the thread that ran it, in microseconds.
+    static OutputBuffer traceJSON(const std::string& input, const std::vector<StageSample>& samples) {
+        OutputBuffer out;
+        out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+        out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": ";
+        jsonString(out, input);
+        out << "}}";
+        for (const StageSample& sample : samples) {
+            out << ",\n  {\"name\": \"" << stageName(sample.stage) << "\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << sample.thread
+                << ", \"ts\": ";
+            out.fixed(sample.start / 1e3, 3) << ", \"dur\": ";
+            out.fixed(sample.nanos / 1e3, 3) << ", \"args\": {";
+            jsonStage(out, sample);
+            out << "}}";
+        }
+        out << "\n]}\n";
+        return out;
+    }
+
+    // Moves the functions taken from the cache out of the module, recording
+    // what the module-wide passes still need to know about them: their call
+    // sites and loads, and their cached optimized IR, which a recompiled
+    // caller inlines from. Returns the module positions of the functions
+    // left in.
+    static std::vector<size_t> detachReused(IRModule& module, const std::vector<uint8_t>& hit, const std::vector<CachedFunction>& cached) {
+        size_t count = module.functions.size();
+        std::vector<IRFunction> functions = std::move(module.functions);
+        module.functions.clear();
+        module.reused = IRReusedCode();
+        std::vector<size_t> kept;
+        for (size_t i = 0; i < count; ++i) {
+            if (!hit[i]) {
+                kept.push_back(i);
+                module.functions.push_back(std::move(functions[i]));
+                continue;
+            }
+            module.reused.bodies.push_back(&cached[i].ir);
+            for (const IRBlock& block : functions[i].blocks) {
+                for (ValueId v : block.insts) {
+                    const IRInst& inst = functions[i].insts[v];
+                    if (inst.op == IROp::Load) module.reused.loads.insert(inst.symbol);
+                    if (inst.op == IROp::Call || inst.op == IROp::TailCall) module.reused.calls[inst.symbol]++;
+                }
+            }
+        }
+        return kept;
+    }
+
+    static std::vector<SymbolId> touchedGlobals(const IRFunction& fn) {
+        std::vector<SymbolId> globals;
+        SymbolSet seen;
+        for (const IRBlock& block : fn.blocks) {
+            for (ValueId v : block.insts) {
+                const IRInst& inst = fn.insts[v];
+                if ((inst.op == IROp::Load || inst.op == IROp::Store) && seen.insert(inst.symbol)) globals.push_back(inst.symbol);
+            }
+        }
+        return globals;
+    }
+
+    // Writes .fir and .asm/.o from the functions compiled in this run (the
+    // module's, at positions `compiled`) and the cached output of the rest.
+    // Globals the passes dropped come back when a cached function uses
+    // them, in declaration order.
+    Emitted emit(FileResult& result, IRModule& module, std::vector<size_t> compiled, const std::vector<CachedFunction>& cached,
+                 const std::vector<SymbolId>& declared) {
+        Emitted out;
+        size_t count = cached.size();
+        std::vector<uint8_t> fresh(count, 0);
+        for (size_t i : compiled) fresh[i] = 1;
+        SymbolSet live;
+        for (SymbolId g : module.globals) live.insert(g);
+        for (size_t i = 0; i < count; ++i) {
+            if (fresh[i]) continue;
+            for (SymbolId g : cached[i].globals) live.insert(g);
+        }
+        module.globals.clear();
+        for (SymbolId g : declared) {
+            if (live.contains(g)) module.globals.push_back(g);
+        }
+
+        NASMGenerator nasm(options.structStorage);
+        NASMGenerator::DataLayout data;
+        {
+            StageTimer timer(times, result.profile, Stage::NASM);
+            data = nasm.placeData(module);
+            for (size_t i = 0; i < count; ++i) {
+                if (fresh[i]) continue;
+                for (const auto& [global, operand] : cached[i].code.addresses) {
+                    if (NASMGenerator::operand(global, data.addresses) != operand) {
+                        out.stale.push_back(i);
+                        break;
+                    }
+                }
+            }
+            if (!out.stale.empty()) return out;
+        }
+        std::vector<NASMGenerator::Probes> probes(compiled.size());
+        if (options.instrument) instrument(result, module, data, probes);
+        out.counters = probes.empty() ? 0 : probes.front().total;
+        out.fir.resize(count);
+        out.code.resize(count);
+        {
+            StageTimer timer(times, result.profile, Stage::IR);
+            scheduler.parallelFor(compiled.size(), [&](size_t k) { out.fir[compiled[k]] = IRPrinter::text(module.functions[k]); });
+            scheduler.parallelFor(count, [&](size_t i) {
+                if (!fresh[i]) out.fir[i] = IRPrinter::text(cached[i].ir);
+            });
+            result.artifacts.push_back({result.stem + ".fir", IRPrinter::render(module.globals, out.fir), "Failed to write IR file."});
+            timer.count(result.artifacts.back().data.size());
+        }
+        std::vector<size_t> placement = textOrder(module, compiled, count);
+        {
+            StageTimer timer(times, result.profile, Stage::NASM);
+            scheduler.parallelFor(compiled.size(), [&](size_t k) {
+                out.code[compiled[k]] = NASMGenerator::lower(module.functions[k], data.addresses, probes[k]);
+            });
+            size_t instructions = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (!fresh[i]) out.code[i] = cached[i].code;
+                out.spills += out.code[i].spills;
+                out.peephole += out.code[i].peephole;
+                instructions += out.code[i].code.size();
+            }
+            timer.count(instructions);
+            if (writesAssembly()) {
+                std::vector<OutputBuffer> text(count);
+                scheduler.parallelFor(count, [&](size_t i) { text[i] = NASMGenerator::print(out.code[placement[i]]); });
+                result.artifacts.push_back({result.stem + ".asm", nasm.assembly(module, data, text), "Failed to write ASM file."});
+            }
+        }
+        if (writesObject()) {
+            StageTimer timer(times, result.profile, Stage::Object);
+            std::vector<MachineCode> machine(count);
+            scheduler.parallelFor(count, [&](size_t i) {
+                const NASMGenerator::Fragment& fragment = out.code[placement[i]];
+                if (!options.jit) machine[i] = NASMGenerator::encode(fragment);
+                else machine[i] = X86Encoder::encode(hostedExit(fragment.code), fragment.tables);
+            });
+            ObjectFile object = nasm.link(module, data, machine);
+            timer.count(object.text.size());
+            if (options.jit) result.object = std::move(object);
+            else ELFWriter::write(object, result.stem + ".o");
+        }
+        out.compiled = std::move(compiled);
+        return out;
     }
 
-    const Token& peek() const {
-        return tokens[current];
+    // --instrument: gives function k of the module counters from
+    // probes[k].first on and adds the counters, the profile path and the
+    // header describing them to the data. The path is a bare file name,
+    // opened relative to wherever the program runs, so the binary does not
+    // depend on where it was built.
+    void instrument(const FileResult& result, const IRModule& module, NASMGenerator::DataLayout& data,
+                    std::vector<NASMGenerator::Probes>& probes) const {
+        std::vector<uint64_t> first(module.functions.size());
+        uint64_t total = 0;
+        for (size_t k = 0; k < module.functions.size(); ++k) {
+            first[k] = total;
+            total += module.functions[k].blocks.size();
+        }
+        std::string path = std::filesystem::path(result.stem).filename().string() + ".hlprof";
+        std::string header = ProfileData::header(module, first, total);
+        NASMGenerator::Probes shared;
+        shared.counters = internSymbol("profile.counters");
+        shared.total = total;
+        shared.path = internSymbol("profile.path");
+        shared.header = internSymbol("profile.header");
+        shared.headerSize = header.size();
+        data.items.push_back({shared.counters, 8, 8 * total, false});
+        data.items.push_back({shared.path, 1, path.size() + 1, false, path});
+        data.items.push_back({shared.header, 1, header.size(), false, header});
+        for (size_t k = 0; k < probes.size(); ++k) {
+            probes[k] = shared;
+            probes[k].first = first[k];
+        }
     }
 
-    const Token& advance() {
-        if (!isAtEnd()) current++;
-        return previous();
+    // The order functions go into .text, as positions in module order:
+    // source order, or under --profile-use the functions that ran, most
+    // entered first, then those without a usable profile, then those that
+    // never ran.
+    static std::vector<size_t> textOrder(const IRModule& module, const std::vector<size_t>& compiled, size_t count) {
+        std::vector<size_t> order(count);
+        for (size_t i = 0; i < count; ++i) order[i] = i;
+        std::vector<const IRFunction*> fresh(count, nullptr);
+        bool profiled = false;
+        for (size_t k = 0; k < compiled.size(); ++k) {
+            fresh[compiled[k]] = &module.functions[k];
+            profiled |= !module.functions[k].counts.empty();
+        }
+        if (!profiled) return order;
+        auto rank = [&](size_t i) -> std::pair<int, uint64_t> {
+            if (!fresh[i] || fresh[i]->counts.empty()) return {1, 0};
+            uint64_t entered = fresh[i]->counts[0];
+            return entered ? std::pair<int, uint64_t>{0, ~entered} : std::pair<int, uint64_t>{2, 0};
+        };
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return rank(a) < rank(b); });
+        return order;
     }
 
-    const Token& previous() const {
-        return tokens[current - 1];
+    // --profile-use PATH: PATH itself, or PATH/<stem>.hlprof when it is a
+    // directory.
+    std::string profilePath(const FileResult& result) const {
+        if (!std::filesystem::is_directory(options.profileUse)) return options.profileUse;
+        return (std::filesystem::path(options.profileUse) / (std::filesystem::path(result.stem).filename().string() + ".hlprof")).string();
     }
 
-    bool match(TokenType type) {
-        if (peek().type == type) {
-            advance();
-            return true;
-        }
-        return false;
-    }
+    bool writesAssembly() const { return options.format != OutputFormat::Object; }
+    bool writesObject() const { return options.jit || options.format != OutputFormat::Assembly; }
 
-    std::shared_ptr<Statement> parseStatement() {
-        if (peek().type == TokenType::Identifier && tokens[current + 1].type == TokenType::Assign) {
-            return parseAssignment();
+    // Runs `result`'s program in-process and returns its exit status. The
+    // program cache is keyed by the source text and the settings, so a
+    // repeat run skips lexing, parsing and code generation entirely.
+    int runJIT(FileResult& result, std::ostream& err) {
+        try {
+            uint64_t key = ContentHash().add(settings).add(MappedFile(result.input).text()).value();
+            std::string image;
+            ObjectFile object;
+            if (cache && cache->loadProgram(key, image)) {
+                object = ELFReader::read(image);
+            } else {
+                compileFile(result);
+                object = std::move(result.object);
+                if (cache) cache->storeProgram(key, ELFWriter::build(object));
+            }
+            return JITProgram(object).run();
+        } catch (const std::exception& ex) {
+            err << result.input << ": " << ex.what() << "\n";
+            return 1;
         }
-        throw std::runtime_error("Unexpected statement");
     }
 
-    std::shared_ptr<Statement> parseAssignment() {
-        std::string name = peek().lexeme;
-        advance(); // Identifier
-        match(TokenType::Assign); // '='
-        auto expr = parseExpression();
-        match(TokenType::EndOfLine); // ';'
-        return std::make_shared<Assignment>(name, expr);
+    std::string outputs() const {
+        std::string list = ".{fir";
+        if (writesAssembly()) list += ",asm";
+        if (options.format != OutputFormat::Assembly) list += ",o";
+        list += options.astXML ? ",hlb,ast,log}" : ",hlb,log}";
+        return list;
     }
 
-    std::shared_ptr<Expression> parseExpression() {
-        if (match(TokenType::Number)) {
-            return std::make_shared<NumberExpr>(previous().lexeme);
-        } else if (match(TokenType::Identifier)) {
-            return std::make_shared<IdentifierExpr>(previous().lexeme);
+    // Adds the log to the file's artifacts and writes them all, one task
+    // each, so the outputs of a single large file go out in parallel.
+    void writeLog(FileResult& result, OutputBuffer& log) {
+        result.artifacts.push_back({result.stem + ".log", std::move(log), "Failed to open debug log."});
+        StageTimer timer(times, result.profile, Stage::Write);
+        size_t bytes = 0;
+        for (const Artifact& artifact : result.artifacts) bytes += artifact.data.size();
+        timer.count(bytes);
+        std::vector<std::string> errors(result.artifacts.size());
+        scheduler.parallelFor(result.artifacts.size(), [&](size_t i) {
+            const Artifact& artifact = result.artifacts[i];
+            try {
+                artifact.data.writeFile(artifact.path, artifact.failure);
+            } catch (const std::exception& ex) {
+                errors[i] = ex.what();
+            }
+        });
+        result.artifacts.clear();
+        for (const std::string& error : errors) {
+            if (!error.empty()) throw std::runtime_error(error);
         }
-        throw std::runtime_error("Invalid expression");
     }
 };
 
-std::shared_ptr<Statement> parseFunction() {
-    advance(); // Skip 'Start'
-    std::string name = expectIdentifier("Expected function name after Start");
-    expect('(');
-    std::vector<std::string> params;
-    while (!match(')')) {
-        params.push_back(expectIdentifier("Expected parameter name"));
-        match(','); // optional comma
-    }
-    expect('{');
-    std::vector<std::shared_ptr<Statement>> body;
-    while (!check('}')) {
-        body.push_back(parseStatement());
+//--------------------------------------------------
+// --- BENCHMARK SUITE ---
+//--------------------------------------------------
+// `hyperlace --bench` writes the built-in workloads (or takes the given
+// files, or one --shape) under DIR/bench and compiles each one repeatedly
+// with the run's flags and no compile cache, until --bench-time has passed
+// and at least BenchMinIterations runs were timed. Every stage, the whole
+// pipeline and the JIT-run program are reported as the median over those
+// runs, with throughput in source bytes per second:
+//
+//     Benchmark                    Time   Iterations     Throughput
+//     loops/lex                0.412 ms           41    118.3 MB/s
+//
+// Results are written to DIR/bench.json (or --bench-out). Given
+// --bench-baseline, every benchmark also present there is compared against
+// it, and one more than --bench-threshold percent slower is a regression:
+// the run exits 1, so a build step running it fails.
+constexpr unsigned BenchMinIterations = 5;
+// Benchmarks faster than this in the baseline are reported but never
+// fail the run; timer noise dominates below it.
+constexpr double BenchNoiseFloorNanos = 20000;
+
+struct BenchWorkload {
+    const char* name;
+    WorkloadShape shape;
+};
+
+// The built-in workloads at --bench-scale 1, each stressing one dimension.
+inline std::vector<BenchWorkload> benchWorkloads(unsigned scale) {
+    std::vector<BenchWorkload> workloads = {
+        {"functions", parseWorkloadShape("functions=400,depth=1,body=8,macros=2")},
+        {"nesting", parseWorkloadShape("functions=16,depth=48,body=4,macros=2")},
+        {"loops", parseWorkloadShape("functions=32,depth=2,body=256,macros=0")},
+        {"macros", parseWorkloadShape("functions=64,depth=2,body=32,macros=32")},
+        {"structs", parseWorkloadShape("functions=64,depth=1,body=16,macros=0,fields=128")},
+        {"mixed", WorkloadShape{}},
+    };
+    for (BenchWorkload& workload : workloads) {
+        if (std::string_view(workload.name) == "structs") workload.shape.fields *= scale;
+        else workload.shape.functions *= scale;
     }
-    expect('}');
-    return std::make_shared<FunctionDef>(FunctionDef{name, params, body});
+    return workloads;
 }
 
-std::shared_ptr<Statement> parseIfStatement() {
-    advance(); // Skip 'if'
-    expect('(');
-    auto condition = parseExpression();
-    expect(')');
-    expect('{');
-    std::vector<std::shared_ptr<Statement>> thenBranch;
-    while (!check('}')) {
-        thenBranch.push_back(parseStatement());
-    }
-    expect('}');
-    std::vector<std::shared_ptr<Statement>> elseBranch;
-    if (matchKeyword("else")) {
-        expect('{');
-        while (!check('}')) {
-            elseBranch.push_back(parseStatement());
+struct BenchResult {
+    std::string name;        // workload/stage
+    double nanos = 0;        // median per iteration
+    uint64_t iterations = 0;
+    double bytesPerSecond = 0;
+};
+
+class BenchmarkSuite {
+public:
+    BenchmarkSuite(BatchDriver& driver, DriverOptions options) : driver(driver), options(std::move(options)) {}
+
+    int run(std::ostream& out, std::ostream& err) {
+        const BenchOptions& bench = options.bench;
+        std::filesystem::path dir = std::filesystem::path(options.outputDir) / "bench";
+        std::filesystem::create_directories(dir);
+        std::vector<std::pair<std::string, std::string>> inputs;   // name, path
+        if (!options.inputs.empty()) {
+            for (const std::string& input : options.inputs) inputs.emplace_back(std::filesystem::path(input).stem().string(), input);
+        } else {
+            std::vector<BenchWorkload> workloads = benchWorkloads(bench.scale);
+            if (options.shape) workloads = {{"shape", *options.shape}};
+            for (const BenchWorkload& workload : workloads) {
+                std::string path = (dir / (std::string(workload.name) + ".hl")).string();
+                WorkloadGenerator::generate(workload.shape).writeFile(path, "Failed to write benchmark workload.");
+                inputs.emplace_back(workload.name, path);
+            }
         }
-        expect('}');
-    }
-    return std::make_shared<IfStatement>(IfStatement{condition, thenBranch, elseBranch});
-}
-std::shared_ptr<Statement> parseWhile() {
-    advance(); // skip 'while'
-    expect('(');
-    auto condition = parseExpression();
-    expect(')');
-    expect('{');
-    std::vector<std::shared_ptr<Statement>> body;
-    while (!check('}')) {
-        body.push_back(parseStatement());
+
+        std::unordered_map<std::string, double> baseline;
+        if (!bench.baseline.empty()) baseline = readResults(bench.baseline);
+
+        out << std::left << std::setw(28) << "Benchmark" << std::right << std::setw(14) << "Time" << std::setw(13) << "Iterations"
+            << std::setw(15) << "Throughput" << (baseline.empty() ? "" : "    vs baseline") << "\n";
+        out << std::string(baseline.empty() ? 70 : 85, '-') << "\n";
+        std::vector<BenchResult> results;
+        size_t failed = 0;
+        for (const auto& [name, path] : inputs) {
+            if (!bench.filter.empty() && name.find(bench.filter) == std::string::npos) continue;
+            size_t first = results.size();
+            try {
+                measure(name, path, dir, results);
+            } catch (const std::exception& ex) {
+                err << path << ": " << ex.what() << "\n";
+                failed++;
+                continue;
+            }
+            for (size_t i = first; i < results.size(); ++i) print(out, results[i], baseline);
+        }
+
+        std::string resultsPath = bench.results.empty() ? (std::filesystem::path(options.outputDir) / "bench.json").string() : bench.results;
+        resultsJSON(results).writeFile(resultsPath, "Failed to write benchmark results.");
+        out << "\n[Bench] " << results.size() << " benchmark(s) written to " << resultsPath << "\n";
+
+        size_t regressions = 0;
+        for (const BenchResult& result : results) {
+            auto base = baseline.find(result.name);
+            if (base == baseline.end() || base->second < BenchNoiseFloorNanos) continue;
+            double change = (result.nanos - base->second) / base->second * 100;
+            if (change <= bench.threshold) continue;
+            err << "[Bench] Regression: " << result.name << " is " << std::fixed << std::setprecision(1) << change
+                << "% slower than the baseline (threshold " << bench.threshold << "%)\n";
+            regressions++;
+        }
+        if (!baseline.empty()) out << "[Bench] " << regressions << " regression(s) against " << bench.baseline << "\n";
+        return failed == 0 && regressions == 0 ? 0 : 1;
     }
-    expect('}');
-    return std::make_shared<WhileLoop>(WhileLoop{condition, body});
-}
 
-std::shared_ptr<Statement> parseFor() {
-    advance(); // skip 'for'
-    expect('(');
-    auto initializer = parseStatement();
-    auto condition = parseExpression();
-    expect(';');
-    auto increment = parseStatement();
-    expect(')');
-    expect('{');
-    std::vector<std::shared_ptr<Statement>> body;
-    while (!check('}')) {
-        body.push_back(parseStatement());
+private:
+    BatchDriver& driver;
+    DriverOptions options;
+
+    static double median(std::vector<double> samples) {
+        if (samples.empty()) return 0;
+        size_t mid = samples.size() / 2;
+        std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(mid), samples.end());
+        return samples[mid];
     }
-    expect('}');
-    return std::make_shared<ForLoop>(ForLoop{initializer, condition, increment, body});
-}
 
-std::shared_ptr<Expression> parseFunctionCall(const std::string& name) {
-    advance(); // skip '('
-    std::vector<std::shared_ptr<Expression>> args;
-    while (!check(')')) {
-        args.push_back(parseExpression());
-        if (!match(')')) match(','); // handle comma-separated arguments
+    bool enough(size_t iterations, std::chrono::steady_clock::time_point start) const {
+        auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        return iterations >= BenchMinIterations && spent >= options.bench.millis;
     }
-    return std::make_shared<FunctionCall>(FunctionCall{name, args});
-}
 
-std::shared_ptr<Statement> parseStructDef() {
-    advance(); // Skip 'Init'
-    std::string name = expectIdentifier("Expected struct name.");
-    expect('{');
-    std::vector<std::string> fields;
-    while (!match('}')) {
-        fields.push_back(expectIdentifier("Expected field name."));
-        match(';');
+    // Times every stage and the whole pipeline over repeated compiles of
+    // `path`, then the program it compiles to.
+    void measure(const std::string& name, const std::string& path, const std::filesystem::path& dir, std::vector<BenchResult>& results) {
+        DriverOptions compile = options;
+        compile.inputs = {path};
+        compile.outputDir = (dir / "out").string();
+        compile.cache = false;
+        compile.profile = false;
+        double bytes = static_cast<double>(std::filesystem::file_size(path));
+
+        std::ostringstream discard, errors;
+        if (driver.run(compile, discard, errors) != 0) throw std::runtime_error(errors.str());   // warm-up
+        std::vector<double> pipeline;
+        std::vector<std::vector<double>> stages(static_cast<size_t>(Stage::Count));
+        for (auto start = std::chrono::steady_clock::now(); !enough(pipeline.size(), start);) {
+            discard.str({});
+            auto begin = std::chrono::steady_clock::now();
+            if (driver.run(compile, discard, errors) != 0) throw std::runtime_error(errors.str());
+            pipeline.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+            for (size_t s = 0; s < stages.size(); ++s) stages[s].push_back(driver.stageTimes().millis(static_cast<Stage>(s)) * 1e6);
+        }
+        auto add = [&](std::string stage, const std::vector<double>& samples) {
+            double nanos = median(samples);
+            results.push_back(BenchResult{name + "/" + stage, nanos, samples.size(), nanos > 0 ? bytes / (nanos / 1e9) : 0});
+        };
+        for (size_t s = 0; s < stages.size(); ++s) {
+            if (median(stages[s]) > 0) add(stageName(static_cast<Stage>(s)), stages[s]);
+        }
+        add("pipeline", pipeline);
+
+#if HYPERLACE_JIT
+        ObjectFile object = driver.link(compile);
+        std::vector<double> runs;
+        for (auto start = std::chrono::steady_clock::now(); !enough(runs.size(), start);) {
+            JITProgram program(object);   // fresh .data for every run
+            auto begin = std::chrono::steady_clock::now();
+            program.run();
+            runs.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+        }
+        add("run", runs);
+#endif
     }
-    return std::make_shared<StructDef>(StructDef{name, fields});
-}
 
-std::shared_ptr<Expression> parseStructInit(const std::string& name) {
-    expect('('); expect(')'); // e.g. Person()
-    return std::make_shared<StructInit>(StructInit{name});
-}
+    void print(std::ostream& out, const BenchResult& result, const std::unordered_map<std::string, double>& baseline) const {
+        out << std::left << std::setw(28) << result.name << std::right << std::fixed << std::setprecision(3) << std::setw(11)
+            << result.nanos / 1e6 << " ms" << std::setw(13) << result.iterations << std::setprecision(1) << std::setw(10)
+            << result.bytesPerSecond / 1e6 << " MB/s";
+        auto base = baseline.find(result.name);
+        if (base != baseline.end() && base->second > 0) {
+            double change = (result.nanos - base->second) / base->second * 100;
+            out << std::setw(14) << std::showpos << change << std::noshowpos << "%";
+        }
+        out << "\n";
+    }
 
-std::shared_ptr<Expression> parseFieldAccess(std::shared_ptr<Expression> obj) {
-    expect('.'); // p.name
-    std::string field = expectIdentifier("Expected field name.");
-    return std::make_shared<FieldAccess>(FieldAccess{obj, field});
-}
+    // One benchmark per line, so readResults() needs no JSON parser.
+    OutputBuffer resultsJSON(const std::vector<BenchResult>& results) const {
+        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        char date[32];
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        OutputBuffer out;
+        out << "{\n  \"context\": {\"date\": \"" << date << "\", \"jobs\": " << driver.jobCount() << ", \"lexer_kernel\": \""
+            << activeScanKernel().name << "\", \"scale\": " << options.bench.scale << ", \"passes\": \"" << options.pipeline << "\"},\n";
+        out << "  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& result = results[i];
+            out << (i ? ",\n    " : "\n    ") << "{\"name\": \"" << result.name << "\", \"ns\": ";
+            out.fixed(result.nanos, 0) << ", \"iterations\": " << result.iterations << ", \"bytes_per_second\": ";
+            out.fixed(result.bytesPerSecond, 0) << "}";
+        }
+        out << "\n  ]\n}\n";
+        return out;
+    }
 
-enum Precedence {
-    PREC_LOWEST,
-    PREC_ASSIGN,   // =
-    PREC_COND,     // ?:
-    PREC_SUM,      // + -
-    PREC_PRODUCT,  // * /
-    PREC_PREFIX,   // -x
-    PREC_CALL,     // ()
-    PREC_PRIMARY
+    // Name to median nanoseconds from a file resultsJSON() wrote.
+    static std::unordered_map<std::string, double> readResults(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) throw std::runtime_error("Failed to open benchmark baseline '" + path + "'");
+        std::unordered_map<std::string, double> results;
+        std::string line;
+        constexpr std::string_view NameKey = "{\"name\": \"", NanosKey = "\"ns\": ";
+        while (std::getline(file, line)) {
+            size_t name = line.find(NameKey);
+            size_t nanos = line.find(NanosKey);
+            if (name == std::string::npos || nanos == std::string::npos) continue;
+            name += NameKey.size();
+            size_t end = line.find('"', name);
+            if (end == std::string::npos) continue;
+            results[line.substr(name, end - name)] = std::strtod(line.c_str() + nanos + NanosKey.size(), nullptr);
+        }
+        if (results.empty()) throw std::runtime_error("Benchmark baseline '" + path + "' has no results");
+        return results;
+    }
 };
 
-if (match(TokenType::PlusEq)) {
-    auto value = parseExpression();
-    return std::make_shared<Assignment>(varName,
-        std::make_shared<BinaryExpr>("+", readVar(varName), value));
-}
-
 //--------------------------------------------------
-// --- MACRO ENGINE (C.I.A.M.S.) ---
+// --- SELF-CHECK ---
 //--------------------------------------------------
-class MacroExpander {
-public:
-    void define(const std::string& name, const std::string& replacement) {
-        macros[name] = replacement;
-    }
+// `hyperlace --check` runs the front end against references and known
+// answers, and prints one row per check:
+//
+//     Check                            Cases     Failed
+//     scan/avx2                         2000          0    1396 KB lexed
+//
+//   scan/<kernel>    every kernel but scalar lexes --check-cases random
+//                    inputs exactly as the scalar kernel does (token type,
+//                    text, line and column), and its four runs agree with
+//                    the scalar ones at random offsets and lengths
+//   macro/reference  MacroStream expands --check-cases random programs of
+//                    definitions, uses and malformed lines exactly as
+//                    ReferenceMacros does, or both reject them
+//   macro/expand     fixed programs, each with its expected expansion
+//   lexer            fixed inputs, each with its expected tokens
+//   front-end        fixed programs through macros, parser, analyzer and IR,
+//                    each with its expected outcome or error
+//   passes/verify    those that lower, a few pass-specific programs and the
+//                    shrunk workloads run the --passes pipeline twice, with
+//                    verify after every pass
+//   workload/<name>  every --bench workload, shrunk, compiles with the
+//                    run's flags
+//
+// Random case i is built from seed --check-seed + i, and every mismatch
+// names its seed, so `--check-seed S --check-cases 1` replays it. Any
+// failure exits 1, so a build step running it fails.
+constexpr size_t CheckMaxReported = 5;
 
-    std::string expand(const std::string& input) {
-        std::string result;
-        std::istringstream stream(input);
-        std::string word;
-        while (stream >> word) {
-            if (macros.find(word) != macros.end()) {
-                result += macros[word] + " ";
-            } else {
-                result += word + " ";
-            }
+// A token stream as comparable text, one token per line. Hygienic names
+// (the only ones holding HygieneMark) are numbered by first appearance,
+// because the two expanders number them differently.
+class CheckStream {
+public:
+    void add(TokenType type, std::string_view lexeme, int line, int column) {
+        text += std::to_string(static_cast<int>(type)) + ' ' + std::to_string(line) + ':' + std::to_string(column) + ' ';
+        if (type == TokenType::Identifier && lexeme.find(HygieneMark) != std::string_view::npos) {
+            auto slot = fresh.emplace(std::string(lexeme), fresh.size()).first;
+            text += HygieneMark + std::to_string(slot->second);
+        } else {
+            text.append(lexeme);
         }
-        return result;
+        text += '\n';
     }
 
-    void loadDefaults() {
-        define("|inc|", "x = x + 1;");
-        define("|dec|", "x = x - 1;");
-        define("|reset|", "x = 0;");
+    void add(const Token& tok) { add(tok.type, tok.lexeme, tok.line, tok.column); }
+
+    void fail(const std::exception& ex) {
+        text += "error: ";
+        text += ex.what();
+        failed = true;
     }
 
+    std::string text;
+    bool failed = false;
+
 private:
-    std::unordered_map<std::string, std::string> macros;
+    std::unordered_map<std::string, size_t> fresh;
 };
 
-//--------------------------------------------------
-// --- SEMANTIC ANALYZER ---
-//--------------------------------------------------
-class SemanticAnalyzer {
+// A direct, recursive reading of the rules in MACRO ENGINE, sharing no code
+// with MacroExpander or MacroStream beyond the Lexer: the whole file is
+// lexed up front, definitions keep their body tokens as they are, and a
+// use substitutes and recurses. Slow, and only used by --check.
+class ReferenceMacros {
 public:
-    void analyze(const std::vector<std::shared_ptr<Statement>>& statements) {
-        declared.clear();
-        for (const auto& stmt : statements) {
-            if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-                analyzeAssignment(assign);
+    explicit ReferenceMacros(CheckStream& out) : out(out) {}
+
+    void expand(std::string_view source) {
+        std::vector<Token> tokens = Lexer(source, scalarScanKernel()).tokenize();
+        for (size_t i = 0; tokens[i].type != TokenType::EndOfFile; ++i) {
+            const Token& tok = tokens[i];
+            if (tok.type == TokenType::Macro) {
+                use(tok.lexeme, nullptr, tok.line, tok.column);
+            } else if (tok.type == TokenType::Keyword && tok.lexeme == "Define") {
+                if (tokens[i + 1].type != TokenType::Macro || tokens[i + 1].line != tok.line)
+                    throw std::runtime_error("Define without a marker");
+                size_t end = i + 2;
+                while (tokens[end].type != TokenType::EndOfFile && tokens[end].line == tok.line) end++;
+                define(tokens[i + 1].lexeme, std::vector<Token>(tokens.begin() + static_cast<std::ptrdiff_t>(i) + 2,
+                                                                tokens.begin() + static_cast<std::ptrdiff_t>(end)));
+                i = end - 1;
+            } else {
+                out.add(tok);
             }
         }
     }
 
 private:
-    std::set<std::string> declared;
+    struct Def {
+        std::vector<std::string_view> params;
+        std::vector<std::string_view> locals;
+        std::vector<Token> body;
+    };
 
-    void analyzeAssignment(const std::shared_ptr<Assignment>& stmt) {
-        declared.insert(stmt->name);
+    struct Frame {
+        const Def* def;
+        const Frame* outer;
+        std::vector<Token> args;
+        std::vector<std::string_view> fresh;
+    };
 
-        if (auto idExpr = std::dynamic_pointer_cast<IdentifierExpr>(stmt->value)) {
-            if (declared.find(idExpr->name) == declared.end()) {
-                throw std::runtime_error("Semantic Error: Use of undeclared variable '" + idExpr->name + "'");
-            }
-        }
-    }
-};
+    CheckStream& out;
+    std::unordered_map<std::string_view, Def> defs;
+    std::deque<std::string> names;   // fresh local spellings
+    size_t counter = 0;
 
-bool inFunction = false;
+    static std::vector<Token> header(std::string_view marker) {
+        std::vector<Token> tokens = Lexer(marker, scalarScanKernel()).tokenize();
+        tokens.pop_back();
+        return tokens;
+    }
 
-for (const auto& stmt : statements) {
-    if (auto fn = std::dynamic_pointer_cast<FunctionDef>(stmt)) {
-        inFunction = true;
-        analyze(fn->body);  // recursively walk inside
-        inFunction = false;
+    template <typename T>
+    static ptrdiff_t indexOf(const std::vector<T>& list, std::string_view name) {
+        auto it = std::find(list.begin(), list.end(), name);
+        return it == list.end() ? -1 : it - list.begin();
     }
-    else if (auto ret = std::dynamic_pointer_cast<ReturnStatement>(stmt)) {
-        if (!inFunction)
-            throw std::runtime_error("Return statement used outside a function.");
+
+    void define(std::string_view marker, std::vector<Token> body) {
+        std::vector<Token> head = header(marker);
+        if (head.empty() || head[0].type != TokenType::Identifier) throw std::runtime_error("bad macro name");
+        Def def;
+        for (size_t k = 1; k < head.size(); ++k) {
+            if (head[k].type != TokenType::Identifier) throw std::runtime_error("bad macro parameter");
+            def.params.push_back(head[k].lexeme);
+        }
+        for (size_t i = 0; i + 1 < body.size(); ++i) {
+            TokenType next = body[i + 1].type;
+            bool assigned = next == TokenType::Assign || next == TokenType::PlusEq || next == TokenType::MinusEq
+                || next == TokenType::StarEq || next == TokenType::SlashEq;
+            if (body[i].type == TokenType::Identifier && assigned && indexOf(def.params, body[i].lexeme) < 0
+                && indexOf(def.locals, body[i].lexeme) < 0)
+                def.locals.push_back(body[i].lexeme);
+        }
+        def.body = std::move(body);
+        defs[head[0].lexeme] = std::move(def);
     }
-}
 
-//--------------------------------------------------
-// --- INTERMEDIATE REPRESENTATION EMITTER ---
-//--------------------------------------------------
-class IREmitter {
-public:
-    void emit(const std::vector<std::shared_ptr<Statement>>& statements, const std::string& outPath) {
-        std::ofstream out(outPath);
-        if (!out) throw std::runtime_error("Failed to write IR file.");
+    // Substitutes `outer`'s parameters and locals into an identifier.
+    static Token resolve(Token tok, const Frame* outer) {
+        if (!outer || tok.type != TokenType::Identifier) return tok;
+        if (ptrdiff_t p = indexOf(outer->def->params, tok.lexeme); p >= 0) return outer->args[static_cast<size_t>(p)];
+        if (ptrdiff_t l = indexOf(outer->def->locals, tok.lexeme); l >= 0) tok.lexeme = outer->fresh[static_cast<size_t>(l)];
+        return tok;
+    }
 
-        for (const auto& stmt : statements) {
-            if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-                out << "STORE " << assign->name << " <- ";
-                if (auto num = std::dynamic_pointer_cast<NumberExpr>(assign->value)) {
-                    out << "NUM(" << num->value << ")\n";
-                } else if (auto id = std::dynamic_pointer_cast<IdentifierExpr>(assign->value)) {
-                    out << "REF(" << id->name << ")\n";
-                }
-            }
+    // Every token a use produces reports the outermost use's position.
+    void use(std::string_view marker, const Frame* outer, int line, int column) {
+        std::vector<Token> head = header(marker);
+        auto def = head.empty() || head[0].type != TokenType::Identifier ? defs.end() : defs.find(head[0].lexeme);
+        if (def == defs.end()) throw std::runtime_error("undefined macro");
+        for (const Frame* f = outer; f; f = f->outer) {
+            if (f->def == &def->second) throw std::runtime_error("recursive expansion");
+        }
+        Frame frame{&def->second, outer, {}, {}};
+        for (size_t k = 1; k < head.size(); ++k) frame.args.push_back(resolve(head[k], outer));
+        if (frame.args.size() != def->second.params.size()) throw std::runtime_error("wrong argument count");
+        for (std::string_view local : def->second.locals) {
+            names.push_back(std::string(local) + HygieneMark + std::to_string(++counter));
+            frame.fresh.push_back(names.back());
+        }
+        for (const Token& body : def->second.body) {
+            Token tok = resolve(body, &frame);
+            if (tok.type == TokenType::Macro) use(tok.lexeme, &frame, line, column);
+            else out.add(tok.type, tok.lexeme, line, column);
         }
     }
 };
 
-//--------------------------------------------------
-// --- NASM CODE GENERATOR ---
-//--------------------------------------------------
-class NASMGenerator {
+struct CheckOutcome {
+    std::string name;
+    size_t cases = 0;
+    size_t failed = 0;
+    std::string note;
+};
+
+class SelfCheck {
 public:
-    void generate(const std::vector<std::shared_ptr<Statement>>& statements, const std::string& outputPath) {
-        std::ofstream out(outputPath);
-        if (!out) throw std::runtime_error("Failed to write ASM file.");
+    SelfCheck(BatchDriver& driver, DriverOptions options) : driver(driver), options(std::move(options)) {}
 
-        out << "section .data\n";
-        for (const auto& stmt : statements) {
-            if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-                out << assign->name << " dq 0\n";
-            }
+    int run(std::ostream& out, std::ostream& err) {
+        errors = &err;
+        out << std::left << std::setw(28) << "Check" << std::right << std::setw(10) << "Cases" << std::setw(11) << "Failed" << "\n";
+        out << std::string(70, '-') << "\n";
+        std::vector<CheckOutcome> outcomes;
+        for (const ScanKernel* kernel : availableScanKernels()) {
+            if (kernel != &scalarScanKernel()) outcomes.push_back(checkKernel(*kernel));
         }
+        outcomes.push_back(checkMacros());
+        outcomes.push_back(checkExpansions());
+        outcomes.push_back(checkLexer());
+        outcomes.push_back(checkFrontEnd());
+        outcomes.push_back(checkPasses());
+        for (const BenchWorkload& workload : benchWorkloads(1)) outcomes.push_back(checkWorkload(workload));
 
-        out << "\nsection .text\n global _start\n_start:\n";
-        for (const auto& stmt : statements) {
-            if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-                if (auto num = std::dynamic_pointer_cast<NumberExpr>(assign->value)) {
-                    out << "    mov rax, " << num->value << "\n";
-                    out << "    mov [" << assign->name << "], rax\n";
-                } else if (auto id = std::dynamic_pointer_cast<IdentifierExpr>(assign->value)) {
-                    out << "    mov rax, [" << id->name << "]\n";
-                    out << "    mov [" << assign->name << "], rax\n";
-                }
-            }
+        size_t failed = 0;
+        for (const CheckOutcome& outcome : outcomes) {
+            out << std::left << std::setw(28) << outcome.name << std::right << std::setw(10) << outcome.cases << std::setw(11)
+                << outcome.failed << (outcome.note.empty() ? "" : "    ") << outcome.note << "\n";
+            failed += outcome.failed;
         }
-        out << "    mov rax, 60\n    xor rdi, rdi\n    syscall\n";
-    }
-};
-
-//--------------------------------------------------
-// --- MAIN: FULL COMPILER TEST HARNESS ---
-//--------------------------------------------------
-int main() {
-    std::ifstream file("samples/hello.hl");
-    if (!file) {
-        std::cerr << "Failed to open sample file." << std::endl;
-        return 1;
+        out << "\n[Check] " << outcomes.size() << " check(s), " << failed << " failure(s)\n";
+        return failed == 0 ? 0 : 1;
     }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    MacroExpander expander;
-    expander.loadDefaults();
-
-    std::string expanded = expander.expand(buffer.str());
-    Lexer lexer(expanded);
+private:
+    BatchDriver& driver;
+    DriverOptions options;
+    std::ostream* errors = nullptr;
+    size_t reported = 0;
 
-    std::vector<Token> tokens = lexer.tokenize();
-    Parser parser(tokens);
-    auto statements = parser.parse();
+    void fail(CheckOutcome& outcome, const std::string& what) {
+        outcome.failed++;
+        if (reported++ < CheckMaxReported) *errors << "[Check] " << outcome.name << ": " << what << "\n";
+    }
 
-    SemanticAnalyzer analyzer;
-    try {
-        analyzer.analyze(statements);
-        std::cout << "Semantic analysis successful.\n";
-    } catch (const std::exception& ex) {
-        std::cerr << ex.what() << std::endl;
-        return 1;
+    static std::string quoted(std::string_view text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '\n') out += "\\n";
+            else if (c == '\t') out += "\\t";
+            else if (c == '\r') out += "\\r";
+            else if (c == '"' || c == '\\') out += std::string("\\") + c;
+            else out += c;
+        }
+        return out + "\"";
     }
 
-    IREmitter ir;
-    ir.emit(statements, "output/hello.fir");
-    std::cout << "IR written to output/hello.fir\n";
+    // Bytes every run stops or continues on, in pieces and long repeats,
+    // so the 16- and 32-byte strides and their tails are all exercised.
+    static std::string randomScanSource(std::mt19937_64& rng) {
+        static constexpr std::string_view Pieces[] = {
+            " ", "\t", "\r", "\n", "    ", "a", "Zq_9", "identifier_", "If", "0", "12345", "3.25", "7.",
+            "#", "**", "*", "|", "\"", "\\", "=", "+=", "->", ";", "(", ".", "\x7f", "\xc3\xa9", "@"};
+        std::string text;
+        for (size_t count = rng() % 200; count > 0; --count) {
+            std::string_view piece = Pieces[rng() % std::size(Pieces)];
+            for (size_t repeat = rng() % 8 == 0 ? rng() % 40 + 1 : 1; repeat > 0; --repeat) text += piece;
+        }
+        return text;
+    }
 
-    NASMGenerator nasm;
-    nasm.generate(statements, "output/hello.asm");
-    std::cout << "NASM assembly written to output/hello.asm\n";
+    static std::string lexed(std::string_view source, const ScanKernel& kernel) {
+        CheckStream stream;
+        try {
+            Lexer lexer(source, kernel);
+            for (Token tok = lexer.next(); tok.type != TokenType::EndOfFile; tok = lexer.next()) stream.add(tok);
+        } catch (const std::exception& ex) {
+            stream.fail(ex);
+        }
+        return stream.text;
+    }
 
-    std::cout << "Parsed " << statements.size() << " statement(s).\n";
-    for (const auto& stmt : statements) {
-        if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-            std::cout << "Assignment to: " << assign->name << "\n";
+    CheckOutcome checkKernel(const ScanKernel& kernel) {
+        const ScanKernel& scalar = scalarScanKernel();
+        CheckOutcome outcome{std::string("scan/") + kernel.name, 0, 0, {}};
+        size_t bytes = 0;
+        for (unsigned i = 0; i < options.check.cases; ++i) {
+            uint64_t seed = static_cast<uint64_t>(options.check.seed) + i;
+            std::mt19937_64 rng(seed);
+            std::string source = randomScanSource(rng);
+            outcome.cases++;
+            bytes += source.size();
+            if (lexed(source, kernel) != lexed(source, scalar)) {
+                fail(outcome, "tokens differ from scalar for seed " + std::to_string(seed) + ": " + quoted(source));
+                continue;
+            }
+            for (unsigned probe = 0; probe < 32 && !source.empty(); ++probe) {
+                size_t at = rng() % source.size();
+                size_t n = rng() % 2 ? source.size() - at : rng() % (source.size() - at + 1);
+                const char* p = source.data() + at;
+                char a = source[rng() % source.size()], b = source[rng() % source.size()];
+                if (kernel.blankRun(p, n) != scalar.blankRun(p, n) || kernel.identRun(p, n) != scalar.identRun(p, n)
+                    || kernel.digitRun(p, n) != scalar.digitRun(p, n) || kernel.untilEither(p, n, a, b) != scalar.untilEither(p, n, a, b)) {
+                    fail(outcome, "runs differ from scalar at offset " + std::to_string(at) + " length " + std::to_string(n)
+                                      + " for seed " + std::to_string(seed));
+                    break;
+                }
+            }
         }
+        outcome.note = std::to_string(bytes / 1000) + " KB lexed";
+        return outcome;
     }
-    return 0;
-}
 
-#include <chrono>
-int main() {
-    auto start_time = std::chrono::high_resolution_clock::now();
+    // Definitions of five macros, whose arities are fixed per case, then
+    // lines of statements and redefinitions. A body assigns to locals and
+    // mostly uses lower-numbered macros, passing its parameters and locals
+    // on; one in twenty may use any macro, so some programs recurse. Now and
+    // then a use names an undefined macro or gets the wrong number of
+    // arguments, or a Define has no marker.
+    static std::string randomMacroSource(std::mt19937_64& rng) {
+        static constexpr std::string_view Args[] = {"p", "q", "a", "b", "t", "1", "42", "If"};
+        static constexpr std::string_view Params[] = {"p", "q", "a"};
+        constexpr size_t Macros = 5;
+        auto pick = [&](size_t n) { return static_cast<size_t>(rng() % n); };
+        size_t arity[Macros];
+        for (size_t& n : arity) n = pick(3);
+        auto use = [&](size_t below) {
+            size_t m = pick(40) == 0 ? Macros : pick(below);
+            std::string text = "|m" + std::to_string(m);
+            size_t argc = m < Macros && pick(40) ? arity[m] : pick(3);
+            for (size_t k = 0; k < argc; ++k) text += " " + std::string(Args[pick(std::size(Args))]);
+            return text + "|";
+        };
+        // `below` bounds the macros used; 0 for none.
+        auto tokens = [&](size_t below, bool body) {
+            std::string text;
+            for (size_t count = pick(7); count > 0; --count) {
+                switch (pick(body ? 9 : 8)) {
+                    case 0: case 1: text += " " + (below ? use(below) : std::string("b")); break;
+                    case 2: text += " ="; break;
+                    case 3: text += " +="; break;
+                    case 4: text += " ;"; break;
+                    case 5: text += " =="; break;
+                    case 8: text += " t = p;"; break;
+                    default: text += " " + std::string(Args[pick(std::size(Args))]); break;
+                }
+            }
+            return text;
+        };
+        auto define = [&](size_t m) {
+            std::string text = "Define |m" + std::to_string(m);
+            size_t params = pick(40) ? arity[m] : pick(3);
+            for (size_t k = 0; k < params; ++k) text += " " + std::string(Params[pick(std::size(Params))]);
+            return text + "|" + tokens(pick(20) ? m : Macros, true) + "\n";
+        };
 
-    std::ifstream file("samples/hello.hl");
-    if (!file) {
-        std::cerr << "Failed to open sample file." << std::endl;
-        return 1;
+        std::string text;
+        for (size_t m = 0; m < Macros; ++m) text += define(m);
+        for (size_t line = pick(12) + 1; line > 0; --line) {
+            size_t form = pick(20);
+            if (form < 4) text += define(pick(Macros));
+            else if (form == 4) text += pick(4) ? "# comment\n" : "Define x = 1;\n";
+            else text += tokens(Macros, false) + "\n";
+        }
+        return text;
     }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string raw_input = buffer.str();
+    CheckOutcome checkMacros() {
+        CheckOutcome outcome{"macro/reference", 0, 0, {}};
+        size_t expanded = 0, rejected = 0;
+        for (unsigned i = 0; i < options.check.cases; ++i) {
+            uint64_t seed = static_cast<uint64_t>(options.check.seed) + i;
+            std::mt19937_64 rng(seed);
+            std::string source = randomMacroSource(rng);
+            CheckStream actual, expected;
+            try {
+                Lexer lexer(source);
+                MacroExpander macros;
+                MacroStream stream(lexer, macros);
+                for (Token tok = stream.next(); tok.type != TokenType::EndOfFile; tok = stream.next()) actual.add(tok);
+            } catch (const std::exception& ex) {
+                actual.fail(ex);
+            }
+            try {
+                ReferenceMacros(expected).expand(source);
+            } catch (const std::exception& ex) {
+                expected.fail(ex);
+            }
+            outcome.cases++;
+            // Both reject, or both produce the same tokens.
+            if (actual.failed != expected.failed || (!actual.failed && actual.text != expected.text)) {
+                fail(outcome, "expansion differs from the reference for seed " + std::to_string(seed) + ": " + quoted(source)
+                                  + (actual.failed ? " (" + actual.text + ")" : expected.failed ? " (reference rejects it)" : ""));
+            } else {
+                (actual.failed ? rejected : expanded)++;
+            }
+        }
+        outcome.note = std::to_string(expanded) + " expanded, " + std::to_string(rejected) + " rejected by both";
+        return outcome;
+    }
 
-    MacroExpander expander;
-    expander.loadDefaults();
+    struct ExpandCase {
+        const char* source;
+        const char* expanded;   // as renderExpanded spells it
+    };
 
-    std::string expanded = expander.expand(raw_input);
-    Lexer lexer(expanded);
+    static constexpr ExpandCase ExpandCases[] = {
+        // A source name spelled like a hygienic local is not captured by one.
+        {"__t_1 = 5;\nDefine |m| t = 3;\n|m|\ny = __t_1;\n", "__t_1 = 5 ;\n\nt$1 = 3 ;\ny = __t_1 ;\n"},
+        {"Define |swap a b| t = a; a = b; b = t;\n|swap x y|\n|swap y x|\n",
+         "\nt$1 = x ; x = y ; y = t$1 ;\nt$2 = y ; y = x ; x = t$2 ;\n"},
+        {"Define |inner v| k = v;\nDefine |outer v| k = 1; |inner k|\n|outer z|\n", "\n\nk$1 = 1 ; k$2 = k$1 ;\n"},
+    };
 
-    std::ofstream log("output/hello.log");
-    if (!log) {
-        std::cerr << "Failed to open debug log." << std::endl;
-        return 1;
+    CheckOutcome checkExpansions() {
+        CheckOutcome outcome{"macro/expand", 0, 0, {}};
+        for (const ExpandCase& test : ExpandCases) {
+            std::string actual;
+            try {
+                MacroExpander macros;
+                actual = renderExpanded(test.source, macros);
+            } catch (const std::exception& ex) {
+                actual = std::string("error: ") + ex.what();
+            }
+            outcome.cases++;
+            if (actual != test.expanded) fail(outcome, quoted(test.source) + " expands to " + quoted(actual) + ", expected " + quoted(test.expanded));
+        }
+        return outcome;
     }
 
-    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    log << "Hyperlace Compiler Debug Log
-";
-    log << "Timestamp: " << std::ctime(&now);
-    log << "----------------------------------------
+    struct LexCase {
+        const char* source;
+        const char* tokens;   // "line:column text" for each token
+    };
 
-";
+    static constexpr LexCase LexCases[] = {
+        {"a += 1;", "1:1 a, 1:3 +=, 1:6 1, 1:7 ;"},
+        {"x = 2.5 # note\ny == \"s t\";", "1:1 x, 1:3 =, 1:5 2.5, 2:1 y, 2:3 ==, 2:6 s t, 2:11 ;"},
+        {"** two\nlines ** If (a <= b) -> c", "2:10 If, 2:13 (, 2:14 a, 2:16 <=, 2:19 b, 2:20 ), 2:22 ->, 2:25 c"},
+        {"|inc x| | y", "1:1 inc x, 1:9 |, 1:11 y"},
+        {"p.f0 = 3.", "1:1 p, 1:2 ., 1:3 f0, 1:6 =, 1:8 3, 1:9 ."},
+        {"\t\r  Start_1 1x ~> !=", "1:5 Start_1, 1:13 1, 1:14 x, 1:16 ~>, 1:19 !="},
+        {"Define |m a|\n** a * b **", "1:1 Define, 1:8 m a"},
+    };
 
-    log << "[Source Code]
-" << raw_input << "
+    CheckOutcome checkLexer() {
+        CheckOutcome outcome{"lexer", 0, 0, {}};
+        for (const LexCase& test : LexCases) {
+            std::string actual;
+            try {
+                Lexer lexer(test.source);
+                for (Token tok = lexer.next(); tok.type != TokenType::EndOfFile; tok = lexer.next()) {
+                    if (!actual.empty()) actual += ", ";
+                    actual += std::to_string(tok.line) + ":" + std::to_string(tok.column) + " " + std::string(tok.lexeme);
+                }
+            } catch (const std::exception& ex) {
+                actual = std::string("error: ") + ex.what();
+            }
+            outcome.cases++;
+            if (actual != test.tokens) fail(outcome, quoted(test.source) + " lexes as [" + actual + "], expected [" + test.tokens + "]");
+        }
+        return outcome;
+    }
 
-";
-    log << "[Expanded Code]
-" << expanded << "
+    struct FrontEndCase {
+        const char* name;
+        const char* source;
+        const char* outcome;   // "ok", "ok; enums A, B", or the start of the error
+    };
 
-";
+    static constexpr FrontEndCase FrontEndCases[] = {
+        {"if-assigned", "if (1) {\n    y = 1;\n} else {\n    y = 2;\n}\nz = y;\n", "ok"},
+        {"while-assigned", "n = 1;\nwhile (n) {\n    w = n;\n    n = 0;\n}\nv = w;\n", "ok"},
+        {"for-assigned", "Start f(n) {\n    for (i = 0; i < n; i = i + 1) {\n        last = i;\n    }\n    t = last;\n    Return t;\n}\n", "ok"},
+        {"undeclared", "x = y;\n", "error: Semantic Error: Use of undeclared variable 'y'"},
+        {"undeclared-in-if", "if (1) {\n    x = q;\n}\n", "error: Semantic Error: Use of undeclared variable 'q'"},
+        {"undeclared-in-loop", "Start f(n) {\n    while (n) {\n        n = k;\n    }\n    Return n;\n}\n",
+         "error: Semantic Error: Use of undeclared variable 'k'"},
+        {"return-outside", "Return 1;\n", "error: Return statement used outside a function."},
+        {"call", "Start f(a, b) {\n    Return a + b;\n}\nx = f(1, 2);\n", "ok"},
+        {"call-missing-argument", "Start f(a, b) {\n    Return a + b;\n}\nx = f(1);\n",
+         "error: IR Error: 'f' takes 2 argument(s), called with 1"},
+        {"call-extra-argument", "Start f(a) {\n    Return a;\n}\nStart g(a) {\n    Return f(a, 2);\n}\nx = g(1);\n",
+         "error: IR Error: 'f' takes 1 argument(s), called with 2"},
+        {"enum", "Init Mode { On; Off; }\nm = Mode.Off;\n", "ok; enums Mode"},
+        {"struct-named-variable", "Init Vec { x; y; }\nInit Mode { Sleep; Awake; }\nVec = Vec();\nVec.x = 4;\nk = Vec.x;\nm = Mode.Awake;\n",
+         "ok; enums Mode"},
+        {"struct-foreign-member", "Init P { x; }\nInit Q { y; }\nq = Q();\nv = P.y;\n", "error: IR Error: 'P' is not a struct variable"},
+        {"macro", "Define |add2 v| v = v + 2;\nx = 1;\n|add2 x|\n|inc x|\n", "ok"},
+        {"macro-hygiene", "Define |swap a b| t = a; a = b; b = t;\nx = 1;\ny = 2;\n|swap x y|\nz = t;\n",
+         "error: Semantic Error: Use of undeclared variable 't'"},
+        {"macro-undefined", "x = 1;\n|add2 x|\n", "error: Macro Error: undefined macro |add2 x|"},
+        {"define-without-marker", "Define x = 1;\n", "error: Macro Error: expected |name params...| after Define"},
+        {"macro-recursive", "Define |a| |b|\nDefine |b| |a|\n|a|\n", "error: Macro Error: recursive expansion |a| -> |b| -> |a|"},
+    };
 
-    log << "[Tokens]\n";
-    for (const auto& token : tokens) {
-        log << std::setw(4) << token.line << ":" << std::setw(2) << token.column << "\t"
-            << static_cast<int>(token.type) << "\t" << token.lexeme << "\n";
+    // One program through macros, parser, analyzer and IR lowering.
+    static IRModule lower(std::string_view source) {
+        ASTArena ast;
+        Lexer lexer(source);
+        MacroExpander macros;
+        macros.loadDefaults();
+        MacroStream stream(lexer, macros);
+        Parser parser(stream, ast);
+        NodeList statements = parser.parse();
+        if (!parser.errors().empty()) throw std::runtime_error(parser.errors().front());
+        SemanticAnalyzer().analyze(ast, statements);
+        TaskScheduler serial(1);
+        return buildIRModule(ast, statements, serial);
     }
 
-    Parser parser(tokens);
-    auto statements = parser.parse();
-    log << "\n[AST]\n";
-    for (const auto& stmt : statements) {
-        if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-            log << "Assign to " << assign->name << " <- ";
-            if (auto num = std::dynamic_pointer_cast<NumberExpr>(assign->value)) {
-                log << "NUM(" << num->value << ")\n";
-            } else if (auto id = std::dynamic_pointer_cast<IdentifierExpr>(assign->value)) {
-                log << "REF(" << id->name << ")\n";
-            }
+    // The outcome of lower(), or its error.
+    static std::string frontEnd(std::string_view source) {
+        try {
+            IRModule module = lower(source);
+            std::string outcome = "ok";
+            for (const EnumLayout& layout : module.enums.all())
+                outcome += (outcome == "ok" ? "; enums " : ", ") + std::string(symbolText(layout.name));
+            return outcome;
+        } catch (const std::exception& ex) {
+            return std::string("error: ") + ex.what();
         }
     }
 
-    SemanticAnalyzer analyzer;
-    try {
-        analyzer.analyze(statements);
-        std::cout << "Semantic analysis successful.\n";
-        log << "\n[Semantic] Success\n";
-    } catch (const std::exception& ex) {
-        std::cerr << ex.what() << std::endl;
-        log << "\n[Semantic Error] " << ex.what() << "\n";
-        return 1;
+    CheckOutcome checkFrontEnd() {
+        CheckOutcome outcome{"front-end", 0, 0, {}};
+        for (const FrontEndCase& test : FrontEndCases) {
+            std::string actual = frontEnd(test.source);
+            std::string_view expected = test.outcome;
+            bool error = expected.substr(0, 7) == "error: ";
+            outcome.cases++;
+            if (error ? actual.compare(0, expected.size(), expected) != 0 : actual != expected)
+                fail(outcome, std::string(test.name) + " gave \"" + actual + "\", expected \"" + test.outcome + "\"");
+        }
+        return outcome;
     }
 
-    IREmitter ir;
-    ir.emit(statements, "output/hello.fir");
-    log << "\n[IR] Emitted to hello.fir\n";
+    // Programs that leave a pass's rewrites in awkward places, run through
+    // the pipeline alongside every front-end case that lowers.
+    static constexpr const char* PassPrograms[] = {
+        // A self tail call left in the entry block once fold drops the branch.
+        "Start f(p0) {\n    p0 = 3;\n    if (p0 > 0) {\n        Return f(p0 - 1);\n    }\n    Return 1;\n}\nx = f(2);\n",
+        "Start sum(n, acc) {\n    if (n == 0) {\n        Return acc;\n    }\n    Return sum(n - 1, acc + n);\n}\nx = sum(10, 0);\n",
+        "Start g(a) {\n    Return g(a);\n}\nStart h(a) {\n    Return a + 1;\n}\ny = h(2);\n",
+        "Start leaf(a) {\n    Return a * 2;\n}\nStart mid(a) {\n    b = leaf(a);\n    Return leaf(b);\n}\nx = 0;\n"
+        "for (i = 0; i < 4; i = i + 1) {\n    x = x + mid(i);\n}\n",
+    };
 
-    NASMGenerator nasm;
-    nasm.generate(statements, "output/hello.asm");
-    log << "[ASM] Emitted to hello.asm\n";
-
-    std::cout << "Parsed " << statements.size() << " statement(s).\n";
-    for (const auto& stmt : statements) {
-        if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-            std::cout << "Assignment to: " << assign->name << "\n";
+    // The run's pipeline twice over, with verify after every pass, so a pass
+    // that leaves broken IR is named even when a later one would tidy it.
+    std::string verifiedPipeline() const {
+        std::string pipeline = "verify";
+        for (int round = 0; round < 2; ++round) {
+            std::string_view list = options.pipeline;
+            while (!list.empty()) {
+                size_t comma = list.find(',');
+                std::string_view pass = list.substr(0, comma);
+                list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+                if (!pass.empty() && pass != "verify") pipeline += "," + std::string(pass) + ",verify";
+            }
         }
+        return pipeline;
     }
 
-        log << "
-[Statistics]
-";
-    log << "Total Statements: " << statements.size() << "
-";
-
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-    log << "Compile Time: " << duration << "ms
-";
-
-    log << "
-[Status] Compilation Completed.
-";
-    log.close();
-    return 0;
-}
-
-// hyperlace_compiler_core.cpp
-// --- Hyperlace Compiler: Core Pipeline Bootstrapping ---
-// Implements lexer, parser, AST, macro engine, semantic analyzer, IR emitter, NASM backend, and debug logger.
-
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <vector>
-#include <unordered_map>
-#include <memory>
-#include <cctype>
-#include <stdexcept>
-#include <set>
-#include <iomanip> // For formatting debug output
+    CheckOutcome checkPasses() {
+        CheckOutcome outcome{"passes/verify", 0, 0, {}};
+        std::vector<std::pair<std::string, std::string>> programs;   // name, source
+        for (size_t i = 0; i < std::size(PassPrograms); ++i) programs.emplace_back("program " + std::to_string(i), PassPrograms[i]);
+        for (const FrontEndCase& test : FrontEndCases) programs.emplace_back(test.name, test.source);
+        for (BenchWorkload workload : benchWorkloads(1)) {
+            workload.shape.functions = std::min(workload.shape.functions, 8u);
+            workload.shape.fields = std::min(workload.shape.fields, 16u);
+            programs.emplace_back(std::string("workload ") + workload.name, WorkloadGenerator::generate(workload.shape).str());
+        }
+        std::string pipeline = verifiedPipeline();
+        TaskScheduler serial(1);
+        for (const auto& [name, source] : programs) {
+            IRModule module;
+            try {
+                module = lower(source);
+            } catch (const std::exception&) {
+                continue;   // rejected programs are front-end cases, checked there
+            }
+            outcome.cases++;
+            PassManager passes(pipeline, options.passOptions);
+            try {
+                passes.run(module, serial);
+            } catch (const std::exception& ex) {
+                const auto& ran = passes.lastRun();
+                fail(outcome, name + ": " + ex.what() + (ran.empty() ? "" : " (after " + ran.back().name + ")"));
+            }
+        }
+        outcome.note = std::to_string(std::count(pipeline.begin(), pipeline.end(), ',') + 1) + " passes per program";
+        return outcome;
+    }
 
-// ... [rest of code remains unchanged until main() below] ...
+    // A --bench workload cut to a few functions compiles with the run's flags.
+    CheckOutcome checkWorkload(BenchWorkload workload) {
+        CheckOutcome outcome{std::string("workload/") + workload.name, 1, 0, {}};
+        workload.shape.functions = std::min(workload.shape.functions, 8u);
+        workload.shape.fields = std::min(workload.shape.fields, 16u);
+        std::filesystem::path dir = std::filesystem::path(options.outputDir) / "check";
+        std::filesystem::create_directories(dir);
+        DriverOptions compile = options;
+        compile.inputs = {(dir / (std::string(workload.name) + ".hl")).string()};
+        compile.outputDir = (dir / "out").string();
+        compile.cache = false;
+        compile.jit = false;
+        std::ostringstream discard, failures;
+        try {
+            WorkloadGenerator::generate(workload.shape).writeFile(compile.inputs[0], "Failed to write check workload.");
+            if (driver.run(compile, discard, failures) != 0) fail(outcome, failures.str());
+        } catch (const std::exception& ex) {
+            fail(outcome, ex.what());
+        }
+        return outcome;
+    }
+};
 
 //--------------------------------------------------
-// --- AST XML EMITTER ---
+// --- COMPILE SERVER ---
 //--------------------------------------------------
-class ASTXMLWriter {
-public:
-    void emit(const std::vector<std::shared_ptr<Statement>>& statements, const std::string& path) {
-        std::ofstream out(path);
-        if (!out) throw std::runtime_error("Failed to open .ast file");
-
-        out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>
-";
-        out << "<program>
-";
-        for (const auto& stmt : statements) {
-            if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-                out << "  <assignment var=\"" << assign->name << "\">";
-                if (auto num = std::dynamic_pointer_cast<NumberExpr>(assign->value)) {
-                    out << "<number>" << num->value << "</number>";
-                } else if (auto id = std::dynamic_pointer_cast<IdentifierExpr>(assign->value)) {
-                    out << "<identifier>" << id->name << "</identifier>";
-                }
-                out << "</assignment>
-";
-            }
-        }
-        out << "</program>
-";
-    }
-};
-
-void writeASTToXML(const std::vector<std::shared_ptr<Statement>>& statements, std::ostream& out) {
-    out << "<Program>\n";
-    for (const auto& stmt : statements) {
-        if (auto fn = std::dynamic_pointer_cast<FunctionDef>(stmt)) {
-            out << "  <Function name=\"" << fn->name << "\">\n";
-            for (auto& param : fn->params)
-                out << "    <Param>" << param << "</Param>\n";
-            out << "    <Body>\n";
-            writeASTToXML(fn->body, out);
-            out << "    </Body>\n  </Function>\n";
-        }
-        else if (auto ifs = std::dynamic_pointer_cast<IfStatement>(stmt)) {
-            out << "  <If>\n";
-            out << "    <Condition/>\n"; // implement this properly
-            out << "    <Then>\n";
-            writeASTToXML(ifs->thenBranch, out);
-            out << "    </Then>\n";
-            if (!ifs->elseBranch.empty()) {
-                out << "    <Else>\n";
-                writeASTToXML(ifs->elseBranch, out);
-                out << "    </Else>\n";
-            }
-            out << "  </If>\n";
-        }
-        else if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-            out << "  <Assignment>\n";
-            out << "    <Target>" << assign->name << "</Target>\n";
-            if (auto num = std::dynamic_pointer_cast<NumberExpr>(assign->value)) {
-                out << "    <Value type=\"Number\">" << num->value << "</Value>\n";
-            } else if (auto id = std::dynamic_pointer_cast<IdentifierExpr>(assign->value)) {
-                out << "    <Value type=\"Identifier\">" << id->name << "</Value>\n";
-            }
-            out << "  </Assignment>\n";
-        }
-    }
-    out << "</Program>\n";
-}
-
-else if (auto w = std::dynamic_pointer_cast<WhileLoop>(stmt)) {
-    out << "  <While>\n";
-    out << "    <Condition/>\n"; // TODO: render condition
-    out << "    <Body>\n";
-    writeASTToXML(w->body, out);
-    out << "    </Body>\n  </While>\n";
-}
-else if (auto f = std::dynamic_pointer_cast<ForLoop>(stmt)) {
-    out << "  <For>\n";
-    out << "    <Initializer/>\n"; // TODO: render init
-    out << "    <Condition/>\n";  // TODO: render condition
-    out << "    <Increment/>\n";  // TODO: render increment
-    out << "    <Body>\n";
-    writeASTToXML(f->body, out);
-    out << "    </Body>\n  </For>\n";
-}
-else if (auto fc = std::dynamic_pointer_cast<FunctionCall>(stmt)) {
-    out << "  <FunctionCall name=\"" << fc->functionName << "\">\n";
-    for (auto& arg : fc->arguments)
-        out << "    <Arg/>\n"; // TODO: render each argument
-    out << "  </FunctionCall>\n";
-}
-
-struct ReturnStatement : public Statement {
-    std::shared_ptr<Expression> returnValue; // optional
-};
+// `hyperlace --serve SOCKET` keeps one BatchDriver alive behind a Unix
+// domain socket, so the interner, default macros, scheduler threads and
+// the in-memory side of every compile cache stay warm between builds.
+// `hyperlace --connect SOCKET ...` sends its other arguments and its
+// working directory as a request and prints the reply as a local run
+// would. Requests are served one at a time; -j is fixed when the server
+// starts. SIGINT or SIGTERM stops it after the current request.
+//
+// Request, one line each:   cwd DIR / arg TEXT ... / end
+// Reply:                    out BYTES\n<stdout>  err BYTES\n<stderr>  status N
+#if defined(__unix__) || defined(__APPLE__)
+#define HYPERLACE_SERVER 1
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
-struct TernaryExpr : public Expression {
-    std::shared_ptr<Expression> condition;
-    std::shared_ptr<Expression> thenExpr;
-    std::shared_ptr<Expression> elseExpr;
-};
+#if HYPERLACE_SERVER
+// Line and byte reads over a connected socket, plus whole writes.
+class SocketStream {
+public:
+    explicit SocketStream(int fd) : fd(fd) {}
+    ~SocketStream() { ::close(fd); }
+    SocketStream(const SocketStream&) = delete;
+    SocketStream& operator=(const SocketStream&) = delete;
 
-//--------------------------------------------------
-// --- MAIN: FULL COMPILER TEST HARNESS ---
-//--------------------------------------------------
-#include <chrono>
-int main() {
-    auto start_time = std::chrono::high_resolution_clock::now();
+    bool readLine(std::string& line) {
+        for (;;) {
+            size_t end = buffer.find('\n', pos);
+            if (end != std::string::npos) {
+                line.assign(buffer, pos, end - pos);
+                pos = end + 1;
+                return true;
+            }
+            if (!fill()) return false;
+        }
+    }
 
-    std::ifstream file("samples/hello.hl");
-    if (!file) {
-        std::cerr << "Failed to open sample file." << std::endl;
-        return 1;
+    bool readBytes(size_t size, std::string& bytes) {
+        while (buffer.size() - pos < size) {
+            if (!fill()) return false;
+        }
+        bytes.assign(buffer, pos, size);
+        pos += size;
+        return true;
     }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string raw_input = buffer.str();
+    bool writeAll(std::string_view data) {
+        while (!data.empty()) {
+            ssize_t sent = ::write(fd, data.data(), data.size());
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            data.remove_prefix(static_cast<size_t>(sent));
+        }
+        return true;
+    }
 
-    MacroExpander expander;
-    expander.loadDefaults();
+private:
+    static constexpr size_t MaxBuffered = 1 << 20;   // longest request or reply frame read in one piece
 
-    std::string expanded = expander.expand(raw_input);
-    Lexer lexer(expanded);
+    int fd;
+    std::string buffer;
+    size_t pos = 0;
 
-    std::ofstream log("output/hello.log");
-    if (!log) {
-        std::cerr << "Failed to open debug log." << std::endl;
-        return 1;
+    bool fill() {
+        if (pos > 0) {
+            buffer.erase(0, pos);
+            pos = 0;
+        }
+        if (buffer.size() >= MaxBuffered) return false;
+        char chunk[4096];
+        for (;;) {
+            ssize_t got = ::read(fd, chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            buffer.append(chunk, static_cast<size_t>(got));
+            return true;
+        }
     }
+};
 
-    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    log << "Hyperlace Compiler Debug Log
-";
-    log << "Timestamp: " << std::ctime(&now);
-    log << "----------------------------------------
-
-";
-
-    log << "[Source Code]
-" << raw_input << "
+inline sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: '" + path + "'");
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
 
-";
-    log << "[Expanded Code]
-" << expanded << "
+// A connected socket to `path`, or -1 when nothing is listening there.
+inline int connectSocket(const std::string& path) {
+    sockaddr_un address = socketAddress(path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error(std::string("Failed to create socket: ") + std::strerror(errno));
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-";
+class CompileServer {
+public:
+    CompileServer(std::string path, BatchDriver& driver) : path(std::move(path)), driver(driver) {}
 
-    log << "[Tokens]\n";
-    for (const auto& token : tokens) {
-        log << std::setw(4) << token.line << ":" << std::setw(2) << token.column << "\t"
-            << static_cast<int>(token.type) << "\t" << token.lexeme << "\n";
-    }
+    int run() {
+        int probe = connectSocket(path);
+        if (probe >= 0) {
+            ::close(probe);
+            throw std::runtime_error("A compile server is already listening on '" + path + "'");
+        }
+        ::unlink(path.c_str());   // left behind by a server that did not stop cleanly
+        sockaddr_un address = socketAddress(path);
+        int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) throw std::runtime_error(std::string("Failed to create socket: ") + std::strerror(errno));
+        if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, 64) != 0) {
+            std::string reason = std::strerror(errno);
+            ::close(listener);
+            throw std::runtime_error("Failed to listen on '" + path + "': " + reason);
+        }
+        installHandlers();
+        std::cout << "[Server] listening on " << path << " (" << driver.jobCount() << " job(s))" << std::endl;
 
-    Parser parser(tokens);
-    auto statements = parser.parse();
-    log << "\n[AST]\n";
-    for (const auto& stmt : statements) {
-        if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-            log << "Assign to " << assign->name << " <- ";
-            if (auto num = std::dynamic_pointer_cast<NumberExpr>(assign->value)) {
-                log << "NUM(" << num->value << ")\n";
-            } else if (auto id = std::dynamic_pointer_cast<IdentifierExpr>(assign->value)) {
-                log << "REF(" << id->name << ")\n";
+        size_t served = 0;
+        while (!stopping) {
+            int client = ::accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "[Server] accept failed: " << std::strerror(errno) << std::endl;
+                break;
             }
+            SocketStream stream(client);
+            serve(stream);
+            served++;
         }
+        ::close(listener);
+        ::unlink(path.c_str());
+        std::cout << "[Server] stopped after " << served << " request(s)" << std::endl;
+        return 0;
     }
 
-    SemanticAnalyzer analyzer;
-    try {
-        analyzer.analyze(statements);
-        std::cout << "Semantic analysis successful.\n";
-        log << "\n[Semantic] Success\n";
-    } catch (const std::exception& ex) {
-        std::cerr << ex.what() << std::endl;
-        log << "\n[Semantic Error] " << ex.what() << "\n";
-        return 1;
-    }
+private:
+    static inline volatile std::sig_atomic_t stopping = 0;
 
-    IREmitter ir;
-    ir.emit(statements, "output/hello.fir");
-    log << "\n[IR] Emitted to hello.fir\n";
+    std::string path;
+    BatchDriver& driver;
 
-    NASMGenerator nasm;
-    nasm.generate(statements, "output/hello.asm");
-    log << "[ASM] Emitted to hello.asm
-";
+    // No SA_RESTART: a signal breaks the server out of accept().
+    static void installHandlers() {
+        struct sigaction action{};
+        action.sa_handler = [](int) { stopping = 1; };
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        std::signal(SIGPIPE, SIG_IGN);   // a client that hangs up early must not take the server down
+    }
 
-    ASTXMLWriter astWriter;
-    astWriter.emit(statements, "output/hello.ast");
-    log << "[AST] XML written to output/hello.ast
-";
+    void serve(SocketStream& stream) {
+        std::string line, cwd;
+        std::vector<std::string> args;
+        bool complete = false;
+        while (stream.readLine(line)) {
+            if (line == "end") {
+                complete = true;
+                break;
+            }
+            if (line.rfind("cwd ", 0) == 0) cwd = line.substr(4);
+            else if (line.rfind("arg ", 0) == 0) args.push_back(line.substr(4));
+        }
+        if (!complete) return;
 
-    std::cout << "Parsed " << statements.size() << " statement(s).\n";
-    for (const auto& stmt : statements) {
-        if (auto assign = std::dynamic_pointer_cast<Assignment>(stmt)) {
-            std::cout << "Assignment to: " << assign->name << "\n";
+        std::ostringstream out, err;
+        int status = 1;
+        try {
+            if (cwd.empty() || !std::filesystem::path(cwd).is_absolute()) throw std::runtime_error("Request has no absolute cwd");
+            DriverOptions options = parseDriverOptions(args, cwd);
+            if (!options.serve.empty()) throw std::runtime_error("--serve is not accepted in a request");
+            if (options.jit) throw std::runtime_error("--jit is not accepted in a request");
+            status = driver.run(std::move(options), out, err);
+        } catch (const std::exception& ex) {
+            err << ex.what() << "\n";
+        }
+        std::string reply;
+        for (const auto& [label, captured] : {std::pair<const char*, const std::ostringstream*>{"out", &out}, {"err", &err}}) {
+            std::string text = captured->str();
+            reply += std::string(label) + " " + std::to_string(text.size()) + "\n" + text;
         }
+        reply += "status " + std::to_string(status) + "\n";
+        stream.writeAll(reply);
     }
+};
 
-        log << "
-[Statistics]
-";
-    log << "Total Statements: " << statements.size() << "
-";
-
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-    log << "Compile Time: " << duration << "ms
-";
+// Sends one build to the server at `path` and replays its output here.
+inline int runClient(const std::string& path, const std::vector<std::string>& args) {
+    int fd = connectSocket(path);
+    if (fd < 0) throw std::runtime_error("No compile server on '" + path + "': " + std::strerror(errno));
+    SocketStream stream(fd);
+    std::signal(SIGPIPE, SIG_IGN);
+    std::string request = "cwd " + std::filesystem::current_path().string() + "\n";
+    for (const std::string& arg : args) {
+        if (arg.find('\n') != std::string::npos) throw std::runtime_error("Arguments sent to the server cannot contain newlines");
+        request += "arg " + arg + "\n";
+    }
+    request += "end\n";
+    if (!stream.writeAll(request)) throw std::runtime_error("Compile server on '" + path + "' closed the connection");
 
-    log << "
-[Status] Compilation Completed.
-";
-    log.close();
-    return 0;
+    std::string label, text;
+    for (std::ostream* target : {static_cast<std::ostream*>(&std::cout), static_cast<std::ostream*>(&std::cerr)}) {
+        if (!stream.readLine(label) || label.find(' ') == std::string::npos) break;
+        size_t size = std::strtoull(label.c_str() + label.find(' ') + 1, nullptr, 10);
+        if (!stream.readBytes(size, text)) break;
+        *target << text;
+    }
+    if (!stream.readLine(label) || label.rfind("status ", 0) != 0)
+        throw std::runtime_error("Compile server on '" + path + "' closed the connection");
+    return std::atoi(label.c_str() + 7);
 }
+#else
+class CompileServer {
+public:
+    CompileServer(std::string, BatchDriver&) {}
+    int run() { throw std::runtime_error("--serve needs Unix domain sockets, which this build does not have"); }
+};
 
+inline int runClient(const std::string&, const std::vector<std::string>&) {
+    throw std::runtime_error("--connect needs Unix domain sockets, which this build does not have");
+}
+#endif
 
-# Emit Return Value (If any)
-
-if (auto ret = std::dynamic_pointer_cast<ReturnStatement>(stmt)) {
-    if (ret->returnValue) {
-        // emit code to evaluate expression into RAX
-        // e.g. mov rax, value
+//--------------------------------------------------
+// --- MAIN: BATCH COMPILER ENTRY POINT ---
+//--------------------------------------------------
+int main(int argc, char** argv) {
+    try {
+        std::vector<std::string> args(argv + 1, argv + argc);
+        auto connect = std::find(args.begin(), args.end(), "--connect");
+        if (connect != args.end()) {
+            if (connect + 1 == args.end()) throw std::runtime_error("Missing value for --connect");
+            std::string socket = *(connect + 1);
+            args.erase(connect, connect + 2);
+            return runClient(socket, args);
+        }
+        DriverOptions options = parseDriverOptions(args);
+        if (!options.dump.empty()) {
+            MappedFile image(options.dump);
+            std::string_view bytes = image.text();
+            std::string copy;
+            if (reinterpret_cast<uintptr_t>(bytes.data()) % 8 != 0) bytes = copy.assign(bytes);   // read, not mapped
+            std::cout << ASTXMLWriter::render(BinaryModule(bytes)).str();
+            return 0;
+        }
+        if (!options.generate.empty()) {
+            OutputBuffer program = WorkloadGenerator::generate(options.shape.value_or(WorkloadShape{}));
+            program.writeFile(options.generate, "Failed to write generated program.");
+            std::cout << options.generate << ": " << program.size() << " bytes\n";
+            return 0;
+        }
+        BatchDriver driver(options.jobs);
+        if (!options.serve.empty()) return CompileServer(options.serve, driver).run();
+        if (options.check.enabled) return SelfCheck(driver, std::move(options)).run(std::cout, std::cerr);
+        if (options.bench.enabled) return BenchmarkSuite(driver, std::move(options)).run(std::cout, std::cerr);
+        return driver.run(std::move(options), std::cout, std::cerr);
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
     }
-    out << "    jmp .return\n";
 }